@@ -0,0 +1,56 @@
+# Measures the per-call overhead of HDFS::FileSystem#open and HDFS::File#close
+# on a small file, with no options and with a handful of them, so that the
+# cost of parsing options shows against the cost of opening the file itself.
+#
+# usage: ruby bench/open_close.rb
+#
+# environment:
+#
+#   HDFS_HOST  - NameNode host; uses the local filesystem when unset
+#   HDFS_PORT  - NameNode port (default: 8020)
+#   HDFS_USER  - user to connect as
+#   BENCH_PATH - scratch file to create and open (default: /tmp/hdfs-bench)
+#   BENCH_OPS  - opens timed per row (default: 20000)
+$:.unshift File.join File.dirname(__FILE__), '..', 'lib'
+require 'hdfs'
+
+options = if ENV['HDFS_HOST']
+  { host: ENV['HDFS_HOST'], port: (ENV['HDFS_PORT'] || 8020).to_i }
+else
+  { local: true }
+end
+options[:user] = ENV['HDFS_USER'] if ENV['HDFS_USER']
+
+path = ENV['BENCH_PATH'] || '/tmp/hdfs-bench'
+ops  = (ENV['BENCH_OPS'] || 20000).to_i
+
+dfs = HDFS::FileSystem.new options
+
+file = dfs.open path, 'w'
+file.write 'x' * 4096
+file.close
+
+# Runs the supplied block ops times, after a tenth as many untimed runs to
+# warm up, and returns the mean time per run in microseconds.
+def timed ops
+  (ops / 10).times { yield }
+  started = Process.clock_gettime Process::CLOCK_MONOTONIC
+  ops.times { yield }
+  (Process.clock_gettime(Process::CLOCK_MONOTONIC) - started) * 1e6 / ops
+end
+
+rows = {
+  'open/close'              => -> { dfs.open(path, 'r').close },
+  'open/close with options' => lambda do
+    dfs.open(path, 'r', buffer_size: 65536, retries: 2,
+             retry_backoff: 0.5).close
+  end,
+  'utime'                   => -> { dfs.utime path, mtime: 1_000_000_000 },
+}
+
+puts format('%-26s %12s', 'call', 'us/call')
+rows.each do |name, call|
+  puts format('%-26s %12.2f', name, timed(ops, &call))
+end
+
+dfs.rm path
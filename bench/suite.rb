@@ -0,0 +1,174 @@
+# Benchmarks read, write and metadata throughput and latency across thread
+# counts, so that releases can be compared against each other.  Every case
+# reports operations and MB per second, the p50 and p99 latency of a single
+# call and the Ruby objects allocated per call, and the results can be saved
+# as JSON.
+#
+# usage: rake bench, or ruby bench/suite.rb
+#
+# environment:
+#
+#   HDFS_HOST     - NameNode host; uses the local filesystem when unset
+#   HDFS_PORT     - NameNode port (default: 8020)
+#   HDFS_USER     - user to connect as
+#   BENCH_PATH    - scratch directory to create and fill
+#                   (default: /tmp/hdfs-bench-suite)
+#   BENCH_SIZE    - size in bytes of the file read, rounded down to whole MBs
+#                   and no smaller than the largest read (default: 64 MB)
+#   BENCH_OPS     - operations issued per thread in each case (default: 1000)
+#   BENCH_THREADS - comma-separated thread counts (default: 1,2,4,8)
+#   BENCH_CHUNKS  - comma-separated read sizes in bytes
+#                   (default: 4096,65536,1048576)
+#   BENCH_CASES   - comma-separated names of the cases to run, such as
+#                   read,pread,write,stat,exist,ls (default: all of them)
+#   BENCH_JSON    - file to write the results to as JSON, or - for stdout,
+#                   in which case the table goes to stderr
+$:.unshift File.join File.dirname(__FILE__), '..', 'lib'
+require 'hdfs'
+require 'json'
+
+options = if ENV['HDFS_HOST']
+  { host: ENV['HDFS_HOST'], port: (ENV['HDFS_PORT'] || 8020).to_i }
+else
+  { local: true }
+end
+options[:user] = ENV['HDFS_USER'] if ENV['HDFS_USER']
+
+dir     = ENV['BENCH_PATH'] || '/tmp/hdfs-bench-suite'
+size    = (ENV['BENCH_SIZE'] || 64 * 1024 * 1024).to_i
+ops     = (ENV['BENCH_OPS'] || 1000).to_i
+threads = (ENV['BENCH_THREADS'] || '1,2,4,8').split(',').map(&:to_i)
+chunks  = (ENV['BENCH_CHUNKS'] || '4096,65536,1048576').split(',').map(&:to_i)
+only    = ENV['BENCH_CASES'] && ENV['BENCH_CASES'].split(',')
+json    = ENV['BENCH_JSON']
+
+# Only whole MBs are written, and each read has to fit in the file.
+size = size >> 20 << 20
+if size < [1 << 20, *chunks].max
+  abort 'BENCH_SIZE must be at least 1 MB and at least each of BENCH_CHUNKS'
+end
+# Keeps stdout for the JSON when that is where it goes.
+table = json == '-' ? $stderr : $stdout
+
+dfs = HDFS::FileSystem.new options
+
+dfs.mkdir dir
+data_path = File.join dir, 'data'
+file  = dfs.open data_path, 'w'
+block = Random.new(42).bytes 1 << 20
+(size >> 20).times { file.write block }
+file.close
+listed_dir = File.join dir, 'listed'
+dfs.mkdir listed_dir
+100.times { |index| dfs.open(File.join(listed_dir, index.to_s), 'w').close }
+
+# The benchmark cases, each a name and a lambda which, given the index of its
+# thread, returns a lambda making one call and returning the bytes it moved,
+# along with one cleaning up after the thread is done.
+cases = []
+chunks.each do |chunk|
+  cases << ["read #{chunk}", lambda do |index|
+    reader = dfs.open data_path, 'r'
+    read = lambda do
+      bytes = reader.read(chunk).to_s.bytesize
+      # Starts over at the end of the file.
+      reader.seek 0 if bytes < chunk
+      bytes
+    end
+    [read, -> { reader.close }]
+  end]
+  cases << ["pread #{chunk}", lambda do |index|
+    reader = dfs.open data_path, 'r'
+    random = Random.new index
+    [-> { reader.read_pos(random.rand(size - chunk + 1), chunk).bytesize },
+     -> { reader.close }]
+  end]
+end
+[4096, 1 << 20].each do |length|
+  cases << ["write #{length}", lambda do |index|
+    # Each thread writes its own String, since a String being written is
+    # locked until the write returns.
+    payload = block[0, length].dup
+    path    = File.join dir, "written-#{index}"
+    writer  = dfs.open path, 'w'
+    [-> { writer.write payload }, -> { writer.close; dfs.rm path }]
+  end]
+end
+cases << ['stat', ->(index) { [-> { dfs.stat data_path; 0 }, -> {}] }]
+cases << ['exist', lambda do |index|
+  missing_path = File.join dir, "missing-#{index}"
+  [-> { dfs.exist? missing_path; 0 }, -> {}]
+end]
+cases << ['ls', ->(index) { [-> { dfs.ls listed_dir; 0 }, -> {}] }]
+cases.select! { |name, _| only.include? name.split(' ').first } if only
+
+# Runs ops calls on each of thread_count threads, each timed on its own, and
+# returns the elapsed wall-clock time in seconds, the bytes moved, the sorted
+# latencies in seconds and the objects allocated per call.
+def timed thread_count, ops, setup
+  calls = Array.new(thread_count) { |index| setup.call index }
+  latencies = Array.new(thread_count) { Array.new ops }
+  bytes = Array.new thread_count, 0
+  calls.each { |call, _| call.call }
+  allocated = GC.stat :total_allocated_objects
+  started   = Process.clock_gettime Process::CLOCK_MONOTONIC
+  thread_count.times.map do |index|
+    Thread.new do
+      call, thread_latencies = calls[index][0], latencies[index]
+      ops.times do |op|
+        op_started = Process.clock_gettime Process::CLOCK_MONOTONIC
+        bytes[index] += call.call
+        thread_latencies[op] =
+            Process.clock_gettime(Process::CLOCK_MONOTONIC) - op_started
+      end
+    end
+  end.each(&:join)
+  elapsed   = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  allocated = GC.stat(:total_allocated_objects) - allocated
+  calls.each { |_, cleanup| cleanup.call }
+  [elapsed, bytes.sum, latencies.flatten.sort,
+   allocated.to_f / (thread_count * ops)]
+end
+
+def percentile sorted, fraction
+  sorted[((sorted.size - 1) * fraction).round]
+end
+
+results = []
+table.puts format('%-16s %8s %12s %10s %10s %10s %10s', 'case',
+                  'threads', 'ops/s', 'MB/s', 'p50 us', 'p99 us', 'allocs/op')
+cases.each do |name, setup|
+  threads.each do |thread_count|
+    elapsed, bytes, latencies, allocations = timed thread_count, ops, setup
+    total  = thread_count * ops
+    result = {
+      case:               name,
+      threads:            thread_count,
+      ops:                total,
+      seconds:            elapsed,
+      ops_per_second:     total / elapsed,
+      mb_per_second:      bytes / elapsed / 1024 / 1024,
+      p50_us:             percentile(latencies, 0.5) * 1e6,
+      p99_us:             percentile(latencies, 0.99) * 1e6,
+      allocations_per_op: allocations,
+    }
+    results << result
+    table.puts format('%-16s %8d %12.1f %10.1f %10.1f %10.1f %10.1f',
+                      name, thread_count, result[:ops_per_second],
+                      result[:mb_per_second], result[:p50_us],
+                      result[:p99_us], allocations)
+  end
+end
+
+dfs.rm dir, true
+
+if json
+  report = JSON.pretty_generate(
+    version: HDFS::Version.to_s.chomp,
+    ruby:    RUBY_DESCRIPTION,
+    target:  ENV['HDFS_HOST'] || 'local',
+    size:    size,
+    results: results,
+  )
+  json == '-' ? puts(report) : File.write(json, report + "\n")
+end
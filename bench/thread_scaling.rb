@@ -0,0 +1,65 @@
+# Measures how HDFS read and metadata throughput scales with the number of
+# Ruby threads.  Since blocking libhdfs calls release the GVL, throughput
+# should grow with the thread count until the cluster (or local disk) is the
+# bottleneck; were the GVL held, every row would match the first.
+#
+# usage: ruby bench/thread_scaling.rb
+#
+# environment:
+#
+#   HDFS_HOST     - NameNode host; uses the local filesystem when unset
+#   HDFS_PORT     - NameNode port (default: 8020)
+#   HDFS_USER     - user to connect as
+#   BENCH_PATH    - scratch file to create and read (default: /tmp/hdfs-bench)
+#   BENCH_SIZE    - size in bytes of the scratch file (default: 64 MB)
+#   BENCH_OPS     - operations issued per thread (default: 256)
+#   BENCH_THREADS - comma-separated thread counts (default: 1,2,4,8,16)
+$:.unshift File.join File.dirname(__FILE__), '..', 'lib'
+require 'hdfs'
+
+options = if ENV['HDFS_HOST']
+  { host: ENV['HDFS_HOST'], port: (ENV['HDFS_PORT'] || 8020).to_i }
+else
+  { local: true }
+end
+options[:user] = ENV['HDFS_USER'] if ENV['HDFS_USER']
+
+path    = ENV['BENCH_PATH'] || '/tmp/hdfs-bench'
+size    = (ENV['BENCH_SIZE'] || 64 * 1024 * 1024).to_i
+ops     = (ENV['BENCH_OPS'] || 256).to_i
+threads = (ENV['BENCH_THREADS'] || '1,2,4,8,16').split(',').map(&:to_i)
+chunk   = 131072
+
+dfs = HDFS::FileSystem.new options
+
+file  = dfs.open path, 'w'
+block = Random.new(42).bytes chunk
+(size / chunk).times { file.write block }
+file.close
+
+# Runs the supplied block ops times on each of thread_count threads, passing
+# the index of the thread, and returns the elapsed wall-clock time in seconds.
+def timed thread_count, ops
+  started = Process.clock_gettime Process::CLOCK_MONOTONIC
+  thread_count.times.map do |index|
+    Thread.new { ops.times { yield index } }
+  end.each(&:join)
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+end
+
+puts format('%-8s %14s %14s', 'threads', 'pread MB/s', 'stat ops/s')
+threads.each do |thread_count|
+  files = Array.new(thread_count) { dfs.open path, 'r' }
+  read_time = timed(thread_count, ops) do |index|
+    files[index].read_pos rand(size - chunk), chunk
+  end
+  files.each(&:close)
+
+  stat_time = timed(thread_count, ops) { |index| dfs.stat path }
+
+  total = thread_count * ops
+  puts format('%-8d %14.1f %14.1f', thread_count,
+              total * chunk / read_time / 1024 / 1024, total / stat_time)
+end
+
+dfs.rm path
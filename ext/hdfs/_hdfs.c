@@ -3,6 +3,9 @@
 #include "file.h"
 #include "file_info.h"
 #include "file_system.h"
+#include "listing.h"
+#include "metrics.h"
+#include "utils.h"
 
 
 static VALUE m_hdfs;
@@ -11,7 +14,10 @@ static VALUE m_hdfs;
 void Init__hdfs() {
   m_hdfs = rb_define_module("HDFS");
 
+  init_utils();
   init_file(m_hdfs);
   init_file_info(m_hdfs);
   init_file_system(m_hdfs);
+  init_listing(m_hdfs);
+  init_metrics(m_hdfs);
 }
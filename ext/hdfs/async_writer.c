@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "hdfs.h"
+
+#include "async_writer.h"
+
+
+typedef enum AsyncWriteKind {
+  kAsyncWrite,
+  kAsyncFlush,
+  kAsyncHFlush
+} AsyncWriteKind;
+
+/* An entry in the queue: either a buffer to write or a flush. */
+typedef struct AsyncWrite {
+  AsyncWriteKind kind;
+  char* buffer;
+  long length;
+  unsigned long ticket;
+} AsyncWrite;
+
+struct AsyncWriter {
+  hdfsFS fs;
+  hdfsFile file;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;   /* signaled whenever any of the below changes */
+  AsyncWrite* queue;
+  int capacity;
+  int head;              /* index of the oldest queued entry */
+  int count;             /* the number of queued entries */
+  char** free_buffers;   /* written buffers kept around for reuse */
+  int num_free_buffers;
+  long buffer_size;
+  unsigned long next_ticket;
+  unsigned long completed_ticket;
+  long hflush_bytes;
+  double hflush_interval;
+  int error;             /* errno of the first failure, or 0 */
+  int stopping;
+};
+
+
+static double now_seconds(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Frees buffer, or keeps it for reuse if it is the standard size. */
+static void release_buffer(AsyncWriter* writer, char* buffer, long size) {
+  if (size == writer->buffer_size &&
+      writer->num_free_buffers < writer->capacity) {
+    writer->free_buffers[writer->num_free_buffers++] = buffer;
+  } else {
+    free(buffer);
+  }
+}
+
+/* Writes length bytes of buffer, returning 0 or errno. */
+static int write_fully(AsyncWriter* writer, const char* buffer, long length) {
+  long total = 0;
+  while (total < length) {
+    tSize bytes_written = hdfsWrite(writer->fs, writer->file, buffer + total,
+        (tSize) (length - total));
+    if (bytes_written == -1) {
+      return errno == 0 ? EIO : errno;
+    }
+    total += bytes_written;
+  }
+  return 0;
+}
+
+static int run_hflush(AsyncWriter* writer) {
+  if (hdfsHFlush(writer->fs, writer->file) == -1) {
+    return errno == 0 ? EIO : errno;
+  }
+  return 0;
+}
+
+static void* run_async_writer(void* ptr) {
+  AsyncWriter* writer = (AsyncWriter*) ptr;
+  long unflushed_bytes = 0;
+  double last_hflush = now_seconds();
+  pthread_mutex_lock(&writer->lock);
+  for (;;) {
+    if (writer->count == 0) {
+      if (writer->stopping) {
+        break;
+      }
+      if (writer->hflush_interval > 0 && unflushed_bytes > 0) {
+        // Sleeps until the next hflush is due, running it if nothing else
+        // arrives in the meantime.
+        double deadline = last_hflush + writer->hflush_interval;
+        struct timespec wake_at;
+        wake_at.tv_sec = (time_t) deadline;
+        wake_at.tv_nsec = (long) ((deadline - (double) wake_at.tv_sec) * 1e9);
+        if (pthread_cond_timedwait(&writer->cond, &writer->lock,
+                &wake_at) == ETIMEDOUT && writer->count == 0) {
+          pthread_mutex_unlock(&writer->lock);
+          int error = writer->error ? 0 : run_hflush(writer);
+          pthread_mutex_lock(&writer->lock);
+          if (error != 0 && writer->error == 0) {
+            writer->error = error;
+          }
+          unflushed_bytes = 0;
+          last_hflush = now_seconds();
+          pthread_cond_broadcast(&writer->cond);
+        }
+      } else {
+        pthread_cond_wait(&writer->cond, &writer->lock);
+      }
+      continue;
+    }
+
+    AsyncWrite entry = writer->queue[writer->head];
+    int failed = writer->error != 0;
+    pthread_mutex_unlock(&writer->lock);
+
+    // Once anything has failed, later entries are dropped unwritten.
+    int error = 0;
+    if (!failed) {
+      switch (entry.kind) {
+        case kAsyncWrite:
+          error = write_fully(writer, entry.buffer, entry.length);
+          unflushed_bytes += entry.length;
+          if (error == 0 && writer->hflush_bytes > 0 &&
+              unflushed_bytes >= writer->hflush_bytes) {
+            error = run_hflush(writer);
+            unflushed_bytes = 0;
+            last_hflush = now_seconds();
+          }
+          break;
+        case kAsyncFlush:
+          if (hdfsFlush(writer->fs, writer->file) == -1) {
+            error = errno == 0 ? EIO : errno;
+          }
+          break;
+        case kAsyncHFlush:
+          error = run_hflush(writer);
+          unflushed_bytes = 0;
+          last_hflush = now_seconds();
+          break;
+      }
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    if (error != 0 && writer->error == 0) {
+      writer->error = error;
+    }
+    if (entry.kind == kAsyncWrite) {
+      release_buffer(writer, entry.buffer, entry.length);
+    } else {
+      writer->completed_ticket = entry.ticket;
+    }
+    writer->head = (writer->head + 1) % writer->capacity;
+    writer->count--;
+    pthread_cond_broadcast(&writer->cond);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return NULL;
+}
+
+AsyncWriter* async_writer_start(hdfsFS fs, hdfsFile file, int queue_length,
+    long buffer_size, long hflush_bytes, double hflush_interval) {
+  AsyncWriter* writer = calloc(1, sizeof(AsyncWriter));
+  if (writer == NULL) {
+    return NULL;
+  }
+  writer->fs = fs;
+  writer->file = file;
+  writer->capacity = queue_length;
+  writer->buffer_size = buffer_size;
+  writer->hflush_bytes = hflush_bytes;
+  writer->hflush_interval = hflush_interval;
+  writer->queue = calloc(queue_length, sizeof(AsyncWrite));
+  writer->free_buffers = calloc(queue_length, sizeof(char*));
+  if (writer->queue == NULL || writer->free_buffers == NULL) {
+    free(writer->queue);
+    free(writer->free_buffers);
+    free(writer);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->cond, NULL);
+  int result = pthread_create(&writer->thread, NULL, run_async_writer,
+      writer);
+  if (result != 0) {
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->queue);
+    free(writer->free_buffers);
+    free(writer);
+    errno = result;
+    return NULL;
+  }
+  return writer;
+}
+
+int async_writer_stop(AsyncWriter* writer) {
+  pthread_mutex_lock(&writer->lock);
+  writer->stopping = 1;
+  pthread_cond_broadcast(&writer->cond);
+  pthread_mutex_unlock(&writer->lock);
+  pthread_join(writer->thread, NULL);
+  int error = writer->error;
+  int i;
+  for (i = 0; i < writer->num_free_buffers; i++) {
+    free(writer->free_buffers[i]);
+  }
+  pthread_mutex_destroy(&writer->lock);
+  pthread_cond_destroy(&writer->cond);
+  free(writer->queue);
+  free(writer->free_buffers);
+  free(writer);
+  return error;
+}
+
+char* async_writer_take_buffer(AsyncWriter* writer) {
+  char* buffer = NULL;
+  pthread_mutex_lock(&writer->lock);
+  if (writer->num_free_buffers > 0) {
+    buffer = writer->free_buffers[--writer->num_free_buffers];
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return buffer != NULL ? buffer : malloc(writer->buffer_size);
+}
+
+void async_writer_recycle_buffer(AsyncWriter* writer, char* buffer) {
+  pthread_mutex_lock(&writer->lock);
+  release_buffer(writer, buffer, writer->buffer_size);
+  pthread_mutex_unlock(&writer->lock);
+}
+
+/*
+ * Appends an entry to the queue, waiting while it is full, and numbers it
+ * with the next ticket if it is a flush.  Must be called with the lock held.
+ */
+static int enqueue(AsyncWriter* writer, AsyncWrite* entry) {
+  while (writer->count == writer->capacity && writer->error == 0) {
+    pthread_cond_wait(&writer->cond, &writer->lock);
+  }
+  if (writer->error != 0) {
+    return writer->error;
+  }
+  // Tickets are handed out only once queued, so that they complete in order.
+  if (entry->kind != kAsyncWrite) {
+    entry->ticket = ++writer->next_ticket;
+  }
+  writer->queue[(writer->head + writer->count) % writer->capacity] = *entry;
+  writer->count++;
+  pthread_cond_broadcast(&writer->cond);
+  return 0;
+}
+
+int async_writer_submit(AsyncWriter* writer, char* buffer, long length) {
+  AsyncWrite entry;
+  entry.kind = kAsyncWrite;
+  entry.buffer = buffer;
+  entry.length = length;
+  entry.ticket = 0;
+  pthread_mutex_lock(&writer->lock);
+  int error = enqueue(writer, &entry);
+  if (error != 0) {
+    release_buffer(writer, buffer, length);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return error;
+}
+
+int async_writer_flush(AsyncWriter* writer, int hflush,
+    unsigned long* ticket) {
+  AsyncWrite entry;
+  entry.kind = hflush ? kAsyncHFlush : kAsyncFlush;
+  entry.buffer = NULL;
+  entry.length = 0;
+  entry.ticket = 0;
+  pthread_mutex_lock(&writer->lock);
+  int error = enqueue(writer, &entry);
+  pthread_mutex_unlock(&writer->lock);
+  *ticket = entry.ticket;
+  return error;
+}
+
+int async_writer_wait(AsyncWriter* writer, unsigned long ticket,
+    volatile int* interrupted, int* error) {
+  int result = 0;
+  pthread_mutex_lock(&writer->lock);
+  for (;;) {
+    if (writer->error != 0) {
+      *error = writer->error;
+      result = -1;
+      break;
+    }
+    if (writer->completed_ticket >= ticket) {
+      result = 1;
+      break;
+    }
+    if (*interrupted) {
+      break;
+    }
+    pthread_cond_wait(&writer->cond, &writer->lock);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return result;
+}
+
+int async_writer_done(AsyncWriter* writer, unsigned long ticket) {
+  pthread_mutex_lock(&writer->lock);
+  int done = writer->completed_ticket >= ticket || writer->error != 0;
+  pthread_mutex_unlock(&writer->lock);
+  return done;
+}
+
+void async_writer_wake(void* writer) {
+  AsyncWriter* self = (AsyncWriter*) writer;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->lock);
+}
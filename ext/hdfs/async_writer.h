@@ -0,0 +1,70 @@
+#ifndef HDFS_ASYNC_WRITER_H
+#define HDFS_ASYNC_WRITER_H
+
+#include "hdfs.h"
+
+
+/*
+ * A background thread which owns an open file and writes out the buffers
+ * handed to it through a bounded queue, optionally running hflush after a
+ * number of bytes or seconds.  Flushes are queued behind the writes before
+ * them and identified by tickets that callers can wait on.
+ */
+typedef struct AsyncWriter AsyncWriter;
+
+/*
+ * Starts a writer with room for queue_length buffers of buffer_size bytes.
+ * hflush_bytes and hflush_interval (in seconds) set how often the thread runs
+ * hflush on its own, or are 0 to never do so.  Returns NULL and sets errno if
+ * the thread cannot be started.
+ */
+AsyncWriter* async_writer_start(hdfsFS fs, hdfsFile file, int queue_length,
+    long buffer_size, long hflush_bytes, double hflush_interval);
+
+/*
+ * Writes out everything queued, stops the thread and frees the writer.  Must
+ * be called before the file is closed.  Returns 0, or the errno of the first
+ * write or flush that failed.
+ */
+int async_writer_stop(AsyncWriter* writer);
+
+/*
+ * Returns a buffer of buffer_size bytes to fill, reusing one that has been
+ * written out if possible, or NULL if out of memory.
+ */
+char* async_writer_take_buffer(AsyncWriter* writer);
+
+/* Hands back a buffer taken from the writer without submitting it. */
+void async_writer_recycle_buffer(AsyncWriter* writer, char* buffer);
+
+/*
+ * Queues length bytes of buffer to be written, taking ownership of buffer,
+ * which must come from async_writer_take_buffer or malloc.  Waits only while
+ * the queue is full, so should be called without the GVL.  Returns 0, or the
+ * errno of an earlier failure, in which case buffer is freed unwritten.
+ */
+int async_writer_submit(AsyncWriter* writer, char* buffer, long length);
+
+/*
+ * Queues a flush, or an hflush if hflush is non-zero, behind everything
+ * submitted so far.  Sets *ticket to identify it and returns as
+ * async_writer_submit does.
+ */
+int async_writer_flush(AsyncWriter* writer, int hflush,
+    unsigned long* ticket);
+
+/*
+ * Waits until the flush identified by ticket has run or *interrupted is set.
+ * Returns 1 if it has run, 0 if interrupted first, or -1 with *error set if
+ * any write or flush failed.
+ */
+int async_writer_wait(AsyncWriter* writer, unsigned long ticket,
+    volatile int* interrupted, int* error);
+
+/* Returns non-zero if the flush identified by ticket has run. */
+int async_writer_done(AsyncWriter* writer, unsigned long ticket);
+
+/* Wakes a caller waiting in async_writer_wait so it rechecks interrupts. */
+void async_writer_wake(void* writer);
+
+#endif /* HDFS_ASYNC_WRITER_H */
@@ -0,0 +1,59 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "batch.h"
+
+
+typedef struct Batch {
+  void (*func)(void*, long);
+  void* arg;
+  long num_items;
+  volatile int* interrupted;
+  pthread_mutex_t lock;      /* guards next */
+  long next;                 /* the index of the next item to claim */
+} Batch;
+
+
+static void* run_batch_worker(void* ptr) {
+  Batch* batch = (Batch*) ptr;
+  for (;;) {
+    pthread_mutex_lock(&batch->lock);
+    if (*batch->interrupted || batch->next >= batch->num_items) {
+      pthread_mutex_unlock(&batch->lock);
+      return NULL;
+    }
+    long index = batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    batch->func(batch->arg, index);
+  }
+}
+
+long batch_run(void (*func)(void*, long), void* arg, long start,
+    long num_items, int num_threads, volatile int* interrupted) {
+  Batch batch;
+  batch.func = func;
+  batch.arg = arg;
+  batch.num_items = num_items;
+  batch.interrupted = interrupted;
+  batch.next = start;
+  pthread_mutex_init(&batch.lock, NULL);
+  // Starts no more helpers than there are items beyond the calling thread's.
+  long num_helpers = num_items - start - 1;
+  num_helpers = num_helpers < num_threads - 1 ? num_helpers : num_threads - 1;
+  pthread_t* helpers = num_helpers > 0 ?
+      malloc(sizeof(pthread_t) * num_helpers) : NULL;
+  long started = 0;
+  // Carries on with fewer threads if some cannot be started.
+  while (helpers != NULL && started < num_helpers &&
+      pthread_create(helpers + started, NULL, run_batch_worker, &batch) == 0) {
+    started++;
+  }
+  run_batch_worker(&batch);
+  long i;
+  for (i = 0; i < started; i++) {
+    pthread_join(helpers[i], NULL);
+  }
+  free(helpers);
+  pthread_mutex_destroy(&batch.lock);
+  return batch.next;
+}
@@ -0,0 +1,15 @@
+#ifndef HDFS_BATCH_H
+#define HDFS_BATCH_H
+
+
+/*
+ * Calls func(arg, index) for each index from start up to num_items, spread
+ * across num_threads threads including the calling one, which claim indices
+ * in order.  Stops claiming once *interrupted is set.  Returns the index
+ * after the last item claimed, every item before which has been run; call
+ * it without the GVL.
+ */
+long batch_run(void (*func)(void*, long), void* arg, long start,
+    long num_items, int num_threads, volatile int* interrupted);
+
+#endif /* HDFS_BATCH_H */
@@ -0,0 +1,581 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "block_cache.h"
+
+
+#define BLOCK_CACHE_PAGE_SIZE 1048576
+#define BLOCK_CACHE_SLAB_PAGES 16
+#define BLOCK_CACHE_SHARDS 16
+#define BLOCK_CACHE_BUCKETS 1024
+#define BLOCK_CACHE_DEFAULT_BUDGET 268435456L
+
+typedef struct Slab Slab;
+
+typedef struct CachedPage {
+  char* path;          /* the file the page is of, or NULL while free */
+  tTime mtime;
+  tOffset index;       /* the offset of the page divided by the page size */
+  uint64_t hash;
+  char* data;          /* BLOCK_CACHE_PAGE_SIZE bytes within its slab */
+  long length;         /* bytes of the file in the page */
+  int pins;            /* readers copying out of the page or loading it */
+  int loading;         /* set until the page has been read from HDFS */
+  Slab* slab;
+  struct CachedPage* chain;  /* the next page in its bucket, or next free */
+  struct CachedPage* prev;   /* the next more recently used page */
+  struct CachedPage* next;   /* the next less recently used page */
+} CachedPage;
+
+/* A run of pages allocated at once, freed once none of them is used. */
+struct Slab {
+  char* memory;
+  CachedPage pages[BLOCK_CACHE_SLAB_PAGES];
+  int num_pages;
+  int num_free;
+  int releasing;       /* set while the slab is being freed */
+  Slab* next;
+};
+
+typedef struct CacheShard {
+  pthread_mutex_t lock;
+  pthread_cond_t loaded_cond;  /* signaled whenever a page is loaded */
+  CachedPage* buckets[BLOCK_CACHE_BUCKETS];
+  CachedPage* head;    /* the most recently used page */
+  CachedPage* tail;    /* the least recently used page */
+  long num_pages;
+  long bytes;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long evicted_bytes;
+} CacheShard;
+
+struct BlockCacheReader {
+  hdfsFS fs;
+  hdfsFile file;
+  char* path;
+  uint64_t path_hash;
+  tTime mtime;
+  tOffset size;
+  tOffset position;
+};
+
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+static CacheShard shards[BLOCK_CACHE_SHARDS];
+
+/* Guards the slabs and free pages, and the budget. */
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static Slab* slabs = NULL;
+static CachedPage* free_pages = NULL;
+static long num_slab_pages = 0;        /* pages in all slabs */
+static long num_free_pages = 0;
+static long max_pages = BLOCK_CACHE_DEFAULT_BUDGET / BLOCK_CACHE_PAGE_SIZE;
+static long budget_bytes = BLOCK_CACHE_DEFAULT_BUDGET;
+
+
+static void init_shards(void) {
+  int i;
+  for (i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    pthread_cond_init(&shards[i].loaded_cond, NULL);
+  }
+}
+
+static int errno_or(int error) {
+  return errno != 0 ? errno : error;
+}
+
+/* Returns the FNV-1a hash of a path. */
+static uint64_t hash_path(const char* path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *path != '\0'; path++) {
+    hash = (hash ^ (unsigned char) *path) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Mixes the modification time and index of a page into its path's hash. */
+static uint64_t hash_page(BlockCacheReader* reader, tOffset index) {
+  uint64_t hash = reader->path_hash ^ ((uint64_t) reader->mtime *
+      0x9e3779b97f4a7c15ULL) ^ ((uint64_t) index * 0xc2b2ae3d27d4eb4fULL);
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/*
+ * Positionally reads until length bytes have been read or the end of the
+ * file is reached, setting *bytes_read.  Returns 0 or an errno.
+ */
+static int pread_fully(hdfsFS fs, hdfsFile file, tOffset position,
+    char* buffer, long length, long* bytes_read) {
+  long total = 0;
+  while (total < length) {
+    errno = 0;
+    tSize result = hdfsPread(fs, file, position + total, buffer + total,
+        (tSize) (length - total));
+    if (result < 0) {
+      return errno_or(EIO);
+    }
+    if (result == 0) {
+      break;
+    }
+    total += result;
+  }
+  *bytes_read = total;
+  return 0;
+}
+
+/*
+ * Takes a free page, allocating a slab of them if none is left, as long as
+ * the budget allows another page to be used.  Returns NULL if it does not.
+ */
+static CachedPage* alloc_page(void) {
+  pthread_mutex_lock(&slab_lock);
+  if (num_slab_pages - num_free_pages >= max_pages) {
+    pthread_mutex_unlock(&slab_lock);
+    return NULL;
+  }
+  if (free_pages == NULL && num_slab_pages < max_pages) {
+    Slab* slab = calloc(1, sizeof(Slab));
+    long num_pages = max_pages - num_slab_pages;
+    num_pages = num_pages < BLOCK_CACHE_SLAB_PAGES ? num_pages :
+        BLOCK_CACHE_SLAB_PAGES;
+    void* memory = NULL;
+    if (slab != NULL && posix_memalign(&memory, 4096,
+        (size_t) num_pages * BLOCK_CACHE_PAGE_SIZE) == 0) {
+      slab->memory = memory;
+      slab->num_pages = slab->num_free = (int) num_pages;
+      int i;
+      for (i = 0; i < slab->num_pages; i++) {
+        CachedPage* page = slab->pages + i;
+        page->data = slab->memory + (long) i * BLOCK_CACHE_PAGE_SIZE;
+        page->slab = slab;
+        page->chain = free_pages;
+        free_pages = page;
+      }
+      slab->next = slabs;
+      slabs = slab;
+      num_slab_pages += num_pages;
+      num_free_pages += num_pages;
+    } else {
+      free(slab);
+    }
+  }
+  CachedPage* page = free_pages;
+  if (page != NULL) {
+    free_pages = page->chain;
+    page->chain = NULL;
+    page->slab->num_free--;
+    num_free_pages--;
+  }
+  pthread_mutex_unlock(&slab_lock);
+  return page;
+}
+
+static void free_page(CachedPage* page) {
+  pthread_mutex_lock(&slab_lock);
+  page->chain = free_pages;
+  free_pages = page;
+  page->slab->num_free++;
+  num_free_pages++;
+  pthread_mutex_unlock(&slab_lock);
+}
+
+/* Frees every slab none of whose pages is in use. */
+static void release_free_slabs(void) {
+  pthread_mutex_lock(&slab_lock);
+  Slab* slab;
+  for (slab = slabs; slab != NULL; slab = slab->next) {
+    slab->releasing = slab->num_free == slab->num_pages;
+  }
+  CachedPage** link = &free_pages;
+  while (*link != NULL) {
+    if ((*link)->slab->releasing) {
+      *link = (*link)->chain;
+    } else {
+      link = &(*link)->chain;
+    }
+  }
+  Slab** slab_link = &slabs;
+  while (*slab_link != NULL) {
+    slab = *slab_link;
+    if (slab->releasing) {
+      *slab_link = slab->next;
+      num_slab_pages -= slab->num_pages;
+      num_free_pages -= slab->num_pages;
+      free(slab->memory);
+      free(slab);
+    } else {
+      slab_link = &slab->next;
+    }
+  }
+  pthread_mutex_unlock(&slab_lock);
+}
+
+/* Returns the most pages a shard may hold. */
+static long shard_capacity(void) {
+  pthread_mutex_lock(&slab_lock);
+  long capacity = max_pages / BLOCK_CACHE_SHARDS;
+  if (capacity == 0 && max_pages > 0) {
+    capacity = 1;
+  }
+  pthread_mutex_unlock(&slab_lock);
+  return capacity;
+}
+
+/*
+ * The functions below operate on a shard, and must be called with its lock
+ * held.
+ */
+
+static CachedPage** bucket_for(CacheShard* shard, uint64_t hash) {
+  return shard->buckets + (hash / BLOCK_CACHE_SHARDS) % BLOCK_CACHE_BUCKETS;
+}
+
+static CachedPage* find_page(CacheShard* shard, BlockCacheReader* reader,
+    tOffset index, uint64_t hash) {
+  CachedPage* page;
+  for (page = *bucket_for(shard, hash); page != NULL; page = page->chain) {
+    if (page->hash == hash && page->index == index &&
+        page->mtime == reader->mtime && strcmp(page->path, reader->path) == 0) {
+      return page;
+    }
+  }
+  return NULL;
+}
+
+static void unlink_page(CacheShard* shard, CachedPage* page) {
+  if (page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    shard->head = page->next;
+  }
+  if (page->next != NULL) {
+    page->next->prev = page->prev;
+  } else {
+    shard->tail = page->prev;
+  }
+  page->prev = page->next = NULL;
+}
+
+static void push_page(CacheShard* shard, CachedPage* page) {
+  page->prev = NULL;
+  page->next = shard->head;
+  if (shard->head != NULL) {
+    shard->head->prev = page;
+  } else {
+    shard->tail = page;
+  }
+  shard->head = page;
+}
+
+/* Drops a page from the shard, leaving it to the caller to reuse or free. */
+static void drop_page(CacheShard* shard, CachedPage* page) {
+  CachedPage** link = bucket_for(shard, page->hash);
+  while (*link != page) {
+    link = &(*link)->chain;
+  }
+  *link = page->chain;
+  page->chain = NULL;
+  unlink_page(shard, page);
+  shard->num_pages--;
+  shard->bytes -= page->length;
+  free(page->path);
+  page->path = NULL;
+}
+
+static void evict_page(CacheShard* shard, CachedPage* page) {
+  shard->evictions++;
+  shard->evicted_bytes += page->length;
+  drop_page(shard, page);
+}
+
+/*
+ * Evicts unpinned pages, least recently used first, until the shard holds
+ * at most capacity, returning them to the slabs.  Returns how many.
+ */
+static long shrink_shard(CacheShard* shard, long capacity) {
+  long num_evicted = 0;
+  CachedPage* page = shard->tail;
+  while (page != NULL && shard->num_pages > capacity) {
+    CachedPage* prev = page->prev;
+    if (page->pins == 0) {
+      evict_page(shard, page);
+      free_page(page);
+      num_evicted++;
+    }
+    page = prev;
+  }
+  return num_evicted;
+}
+
+/*
+ * Returns a page for the shard to fill, allocating one while it is under
+ * its share of the budget and otherwise evicting its least recently used
+ * unpinned page.  Returns NULL if every page is pinned.
+ */
+static CachedPage* take_page(CacheShard* shard) {
+  long capacity = shard_capacity();
+  if (capacity == 0) {
+    return NULL;
+  }
+  CachedPage* page = shard->num_pages < capacity ? alloc_page() : NULL;
+  if (page != NULL) {
+    return page;
+  }
+  for (page = shard->tail; page != NULL; page = page->prev) {
+    if (page->pins == 0) {
+      evict_page(shard, page);
+      return page;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Finds the page at index of the reader's file, pinned so that it cannot be
+ * evicted until released, reading it from HDFS first if it is not cached or
+ * waiting for another thread already doing so.  Sets *page to NULL if no
+ * page can be had, for the caller to read around the cache.  Returns 0, or
+ * an errno, which is EINTR if *interrupted was set while waiting.
+ */
+static int acquire_page(BlockCacheReader* reader, tOffset index,
+    CacheShard** shard_out, CachedPage** page_out,
+    volatile int* interrupted) {
+  uint64_t hash = hash_page(reader, index);
+  CacheShard* shard = shards + hash % BLOCK_CACHE_SHARDS;
+  *shard_out = shard;
+  *page_out = NULL;
+  pthread_mutex_lock(&shard->lock);
+  CachedPage* page;
+  while ((page = find_page(shard, reader, index, hash)) != NULL &&
+      page->loading) {
+    if (*interrupted) {
+      pthread_mutex_unlock(&shard->lock);
+      return EINTR;
+    }
+    pthread_cond_wait(&shard->loaded_cond, &shard->lock);
+  }
+  if (page != NULL) {
+    page->pins++;
+    unlink_page(shard, page);
+    push_page(shard, page);
+    shard->hits++;
+    pthread_mutex_unlock(&shard->lock);
+    *page_out = page;
+    return 0;
+  }
+  shard->misses++;
+  page = take_page(shard);
+  if (page == NULL) {
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+  }
+  page->path = strdup(reader->path);
+  if (page->path == NULL) {
+    free_page(page);
+    pthread_mutex_unlock(&shard->lock);
+    return ENOMEM;
+  }
+  page->mtime = reader->mtime;
+  page->index = index;
+  page->hash = hash;
+  page->length = 0;
+  page->pins = 1;
+  page->loading = 1;
+  CachedPage** bucket = bucket_for(shard, hash);
+  page->chain = *bucket;
+  *bucket = page;
+  push_page(shard, page);
+  shard->num_pages++;
+  pthread_mutex_unlock(&shard->lock);
+
+  // Reads the page without the lock, so the rest of the shard stays usable.
+  tOffset start = index * BLOCK_CACHE_PAGE_SIZE;
+  tOffset remaining = reader->size - start;
+  long length = 0;
+  int error = pread_fully(reader->fs, reader->file, start, page->data,
+      remaining < BLOCK_CACHE_PAGE_SIZE ? (long) remaining :
+      BLOCK_CACHE_PAGE_SIZE, &length);
+
+  pthread_mutex_lock(&shard->lock);
+  page->loading = 0;
+  if (error != 0) {
+    page->pins--;
+    drop_page(shard, page);
+    free_page(page);
+  } else {
+    page->length = length;
+    shard->bytes += length;
+    *page_out = page;
+  }
+  pthread_cond_broadcast(&shard->loaded_cond);
+  pthread_mutex_unlock(&shard->lock);
+  return error;
+}
+
+static void release_page(CacheShard* shard, CachedPage* page) {
+  pthread_mutex_lock(&shard->lock);
+  page->pins--;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void block_cache_configure(long budget) {
+  pthread_once(&shards_once, init_shards);
+  pthread_mutex_lock(&slab_lock);
+  budget_bytes = budget;
+  max_pages = budget / BLOCK_CACHE_PAGE_SIZE;
+  pthread_mutex_unlock(&slab_lock);
+  long capacity = shard_capacity();
+  int i;
+  for (i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    shrink_shard(shards + i, capacity);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  release_free_slabs();
+}
+
+BlockCacheReader* block_cache_open(hdfsFS fs, hdfsFile file,
+    const char* path, tTime mtime, tOffset size) {
+  pthread_once(&shards_once, init_shards);
+  BlockCacheReader* reader = malloc(sizeof(BlockCacheReader));
+  char* path_copy = strdup(path);
+  if (reader == NULL || path_copy == NULL) {
+    free(reader);
+    free(path_copy);
+    errno = ENOMEM;
+    return NULL;
+  }
+  reader->fs = fs;
+  reader->file = file;
+  reader->path = path_copy;
+  reader->path_hash = hash_path(path);
+  reader->mtime = mtime;
+  reader->size = size;
+  reader->position = 0;
+  return reader;
+}
+
+void block_cache_close(BlockCacheReader* reader) {
+  free(reader->path);
+  free(reader);
+}
+
+long block_cache_read(BlockCacheReader* reader, tOffset position,
+    char* buffer, long length, volatile int* interrupted, int* error) {
+  tOffset offset = position == -1 ? reader->position : position;
+  long total = 0;
+  while (total < length && !*interrupted) {
+    tOffset at = offset + total;
+    if (at >= reader->size) {
+      break;
+    }
+    tOffset index = at / BLOCK_CACHE_PAGE_SIZE;
+    long skip = (long) (at - index * BLOCK_CACHE_PAGE_SIZE);
+    long wanted = length - total < BLOCK_CACHE_PAGE_SIZE - skip ?
+        length - total : BLOCK_CACHE_PAGE_SIZE - skip;
+    CacheShard* shard;
+    CachedPage* page;
+    int result = acquire_page(reader, index, &shard, &page, interrupted);
+    if (result == EINTR) {
+      break;
+    }
+    if (result != 0) {
+      *error = result;
+      return -1;
+    }
+    long copied;
+    if (page == NULL) {
+      // Every page the shard could use is pinned, so reads around the cache.
+      result = pread_fully(reader->fs, reader->file, at, buffer + total,
+          wanted, &copied);
+      if (result != 0) {
+        *error = result;
+        return -1;
+      }
+    } else {
+      copied = page->length - skip;
+      copied = copied < 0 ? 0 : (copied < wanted ? copied : wanted);
+      memcpy(buffer + total, page->data + skip, copied);
+      release_page(shard, page);
+    }
+    if (copied == 0) {
+      break;
+    }
+    total += copied;
+  }
+  if (position == -1) {
+    reader->position += total;
+  }
+  return total;
+}
+
+int block_cache_seek(BlockCacheReader* reader, tOffset position) {
+  if (position < 0 || position > reader->size) {
+    return -1;
+  }
+  reader->position = position;
+  return 0;
+}
+
+tOffset block_cache_tell(BlockCacheReader* reader) {
+  return reader->position;
+}
+
+tOffset block_cache_size(BlockCacheReader* reader) {
+  return reader->size;
+}
+
+long block_cache_clear(void) {
+  pthread_once(&shards_once, init_shards);
+  long num_evicted = 0;
+  int i;
+  for (i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    num_evicted += shrink_shard(shards + i, 0);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  release_free_slabs();
+  return num_evicted;
+}
+
+void block_cache_stats(BlockCacheStats* stats) {
+  pthread_once(&shards_once, init_shards);
+  memset(stats, 0, sizeof(BlockCacheStats));
+  int i;
+  for (i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    CacheShard* shard = shards + i;
+    pthread_mutex_lock(&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->evicted_bytes += shard->evicted_bytes;
+    stats->pages += shard->num_pages;
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  pthread_mutex_lock(&slab_lock);
+  stats->allocated_bytes = num_slab_pages * BLOCK_CACHE_PAGE_SIZE;
+  stats->budget = budget_bytes;
+  pthread_mutex_unlock(&slab_lock);
+  stats->page_size = BLOCK_CACHE_PAGE_SIZE;
+}
+
+void block_cache_wake(void* unused) {
+  pthread_once(&shards_once, init_shards);
+  int i;
+  for (i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    pthread_cond_broadcast(&shards[i].loaded_cond);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef HDFS_BLOCK_CACHE_H
+#define HDFS_BLOCK_CACHE_H
+
+#include "hdfs.h"
+
+
+/*
+ * A process-wide cache of aligned 1 MB pages of files, keyed by path,
+ * modification time and page index, shared by every file opened with
+ * block_cache so that threads reading the same ranges of a file, such as a
+ * Parquet footer, read them from a DataNode once.  Pages come from slabs
+ * allocated up to a byte budget, and are spread over shards each with a lock
+ * and an LRU list of its own.  A page missing from the cache is read by one
+ * thread while any others wanting it wait.  All functions are thread-safe;
+ * none calls into Ruby.
+ */
+typedef struct BlockCacheReader BlockCacheReader;
+
+typedef struct BlockCacheStats {
+  unsigned long hits;        /* pages read from the cache */
+  unsigned long misses;      /* pages read from HDFS */
+  unsigned long evictions;   /* pages dropped to make room */
+  unsigned long evicted_bytes;
+  long pages;                /* pages currently cached */
+  long bytes;                /* bytes of file data currently cached */
+  long allocated_bytes;      /* bytes of slabs allocated for pages */
+  long budget;
+  long page_size;
+} BlockCacheStats;
+
+/*
+ * Keeps at most budget bytes of pages, evicting pages and freeing slabs
+ * which are no longer used if it shrinks.
+ */
+void block_cache_configure(long budget);
+
+/*
+ * Starts reading file, opened from path, through the cache, taking it to be
+ * size bytes long as last modified at mtime.  The reader does not own the
+ * file.  Returns NULL and sets errno if memory runs out.
+ */
+BlockCacheReader* block_cache_open(hdfsFS fs, hdfsFile file,
+    const char* path, tTime mtime, tOffset size);
+
+void block_cache_close(BlockCacheReader* reader);
+
+/*
+ * Reads through the cache from position, or from the offset of the reader if
+ * position is -1, advancing it, until length bytes have been read, the end
+ * of the file is reached, or *interrupted is set.  Returns the bytes read,
+ * or -1 with *error set.  Blocks, so should be called without the GVL.
+ */
+long block_cache_read(BlockCacheReader* reader, tOffset position,
+    char* buffer, long length, volatile int* interrupted, int* error);
+
+/* Moves the offset of the reader, returning -1 if it is past the end. */
+int block_cache_seek(BlockCacheReader* reader, tOffset position);
+
+tOffset block_cache_tell(BlockCacheReader* reader);
+tOffset block_cache_size(BlockCacheReader* reader);
+
+/* Evicts every page not being read, returning how many. */
+long block_cache_clear(void);
+
+void block_cache_stats(BlockCacheStats* stats);
+
+/* Wakes callers waiting on another thread reading a page. */
+void block_cache_wake(void* unused);
+
+#endif /* HDFS_BLOCK_CACHE_H */
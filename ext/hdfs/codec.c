@@ -0,0 +1,558 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBSNAPPY
+#include <snappy-c.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#include "codec.h"
+
+
+/* The uncompressed bytes in each block, as SnappyCodec writes by default. */
+#define CODEC_SNAPPY_BLOCK_SIZE 262144
+
+/* The largest compressed chunk accepted, so corrupt lengths do not OOM. */
+#define CODEC_SNAPPY_MAX_CHUNK (64 * 1048576)
+
+/* The parts of a snappy stream a decompressor may be in the middle of. */
+enum {
+  kSnappyBlockHeader,        /* the uncompressed length of a block */
+  kSnappyChunkHeader,        /* the compressed length of a chunk */
+  kSnappyChunk,              /* the compressed chunk itself */
+};
+
+struct Codec {
+  CodecKind kind;
+  int compress;
+  char* buffer;              /* compressed input or output */
+  long buffer_size;
+  long buffer_start;         /* offset of the first byte not yet consumed */
+  long buffer_end;
+  CodecMode done;            /* the flush finished, with no input since */
+  int boundary;              /* a decompressor is between streams */
+#ifdef HAVE_LIBZ
+  z_stream zlib;
+#endif
+#ifdef HAVE_LIBZSTD
+  ZSTD_CStream* zstd_out;
+  ZSTD_DStream* zstd_in;
+#endif
+  /* Snappy works a whole block or chunk at a time, so buffers it here. */
+  char* block;               /* uncompressed input, or decompressed output */
+  long block_size;
+  long block_start;          /* offset of the first byte not yet consumed */
+  long block_end;
+  char* chunk;               /* a compressed chunk with its framing */
+  long chunk_size;
+  long chunk_length;
+  long chunk_start;          /* offset of the first byte not yet consumed */
+  long chunk_end;
+  unsigned char header[4];
+  int header_used;
+  int snappy_state;
+  long block_remaining;      /* bytes of the block not yet decompressed */
+};
+
+
+CodecKind codec_for_name(const char* name) {
+  if (strcmp(name, "deflate") == 0 || strcmp(name, "zlib") == 0) {
+    return kCodecDeflate;
+  } else if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0) {
+    return kCodecGzip;
+  } else if (strcmp(name, "snappy") == 0) {
+    return kCodecSnappy;
+  } else if (strcmp(name, "zstd") == 0 || strcmp(name, "zst") == 0) {
+    return kCodecZstd;
+  }
+  return kCodecNone;
+}
+
+CodecKind codec_for_path(const char* path) {
+  const char* extension = strrchr(path, '.');
+  if (extension == NULL || strchr(extension, '/') != NULL) {
+    return kCodecNone;
+  }
+  return codec_for_name(extension + 1);
+}
+
+int codec_supported(CodecKind kind) {
+  switch (kind) {
+#ifdef HAVE_LIBZ
+    case kCodecDeflate:
+    case kCodecGzip:
+      return 1;
+#endif
+#ifdef HAVE_LIBSNAPPY
+    case kCodecSnappy:
+      return 1;
+#endif
+#ifdef HAVE_LIBZSTD
+    case kCodecZstd:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+Codec* codec_start(CodecKind kind, int compress, long buffer_size) {
+  if (!codec_supported(kind)) {
+    errno = ENOTSUP;
+    return NULL;
+  }
+  Codec* codec = calloc(1, sizeof(Codec));
+  if (codec == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  codec->kind = kind;
+  codec->compress = compress;
+  codec->buffer_size = buffer_size;
+  codec->boundary = 1;
+  codec->buffer = malloc(buffer_size);
+  int failed = codec->buffer == NULL;
+  switch (kind) {
+#ifdef HAVE_LIBZ
+    case kCodecDeflate:
+    case kCodecGzip: {
+      // Adding 16 to the window bits selects a gzip header and trailer.
+      int window_bits = kind == kCodecGzip ? 15 + 16 : 15;
+      failed = failed || (compress ?
+          deflateInit2(&codec->zlib, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+              window_bits, 8, Z_DEFAULT_STRATEGY) :
+          inflateInit2(&codec->zlib, window_bits)) != Z_OK;
+      break;
+    }
+#endif
+#ifdef HAVE_LIBSNAPPY
+    case kCodecSnappy:
+      codec->chunk_size = 8 + (long) snappy_max_compressed_length(
+          CODEC_SNAPPY_BLOCK_SIZE);
+      codec->block_size = CODEC_SNAPPY_BLOCK_SIZE;
+      codec->block = malloc(codec->block_size);
+      codec->chunk = malloc(codec->chunk_size);
+      failed = failed || codec->block == NULL || codec->chunk == NULL;
+      break;
+#endif
+#ifdef HAVE_LIBZSTD
+    case kCodecZstd:
+      if (compress) {
+        codec->zstd_out = ZSTD_createCStream();
+        failed = failed || codec->zstd_out == NULL ||
+            ZSTD_isError(ZSTD_initCStream(codec->zstd_out,
+                ZSTD_CLEVEL_DEFAULT));
+      } else {
+        codec->zstd_in = ZSTD_createDStream();
+        failed = failed || codec->zstd_in == NULL ||
+            ZSTD_isError(ZSTD_initDStream(codec->zstd_in));
+      }
+      break;
+#endif
+    default:
+      break;
+  }
+  if (failed) {
+    // Marks the stream as never started, so that stopping skips it.
+    codec->kind = kCodecNone;
+    codec_stop(codec);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return codec;
+}
+
+void codec_stop(Codec* codec) {
+  switch (codec->kind) {
+#ifdef HAVE_LIBZ
+    case kCodecDeflate:
+    case kCodecGzip:
+      if (codec->compress) {
+        deflateEnd(&codec->zlib);
+      } else {
+        inflateEnd(&codec->zlib);
+      }
+      break;
+#endif
+#ifdef HAVE_LIBZSTD
+    case kCodecZstd:
+      ZSTD_freeCStream(codec->zstd_out);
+      ZSTD_freeDStream(codec->zstd_in);
+      break;
+#endif
+    default:
+      break;
+  }
+#ifdef HAVE_LIBZSTD
+  if (codec->kind == kCodecNone) {
+    // Frees whichever stream was created before starting failed.
+    ZSTD_freeCStream(codec->zstd_out);
+    ZSTD_freeDStream(codec->zstd_in);
+  }
+#endif
+  free(codec->buffer);
+  free(codec->block);
+  free(codec->chunk);
+  free(codec);
+}
+
+char* codec_input_space(Codec* codec, long* length) {
+  if (codec->buffer_start > 0) {
+    memmove(codec->buffer, codec->buffer + codec->buffer_start,
+        codec->buffer_end - codec->buffer_start);
+    codec->buffer_end -= codec->buffer_start;
+    codec->buffer_start = 0;
+  }
+  *length = codec->buffer_size - codec->buffer_end;
+  return codec->buffer + codec->buffer_end;
+}
+
+void codec_input_added(Codec* codec, long length) {
+  codec->buffer_end += length;
+}
+
+int codec_at_boundary(Codec* codec) {
+  return codec->boundary;
+}
+
+#ifdef HAVE_LIBZ
+/* Clamps a length to what fits in the unsigned int fields of zlib. */
+static unsigned int clamp_uint(long length) {
+  return length > (long) UINT_MAX ? UINT_MAX : (unsigned int) length;
+}
+
+static long zlib_decompress(Codec* codec, char* output, long length) {
+  long total = 0;
+  while (total < length && codec->buffer_start < codec->buffer_end) {
+    if (codec->boundary) {
+      // Starts the next of several concatenated streams.
+      inflateReset(&codec->zlib);
+      codec->boundary = 0;
+    }
+    codec->zlib.next_in = (Bytef*) codec->buffer + codec->buffer_start;
+    codec->zlib.avail_in = clamp_uint(codec->buffer_end -
+        codec->buffer_start);
+    codec->zlib.next_out = (Bytef*) output + total;
+    codec->zlib.avail_out = clamp_uint(length - total);
+    unsigned int available = codec->zlib.avail_in;
+    unsigned int space = codec->zlib.avail_out;
+    int result = inflate(&codec->zlib, Z_NO_FLUSH);
+    codec->buffer_start += available - codec->zlib.avail_in;
+    total += space - codec->zlib.avail_out;
+    if (result == Z_STREAM_END) {
+      codec->boundary = 1;
+    } else if (result == Z_BUF_ERROR) {
+      // Made no progress, which needs more input than is buffered.
+      break;
+    } else if (result != Z_OK) {
+      errno = EBADMSG;
+      return -1;
+    }
+  }
+  return total;
+}
+
+static long zlib_compress(Codec* codec, const char** input,
+    long* input_length, CodecMode mode) {
+  codec->zlib.next_in = (Bytef*) *input;
+  codec->zlib.avail_in = clamp_uint(*input_length);
+  codec->zlib.next_out = (Bytef*) codec->buffer;
+  codec->zlib.avail_out = clamp_uint(codec->buffer_size);
+  unsigned int available = codec->zlib.avail_in;
+  int flush = mode == kCodecFinish ? Z_FINISH :
+      (mode == kCodecFlush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+  int result = deflate(&codec->zlib, flush);
+  if (result == Z_STREAM_ERROR) {
+    errno = EINVAL;
+    return -1;
+  }
+  long consumed = available - codec->zlib.avail_in;
+  *input += consumed;
+  *input_length -= consumed;
+  if (result == Z_STREAM_END) {
+    // Any later writes go into a new stream, which readers concatenate.
+    deflateReset(&codec->zlib);
+    codec->done = kCodecFinish;
+  } else if (flush == Z_SYNC_FLUSH && *input_length == 0 &&
+      codec->zlib.avail_out > 0) {
+    codec->done = kCodecFlush;
+  }
+  return codec->buffer_size - codec->zlib.avail_out;
+}
+#endif
+
+#ifdef HAVE_LIBSNAPPY
+static void write_be32(char* buffer, unsigned long value) {
+  buffer[0] = (char) (value >> 24);
+  buffer[1] = (char) (value >> 16);
+  buffer[2] = (char) (value >> 8);
+  buffer[3] = (char) value;
+}
+
+static unsigned long read_be32(const unsigned char* buffer) {
+  return ((unsigned long) buffer[0] << 24) |
+      ((unsigned long) buffer[1] << 16) | ((unsigned long) buffer[2] << 8) |
+      buffer[3];
+}
+
+/*
+ * Copies input into the header until it holds four bytes, returning 1 once
+ * it does.
+ */
+static int fill_snappy_header(Codec* codec) {
+  while (codec->header_used < 4 && codec->buffer_start < codec->buffer_end) {
+    codec->header[codec->header_used++] =
+        (unsigned char) codec->buffer[codec->buffer_start++];
+  }
+  if (codec->header_used < 4) {
+    return 0;
+  }
+  codec->header_used = 0;
+  return 1;
+}
+
+/* Decompresses a whole chunk into the block buffer. */
+static int decompress_snappy_chunk(Codec* codec) {
+  size_t length;
+  if (snappy_uncompressed_length(codec->chunk, codec->chunk_length,
+      &length) != SNAPPY_OK || (long) length > codec->block_remaining) {
+    return -1;
+  }
+  if ((long) length > codec->block_size) {
+    // Writers may be configured with blocks larger than the default.
+    char* block = realloc(codec->block, length);
+    if (block == NULL) {
+      return -1;
+    }
+    codec->block = block;
+    codec->block_size = (long) length;
+  }
+  if (snappy_uncompress(codec->chunk, codec->chunk_length, codec->block,
+      &length) != SNAPPY_OK) {
+    return -1;
+  }
+  codec->block_start = 0;
+  codec->block_end = (long) length;
+  codec->block_remaining -= (long) length;
+  return 0;
+}
+
+static long snappy_decompress(Codec* codec, char* output, long length) {
+  long total = 0;
+  for (;;) {
+    long pending = codec->block_end - codec->block_start;
+    if (pending > 0) {
+      long taken = pending < length - total ? pending : length - total;
+      memcpy(output + total, codec->block + codec->block_start, taken);
+      codec->block_start += taken;
+      total += taken;
+    }
+    if (total == length || codec->buffer_start == codec->buffer_end) {
+      break;
+    }
+    codec->boundary = 0;
+    if (codec->snappy_state == kSnappyChunk) {
+      long available = codec->buffer_end - codec->buffer_start;
+      long needed = codec->chunk_length - codec->chunk_end;
+      long taken = available < needed ? available : needed;
+      memcpy(codec->chunk + codec->chunk_end,
+          codec->buffer + codec->buffer_start, taken);
+      codec->buffer_start += taken;
+      codec->chunk_end += taken;
+      if (codec->chunk_end == codec->chunk_length) {
+        if (decompress_snappy_chunk(codec) != 0) {
+          errno = EBADMSG;
+          return -1;
+        }
+        codec->snappy_state = codec->block_remaining > 0 ?
+            kSnappyChunkHeader : kSnappyBlockHeader;
+      }
+    } else if (fill_snappy_header(codec)) {
+      unsigned long value = read_be32(codec->header);
+      if (codec->snappy_state == kSnappyBlockHeader) {
+        codec->block_remaining = (long) value;
+        if (value > 0) {
+          codec->snappy_state = kSnappyChunkHeader;
+        }
+      } else if (value > CODEC_SNAPPY_MAX_CHUNK ||
+          codec->block_remaining > CODEC_SNAPPY_MAX_CHUNK) {
+        errno = EBADMSG;
+        return -1;
+      } else {
+        if ((long) value > codec->chunk_size) {
+          char* chunk = realloc(codec->chunk, value);
+          if (chunk == NULL) {
+            errno = ENOMEM;
+            return -1;
+          }
+          codec->chunk = chunk;
+          codec->chunk_size = (long) value;
+        }
+        codec->chunk_length = (long) value;
+        codec->chunk_end = 0;
+        codec->snappy_state = kSnappyChunk;
+      }
+    }
+  }
+  codec->boundary = codec->snappy_state == kSnappyBlockHeader &&
+      codec->header_used == 0 && codec->block_start == codec->block_end;
+  return total;
+}
+
+/* Compresses the block buffer into a framed chunk, emptying the block. */
+static int compress_snappy_block(Codec* codec) {
+  size_t length = codec->chunk_size - 8;
+  if (snappy_compress(codec->block, codec->block_end, codec->chunk + 8,
+      &length) != SNAPPY_OK) {
+    return -1;
+  }
+  write_be32(codec->chunk, (unsigned long) codec->block_end);
+  write_be32(codec->chunk + 4, (unsigned long) length);
+  codec->chunk_start = 0;
+  codec->chunk_end = 8 + (long) length;
+  codec->block_end = 0;
+  return 0;
+}
+
+static long snappy_compress_blocks(Codec* codec, const char** input,
+    long* input_length, CodecMode mode) {
+  long total = 0;
+  for (;;) {
+    long pending = codec->chunk_end - codec->chunk_start;
+    if (pending > 0) {
+      long space = codec->buffer_size - total;
+      long taken = pending < space ? pending : space;
+      memcpy(codec->buffer + total, codec->chunk + codec->chunk_start, taken);
+      codec->chunk_start += taken;
+      total += taken;
+      if (taken < pending) {
+        break;
+      }
+    }
+    long space = CODEC_SNAPPY_BLOCK_SIZE - codec->block_end;
+    long taken = *input_length < space ? *input_length : space;
+    memcpy(codec->block + codec->block_end, *input, taken);
+    codec->block_end += taken;
+    *input += taken;
+    *input_length -= taken;
+    if (codec->block_end == CODEC_SNAPPY_BLOCK_SIZE ||
+        (mode != kCodecContinue && *input_length == 0 &&
+            codec->block_end > 0)) {
+      if (compress_snappy_block(codec) != 0) {
+        errno = EINVAL;
+        return -1;
+      }
+    } else {
+      break;
+    }
+  }
+  if (mode != kCodecContinue && *input_length == 0 &&
+      codec->chunk_start == codec->chunk_end && codec->block_end == 0) {
+    codec->done = mode;
+  }
+  return total;
+}
+#endif
+
+#ifdef HAVE_LIBZSTD
+static long zstd_decompress(Codec* codec, char* output, long length) {
+  ZSTD_inBuffer in = { codec->buffer + codec->buffer_start,
+      codec->buffer_end - codec->buffer_start, 0 };
+  ZSTD_outBuffer out = { output, length, 0 };
+  // Runs even once the input is used up, since zstd may still hold output
+  // which an earlier call had no room for, and stops once a call neither
+  // consumes input nor produces output.
+  while (out.pos < out.size) {
+    size_t consumed = in.pos, produced = out.pos;
+    size_t result = ZSTD_decompressStream(codec->zstd_in, &out, &in);
+    if (ZSTD_isError(result)) {
+      errno = EBADMSG;
+      return -1;
+    }
+    if (in.pos == consumed && out.pos == produced) {
+      break;
+    }
+    // Reaches 0 only once a frame has been decoded and flushed in full.
+    codec->boundary = result == 0;
+  }
+  codec->buffer_start += in.pos;
+  return out.pos;
+}
+
+static long zstd_compress(Codec* codec, const char** input,
+    long* input_length, CodecMode mode) {
+  ZSTD_inBuffer in = { *input, *input_length, 0 };
+  ZSTD_outBuffer out = { codec->buffer, codec->buffer_size, 0 };
+  ZSTD_EndDirective directive = mode == kCodecFinish ? ZSTD_e_end :
+      (mode == kCodecFlush ? ZSTD_e_flush : ZSTD_e_continue);
+  size_t result = ZSTD_compressStream2(codec->zstd_out, &out, &in,
+      directive);
+  if (ZSTD_isError(result)) {
+    errno = EINVAL;
+    return -1;
+  }
+  *input += in.pos;
+  *input_length -= in.pos;
+  if (directive != ZSTD_e_continue && *input_length == 0 && result == 0) {
+    codec->done = mode;
+  }
+  return out.pos;
+}
+#endif
+
+long codec_decompress(Codec* codec, char* output, long length) {
+  switch (codec->kind) {
+#ifdef HAVE_LIBZ
+    case kCodecDeflate:
+    case kCodecGzip:
+      return zlib_decompress(codec, output, length);
+#endif
+#ifdef HAVE_LIBSNAPPY
+    case kCodecSnappy:
+      return snappy_decompress(codec, output, length);
+#endif
+#ifdef HAVE_LIBZSTD
+    case kCodecZstd:
+      return zstd_decompress(codec, output, length);
+#endif
+    default:
+      errno = ENOTSUP;
+      return -1;
+  }
+}
+
+long codec_compress(Codec* codec, const char** input, long* input_length,
+    CodecMode mode, const char** output) {
+  *output = codec->buffer;
+  if (*input_length > 0) {
+    codec->done = kCodecContinue;
+  } else if (mode <= codec->done) {
+    // Returns nothing rather than ending another, empty, stream.
+    return 0;
+  }
+  switch (codec->kind) {
+#ifdef HAVE_LIBZ
+    case kCodecDeflate:
+    case kCodecGzip:
+      return zlib_compress(codec, input, input_length, mode);
+#endif
+#ifdef HAVE_LIBSNAPPY
+    case kCodecSnappy:
+      return snappy_compress_blocks(codec, input, input_length, mode);
+#endif
+#ifdef HAVE_LIBZSTD
+    case kCodecZstd:
+      return zstd_compress(codec, input, input_length, mode);
+#endif
+    default:
+      errno = ENOTSUP;
+      return -1;
+  }
+}
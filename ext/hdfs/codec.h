@@ -0,0 +1,82 @@
+#ifndef HDFS_CODEC_H
+#define HDFS_CODEC_H
+
+
+/*
+ * A streaming compressor or decompressor for one file, in one of the formats
+ * Hadoop writes.  Each codec owns a buffer: a decompressor buffers the
+ * compressed data read for it, and a compressor buffers its output, so that
+ * data is copied only between that buffer and the caller's.  Codecs run on
+ * any thread but are not themselves thread-safe; none calls into Ruby, so
+ * all can run without the GVL.
+ */
+typedef struct Codec Codec;
+
+typedef enum CodecKind {
+  kCodecNone,
+  kCodecDeflate,             /* zlib streams, as written by DefaultCodec */
+  kCodecGzip,                /* gzip members, as written by GzipCodec */
+  kCodecSnappy,              /* snappy blocks framed as by SnappyCodec */
+  kCodecZstd,                /* zstd frames, as written by ZStandardCodec */
+} CodecKind;
+
+typedef enum CodecMode {
+  kCodecContinue,            /* compresses as much as is efficient */
+  kCodecFlush,               /* also ends the output on a readable boundary */
+  kCodecFinish,              /* also ends the stream */
+} CodecMode;
+
+/*
+ * Returns the codec with the supplied name, such as "gzip", or the codec
+ * for the extension of path, such as ".gz", or kCodecNone if there is none.
+ */
+CodecKind codec_for_name(const char* name);
+CodecKind codec_for_path(const char* path);
+
+/* Returns non-zero if this build was linked against the codec's library. */
+int codec_supported(CodecKind kind);
+
+/*
+ * Starts a compressor if compress is non-zero, or else a decompressor, with
+ * a buffer of buffer_size bytes.  Returns NULL and sets errno if kind is not
+ * supported or memory runs out.
+ */
+Codec* codec_start(CodecKind kind, int compress, long buffer_size);
+
+/* Frees the codec along with anything left in its buffer. */
+void codec_stop(Codec* codec);
+
+/*
+ * Returns the free space at the end of a decompressor's buffer, compacting
+ * it first, and sets *length to its size; once compressed data has been
+ * read into it, codec_input_added records how much.
+ */
+char* codec_input_space(Codec* codec, long* length);
+void codec_input_added(Codec* codec, long length);
+
+/*
+ * Decompresses buffered input into output until length bytes have been
+ * produced or the input runs out.  Returns the bytes produced, 0 meaning
+ * more input is needed, or -1 with errno set to EBADMSG if the input is
+ * corrupt.
+ */
+long codec_decompress(Codec* codec, char* output, long length);
+
+/*
+ * Returns non-zero if a decompressor stopped between streams, and so may
+ * reach the end of its input without it having been truncated.
+ */
+int codec_at_boundary(Codec* codec);
+
+/*
+ * Compresses up to *input_length bytes from *input, advancing them past what
+ * was consumed, and sets *output to the compressed data produced in the
+ * codec's buffer, which the next call reuses.  Returns the bytes produced,
+ * or -1 with errno set.  With kCodecContinue, the codec may hold input back
+ * until it has enough; with kCodecFlush or kCodecFinish, call again with the
+ * same mode until the input is consumed and 0 is returned.
+ */
+long codec_compress(Codec* codec, const char** input, long* input_length,
+    CodecMode mode, const char** output);
+
+#endif /* HDFS_CODEC_H */
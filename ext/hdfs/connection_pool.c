@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "connection_pool.h"
+
+
+typedef struct PooledConnection {
+  char* key;           /* the canonical form of the ConnectionKey */
+  hdfsFS fs;
+  int references;      /* 0 for an idle handle */
+  int shared;          /* 0 for a new instance that is never shared */
+  struct PooledConnection* next;
+} PooledConnection;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static PooledConnection* pool = NULL;
+static unsigned long pool_hits = 0;
+static unsigned long pool_misses = 0;
+
+
+static int compare_conf_pairs(const void* a, const void* b) {
+  return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+/*
+ * Builds a string that is equal for two keys exactly when they describe the
+ * same connection, listing configuration in order of key.  Returns NULL if
+ * out of memory.
+ */
+static char* canonical_key(const ConnectionKey* key) {
+  size_t length = 64;
+  length += key->host != NULL ? strlen(key->host) : 0;
+  length += key->user != NULL ? strlen(key->user) : 0;
+  length += key->kerb_ticket_cache != NULL ? strlen(key->kerb_ticket_cache) :
+      0;
+  int i;
+  for (i = 0; i < key->num_conf * 2; i++) {
+    length += strlen(key->conf[i]) + 1;
+  }
+  const char** pairs = malloc(sizeof(char*) * (key->num_conf * 2 + 1));
+  char* result = malloc(length);
+  if (pairs == NULL || result == NULL) {
+    free(pairs);
+    free(result);
+    return NULL;
+  }
+  memcpy(pairs, key->conf, sizeof(char*) * key->num_conf * 2);
+  // Sorts the pairs by key; each key is followed by its value.
+  qsort(pairs, key->num_conf, sizeof(char*) * 2, compare_conf_pairs);
+  int offset = snprintf(result, length, "%c%s\037%u\037%c%s\037%c%s",
+      key->host != NULL ? 'h' : 'l', key->host != NULL ? key->host : "",
+      (unsigned) key->port, key->user != NULL ? 'u' : 'n',
+      key->user != NULL ? key->user : "",
+      key->kerb_ticket_cache != NULL ? 'k' : 'n',
+      key->kerb_ticket_cache != NULL ? key->kerb_ticket_cache : "");
+  for (i = 0; i < key->num_conf; i++) {
+    offset += snprintf(result + offset, length - offset, "\037%s\036%s",
+        pairs[i * 2], pairs[i * 2 + 1]);
+  }
+  free(pairs);
+  return result;
+}
+
+static hdfsFS connect_fs(const ConnectionKey* key, int new_instance) {
+  struct hdfsBuilder* builder = hdfsNewBuilder();
+  if (builder == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  hdfsBuilderSetNameNode(builder, key->host);
+  if (key->host != NULL) {
+    hdfsBuilderSetNameNodePort(builder, key->port);
+  }
+  if (key->user != NULL) {
+    hdfsBuilderSetUserName(builder, key->user);
+  }
+  if (key->kerb_ticket_cache != NULL) {
+    hdfsBuilderSetKerbTicketCachePath(builder, key->kerb_ticket_cache);
+  }
+  int i;
+  for (i = 0; i < key->num_conf; i++) {
+    hdfsBuilderConfSetStr(builder, key->conf[i * 2], key->conf[i * 2 + 1]);
+  }
+  if (new_instance) {
+    hdfsBuilderSetForceNewInstance(builder);
+  }
+  // Frees the builder whether or not this succeeds.
+  return hdfsBuilderConnect(builder);
+}
+
+/* Returns an idle or shared handle for key, or NULL.  Requires the lock. */
+static PooledConnection* find_connection(const char* key) {
+  PooledConnection* connection;
+  for (connection = pool; connection != NULL; connection = connection->next) {
+    if (connection->shared && strcmp(connection->key, key) == 0) {
+      return connection;
+    }
+  }
+  return NULL;
+}
+
+hdfsFS connection_pool_acquire(const ConnectionKey* key, int new_instance) {
+  char* canonical = canonical_key(key);
+  PooledConnection* entry = malloc(sizeof(PooledConnection));
+  if (canonical == NULL || entry == NULL) {
+    free(canonical);
+    free(entry);
+    errno = ENOMEM;
+    return NULL;
+  }
+  if (!new_instance) {
+    pthread_mutex_lock(&pool_lock);
+    PooledConnection* connection = find_connection(canonical);
+    if (connection != NULL) {
+      connection->references++;
+      pool_hits++;
+      pthread_mutex_unlock(&pool_lock);
+      free(canonical);
+      free(entry);
+      return connection->fs;
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+  // Connects without the lock, so that a slow NameNode does not hold up
+  // connections to others.
+  hdfsFS fs = connect_fs(key, new_instance);
+  if (fs == NULL) {
+    int error = errno;
+    free(canonical);
+    free(entry);
+    errno = error;
+    return NULL;
+  }
+  pthread_mutex_lock(&pool_lock);
+  pool_misses++;
+  PooledConnection* connection = new_instance ? NULL :
+      find_connection(canonical);
+  if (connection != NULL) {
+    // Another thread connected with the same key first, so shares its handle.
+    connection->references++;
+    pthread_mutex_unlock(&pool_lock);
+    hdfsDisconnect(fs);
+    free(canonical);
+    free(entry);
+    return connection->fs;
+  }
+  entry->key = canonical;
+  entry->fs = fs;
+  entry->references = 1;
+  entry->shared = !new_instance;
+  entry->next = pool;
+  pool = entry;
+  pthread_mutex_unlock(&pool_lock);
+  return fs;
+}
+
+void connection_pool_retain(hdfsFS fs) {
+  pthread_mutex_lock(&pool_lock);
+  PooledConnection* connection;
+  for (connection = pool; connection != NULL; connection = connection->next) {
+    if (connection->fs == fs) {
+      connection->references++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+int connection_pool_release(hdfsFS fs) {
+  pthread_mutex_lock(&pool_lock);
+  PooledConnection** link = &pool;
+  while (*link != NULL && (*link)->fs != fs) {
+    link = &(*link)->next;
+  }
+  PooledConnection* connection = *link;
+  if (connection == NULL || --connection->references > 0 ||
+      connection->shared) {
+    pthread_mutex_unlock(&pool_lock);
+    return 0;
+  }
+  // Unshared handles are disconnected as soon as they are released.
+  *link = connection->next;
+  pthread_mutex_unlock(&pool_lock);
+  free(connection->key);
+  free(connection);
+  return hdfsDisconnect(fs);
+}
+
+int connection_pool_close_idle(void) {
+  PooledConnection* idle = NULL;
+  pthread_mutex_lock(&pool_lock);
+  PooledConnection** link = &pool;
+  while (*link != NULL) {
+    PooledConnection* connection = *link;
+    if (connection->references == 0) {
+      *link = connection->next;
+      connection->next = idle;
+      idle = connection;
+    } else {
+      link = &connection->next;
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+  int closed = 0;
+  while (idle != NULL) {
+    PooledConnection* next = idle->next;
+    hdfsDisconnect(idle->fs);
+    free(idle->key);
+    free(idle);
+    idle = next;
+    closed++;
+  }
+  return closed;
+}
+
+void connection_pool_stats(ConnectionPoolStats* stats) {
+  memset(stats, 0, sizeof(ConnectionPoolStats));
+  pthread_mutex_lock(&pool_lock);
+  stats->hits = pool_hits;
+  stats->misses = pool_misses;
+  PooledConnection* connection;
+  for (connection = pool; connection != NULL; connection = connection->next) {
+    stats->connections++;
+    stats->active += connection->references > 0;
+    stats->references += connection->references;
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,63 @@
+#ifndef HDFS_CONNECTION_POOL_H
+#define HDFS_CONNECTION_POOL_H
+
+#include "hdfs.h"
+
+
+/*
+ * A process-wide pool of hdfsFS handles shared between HDFS::FileSystem
+ * objects connecting with the same parameters.  Handles are reference
+ * counted, each HDFS::File holding a use of the handle it was opened through
+ * as well, so that closing a FileSystem never disconnects a handle its files
+ * still read from; once nothing uses one it stays open, idle, for the next
+ * object to connect with the same parameters.  All functions are thread-safe
+ * and may block connecting, so should be called without the GVL.
+ */
+
+/* The parameters identifying a connection. */
+typedef struct ConnectionKey {
+  const char* host;    /* the NameNode, or NULL for the local file system */
+  tPort port;
+  const char* user;    /* the user to connect as, or NULL */
+  const char* kerb_ticket_cache;  /* Kerberos ticket cache path, or NULL */
+  const char** conf;   /* num_conf configuration keys and values, in pairs */
+  int num_conf;
+} ConnectionKey;
+
+typedef struct ConnectionPoolStats {
+  unsigned long hits;  /* connections satisfied from the pool */
+  unsigned long misses;  /* connections that had to connect */
+  long connections;    /* handles held by the pool */
+  long active;         /* handles held which are in use */
+  long references;     /* uses of all handles held */
+} ConnectionPoolStats;
+
+/*
+ * Returns a handle connected with the supplied parameters, sharing one from
+ * the pool if possible.  If new_instance is non-zero, instead connects a new
+ * instance of the file system which is never shared and is disconnected when
+ * released.  Returns NULL and sets errno if connecting fails.
+ */
+hdfsFS connection_pool_acquire(const ConnectionKey* key, int new_instance);
+
+/*
+ * Takes another use of a handle returned by connection_pool_acquire, which
+ * must be given up with connection_pool_release.  Never blocks.
+ */
+void connection_pool_retain(hdfsFS fs);
+
+/*
+ * Gives up a use of a handle returned by connection_pool_acquire.  Returns 0,
+ * or -1 with errno set if disconnecting an unshared handle fails.
+ */
+int connection_pool_release(hdfsFS fs);
+
+/*
+ * Disconnects every pooled handle not in use, returning how many were
+ * closed.
+ */
+int connection_pool_close_idle(void);
+
+void connection_pool_stats(ConnectionPoolStats* stats);
+
+#endif /* HDFS_CONNECTION_POOL_H */
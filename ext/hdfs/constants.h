@@ -6,13 +6,29 @@
 #include <ctype.h>
 
 
+static const int HDFS_DEFAULT_ASYNC_QUEUE      = 8;
 static const tSize HDFS_DEFAULT_BUFFER_SIZE    = 131072;
+static const long HDFS_DEFAULT_CACHE_SIZE      = 10000;
+static const double HDFS_DEFAULT_CACHE_TTL     = 5.0;
 static const char* HDFS_DEFAULT_HOST           = "0.0.0.0";
+static const int HDFS_DEFAULT_IO_THREADS       = 16;
 static const short HDFS_DEFAULT_MODE           = 0644;
 static const int HDFS_DEFAULT_PORT             = 8020;
+static const long HDFS_DEFAULT_PREAD_GAP       = 65536;
+static const int HDFS_DEFAULT_READAHEAD        = 4;
+static const long HDFS_DEFAULT_READAHEAD_SIZE  = 1048576;
+static const tSize HDFS_DEFAULT_READ_CHUNK     = 4194304;
+static const int HDFS_DEFAULT_READ_THREADS     = 4;
 static const int HDFS_DEFAULT_RECURSIVE_DELETE = 0;
 static const int16_t HDFS_DEFAULT_REPLICATION  = 3;
+static const int HDFS_DEFAULT_RETRIES         = 3;
+static const double HDFS_DEFAULT_RETRY_BACKOFF = 0.1;
 static const int HDFS_DEFAULT_STRING_LENGTH    = 1024;
+static const int HDFS_DEFAULT_TRANSFER_THREADS = 8;
 static const char* HDFS_DEFAULT_USER           = "hdfs";
+static const int HDFS_DEFAULT_WALK_THREADS     = 8;
+static const long HDFS_DEFAULT_WRITE_BUFFER    = 65536;
+static const long HDFS_MAX_IDLE_PIPES         = 16;
+static const tSize HDFS_MAX_IO_CHUNK_SIZE      = 1048576;
 
 #endif /* HDFS_CONSTANTS_H */
@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "content_summary.h"
+
+
+typedef struct SummaryEntry {
+  char* path;
+  size_t length;
+  ContentSummary summary;
+} SummaryEntry;
+
+struct SummaryTable {
+  int max_depth;
+  int root_slashes;          /* slashes in the root, less any trailing one */
+  SummaryEntry* entries;     /* the root first, then in order of creation */
+  long num_entries;
+  long capacity;
+  long* slots;               /* open-addressed indices of entries, or -1 */
+  long num_slots;
+};
+
+
+static uint64_t hash_path(const char* path, size_t length) {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char) path[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int count_slashes(const char* path, size_t length) {
+  int slashes = 0;
+  size_t i;
+  for (i = 0; i < length; i++) {
+    slashes += path[i] == '/';
+  }
+  return slashes;
+}
+
+/* Adds an empty entry for path, returning its index or -1 with errno set. */
+static long append_entry(SummaryTable* table, const char* path,
+    size_t length) {
+  if (table->num_entries == table->capacity) {
+    long capacity = table->capacity * 2;
+    SummaryEntry* entries = realloc(table->entries,
+        sizeof(SummaryEntry) * capacity);
+    if (entries == NULL) {
+      return -1;
+    }
+    table->entries = entries;
+    table->capacity = capacity;
+  }
+  SummaryEntry* entry = table->entries + table->num_entries;
+  entry->path = malloc(length + 1);
+  if (entry->path == NULL) {
+    return -1;
+  }
+  memcpy(entry->path, path, length);
+  entry->path[length] = '\0';
+  entry->length = length;
+  memset(&entry->summary, 0, sizeof(ContentSummary));
+  return table->num_entries++;
+}
+
+/* Doubles the slots once they are half full, rehashing every entry. */
+static int grow_slots(SummaryTable* table) {
+  long num_slots = table->num_slots * 2;
+  long* slots = malloc(sizeof(long) * num_slots);
+  if (slots == NULL) {
+    return -1;
+  }
+  memset(slots, 0xff, sizeof(long) * num_slots);
+  long i;
+  for (i = 1; i < table->num_entries; i++) {
+    SummaryEntry* entry = table->entries + i;
+    long slot = hash_path(entry->path, entry->length) & (num_slots - 1);
+    while (slots[slot] != -1) {
+      slot = (slot + 1) & (num_slots - 1);
+    }
+    slots[slot] = i;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->num_slots = num_slots;
+  return 0;
+}
+
+/*
+ * Returns the summary of the directory at path, creating it if need be, or
+ * NULL if memory runs out.
+ */
+static ContentSummary* find_summary(SummaryTable* table, const char* path,
+    size_t length) {
+  long slot = hash_path(path, length) & (table->num_slots - 1);
+  while (table->slots[slot] != -1) {
+    SummaryEntry* entry = table->entries + table->slots[slot];
+    if (entry->length == length && memcmp(entry->path, path, length) == 0) {
+      return &entry->summary;
+    }
+    slot = (slot + 1) & (table->num_slots - 1);
+  }
+  long index = append_entry(table, path, length);
+  if (index == -1) {
+    return NULL;
+  }
+  table->slots[slot] = index;
+  if (table->num_entries * 2 > table->num_slots && grow_slots(table) != 0) {
+    return NULL;
+  }
+  return &table->entries[index].summary;
+}
+
+SummaryTable* summary_table_new(const char* root, int max_depth) {
+  SummaryTable* table = calloc(1, sizeof(SummaryTable));
+  if (table == NULL) {
+    return NULL;
+  }
+  size_t length = strlen(root);
+  table->max_depth = max_depth;
+  table->root_slashes = count_slashes(root, length) -
+      (length > 0 && root[length - 1] == '/');
+  table->capacity = 16;
+  table->num_slots = 64;
+  table->entries = malloc(sizeof(SummaryEntry) * table->capacity);
+  table->slots = malloc(sizeof(long) * table->num_slots);
+  if (table->entries == NULL || table->slots == NULL ||
+      append_entry(table, root, length) == -1) {
+    summary_table_free(table);
+    return NULL;
+  }
+  memset(table->slots, 0xff, sizeof(long) * table->num_slots);
+  table->entries[0].summary.directories = 1;
+  return table;
+}
+
+static void add_summary(ContentSummary* to, ContentSummary* from) {
+  to->files += from->files;
+  to->directories += from->directories;
+  to->bytes += from->bytes;
+  to->replicated_bytes += from->replicated_bytes;
+}
+
+int summary_table_add(SummaryTable* table, hdfsFileInfo* infos,
+    int num_entries) {
+  if (num_entries == 0) {
+    return 0;
+  }
+  // Every entry shares a parent, so totals the listing first and then adds
+  // it to each summarized ancestor once.
+  ContentSummary total;
+  memset(&total, 0, sizeof(ContentSummary));
+  int i;
+  for (i = 0; i < num_entries; i++) {
+    hdfsFileInfo* info = infos + i;
+    if (info->mKind == kObjectKindDirectory) {
+      total.directories++;
+    } else {
+      total.files++;
+      total.bytes += info->mSize;
+      total.replicated_bytes += info->mSize * info->mReplication;
+    }
+  }
+  const char* parent = infos[0].mName;
+  const char* last_slash = strrchr(parent, '/');
+  size_t parent_length = last_slash != NULL ? last_slash - parent : 0;
+  int parent_depth = count_slashes(parent, parent_length) -
+      table->root_slashes;
+  add_summary(&table->entries[0].summary, &total);
+  // Adds the totals to the ancestors summarized beneath the root, the
+  // ancestor at depth j ending before the slash that starts depth j + 1.
+  int depth = 0;
+  int slashes = 0;
+  size_t position;
+  for (position = 0; position <= parent_length; position++) {
+    if (position < parent_length && parent[position] != '/') {
+      continue;
+    }
+    if (position < parent_length && ++slashes <= table->root_slashes + 1) {
+      continue;
+    }
+    if (++depth > table->max_depth || depth > parent_depth) {
+      break;
+    }
+    ContentSummary* summary = find_summary(table, parent, position);
+    if (summary == NULL) {
+      return ENOMEM;
+    }
+    add_summary(summary, &total);
+  }
+  // Summarizes the directories listed if they are shallow enough, each
+  // counting itself.
+  if (parent_depth + 1 <= table->max_depth) {
+    for (i = 0; i < num_entries; i++) {
+      if (infos[i].mKind == kObjectKindDirectory) {
+        ContentSummary* summary = find_summary(table, infos[i].mName,
+            strlen(infos[i].mName));
+        if (summary == NULL) {
+          return ENOMEM;
+        }
+        summary->directories++;
+      }
+    }
+  }
+  return 0;
+}
+
+static int compare_entries(const void* a, const void* b) {
+  return strcmp(((const SummaryEntry*) a)->path,
+      ((const SummaryEntry*) b)->path);
+}
+
+void summary_table_sort(SummaryTable* table) {
+  qsort(table->entries + 1, table->num_entries - 1, sizeof(SummaryEntry),
+      compare_entries);
+  // The slots no longer match, and nothing more is added once sorted.
+  memset(table->slots, 0xff, sizeof(long) * table->num_slots);
+}
+
+long summary_table_size(SummaryTable* table) {
+  return table->num_entries;
+}
+
+const char* summary_table_entry(SummaryTable* table, long index,
+    ContentSummary** summary) {
+  *summary = &table->entries[index].summary;
+  return table->entries[index].path;
+}
+
+void summary_table_free(SummaryTable* table) {
+  long i;
+  for (i = 0; i < table->num_entries; i++) {
+    free(table->entries[i].path);
+  }
+  free(table->entries);
+  free(table->slots);
+  free(table);
+}
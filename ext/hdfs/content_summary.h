@@ -0,0 +1,48 @@
+#ifndef HDFS_CONTENT_SUMMARY_H
+#define HDFS_CONTENT_SUMMARY_H
+
+#include "hdfs.h"
+
+
+/*
+ * Sums the listings of a tree as a walk produces them into a summary of the
+ * root and of each directory up to some depth beneath it, so that the usage
+ * of a namespace can be totted up without creating an object per entry.
+ * None of the functions calls into Ruby, so all can run without the GVL,
+ * but a table must only be used by one thread at a time.
+ */
+typedef struct ContentSummary {
+  long files;
+  long directories;          /* counting the summarized directory itself */
+  tOffset bytes;             /* the logical size of the files */
+  tOffset replicated_bytes;  /* the size of the files times their replication */
+} ContentSummary;
+
+typedef struct SummaryTable SummaryTable;
+
+/*
+ * Starts summing the tree beneath the directory root, named as libhdfs names
+ * it, keeping summaries of directories up to max_depth levels beneath it.
+ * Returns NULL if memory runs out.
+ */
+SummaryTable* summary_table_new(const char* root, int max_depth);
+
+/*
+ * Adds the entries of one listed directory, all of which must share a parent.
+ * Returns 0, or ENOMEM if memory runs out.
+ */
+int summary_table_add(SummaryTable* table, hdfsFileInfo* infos,
+    int num_entries);
+
+/* Sorts the summaries by path, the root first. */
+void summary_table_sort(SummaryTable* table);
+
+long summary_table_size(SummaryTable* table);
+
+/* Returns the path of the summary at index, setting *summary to it. */
+const char* summary_table_entry(SummaryTable* table, long index,
+    ContentSummary** summary);
+
+void summary_table_free(SummaryTable* table);
+
+#endif /* HDFS_CONTENT_SUMMARY_H */
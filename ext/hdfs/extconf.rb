@@ -62,4 +62,26 @@ dir_config 'hdfs'
 end
 
 have_library    'c', 'main'
+have_library    'pthread', 'pthread_create'
+have_header     'ruby/thread.h'
+have_func       'rb_thread_call_without_gvl2', 'ruby/thread.h'
+have_header     'ruby/fiber/scheduler.h'
+
+# Links whichever compression libraries are present for File codecs.
+[
+  [ 'z', 'inflate', 'zlib.h' ],
+  [ 'snappy', 'snappy_uncompress', 'snappy-c.h' ],
+  [ 'zstd', 'ZSTD_compressStream2', 'zstd.h' ]
+].each do |lib, func, header|
+  $defs << "-DHAVE_LIB#{lib.upcase}" if have_library lib, func, header
+end
 create_makefile '_hdfs'
+
+# Caches the CLASSPATH of Hadoop JARs so that requiring hdfs does not search
+# for them on every load.
+jvm_path = File.expand_path '../../lib/hdfs/jvm.rb', File.dirname(__FILE__)
+if File.exist? jvm_path
+  require jvm_path
+  puts 'caching CLASSPATH in ' + HDFS::JVM.cache_path
+  HDFS::JVM.write_classpath_cache
+end
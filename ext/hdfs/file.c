@@ -1,33 +1,196 @@
+#include <string.h>
+
 #include "hdfs.h"
 #include "ruby.h"
+#include "ruby/encoding.h"
+#include "ruby/io.h"
 
 #include "file.h"
 
+#include "async_writer.h"
+#include "block_cache.h"
+#include "codec.h"
+#include "connection_pool.h"
 #include "constants.h"
+#include "metrics.h"
+#include "readahead.h"
+#include "resilient_reader.h"
+#include "staging_cache.h"
 #include "utils.h"
 
 
 typedef struct FileData {
-  hdfsFS fs;
+  hdfsFS fs;           /* holds a use of the pooled handle if not NULL */
   hdfsFile file;
+  int busy;            /* count of calls currently running without the GVL */
+  Readahead* readahead;  /* reads ahead of the file if not NULL */
+  char* write_buffer;  /* coalesces small writes if not NULL */
+  long write_buffer_size;
+  long write_buffer_used;
+  VALUE write_lock;    /* Mutex serializing writes while buffering */
+  AsyncWriter* async_writer;  /* writes in the background if not NULL */
+  tOffset async_position;  /* offset of the end of the data submitted */
+  int async_error;     /* errno with which the writer stopped, or 0 */
+  char* read_buffer;   /* data read ahead of the position by gets and such */
+  long read_buffer_start;  /* offset of the first unconsumed byte */
+  long read_buffer_end;    /* offset after the last byte read */
+  Codec* codec;        /* decompresses reads or compresses writes if not NULL */
+  int codec_busy;      /* set while a call is using the codec */
+  tOffset codec_position;  /* uncompressed bytes read or written so far */
+  ResilientReader* resilient;  /* retries and hedges reads if not NULL */
+  StagedFile* staged;  /* serves reads from a staged copy if not NULL */
+  BlockCacheReader* block_cache;  /* reads through the block cache if set */
+  VALUE path;          /* the path opened, for metrics */
 } FileData;
 
+/* Arguments to and results of a libhdfs call made without the GVL. */
+typedef struct FileCall {
+  hdfsFS fs;
+  hdfsFile file;
+  Readahead* readahead;
+  AsyncWriter* async_writer;
+  Codec* codec;
+  ResilientReader* resilient;
+  StagedFile* staged;
+  BlockCacheReader* block_cache;
+  void* buffer;
+  tOffset position;
+  long length;
+  long result;
+  int error;
+  volatile int interrupted;
+} FileCall;
+
+/* A range requested from File#pread_batch. */
+typedef struct PreadRange {
+  tOffset position;
+  long length;
+  long group;          /* index of the coalesced read covering this range */
+} PreadRange;
+
+/* A single read covering one or more nearby requested ranges. */
+typedef struct PreadGroup {
+  tOffset position;
+  long length;
+  long offset;         /* offset of this read within the backing buffer */
+  long bytes_read;
+} PreadGroup;
+
+/* The coalesced reads issued by File#pread_batch without the GVL. */
+typedef struct PreadBatch {
+  FileCall call;       /* must come first; buffer is the backing buffer */
+  PreadGroup* groups;
+  long num_groups;
+  long next_group;
+} PreadBatch;
+
+/* Data compressed by a file's codec without the GVL. */
+typedef struct CompressCall {
+  FileCall call;       /* must come first; result is the bytes produced */
+  const char* input;
+  long input_length;
+  CodecMode mode;
+  const char* output;
+} CompressCall;
+
+/* A flush queued by File#hflush on a file writing in the background. */
+typedef struct FlushHandle {
+  VALUE file;
+  unsigned long ticket;
+} FlushHandle;
+
 static VALUE c_file;
+static VALUE c_file_flush;
 
 static VALUE e_file_closed_error;
 static VALUE e_file_error;
 
+/*
+ * The keys of the options taken and the Hashes returned by the methods of
+ * File, interned once by init_file rather than on every call.
+ */
+static VALUE sym_chomp;
+static VALUE sym_exception;
+static VALUE sym_gap;
+static VALUE sym_hedge_wins;
+static VALUE sym_hedges;
+static VALUE sym_reopens;
+static VALUE sym_retries;
+
+
+void mark_file_data(FileData* data) {
+  if (data) {
+    rb_gc_mark(data->write_lock);
+    rb_gc_mark(data->path);
+  }
+}
+
+void mark_flush_handle(FlushHandle* handle) {
+  if (handle) {
+    rb_gc_mark(handle->file);
+  }
+}
 
 void free_file_data(FileData* data) {
-  if (data && data->file != NULL) {
-    hdfsCloseFile(data->fs, data->file);
-    data->file = NULL;
+  if (data) {
+    if (data->staged != NULL) {
+      staged_file_close(data->staged);
+      data->staged = NULL;
+    }
+    if (data->resilient != NULL) {
+      data->file = resilient_reader_stop(data->resilient);
+      data->resilient = NULL;
+    }
+    if (data->readahead != NULL) {
+      readahead_stop(data->readahead);
+      data->readahead = NULL;
+    }
+    if (data->block_cache != NULL) {
+      block_cache_close(data->block_cache);
+      data->block_cache = NULL;
+    }
+    if (data->async_writer != NULL) {
+      // Hands any buffered data to the writer, then waits for it to finish.
+      if (data->write_buffer_used > 0) {
+        async_writer_submit(data->async_writer, data->write_buffer,
+            data->write_buffer_used);
+      } else {
+        async_writer_recycle_buffer(data->async_writer, data->write_buffer);
+      }
+      data->write_buffer = NULL;
+      async_writer_stop(data->async_writer);
+      data->async_writer = NULL;
+    }
+    if (data->write_buffer != NULL) {
+      // Makes a best effort to write out data that was never flushed.
+      if (data->file != NULL && data->write_buffer_used > 0) {
+        hdfsWrite(data->fs, data->file, data->write_buffer,
+            data->write_buffer_used);
+      }
+      xfree(data->write_buffer);
+      data->write_buffer = NULL;
+    }
+    xfree(data->read_buffer);
+    if (data->codec != NULL) {
+      // Anything compressed since the last flush is lost, as with an IO.
+      codec_stop(data->codec);
+      data->codec = NULL;
+    }
+    if (data->file != NULL) {
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+    }
+    if (data->fs != NULL) {
+      connection_pool_release(data->fs);
+      data->fs = NULL;
+    }
+    xfree(data);
   }
 }
 
 /* Ensures that a file is open; otherwise throws a FileError. */
 void ensure_file_open(FileData* data) {
-  if (data->file == NULL) {
+  if (data->file == NULL && data->staged == NULL) {
     rb_raise(e_file_closed_error, "File is closed");
   }
 }
@@ -35,22 +198,946 @@ void ensure_file_open(FileData* data) {
 FileData* get_FileData(VALUE rb_object) {
   FileData* data = NULL;
   Data_Get_Struct(rb_object, FileData, data);
-  if (data->file == NULL) {
-    rb_raise(e_file_closed_error, "File is closed");
-  }
+  ensure_file_open(data);
+  raise_deferred_exception();
   return data;
 }
 
-VALUE new_HDFS_File(VALUE path, hdfsFile* file, hdfsFS* fs) {
+VALUE new_HDFS_File(VALUE path, hdfsFile* file, hdfsFS* fs,
+    FileOptions* options) {
   FileData* data = ALLOC_N(FileData, 1);
   data->fs = *fs;
   data->file = *file;
-  VALUE file_instance = Data_Wrap_Struct(c_file, NULL, free_file_data,
-      data);
+  data->busy = 0;
+  data->readahead = NULL;
+  data->write_buffer = NULL;
+  data->write_buffer_size = 0;
+  data->write_buffer_used = 0;
+  data->write_lock = Qnil;
+  data->async_writer = NULL;
+  data->async_position = 0;
+  data->async_error = 0;
+  data->read_buffer = NULL;
+  data->read_buffer_start = 0;
+  data->read_buffer_end = 0;
+  data->codec = NULL;
+  data->codec_busy = 0;
+  data->codec_position = 0;
+  data->resilient = NULL;
+  data->staged = NULL;
+  data->block_cache = NULL;
+  data->path = path;
+  // Wraps the data first so that the GC sees anything allocated below.
+  VALUE file_instance = Data_Wrap_Struct(c_file, mark_file_data,
+      free_file_data, data);
+  // Keeps the handle connected for as long as the file may use it, even once
+  // the FileSystem it was opened through has been closed.
+  if (data->fs != NULL) {
+    connection_pool_retain(data->fs);
+  }
+  if (options->codec != kCodecNone) {
+    int compress = hdfsFileIsOpenForWrite(data->file);
+    data->codec = codec_start(options->codec, compress,
+        HDFS_DEFAULT_BUFFER_SIZE);
+    if (data->codec == NULL) {
+      int error = errno;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      raise_error(e_file_error, error, "Failed to start codec");
+    }
+    // Compressing runs without the GVL, so writes must take turns.
+    if (compress) {
+      data->write_lock = rb_mutex_new();
+    }
+  }
+  if (options->retries > 0 || options->hedge_after > 0) {
+    ResilientOptions resilient_options;
+    resilient_options.retries = options->retries;
+    resilient_options.backoff = options->retry_backoff;
+    resilient_options.hedge_after = options->hedge_after;
+    resilient_options.max_chunk = HDFS_MAX_IO_CHUNK_SIZE;
+    data->resilient = resilient_reader_start(data->fs, data->file,
+        StringValueCStr(path), &resilient_options);
+    if (data->resilient == NULL) {
+      int error = errno;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      raise_error(e_file_error, error, "Failed to start reader");
+    }
+  }
+  if (options->block_cache) {
+    data->block_cache = block_cache_open(data->fs, data->file,
+        StringValueCStr(path), options->mtime, options->size);
+    if (data->block_cache == NULL) {
+      int error = errno;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      raise_error(e_file_error, error, "Failed to start reader");
+    }
+  }
+  if (options->async_queue_length > 0) {
+    data->async_position = hdfsTell(data->fs, data->file);
+    data->async_writer = async_writer_start(data->fs, data->file,
+        options->async_queue_length, options->write_buffer_size,
+        options->hflush_bytes, options->hflush_interval);
+    if (data->async_writer == NULL) {
+      int error = errno;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      raise_error(e_file_error, error, "Failed to start writer");
+    }
+    // The writer frees buffers once written, so they come from it.
+    data->write_buffer = async_writer_take_buffer(data->async_writer);
+    data->write_buffer_size = options->write_buffer_size;
+    if (data->write_lock == Qnil) {
+      data->write_lock = rb_mutex_new();
+    }
+    if (data->write_buffer == NULL) {
+      async_writer_stop(data->async_writer);
+      data->async_writer = NULL;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      rb_raise(rb_eNoMemError, "Failed to allocate write buffer");
+    }
+  } else if (options->write_buffer_size > 0) {
+    data->write_buffer = ALLOC_N(char, options->write_buffer_size);
+    data->write_buffer_size = options->write_buffer_size;
+    if (data->write_lock == Qnil) {
+      data->write_lock = rb_mutex_new();
+    }
+  }
+  if (options->readahead_chunks > 0) {
+    data->readahead = readahead_start(data->fs, data->file, 0,
+        options->readahead_chunks, options->readahead_chunk_size);
+    if (data->readahead == NULL) {
+      int error = errno;
+      hdfsCloseFile(data->fs, data->file);
+      data->file = NULL;
+      raise_error(e_file_error, error, "Failed to start readahead");
+    }
+  }
   rb_iv_set(file_instance, "@path", path);
   return file_instance;
 }
 
+VALUE new_staged_HDFS_File(VALUE path, StagedFile* staged) {
+  hdfsFS fs = NULL;
+  hdfsFile file = NULL;
+  FileOptions options;
+  memset(&options, 0, sizeof(options));
+  options.codec = kCodecNone;
+  VALUE file_instance = new_HDFS_File(path, &file, &fs, &options);
+  FileData* data = NULL;
+  Data_Get_Struct(file_instance, FileData, data);
+  data->staged = staged;
+  return file_instance;
+}
+
+static void* call_async_writer_flush(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  unsigned long ticket = 0;
+  call->error = async_writer_flush(call->async_writer, call->length != 0,
+      &ticket);
+  call->result = call->error == 0 ? (long) ticket : -1;
+  return NULL;
+}
+
+static void* call_async_writer_stop(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->error = async_writer_stop(call->async_writer);
+  call->result = call->error == 0 ? 0 : -1;
+  return NULL;
+}
+
+static void* call_async_writer_submit(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->error = async_writer_submit(call->async_writer, call->buffer,
+      call->length);
+  call->result = call->error == 0 ? call->length : -1;
+  return NULL;
+}
+
+/* Waits for the flush whose ticket is in position, or an interrupt. */
+static void* call_async_writer_wait(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->result = async_writer_wait(call->async_writer,
+      (unsigned long) call->position, &call->interrupted, &call->error);
+  return NULL;
+}
+
+/*
+ * Decompresses into buffer until length bytes have been produced, the end of
+ * the file is reached, or the call is interrupted, reading compressed data
+ * through the readahead if there is one.  Treats a file which ends midway
+ * through a stream as corrupt.
+ */
+static void* call_codec_read(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  char* buffer = (char*) call->buffer;
+  long total = 0;
+  while (total < call->length && !call->interrupted) {
+    long produced = codec_decompress(call->codec, buffer + total,
+        call->length - total);
+    if (produced == -1) {
+      call->result = -1;
+      call->error = errno;
+      return NULL;
+    }
+    total += produced;
+    if (produced > 0) {
+      continue;
+    }
+    long space;
+    char* input = codec_input_space(call->codec, &space);
+    tSize chunk = space > HDFS_MAX_IO_CHUNK_SIZE ? HDFS_MAX_IO_CHUNK_SIZE :
+        (tSize) space;
+    long bytes_read;
+    if (call->readahead != NULL) {
+      bytes_read = readahead_read(call->readahead, input, chunk,
+          &call->interrupted, &call->error);
+    } else if (call->resilient != NULL) {
+      bytes_read = resilient_reader_read(call->resilient, -1, input, chunk,
+          &call->interrupted, &call->error);
+    } else {
+      bytes_read = hdfsRead(call->fs, call->file, input, chunk);
+      call->error = errno;
+    }
+    if (bytes_read == -1) {
+      call->result = -1;
+      return NULL;
+    }
+    if (bytes_read == 0) {
+      if (!call->interrupted && !codec_at_boundary(call->codec)) {
+        call->result = -1;
+        call->error = EBADMSG;
+        return NULL;
+      }
+      break;
+    }
+    codec_input_added(call->codec, bytes_read);
+  }
+  call->result = total;
+  return NULL;
+}
+
+static void* call_codec_compress(void* ptr) {
+  CompressCall* compress = (CompressCall*) ptr;
+  compress->call.result = codec_compress(compress->call.codec,
+      &compress->input, &compress->input_length, compress->mode,
+      &compress->output);
+  compress->call.error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_close(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  if (call->readahead != NULL) {
+    readahead_stop(call->readahead);
+  }
+  if (call->resilient != NULL) {
+    // Closes whichever stream the reader last reopened.
+    call->file = resilient_reader_stop(call->resilient);
+  }
+  call->result = hdfsCloseFile(call->fs, call->file);
+  call->error = errno;
+  // Gives up the file's use of the handle, which may disconnect it.
+  connection_pool_release(call->fs);
+  return NULL;
+}
+
+static void* call_hdfs_flush(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->result = hdfsFlush(call->fs, call->file);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_hflush(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->result = hdfsHFlush(call->fs, call->file);
+  call->error = errno;
+  return NULL;
+}
+
+/*
+ * Reads until length bytes have been read, the end of the file is reached, or
+ * the call is interrupted.  Reads positionally unless position is -1, and in
+ * chunks of at most HDFS_MAX_IO_CHUNK_SIZE so that the JVM never allocates
+ * a buffer the size of the whole read.
+ */
+static void* call_hdfs_read_fully(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  char* buffer = (char*) call->buffer;
+  if (call->staged != NULL) {
+    call->result = staged_file_read(call->staged, call->position, buffer,
+        call->length);
+    return NULL;
+  }
+  if (call->block_cache != NULL) {
+    call->result = block_cache_read(call->block_cache, call->position,
+        buffer, call->length, &call->interrupted, &call->error);
+    return NULL;
+  }
+  if (call->resilient != NULL) {
+    call->result = resilient_reader_read(call->resilient, call->position,
+        buffer, call->length, &call->interrupted, &call->error);
+    return NULL;
+  }
+  long total = 0;
+  do {
+    long remaining = call->length - total;
+    tSize chunk = remaining > HDFS_MAX_IO_CHUNK_SIZE ?
+        HDFS_MAX_IO_CHUNK_SIZE : (tSize) remaining;
+    tSize bytes_read = call->position == -1 ?
+        hdfsRead(call->fs, call->file, buffer + total, chunk) :
+        hdfsPread(call->fs, call->file, call->position + total,
+            buffer + total, chunk);
+    if (bytes_read == -1) {
+      call->result = -1;
+      call->error = errno;
+      return NULL;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    total += bytes_read;
+  } while (total < call->length && !call->interrupted);
+  call->result = total;
+  return NULL;
+}
+
+/*
+ * Issues the coalesced reads of a PreadBatch in order, starting at next_group
+ * and checking for interrupts between reads.
+ */
+static void* call_hdfs_pread_batch(void* ptr) {
+  PreadBatch* batch = (PreadBatch*) ptr;
+  FileCall group_call;
+  group_call.fs = batch->call.fs;
+  group_call.file = batch->call.file;
+  group_call.resilient = batch->call.resilient;
+  group_call.staged = batch->call.staged;
+  group_call.block_cache = batch->call.block_cache;
+  group_call.interrupted = 0;
+  batch->call.result = 0;
+  while (batch->next_group < batch->num_groups && !batch->call.interrupted) {
+    PreadGroup* group = batch->groups + batch->next_group;
+    group_call.buffer = (char*) batch->call.buffer + group->offset;
+    group_call.position = group->position;
+    group_call.length = group->length;
+    call_hdfs_read_fully(&group_call);
+    if (group_call.result == -1) {
+      batch->call.result = -1;
+      batch->call.error = group_call.error;
+      return NULL;
+    }
+    group->bytes_read = group_call.result;
+    batch->next_group++;
+  }
+  return NULL;
+}
+
+static int compare_pread_ranges(const void* a, const void* b) {
+  tOffset left = (*(PreadRange* const*) a)->position;
+  tOffset right = (*(PreadRange* const*) b)->position;
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+static void* call_readahead_read(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->result = readahead_read(call->readahead, call->buffer, call->length,
+      &call->interrupted, &call->error);
+  return NULL;
+}
+
+static void* call_hdfs_seek(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  call->result = hdfsSeek(call->fs, call->file, call->position);
+  call->error = errno;
+  return NULL;
+}
+
+/*
+ * Writes length bytes in chunks of at most HDFS_MAX_IO_CHUNK_SIZE, so that the
+ * JVM never allocates a buffer the size of the whole write.
+ */
+static void* call_hdfs_write(void* ptr) {
+  FileCall* call = (FileCall*) ptr;
+  const char* buffer = (const char*) call->buffer;
+  long total = 0;
+  while (total < call->length) {
+    long remaining = call->length - total;
+    tSize chunk = remaining > HDFS_MAX_IO_CHUNK_SIZE ?
+        HDFS_MAX_IO_CHUNK_SIZE : (tSize) remaining;
+    tSize bytes_written = hdfsWrite(call->fs, call->file, buffer + total,
+        chunk);
+    if (bytes_written == -1) {
+      call->result = -1;
+      call->error = errno;
+      return NULL;
+    }
+    total += bytes_written;
+  }
+  call->result = total;
+  return NULL;
+}
+
+/*
+ * Runs the supplied libhdfs call against this file with the GVL released,
+ * marking the file as busy so that it cannot be closed underneath the call.
+ */
+static void run_file_call(FileData* data, void* (*func)(void*),
+    FileCall* call) {
+  call->fs = data->fs;
+  call->file = data->file;
+  call->readahead = data->readahead;
+  call->async_writer = data->async_writer;
+  call->codec = data->codec;
+  call->resilient = data->resilient;
+  call->staged = data->staged;
+  call->block_cache = data->block_cache;
+  call->interrupted = 0;
+  data->busy++;
+  if (data->staged != NULL) {
+    // Reads of a staged file only copy from its mapping, which is quicker
+    // than releasing the GVL.
+    func(call);
+  } else if (data->readahead != NULL) {
+    // Reads may sleep waiting on the readahead thread, so must be woken.
+    call_without_gvl_wakeable(func, call, &call->interrupted, readahead_wake,
+        data->readahead);
+  } else if (data->async_writer != NULL) {
+    // Likewise for waits on the writer thread.
+    call_without_gvl_wakeable(func, call, &call->interrupted,
+        async_writer_wake, data->async_writer);
+  } else if (data->block_cache != NULL) {
+    // And for waits on another thread reading a page.
+    call_without_gvl_wakeable(func, call, &call->interrupted,
+        block_cache_wake, NULL);
+  } else if (data->resilient != NULL) {
+    // And for waits to retry a read or on a hedged read.
+    call_without_gvl_wakeable(func, call, &call->interrupted,
+        resilient_reader_wake, data->resilient);
+    // Follows the stream, which may have been reopened.
+    data->file = resilient_reader_file(data->resilient);
+  } else {
+    call_without_gvl(func, call, &call->interrupted);
+  }
+  data->busy--;
+}
+
+/*
+ * Like run_file_call, but if the file has a codec, fails the call with EBUSY
+ * rather than letting two threads use the codec at once.
+ */
+static void run_codec_call(FileData* data, void* (*func)(void*),
+    FileCall* call) {
+  if (data->codec == NULL) {
+    run_file_call(data, func, call);
+    return;
+  }
+  if (data->codec_busy) {
+    call->result = -1;
+    call->error = EBUSY;
+    return;
+  }
+  data->codec_busy = 1;
+  run_file_call(data, func, call);
+  data->codec_busy = 0;
+}
+
+/* Serializes writes against one another while the file buffers writes. */
+static void lock_writes(FileData* data) {
+  if (data->write_lock != Qnil) {
+    rb_mutex_lock(data->write_lock);
+  }
+}
+
+static void unlock_writes(FileData* data) {
+  if (data->write_lock != Qnil) {
+    rb_mutex_unlock(data->write_lock);
+  }
+}
+
+/*
+ * Hands length bytes of buffer, which the writer takes ownership of, to the
+ * writer thread, waiting without the GVL while its queue is full.  Returns 0
+ * if successful; otherwise returns the errno of an earlier failed write.
+ */
+static int submit_async_write(FileData* data, char* buffer, long length) {
+  FileCall call;
+  call.buffer = buffer;
+  call.length = length;
+  run_file_call(data, call_async_writer_submit, &call);
+  if (call.result == -1) {
+    return call.error;
+  }
+  data->async_position += length;
+  return 0;
+}
+
+/*
+ * Writes out any buffered data with a single hdfsWrite, or hands it to the
+ * writer thread if writing in the background.  Must be called with the write
+ * lock held.  Returns 0 if successful; otherwise returns errno, keeping the
+ * data buffered if it was not handed off.
+ */
+static int drain_write_buffer(FileData* data) {
+  if (data->write_buffer == NULL || data->write_buffer_used == 0) {
+    return 0;
+  }
+  if (data->async_writer != NULL) {
+    char* next_buffer = async_writer_take_buffer(data->async_writer);
+    if (next_buffer == NULL) {
+      return ENOMEM;
+    }
+    char* buffer = data->write_buffer;
+    long length = data->write_buffer_used;
+    data->write_buffer = next_buffer;
+    data->write_buffer_used = 0;
+    return submit_async_write(data, buffer, length);
+  }
+  FileCall call;
+  call.buffer = data->write_buffer;
+  call.length = data->write_buffer_used;
+  run_file_call(data, call_hdfs_write, &call);
+  if (call.result == -1) {
+    return call.error == 0 ? EIO : call.error;
+  }
+  data->write_buffer_used = 0;
+  return 0;
+}
+
+/*
+ * Writes num_bytes of bytes through the write buffer if there is room,
+ * draining the buffer first if there is not, or else hands them to the
+ * writer thread or writes them straight to HDFS.  Must be called with the
+ * write lock held.  Returns 0 if successful; otherwise returns errno.
+ */
+static int write_bytes(FileData* data, const char* bytes, long num_bytes) {
+  int error = 0;
+  if (data->write_buffer != NULL &&
+      data->write_buffer_used + num_bytes > data->write_buffer_size) {
+    error = drain_write_buffer(data);
+  }
+  if (error == 0 && data->write_buffer != NULL &&
+      num_bytes < data->write_buffer_size) {
+    memcpy(data->write_buffer + data->write_buffer_used, bytes, num_bytes);
+    data->write_buffer_used += num_bytes;
+  } else if (error == 0 && data->async_writer != NULL) {
+    // Copies the data, since the writer thread outlives this call.
+    char* copy = malloc(num_bytes);
+    if (copy == NULL) {
+      error = ENOMEM;
+    } else {
+      memcpy(copy, bytes, num_bytes);
+      error = submit_async_write(data, copy, num_bytes);
+    }
+  } else if (error == 0) {
+    FileCall call;
+    call.buffer = (void*) bytes;
+    call.length = num_bytes;
+    run_file_call(data, call_hdfs_write, &call);
+    if (call.result == -1) {
+      error = call.error;
+    }
+  }
+  return error;
+}
+
+/*
+ * Compresses num_bytes of bytes with the codec of the file without the GVL,
+ * writing out its output with write_bytes as each buffer of it fills, and
+ * with mode kCodecFlush or kCodecFinish then flushes or ends the stream.
+ * Must be called with the write lock held.  Returns 0 if successful;
+ * otherwise returns errno.
+ */
+static int write_compressed(FileData* data, const char* bytes,
+    long num_bytes, CodecMode mode) {
+  CompressCall compress;
+  compress.input = bytes;
+  compress.input_length = num_bytes;
+  compress.mode = mode;
+  for (;;) {
+    run_codec_call(data, call_codec_compress, &compress.call);
+    if (compress.call.result == -1) {
+      return compress.call.error;
+    }
+    if (compress.call.result > 0) {
+      int error = write_bytes(data, compress.output, compress.call.result);
+      if (error != 0) {
+        return error;
+      }
+    } else if (compress.input_length == 0) {
+      data->codec_position += num_bytes;
+      return 0;
+    }
+  }
+}
+
+/*
+ * Copies up to length bytes already read ahead by gets and such into buffer,
+ * returning how many it copied.
+ */
+static long take_buffered(FileData* data, char* buffer, long length) {
+  long buffered = data->read_buffer_end - data->read_buffer_start;
+  long taken = buffered < length ? buffered : length;
+  if (taken > 0) {
+    memcpy(buffer, data->read_buffer + data->read_buffer_start, taken);
+    data->read_buffer_start += taken;
+  }
+  return taken;
+}
+
+/* Drops anything read ahead by gets and such, as when seeking. */
+static void discard_buffered(FileData* data) {
+  data->read_buffer_start = 0;
+  data->read_buffer_end = 0;
+}
+
+/*
+ * Returns the call which reads from position, or sequentially if position is
+ * -1, through the codec or readahead of the file if it has one.
+ */
+static void* (*sequential_read_call(FileData* data, tOffset position))(void*) {
+  if (position != -1) {
+    return call_hdfs_read_fully;
+  }
+  return data->codec != NULL ? call_codec_read :
+      (data->readahead != NULL ? call_readahead_read : call_hdfs_read_fully);
+}
+
+/*
+ * Reads straight into the buffer of str until length bytes have been read or
+ * the end of the file is reached, from position if it is not -1 or else from
+ * the current offset.  Grows the capacity of str if needed but never shrinks
+ * it.  Returns the number of bytes read, raising a FileError if this fails.
+ */
+static long read_into_string(FileData* data, VALUE str, tOffset position,
+    long length) {
+  if (length < 0) {
+    rb_raise(rb_eArgError, "negative length %ld given", length);
+  }
+  if (position != -1 && data->codec != NULL) {
+    rb_raise(e_file_error, "Cannot read positionally from a compressed file");
+  }
+  rb_str_modify(str);
+  if (rb_str_capacity(str) < (size_t) length) {
+    rb_str_resize(str, length);
+  }
+  rb_str_set_len(str, 0);
+  Metric metric = position == -1 ? kMetricRead : kMetricPread;
+  uint64_t started = metrics_start();
+  long total = 0;
+  if (position == -1) {
+    // Hands out data already buffered by gets and such first.
+    total = take_buffered(data, RSTRING_PTR(str), length);
+    rb_str_set_len(str, total);
+    if (total == length) {
+      metrics_record(metric, started, total, 0, data->path);
+      return total;
+    }
+  }
+  FileCall call;
+  for (;;) {
+    call.buffer = RSTRING_PTR(str) + total;
+    call.position = position == -1 ? -1 : position + total;
+    call.length = length - total;
+    // Locks the string so that other threads cannot modify it mid-read.
+    rb_str_locktmp(str);
+    run_codec_call(data, sequential_read_call(data, position), &call);
+    rb_str_unlocktmp(str);
+    if (call.result == -1) {
+      metrics_record(metric, started, total, call.error, data->path);
+      raise_error(e_file_error, call.error, "Failed to read data");
+    }
+    if (data->codec != NULL) {
+      data->codec_position += call.result;
+    }
+    total += call.result;
+    rb_str_set_len(str, total);
+    // Waits on the readahead or codec may stop short when interrupted, so
+    // only a short read which was not interrupted marks the end of the file.
+    if (!call.interrupted || total == length) {
+      metrics_record(metric, started, total, 0, data->path);
+      raise_deferred_exception();
+      return total;
+    }
+    // Runs pending interrupts such as signal handlers, which may raise, then
+    // resumes the read where it stopped.
+    check_interrupts();
+  }
+}
+
+/*
+ * Refills the read buffer once it has been consumed, returning the number of
+ * bytes buffered, which is 0 only at the end of the file.  Raises a
+ * FileError if this fails.
+ */
+static long fill_read_buffer(FileData* data) {
+  long buffered = data->read_buffer_end - data->read_buffer_start;
+  if (buffered > 0) {
+    return buffered;
+  }
+  if (data->read_buffer == NULL) {
+    data->read_buffer = ALLOC_N(char, HDFS_DEFAULT_BUFFER_SIZE);
+  }
+  discard_buffered(data);
+  uint64_t started = metrics_start();
+  FileCall call;
+  for (;;) {
+    call.buffer = data->read_buffer + data->read_buffer_end;
+    call.position = -1;
+    call.length = HDFS_DEFAULT_BUFFER_SIZE - data->read_buffer_end;
+    run_codec_call(data, sequential_read_call(data, -1), &call);
+    if (call.result == -1) {
+      metrics_record(kMetricRead, started, data->read_buffer_end, call.error,
+          data->path);
+      raise_error(e_file_error, call.error, "Failed to read data");
+    }
+    if (data->codec != NULL) {
+      data->codec_position += call.result;
+    }
+    data->read_buffer_end += call.result;
+    if (!call.interrupted || data->read_buffer_end > 0) {
+      metrics_record(kMetricRead, started, data->read_buffer_end, 0,
+          data->path);
+      raise_deferred_exception();
+      return data->read_buffer_end;
+    }
+    // Runs pending interrupts, which may raise, then resumes the read.
+    check_interrupts();
+  }
+}
+
+/*
+ * Reads a line ending with separator, or the rest of the file if separator
+ * is nil, of at most limit bytes unless limit is negative.  Returns nil at
+ * the end of the file, but an empty String for a limit of 0, as IO does.
+ * Scans the read buffer with memchr for the last byte of the separator, so
+ * that each byte is copied only once, into the line.
+ */
+static VALUE read_line(FileData* data, VALUE separator, long limit,
+    int chomp) {
+  if (limit == 0) {
+    VALUE empty = rb_str_new(NULL, 0);
+    rb_enc_associate(empty, rb_default_external_encoding());
+    return empty;
+  }
+  const char* sep = NIL_P(separator) ? NULL : RSTRING_PTR(separator);
+  long sep_length = NIL_P(separator) ? 0 : RSTRING_LEN(separator);
+  VALUE line = Qnil;
+  long length = 0;
+  int found = 0;
+  while (!found && (limit < 0 || length < limit) &&
+      fill_read_buffer(data) > 0) {
+    const char* start = data->read_buffer + data->read_buffer_start;
+    long available = data->read_buffer_end - data->read_buffer_start;
+    if (limit >= 0 && available > limit - length) {
+      available = limit - length;
+    }
+    long taken = available;
+    if (sep != NULL) {
+      const char* match = start;
+      const char* end = start + available;
+      while ((match = memchr(match, sep[sep_length - 1], end - match)) !=
+          NULL) {
+        long candidate = match - start + 1;
+        // Checks the rest of a longer separator, which may have begun in the
+        // part of the line already copied.
+        if (sep_length == 1 || (length + candidate >= sep_length &&
+            (sep_length <= candidate ?
+                memcmp(match + 1 - sep_length, sep, sep_length) == 0 :
+                memcmp(RSTRING_PTR(line) + length + candidate - sep_length,
+                    sep, sep_length - candidate) == 0 &&
+                memcmp(start, sep + sep_length - candidate, candidate) ==
+                    0))) {
+          taken = candidate;
+          found = 1;
+          break;
+        }
+        match++;
+      }
+    }
+    if (NIL_P(line)) {
+      line = rb_str_buf_new(taken);
+    }
+    rb_str_buf_cat(line, start, taken);
+    data->read_buffer_start += taken;
+    length += taken;
+  }
+  if (NIL_P(line)) {
+    return Qnil;
+  }
+  if (chomp && found) {
+    long chomped = sep_length;
+    if (sep_length == 1 && sep[0] == '\n' && length >= 2 &&
+        RSTRING_PTR(line)[length - 2] == '\r') {
+      chomped = 2;
+    }
+    rb_str_set_len(line, length - chomped);
+  }
+  rb_enc_associate(line, rb_default_external_encoding());
+  return line;
+}
+
+/*
+ * Parses the arguments of gets and each_line: an optional separator, which
+ * defaults to $/, an optional limit, and the chomp keyword.
+ */
+static void parse_line_args(int argc, VALUE* argv, VALUE* separator,
+    long* limit, int* chomp) {
+  VALUE first, second, options;
+  int num_args = rb_scan_args(argc, argv, "02:", &first, &second, &options);
+  *separator = rb_rs;
+  *limit = -1;
+  if (num_args == 1) {
+    if (!NIL_P(first) && NIL_P(rb_check_string_type(first))) {
+      *limit = NUM2LONG(first);
+    } else {
+      *separator = first;
+    }
+  } else if (num_args == 2) {
+    *separator = first;
+    *limit = NIL_P(second) ? -1 : NUM2LONG(second);
+  }
+  if (!NIL_P(*separator)) {
+    StringValue(*separator);
+    if (RSTRING_LEN(*separator) == 0) {
+      rb_raise(rb_eArgError, "paragraph mode is not supported");
+    }
+  }
+  *chomp = !NIL_P(options) &&
+      RTEST(rb_hash_aref(options, sym_chomp));
+}
+
+/*
+ * Reads at most length bytes, reading from HDFS only if nothing is buffered,
+ * into buffer if it is not nil.  Returns nil at the end of the file.
+ */
+static VALUE read_partial(FileData* data, long length, VALUE buffer) {
+  if (length < 0) {
+    rb_raise(rb_eArgError, "negative length %ld given", length);
+  }
+  if (NIL_P(buffer)) {
+    buffer = rb_str_buf_new(length);
+  } else {
+    StringValue(buffer);
+    rb_str_modify(buffer);
+    rb_str_set_len(buffer, 0);
+  }
+  if (length == 0) {
+    return buffer;
+  }
+  long available = fill_read_buffer(data);
+  if (available == 0) {
+    return Qnil;
+  }
+  long taken = available < length ? available : length;
+  rb_str_cat(buffer, data->read_buffer + data->read_buffer_start, taken);
+  data->read_buffer_start += taken;
+  return buffer;
+}
+
+/*
+ * Hands any buffered data to the writer thread and stops it once everything
+ * has been written, recording and returning the errno of the first failure,
+ * or 0.  Must be called with the write lock held.
+ */
+static int stop_async_writer(FileData* data) {
+  int error = drain_write_buffer(data);
+  if (data->write_buffer != NULL) {
+    async_writer_recycle_buffer(data->async_writer, data->write_buffer);
+    data->write_buffer = NULL;
+  }
+  FileCall call;
+  call.async_writer = data->async_writer;
+  call.interrupted = 0;
+  data->async_writer = NULL;
+  call_without_gvl(call_async_writer_stop, &call, &call.interrupted);
+  data->async_error = error != 0 ? error : call.error;
+  return data->async_error;
+}
+
+/*
+ * Queues a flush, or an hflush if hflush is non-zero, behind everything
+ * written so far to a file writing in the background, returning its ticket.
+ * If an earlier write failed, raises a FileError.
+ */
+static unsigned long queue_async_flush(FileData* data, int hflush) {
+  lock_writes(data);
+  if (data->async_writer == NULL) {
+    // Another thread closed the file while this one waited for the lock.
+    unlock_writes(data);
+    ensure_file_open(data);
+  }
+  int error = data->codec != NULL ?
+      write_compressed(data, NULL, 0, kCodecFlush) : 0;
+  error = error != 0 ? error : drain_write_buffer(data);
+  FileCall call;
+  call.length = hflush;
+  if (error == 0) {
+    run_file_call(data, call_async_writer_flush, &call);
+    error = call.result == -1 ? call.error : 0;
+  }
+  unlock_writes(data);
+  if (error != 0) {
+    raise_error(e_file_error, error, "Failed to write data");
+  }
+  raise_deferred_exception();
+  return (unsigned long) call.result;
+}
+
+/*
+ * Waits until the flush with the supplied ticket has run, raising a FileError
+ * if it or anything before it failed.
+ */
+static void wait_async_flush(FileData* data, unsigned long ticket) {
+  FileCall call;
+  for (;;) {
+    if (data->file == NULL || data->async_writer == NULL) {
+      // Closing the file ran every flush, so only its result matters.
+      call.result = data->async_error != 0 ? -1 : 1;
+      call.error = data->async_error;
+    } else {
+      call.position = (tOffset) ticket;
+      run_file_call(data, call_async_writer_wait, &call);
+    }
+    if (call.result == -1) {
+      raise_error(e_file_error, call.error, "Failed to write data");
+    }
+    if (call.result == 1) {
+      raise_deferred_exception();
+      return;
+    }
+    // Runs pending interrupts such as signal handlers, which may raise, then
+    // resumes waiting.
+    check_interrupts();
+  }
+}
+
+/*
+ * Writes out any buffered data for the supplied file, raising a FileError if
+ * this fails.
+ */
+static void flush_write_buffer(VALUE self, FileData* data) {
+  if (data->write_buffer == NULL && data->codec == NULL) {
+    return;
+  }
+  lock_writes(data);
+  int error = data->file == NULL || data->codec == NULL ||
+      !hdfsFileIsOpenForWrite(data->file) ? 0 :
+      write_compressed(data, NULL, 0, kCodecFlush);
+  error = error != 0 || data->file == NULL ? error :
+      drain_write_buffer(data);
+  unlock_writes(data);
+  ensure_file_open(data);
+  if (error != 0) {
+    raise_error(e_file_error, error, "Failed to write data");
+  }
+  raise_deferred_exception();
+}
+
 /*
  * HDFS::File
  */
@@ -64,12 +1151,30 @@ VALUE new_HDFS_File(VALUE path, hdfsFile* file, hdfsFS* fs) {
  */
 VALUE HDFS_File_available(VALUE self) {
   FileData* data = get_FileData(self);
+  if (data->codec != NULL) {
+    // Only data already decompressed can be counted.
+    return LONG2NUM(data->read_buffer_end - data->read_buffer_start);
+  }
+  if (data->staged != NULL) {
+    return LONG2NUM(staged_file_size(data->staged) -
+        staged_file_tell(data->staged) + data->read_buffer_end -
+        data->read_buffer_start);
+  }
+  if (data->block_cache != NULL) {
+    return LONG2NUM(block_cache_size(data->block_cache) -
+        block_cache_tell(data->block_cache) + data->read_buffer_end -
+        data->read_buffer_start);
+  }
   int bytes_available = hdfsAvailable(data->fs, data->file);
   if (bytes_available == -1) {
-    rb_raise(e_file_error, "Failed to get available data: %s",
-        get_error(errno));
+    raise_error(e_file_error, errno, "Failed to get available data");
+  }
+  // Counts data already read ahead, which hdfsAvailable has skipped.
+  long buffered = data->read_buffer_end - data->read_buffer_start;
+  if (data->readahead != NULL) {
+    buffered += readahead_buffered(data->readahead);
   }
-  return INT2NUM(bytes_available);
+  return LONG2NUM(bytes_available + buffered);
 }
 
 /**
@@ -81,16 +1186,120 @@ VALUE HDFS_File_available(VALUE self) {
 VALUE HDFS_File_close(VALUE self) {
   FileData* data = NULL;
   Data_Get_Struct(self, FileData, data);
+  if (data->staged != NULL) {
+    // Leaves the staged copy cached for the next file to open it.
+    staged_file_close(data->staged);
+    data->staged = NULL;
+    xfree(data->read_buffer);
+    data->read_buffer = NULL;
+    discard_buffered(data);
+  }
   if (data->file != NULL) {
-    if (hdfsCloseFile(data->fs, data->file) == -1) {
-      rb_raise(e_file_error, "Could not close file: %s", get_error(errno));
+    lock_writes(data);
+    if (data->file == NULL) {
+      // Another thread closed the file while this one waited for the lock.
+      unlock_writes(data);
+      return Qtrue;
+    }
+    if (data->busy > 0) {
+      unlock_writes(data);
+      rb_raise(e_file_error, "Could not close file: in use by another thread");
       return Qnil;
     }
+    uint64_t started = metrics_start();
+    // Ends the compressed stream before everything buffered is written out.
+    int drain_error = data->codec != NULL &&
+        hdfsFileIsOpenForWrite(data->file) ?
+        write_compressed(data, NULL, 0, kCodecFinish) : 0;
+    if (data->async_writer != NULL) {
+      int stop_error = stop_async_writer(data);
+      drain_error = drain_error != 0 ? drain_error : stop_error;
+    } else if (drain_error == 0) {
+      drain_error = drain_write_buffer(data);
+    }
+    // Detaches the handle first, as libhdfs frees it even if closing fails.
+    FileCall call;
+    call.fs = data->fs;
+    call.file = data->file;
+    call.readahead = data->readahead;
+    call.resilient = data->resilient;
+    call.interrupted = 0;
+    data->fs = NULL;
     data->file = NULL;
+    data->readahead = NULL;
+    data->resilient = NULL;
+    if (data->block_cache != NULL) {
+      block_cache_close(data->block_cache);
+      data->block_cache = NULL;
+    }
+    call_without_gvl(call_hdfs_close, &call, &call.interrupted);
+    if (data->write_buffer != NULL) {
+      xfree(data->write_buffer);
+      data->write_buffer = NULL;
+    }
+    xfree(data->read_buffer);
+    data->read_buffer = NULL;
+    discard_buffered(data);
+    if (data->codec != NULL) {
+      codec_stop(data->codec);
+      data->codec = NULL;
+    }
+    unlock_writes(data);
+    int error = drain_error != 0 ? drain_error :
+        (call.result == -1 ? call.error : 0);
+    metrics_record(kMetricClose, started, 0, error, data->path);
+    if (drain_error != 0) {
+      raise_error(e_file_error, drain_error,
+          "Could not write buffered data to file");
+      return Qnil;
+    }
+    if (call.result == -1) {
+      raise_error(e_file_error, call.error, "Could not close file");
+      return Qnil;
+    }
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    file.each_line(separator=$/, limit=nil, chomp: false) { |line| ... } -> file
+ *    file.each_line(separator=$/, limit=nil, chomp: false) -> enumerator
+ *
+ * Yields each line of the rest of the file as gets would return it.  Returns
+ * an Enumerator if no block is given.  Raises an ArgumentError if limit is
+ * 0.  If this fails, raises a FileError.
+ */
+VALUE HDFS_File_each_line(int argc, VALUE* argv, VALUE self) {
+  RETURN_ENUMERATOR(self, argc, argv);
+  VALUE separator, line;
+  long limit;
+  int chomp;
+  parse_line_args(argc, argv, &separator, &limit, &chomp);
+  if (limit == 0) {
+    // Would yield empty lines forever, so IO refuses it too.
+    rb_raise(rb_eArgError, "invalid limit: 0 for each_line");
+  }
+  while (!NIL_P(line = read_line(get_FileData(self), separator, limit,
+      chomp))) {
+    rb_yield(line);
+  }
+  return self;
+}
+
+/**
+ * call-seq:
+ *    file.eof? -> at_end
+ *
+ * Returns True if there is nothing left to read from this file, reading
+ * ahead into the buffer shared with gets to find out.  If this fails, raises
+ * a FileError.
+ */
+VALUE HDFS_File_eof(VALUE self) {
+  return fill_read_buffer(get_FileData(self)) == 0 ? Qtrue : Qfalse;
+}
+
 /**
  * call-seq:
  *    file.flush -> success
@@ -100,57 +1309,297 @@ VALUE HDFS_File_close(VALUE self) {
  */
 VALUE HDFS_File_flush(VALUE self) {
   FileData* data = get_FileData(self);
-  if (hdfsFlush(data->fs, data->file) == -1) {
-    rb_raise(e_file_error, "Flush failed: %s", get_error(errno));
+  if (data->staged != NULL) {
+    raise_error(e_file_error, EBADF, "Flush failed");
+  }
+  uint64_t started = metrics_start();
+  if (data->async_writer != NULL) {
+    wait_async_flush(data, queue_async_flush(data, 0));
+    metrics_record(kMetricFlush, started, 0, 0, data->path);
+    return Qtrue;
   }
+  flush_write_buffer(self, data);
+  FileCall call;
+  run_file_call(data, call_hdfs_flush, &call);
+  if (call.result == -1) {
+    metrics_record(kMetricFlush, started, 0, call.error, data->path);
+    raise_error(e_file_error, call.error, "Flush failed");
+  }
+  metrics_record(kMetricFlush, started, 0, 0, data->path);
+  raise_deferred_exception();
   return Qtrue;
 }
 
 /**
  * call-seq:
- *    file.hflush -> success
+ *    file.gets(separator=$/, limit=nil, chomp: false) -> line
+ *
+ * Reads the next line, ending with separator, or the rest of the file if
+ * separator is nil, returning nil if nothing is left.  If limit is given,
+ * returns at most that many bytes, which may split a line, and an empty
+ * String if limit is 0.  chomp removes the separator.  Lines are read from
+ * HDFS through a native buffer which read, readpartial and eof? share, and
+ * tagged with the default external encoding.  If this fails, raises a
+ * FileError.
+ */
+VALUE HDFS_File_gets(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE separator;
+  long limit;
+  int chomp;
+  parse_line_args(argc, argv, &separator, &limit, &chomp);
+  return read_line(data, separator, limit, chomp);
+}
+
+/**
+ * call-seq:
+ *    file.hflush -> success or flush
  *
  * Flushes all buffers currently being written to this file.  When this
  * finishes, new readers will see the data that has been written.  If this
  * fails, raises a FileError.
+ *
+ * If the file was opened with async, instead queues the hflush behind every
+ * write so far and returns at once with an HDFS::File::Flush, whose wait
+ * method blocks until it has finished.
  */
 VALUE HDFS_File_hflush(VALUE self) {
   FileData* data = get_FileData(self);
-  if (hdfsHFlush(data->fs, data->file) == -1) {
-    rb_raise(e_file_error, "HFlush failed: %s", get_error(errno));
+  if (data->staged != NULL) {
+    raise_error(e_file_error, EBADF, "HFlush failed");
   }
+  if (data->async_writer != NULL) {
+    unsigned long ticket = queue_async_flush(data, 1);
+    FlushHandle* handle = ALLOC_N(FlushHandle, 1);
+    handle->file = self;
+    handle->ticket = ticket;
+    return Data_Wrap_Struct(c_file_flush, mark_flush_handle, xfree, handle);
+  }
+  uint64_t started = metrics_start();
+  flush_write_buffer(self, data);
+  FileCall call;
+  run_file_call(data, call_hdfs_hflush, &call);
+  if (call.result == -1) {
+    metrics_record(kMetricHflush, started, 0, call.error, data->path);
+    raise_error(e_file_error, call.error, "HFlush failed");
+  }
+  metrics_record(kMetricHflush, started, 0, 0, data->path);
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    file.pread_batch(ranges, options={}) -> strings
+ *
+ * Positionally reads each [position, length] pair in the Array ranges,
+ * returning an Array holding a String for each range in the same order.  Each
+ * String is shorter than its length only at the end of the file.  Ranges that
+ * overlap or lie within gap bytes of each other are coalesced into a single
+ * read, and every read is issued in one pass without the GVL; the Strings
+ * returned are slices sharing one backing buffer.  If this fails, raises a
+ * FileError.
+ *
+ * options can have the following keys:
+ *
+ * * *gap*: the largest distance in bytes between two ranges for which they
+ *   are still read together (default: 65536)
+ */
+VALUE HDFS_File_pread_batch(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE ranges, options;
+  rb_scan_args(argc, argv, "11", &ranges, &options);
+  Check_Type(ranges, T_ARRAY);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  if (TYPE(options) != T_HASH) {
+    rb_raise(rb_eArgError, "options must be of type Hash");
+  }
+  VALUE r_gap = rb_hash_aref(options, sym_gap);
+  long gap = NIL_P(r_gap) ? HDFS_DEFAULT_PREAD_GAP : NUM2LONG(r_gap);
+  if (data->codec != NULL) {
+    rb_raise(e_file_error, "Cannot read positionally from a compressed file");
+  }
+  long num_ranges = RARRAY_LEN(ranges);
+  VALUE results = rb_ary_new2(num_ranges);
+  if (num_ranges == 0) {
+    return results;
+  }
+  // Scratch space is owned by temporary Ruby objects so that an exception
+  // while parsing ranges cannot leak it.
+  VALUE ranges_tmp, sorted_tmp, groups_tmp;
+  PreadRange* requested = ALLOCV_N(PreadRange, ranges_tmp, num_ranges);
+  PreadRange** sorted = ALLOCV_N(PreadRange*, sorted_tmp, num_ranges);
+  PreadGroup* groups = ALLOCV_N(PreadGroup, groups_tmp, num_ranges);
+  long i;
+  for (i = 0; i < num_ranges; i++) {
+    VALUE range = rb_ary_entry(ranges, i);
+    Check_Type(range, T_ARRAY);
+    if (RARRAY_LEN(range) != 2) {
+      rb_raise(rb_eArgError, "range must be a [position, length] pair");
+    }
+    requested[i].position = NUM2LL(rb_ary_entry(range, 0));
+    requested[i].length = NUM2LONG(rb_ary_entry(range, 1));
+    if (requested[i].position < 0 || requested[i].length < 0) {
+      rb_raise(rb_eArgError, "negative position or length given");
+    }
+    sorted[i] = requested + i;
+  }
+  // Sorts ranges by position, then merges each into the previous read if it
+  // starts within gap bytes of its end.
+  qsort(sorted, num_ranges, sizeof(PreadRange*), compare_pread_ranges);
+  long num_groups = 0;
+  for (i = 0; i < num_ranges; i++) {
+    PreadRange* range = sorted[i];
+    tOffset range_end = range->position + range->length;
+    PreadGroup* last = num_groups > 0 ? groups + num_groups - 1 : NULL;
+    if (last != NULL &&
+        range->position <= last->position + last->length + gap) {
+      if (range_end > last->position + last->length) {
+        last->length = range_end - last->position;
+      }
+    } else {
+      last = groups + num_groups++;
+      last->position = range->position;
+      last->length = range->length;
+      last->bytes_read = 0;
+    }
+    range->group = num_groups - 1;
+  }
+  // Lays the reads out back to back within one backing buffer.
+  long total = 0;
+  for (i = 0; i < num_groups; i++) {
+    groups[i].offset = total;
+    total += groups[i].length;
+  }
+  VALUE backing = rb_str_buf_new(0);
+  rb_str_resize(backing, total);
+  PreadBatch batch;
+  batch.groups = groups;
+  batch.num_groups = num_groups;
+  batch.next_group = 0;
+  uint64_t started = metrics_start();
+  for (;;) {
+    batch.call.buffer = RSTRING_PTR(backing);
+    // Locks the string so that other threads cannot modify it mid-read.
+    rb_str_locktmp(backing);
+    run_file_call(data, call_hdfs_pread_batch, &batch.call);
+    rb_str_unlocktmp(backing);
+    if (batch.call.result == -1) {
+      metrics_record(kMetricPread, started, 0, batch.call.error, data->path);
+      raise_error(e_file_error, batch.call.error, "Failed to read data");
+    }
+    if (batch.next_group == batch.num_groups) {
+      break;
+    }
+    // Runs pending interrupts such as signal handlers, which may raise, then
+    // resumes with the next read.
+    check_interrupts();
+  }
+  long bytes_read = 0;
+  for (i = 0; i < num_groups; i++) {
+    bytes_read += groups[i].bytes_read;
+  }
+  metrics_record(kMetricPread, started, bytes_read, 0, data->path);
+  // Slices each requested range out of its read, trimmed to the bytes that
+  // read actually returned.
+  for (i = 0; i < num_ranges; i++) {
+    PreadRange* range = requested + i;
+    PreadGroup* group = groups + range->group;
+    long skip = (long) (range->position - group->position);
+    long available = group->bytes_read - skip;
+    available = available < 0 ? 0 : available;
+    rb_ary_push(results, rb_str_substr(backing, group->offset + skip,
+        range->length < available ? range->length : available));
+  }
+  ALLOCV_END(ranges_tmp);
+  ALLOCV_END(sorted_tmp);
+  ALLOCV_END(groups_tmp);
+  raise_deferred_exception();
+  return results;
+}
+
+/**
+ * call-seq:
+ *    file.pread_into(buffer, position, length=131072) -> num_bytes_read
+ *
+ * Positionally reads the number of bytes specified by length at the specified
+ * byte offset directly into the String buffer, replacing its contents and
+ * returning the number of bytes read as an Integer, which is less than length
+ * only at the end of the file.  buffer keeps its capacity across calls, so
+ * reusing it avoids any allocation.  If this fails, raises a FileError.
+ */
+VALUE HDFS_File_pread_into(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE buffer, position, length;
+  rb_scan_args(argc, argv, "21", &buffer, &position, &length);
+  StringValue(buffer);
+  long hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE :
+      NUM2LONG(length);
+  return LONG2NUM(read_into_string(data, buffer, NUM2ULONG(position),
+      hdfsLength));
+}
+
+/**
+ * call-seq:
+ *    file.read_nonblock(length, buffer=nil, exception: true) -> retval
+ *
+ * Like readpartial, but returns nil at the end of the file if exception is
+ * false.  Reads from HDFS cannot be made without blocking, so this returns
+ * as soon as some data has been read rather than raising IO::WaitReadable.
+ */
+VALUE HDFS_File_read_nonblock(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE length, buffer, options;
+  rb_scan_args(argc, argv, "11:", &length, &buffer, &options);
+  VALUE result = read_partial(data, NUM2LONG(length), buffer);
+  if (NIL_P(result) && (NIL_P(options) ||
+      rb_hash_aref(options, sym_exception) != Qfalse)) {
+    rb_eof_error();
+  }
+  return result;
+}
+
 /**
  * call-seq:
  *    file.read(length=131072) -> retval
  *
  * Reads the number of bytes specified by length from the current file object,
- * returning the bytes read as a String.  If this fails, raises a
- * FileError.
+ * returning the bytes read as a String, which is shorter than length only at
+ * the end of the file.  length is not limited; large reads are issued to HDFS
+ * in chunks but land in a single String.  If this fails, raises a FileError.
  */ 
 VALUE HDFS_File_read(int argc, VALUE* argv, VALUE self) {
   FileData* data = get_FileData(self);
   VALUE length;
   rb_scan_args(argc, argv, "01", &length);
-  tSize hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE : NUM2INT(length);
-  // Checks whether we're reading more data than HDFS client can support.
-  if (hdfsLength > HDFS_DEFAULT_BUFFER_SIZE) {
-    rb_raise(e_file_error, "Can only read a max of %u bytes from HDFS",
-        HDFS_DEFAULT_BUFFER_SIZE);
-    return Qnil;
-  }
-  char* buffer = ALLOC_N(char, hdfsLength);
-  tSize bytes_read = hdfsRead(data->fs, data->file, buffer, hdfsLength);
-  if (bytes_read == -1) {
-    rb_raise(e_file_error, "Failed to read data: %s", get_error(errno));
-  }
-  VALUE string_output = rb_tainted_str_new(buffer, bytes_read);
-  xfree(buffer);
+  long hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE :
+      NUM2LONG(length);
+  VALUE string_output = rb_str_buf_new(0);
+  rb_str_resize(string_output, read_into_string(data, string_output, -1,
+      hdfsLength));
   return string_output;
 }
 
+/**
+ * call-seq:
+ *    file.read_into(buffer, length=131072) -> num_bytes_read
+ *
+ * Reads the number of bytes specified by length from the current file object
+ * directly into the String buffer, replacing its contents and returning the
+ * number of bytes read as an Integer, which is less than length only at the
+ * end of the file.  buffer keeps its capacity across calls, so reusing it
+ * avoids any allocation.  If this fails, raises a FileError.
+ */
+VALUE HDFS_File_read_into(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE buffer, length;
+  rb_scan_args(argc, argv, "11", &buffer, &length);
+  StringValue(buffer);
+  long hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE :
+      NUM2LONG(length);
+  return LONG2NUM(read_into_string(data, buffer, -1, hdfsLength));
+}
+
 /**
  * call-seq:
  *    file.read_open? -> open_for_read
@@ -160,7 +1609,9 @@ VALUE HDFS_File_read(int argc, VALUE* argv, VALUE self) {
 VALUE HDFS_File_read_open(VALUE self) {
   FileData* data = NULL;
   Data_Get_Struct(self, FileData, data);
-  if (data->file) {
+  if (data->staged != NULL) {
+    return Qtrue;
+  } else if (data->file) {
     return hdfsFileIsOpenForRead(data->file) ? Qtrue : Qfalse;
   } else {
     return Qfalse;
@@ -172,29 +1623,79 @@ VALUE HDFS_File_read_open(VALUE self) {
  *    file.read_pos(position, length=131072) -> retval
  *
  * Positionally reads the number of bytes specified by length at the specified
- * byte offset, returning the bytes read as a String.  If this fails, raises a
- * FileError.
+ * byte offset, returning the bytes read as a String, which is shorter than
+ * length only at the end of the file.  If this fails, raises a FileError.
  */ 
 VALUE HDFS_File_read_pos(int argc, VALUE* argv, VALUE self) {
   FileData* data = get_FileData(self);
   VALUE position, length;
   rb_scan_args(argc, argv, "11", &position, &length);
-  tSize hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE : NUM2INT(length);
-  // Checks whether we're reading more data than HDFS client can support.
-  if (hdfsLength > HDFS_DEFAULT_BUFFER_SIZE) {
-    rb_raise(e_file_error, "Can only read a max of %u bytes from HDFS",
-        HDFS_DEFAULT_BUFFER_SIZE);
-    return Qnil;
+  long hdfsLength = NIL_P(length) ? HDFS_DEFAULT_BUFFER_SIZE :
+      NUM2LONG(length);
+  VALUE string_output = rb_str_buf_new(0);
+  rb_str_resize(string_output, read_into_string(data, string_output,
+      NUM2ULONG(position), hdfsLength));
+  return string_output;
+}
+
+/**
+ * call-seq:
+ *    file.read_stats -> stats
+ *
+ * Returns a Hash counting how often reads of this file were retried, how
+ * often its stream was reopened to retry them, how many preads were hedged,
+ * and how many of those the hedge finished first, with the keys retries,
+ * reopens, hedges and hedge_wins.  Counts stay at 0 unless the file was
+ * opened with retries or hedge_after.
+ */
+VALUE HDFS_File_read_stats(VALUE self) {
+  FileData* data = get_FileData(self);
+  ResilientStats stats;
+  memset(&stats, 0, sizeof(stats));
+  if (data->resilient != NULL) {
+    resilient_reader_stats(data->resilient, &stats);
   }
-  char* buffer = ALLOC_N(char, hdfsLength);
-  tSize bytes_read = hdfsPread(data->fs, data->file, NUM2ULONG(position),
-      buffer, hdfsLength);
-  if (bytes_read == -1) {
-    rb_raise(e_file_error, "Failed to read data: %s", get_error(errno));
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, sym_retries, ULONG2NUM(stats.retries));
+  rb_hash_aset(result, sym_reopens, ULONG2NUM(stats.reopens));
+  rb_hash_aset(result, sym_hedges, ULONG2NUM(stats.hedges));
+  rb_hash_aset(result, sym_hedge_wins, ULONG2NUM(stats.hedge_wins));
+  return result;
+}
+
+/**
+ * call-seq:
+ *    file.readline(separator=$/, limit=nil, chomp: false) -> line
+ *
+ * Like gets, but raises an EOFError at the end of the file.
+ */
+VALUE HDFS_File_readline(int argc, VALUE* argv, VALUE self) {
+  VALUE line = HDFS_File_gets(argc, argv, self);
+  if (NIL_P(line)) {
+    rb_eof_error();
   }
-  VALUE string_output = rb_tainted_str_new(buffer, bytes_read);
-  xfree(buffer);
-  return string_output;
+  return line;
+}
+
+/**
+ * call-seq:
+ *    file.readpartial(length, buffer=nil) -> retval
+ *
+ * Reads at most length bytes, blocking only if nothing has been read ahead,
+ * returning them as a String, or in buffer if it is given.  Raises an
+ * EOFError at the end of the file, so that objects such as
+ * Zlib::GzipReader can read from this file as they would from an IO.  If
+ * this fails, raises a FileError.
+ */
+VALUE HDFS_File_readpartial(int argc, VALUE* argv, VALUE self) {
+  FileData* data = get_FileData(self);
+  VALUE length, buffer;
+  rb_scan_args(argc, argv, "11", &length, &buffer);
+  VALUE result = read_partial(data, NUM2LONG(length), buffer);
+  if (NIL_P(result)) {
+    rb_eof_error();
+  }
+  return result;
 }
 
 /**
@@ -206,10 +1707,32 @@ VALUE HDFS_File_read_pos(int argc, VALUE* argv, VALUE self) {
  */
 VALUE HDFS_File_seek(VALUE self, VALUE offset) {
   FileData* data = get_FileData(self);
-  if (hdfsSeek(data->fs, data->file, NUM2ULONG(offset)) == -1) {
-    rb_raise(e_file_error, "Failed to seek to position %lu: %s",
-        NUM2ULONG(offset), get_error(errno));
+  if (data->codec != NULL) {
+    rb_raise(e_file_error, "Cannot seek in a compressed file");
+  }
+  discard_buffered(data);
+  if (data->staged != NULL || data->block_cache != NULL) {
+    int result = data->staged != NULL ?
+        staged_file_seek(data->staged, NUM2ULONG(offset)) :
+        block_cache_seek(data->block_cache, NUM2ULONG(offset));
+    if (result == -1) {
+      raise_error(e_file_error, EINVAL, "Failed to seek to position %lu",
+          NUM2ULONG(offset));
+    }
+    return Qtrue;
+  }
+  if (data->readahead != NULL) {
+    readahead_seek(data->readahead, NUM2ULONG(offset));
+    return Qtrue;
   }
+  FileCall call;
+  call.position = NUM2ULONG(offset);
+  run_file_call(data, call_hdfs_seek, &call);
+  if (call.result == -1) {
+    raise_error(e_file_error, call.error, "Failed to seek to position %lu",
+        NUM2ULONG(offset));
+  }
+  raise_deferred_exception();
   return Qtrue;
 }
 
@@ -222,10 +1745,29 @@ VALUE HDFS_File_seek(VALUE self, VALUE offset) {
  */
 VALUE HDFS_File_tell(VALUE self) {
   FileData* data = get_FileData(self);
+  // Leaves out data read ahead by gets and such but not yet consumed.
+  long buffered = data->read_buffer_end - data->read_buffer_start;
+  if (data->codec != NULL) {
+    return ULONG2NUM(data->codec_position - buffered);
+  }
+  if (data->staged != NULL) {
+    return ULONG2NUM(staged_file_tell(data->staged) - buffered);
+  }
+  if (data->block_cache != NULL) {
+    return ULONG2NUM(block_cache_tell(data->block_cache) - buffered);
+  }
+  if (data->readahead != NULL) {
+    return ULONG2NUM(readahead_tell(data->readahead) - buffered);
+  }
+  if (data->async_writer != NULL) {
+    return ULONG2NUM(data->async_position + data->write_buffer_used);
+  }
   tOffset offset = hdfsTell(data->fs, data->file);
   if (offset == -1) {
-    rb_raise(e_file_error, "Failed to read position: %s", get_error(errno));
+    raise_error(e_file_error, errno, "Failed to read position");
   }
+  // Counts buffered data as written.
+  offset += data->write_buffer_used - buffered;
   return ULONG2NUM(offset);
 }
 
@@ -234,19 +1776,42 @@ VALUE HDFS_File_tell(VALUE self) {
  *    file.write(bytes) -> num_bytes_written
  *
  * Writes the string specified by bytes to the current file object, returning
- * the number of bytes written as an Integer.  If this fails, raises a
- * FileError.
+ * the number of bytes written as an Integer.  If the file was opened with a
+ * write buffer, small writes are collected in it and only sent to HDFS once it
+ * fills or the file is flushed or closed.  If the file was opened with async,
+ * written data is handed to a background thread, and this blocks only while
+ * its queue is full; a failed write is then raised by the next call to write,
+ * flush, hflush or close.  If this fails, raises a FileError.
  */
 VALUE HDFS_File_write(VALUE self, VALUE bytes) {
   FileData* data = get_FileData(self);
   VALUE str_value = StringValue(bytes);
-  tSize num_bytes = NUM2UINT(rb_funcall(str_value, rb_intern("bytesize"), 0));
-  tSize bytes_written = hdfsWrite(data->fs, data->file, RSTRING_PTR(str_value),
-      num_bytes);
-  if (bytes_written == -1) {
-    rb_raise(e_file_error, "Failed to write data: %s", get_error(errno));
+  long num_bytes = RSTRING_LEN(str_value);
+  if (data->staged != NULL) {
+    raise_error(e_file_error, EBADF, "Failed to write data");
+  }
+  lock_writes(data);
+  if (data->file == NULL) {
+    // Another thread closed the file while this one waited for the lock.
+    unlock_writes(data);
+    ensure_file_open(data);
+  }
+  uint64_t started = metrics_start();
+  // Locks the string so that other threads cannot modify it mid-write.
+  rb_str_locktmp(str_value);
+  int error = data->codec != NULL ?
+      write_compressed(data, RSTRING_PTR(str_value), num_bytes,
+          kCodecContinue) :
+      write_bytes(data, RSTRING_PTR(str_value), num_bytes);
+  rb_str_unlocktmp(str_value);
+  unlock_writes(data);
+  metrics_record(kMetricWrite, started, error != 0 ? 0 : num_bytes, error,
+      data->path);
+  if (error != 0) {
+    raise_error(e_file_error, error, "Failed to write data");
   }
-  return UINT2NUM(bytes_written);
+  raise_deferred_exception();
+  return LONG2NUM(num_bytes);
 }
 
 /**
@@ -270,16 +1835,67 @@ VALUE HDFS_File_to_s(VALUE self) {
   return rb_sprintf("#<HDFS::File: %s>", StringValuePtr(path));
 }
 
+/*
+ * HDFS::File::Flush
+ */
+
+/**
+ * call-seq:
+ *    flush.done? -> done
+ *
+ * Returns True if the hflush has finished, or if writing failed first;
+ * otherwise returns False.
+ */
+VALUE HDFS_File_Flush_done(VALUE self) {
+  FlushHandle* handle = NULL;
+  Data_Get_Struct(self, FlushHandle, handle);
+  FileData* data = NULL;
+  Data_Get_Struct(handle->file, FileData, data);
+  if (data->async_writer == NULL) {
+    return Qtrue;
+  }
+  return async_writer_done(data->async_writer, handle->ticket) ? Qtrue :
+      Qfalse;
+}
+
+/**
+ * call-seq:
+ *    flush.wait -> success
+ *
+ * Blocks until the hflush has finished, after which new readers will see
+ * everything written before it.  If it or any write before it failed, raises
+ * a FileError.
+ */
+VALUE HDFS_File_Flush_wait(VALUE self) {
+  FlushHandle* handle = NULL;
+  Data_Get_Struct(self, FlushHandle, handle);
+  FileData* data = NULL;
+  Data_Get_Struct(handle->file, FileData, data);
+  wait_async_flush(data, handle->ticket);
+  return Qtrue;
+}
+
 void init_file(VALUE parent) {
   c_file = rb_define_class_under(parent, "File", rb_cObject);
 
   rb_define_method(c_file, "available", HDFS_File_available, 0);
   rb_define_method(c_file, "close", HDFS_File_close, 0);
+  rb_define_method(c_file, "each_line", HDFS_File_each_line, -1);
+  rb_define_method(c_file, "eof", HDFS_File_eof, 0);
+  rb_define_method(c_file, "eof?", HDFS_File_eof, 0);
   rb_define_method(c_file, "flush", HDFS_File_flush, 0);
+  rb_define_method(c_file, "gets", HDFS_File_gets, -1);
   rb_define_method(c_file, "hflush", HDFS_File_hflush, 0);
+  rb_define_method(c_file, "pread_batch", HDFS_File_pread_batch, -1);
+  rb_define_method(c_file, "pread_into", HDFS_File_pread_into, -1);
   rb_define_method(c_file, "read", HDFS_File_read, -1);
+  rb_define_method(c_file, "read_into", HDFS_File_read_into, -1);
+  rb_define_method(c_file, "read_nonblock", HDFS_File_read_nonblock, -1);
   rb_define_method(c_file, "read_open?", HDFS_File_read_open, 0);
   rb_define_method(c_file, "read_pos", HDFS_File_read_pos, -1);
+  rb_define_method(c_file, "read_stats", HDFS_File_read_stats, 0);
+  rb_define_method(c_file, "readline", HDFS_File_readline, -1);
+  rb_define_method(c_file, "readpartial", HDFS_File_readpartial, -1);
   rb_define_method(c_file, "seek", HDFS_File_seek, 1);
   rb_define_method(c_file, "tell", HDFS_File_tell, 0);
   rb_define_method(c_file, "to_s", HDFS_File_to_s, 0);
@@ -287,7 +1903,20 @@ void init_file(VALUE parent) {
   rb_define_method(c_file, "write_open?", HDFS_File_write_open, 0);
   rb_define_method(c_file, "<<", HDFS_File_write, 1);
 
+  c_file_flush = rb_define_class_under(c_file, "Flush", rb_cObject);
+  rb_define_method(c_file_flush, "done?", HDFS_File_Flush_done, 0);
+  rb_define_method(c_file_flush, "wait", HDFS_File_Flush_wait, 0);
+
   e_file_error = rb_define_class_under(parent, "FileError", rb_eException);
+  define_error_class(e_file_error);
   e_file_closed_error = rb_define_class_under(parent, "FileClosedError",
       e_file_error);
+
+  sym_chomp = ID2SYM(rb_intern("chomp"));
+  sym_exception = ID2SYM(rb_intern("exception"));
+  sym_gap = ID2SYM(rb_intern("gap"));
+  sym_hedge_wins = ID2SYM(rb_intern("hedge_wins"));
+  sym_hedges = ID2SYM(rb_intern("hedges"));
+  sym_reopens = ID2SYM(rb_intern("reopens"));
+  sym_retries = ID2SYM(rb_intern("retries"));
 }
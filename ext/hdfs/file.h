@@ -4,8 +4,39 @@
 #include "hdfs.h"
 #include "ruby.h"
 
+#include "codec.h"
+#include "staging_cache.h"
 
-VALUE new_HDFS_File(VALUE path, hdfsFile* file, hdfsFS* fs);
+
+/* Options applied to a file as it is opened by HDFS::FileSystem#open. */
+typedef struct FileOptions {
+  int readahead_chunks;      /* chunks to read ahead, or 0 to not read ahead */
+  long readahead_chunk_size; /* size in bytes of each chunk read ahead */
+  long write_buffer_size;    /* bytes of writes to coalesce, or 0 for none */
+  int async_queue_length;    /* buffers queued to a writer thread, or 0 */
+  long hflush_bytes;         /* bytes after which the writer runs hflush */
+  double hflush_interval;    /* seconds after which the writer runs hflush */
+  CodecKind codec;           /* compresses or decompresses data, if not none */
+  int retries;               /* times a failed read is retried, or 0 */
+  double retry_backoff;      /* seconds before the first retry */
+  double hedge_after;        /* seconds before hedging a pread, or 0 */
+  int block_cache;           /* reads through the process-wide block cache */
+  tTime mtime;               /* with block_cache, when the file was modified */
+  tOffset size;              /* with block_cache, the size of the file */
+} FileOptions;
+
+/*
+ * Wraps an open hdfsFile in an HDFS::File object, applying the supplied
+ * options.  If this fails, closes the file and raises a FileError.
+ */
+VALUE new_HDFS_File(VALUE path, hdfsFile* file, hdfsFS* fs,
+    FileOptions* options);
+
+/*
+ * Wraps a reader of a staged copy of the file at path in an HDFS::File
+ * object, which takes ownership of it.
+ */
+VALUE new_staged_HDFS_File(VALUE path, StagedFile* staged);
 
 void init_file(VALUE parent);
 
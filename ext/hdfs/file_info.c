@@ -11,68 +11,140 @@
 
 
 typedef struct FileInfo {
-  char* mName;         /* the name of the file */
+  VALUE arena;         /* the object owning the arena holding this entry */
+  const char* mName;   /* the name of the file, within the arena */
+  long name_length;
+  VALUE name;          /* the name as a frozen String once asked for */
   tTime mLastMod;      /* the last modification time for the file in seconds */
   tOffset mSize;       /* the size of the file in bytes */
   short mReplication;  /* the count of replicas */
   tOffset mBlockSize;  /* the block size for the file */
-  char* mOwner;        /* the owner of the file */
-  char* mGroup;        /* the group associated with the file */
+  VALUE owner;         /* the owner of the file, interned */
+  VALUE group;         /* the group associated with the file, interned */
   short mPermissions;  /* the permissions associated with the file */
   tTime mLastAccess;   /* the last access time for the file in seconds */
+  tObjectKind mKind;
 } FileInfo;
 
+/*
+ * The entries of one listing, allocated at once along with their names, and
+ * freed once no HDFS::FileInfo object wrapping any of them is left.
+ */
+typedef struct FileInfoArena {
+  long num_entries;
+  FileInfo* infos;     /* num_entries entries, followed by their names */
+} FileInfoArena;
+
 static VALUE c_file_info;
 static VALUE c_file_info_file;
 static VALUE c_file_info_directory;
 
+/*
+ * Frozen Strings of the owners and groups seen so far, keyed by name, so
+ * that each is allocated once however many entries share it;
+ * principal_name_list keeps them alive.
+ */
+static st_table* principal_names;
+static VALUE principal_name_list;
+
 
 /*
  * HDFS::FileInfo
  */
 
-void free_file_info(FileInfo* file_info) {
+void mark_file_info(FileInfo* file_info) {
   if (file_info) {
-    free(file_info->mName);
-    free(file_info->mOwner);
-    free(file_info->mGroup);
-    free(file_info);
+    rb_gc_mark(file_info->arena);
   }
 }
 
-/*
- * Copies an hdfsFileInfo struct into a Hadoop::DFS::FileInfo derivative
- * object.
- */
-VALUE new_HDFS_File_Info(hdfsFileInfo* info) {
-  // Creates a FileInfo struct, populates it with information from the
-  // supplied hdfsFileInfo struct.
-  FileInfo* file_info = ALLOC_N(FileInfo, 1);
-  file_info->mName = strdup(info->mName);
-  file_info->mLastMod = info->mLastMod;
-  file_info->mSize = info->mSize;
-  file_info->mReplication = info->mReplication;
-  file_info->mBlockSize = info->mBlockSize;
-  file_info->mOwner = strdup(info->mOwner);
-  file_info->mGroup = strdup(info->mGroup);
-  file_info->mPermissions = info->mPermissions;
-  file_info->mLastAccess = info->mLastAccess;
+void mark_file_info_arena(FileInfoArena* arena) {
+  if (arena) {
+    long i;
+    for (i = 0; i < arena->num_entries; i++) {
+      rb_gc_mark(arena->infos[i].name);
+    }
+  }
+}
+
+/* Returns the interned frozen String for an owner or group. */
+static VALUE principal_name(const char* principal) {
+  st_data_t name;
+  if (st_lookup(principal_names, (st_data_t) principal, &name)) {
+    return (VALUE) name;
+  }
+  VALUE principal_string = rb_obj_freeze(rb_str_new2(principal));
+  rb_ary_push(principal_name_list, principal_string);
+  st_insert(principal_names, (st_data_t) strdup(principal),
+      (st_data_t) principal_string);
+  return principal_string;
+}
+
+VALUE new_HDFS_File_Info_arena(hdfsFileInfo* infos, int num_entries) {
+  size_t names_length = 0;
+  int i;
+  for (i = 0; i < num_entries; i++) {
+    names_length += strlen(infos[i].mName) + 1;
+  }
+  // Lays out the entries and then their names in a single allocation.
+  FileInfoArena* arena = (FileInfoArena*) ALLOC_N(char,
+      sizeof(FileInfoArena) + sizeof(FileInfo) * num_entries + names_length);
+  arena->num_entries = 0;
+  arena->infos = (FileInfo*) (arena + 1);
+  VALUE arena_object = Data_Wrap_Struct(0, mark_file_info_arena, xfree,
+      arena);
+  char* names = (char*) (arena->infos + num_entries);
+  for (i = 0; i < num_entries; i++) {
+    hdfsFileInfo* info = infos + i;
+    FileInfo* file_info = arena->infos + i;
+    file_info->arena = arena_object;
+    file_info->name_length = (long) strlen(info->mName);
+    memcpy(names, info->mName, file_info->name_length + 1);
+    file_info->mName = names;
+    names += file_info->name_length + 1;
+    file_info->name = Qnil;
+    file_info->mLastMod = info->mLastMod;
+    file_info->mSize = info->mSize;
+    file_info->mReplication = info->mReplication;
+    file_info->mBlockSize = info->mBlockSize;
+    file_info->owner = principal_name(info->mOwner);
+    file_info->group = principal_name(info->mGroup);
+    file_info->mPermissions = info->mPermissions;
+    file_info->mLastAccess = info->mLastAccess;
+    file_info->mKind = info->mKind;
+    arena->num_entries++;
+  }
+  return arena_object;
+}
+
+VALUE wrap_HDFS_File_Info(VALUE arena_object, int index) {
+  FileInfoArena* arena = NULL;
+  Data_Get_Struct(arena_object, FileInfoArena, arena);
+  FileInfo* file_info = arena->infos + index;
   // Assigns FileInfo::Info or FileInfo::Directory class based upon the type of
-  // the file.
-  switch(info->mKind) {
+  // the file.  The entry belongs to the arena, so is never freed alone.
+  switch(file_info->mKind) {
     case kObjectKindDirectory:
-      return Data_Wrap_Struct(c_file_info_directory, NULL, free_file_info,
+      return Data_Wrap_Struct(c_file_info_directory, mark_file_info, NULL,
           file_info);
     case kObjectKindFile:
-      return Data_Wrap_Struct(c_file_info_file, NULL, free_file_info,
+      return Data_Wrap_Struct(c_file_info_file, mark_file_info, NULL,
           file_info);
     default:
       rb_raise(rb_eTypeError, "FileInfo was not a file or directory: %s",
-          info->mName);
+          file_info->mName);
   }
   return Qnil;
 }
 
+/*
+ * Copies an hdfsFileInfo struct into a Hadoop::DFS::FileInfo derivative
+ * object.
+ */
+VALUE new_HDFS_File_Info(hdfsFileInfo* info) {
+  return wrap_HDFS_File_Info(new_HDFS_File_Info_arena(info, 1), 0);
+}
+
 /**
  * HDFS File Info interface
  */
@@ -105,12 +177,13 @@ VALUE HDFS_File_Info_block_size(VALUE self) {
  * call-seq:
  *    file_info.group -> retval
  *
- * Returns the group of the file described by this object.
+ * Returns the group of the file described by this object as a frozen String,
+ * which is shared with every other object of the same group.
  */
 VALUE HDFS_File_Info_group(VALUE self) {
   FileInfo* file_info = NULL;
   Data_Get_Struct(self, FileInfo, file_info);
-  return rb_str_new2(file_info->mGroup);
+  return file_info->group;
 }
 
 /**
@@ -183,24 +256,29 @@ VALUE HDFS_File_Info_mode(VALUE self) {
  * call-seq:
  *    file_info.name -> retval
  *
- * Returns the name of the file as a String.
+ * Returns the name of the file as a frozen String, allocated on first call.
  */
 VALUE HDFS_File_Info_name(VALUE self) {
   FileInfo* file_info = NULL;
   Data_Get_Struct(self, FileInfo, file_info);
-  return rb_str_new2(file_info->mName);
+  if (NIL_P(file_info->name)) {
+    file_info->name = rb_obj_freeze(rb_str_new(file_info->mName,
+        file_info->name_length));
+  }
+  return file_info->name;
 }
 
 /**
  * call-seq:
  *    file_info.owner -> retval
  *
- * Returns the owner of the file as a String.
+ * Returns the owner of the file as a frozen String, which is shared with
+ * every other object of the same owner.
  */
 VALUE HDFS_File_Info_owner(VALUE self) {
   FileInfo* file_info = NULL;
   Data_Get_Struct(self, FileInfo, file_info);
-  return rb_str_new2(file_info->mOwner);
+  return file_info->owner;
 }
 
 /**
@@ -242,13 +320,17 @@ VALUE HDFS_File_Info_to_s(VALUE self) {
       rb_intern("to_s"), 0);
   return rb_sprintf("#<%s: %s, mode=%d, owner=%s, group=%s>",
       RSTRING_PTR(class_string), file_info->mName,
-      decimal_octal(file_info->mPermissions), file_info->mOwner,
-      file_info->mGroup);
+      decimal_octal(file_info->mPermissions), RSTRING_PTR(file_info->owner),
+      RSTRING_PTR(file_info->group));
 }
 
 void init_file_info(VALUE parent) {
   c_file_info = rb_define_class_under(parent, "FileInfo", rb_cObject);
 
+  principal_names = st_init_strtable();
+  principal_name_list = rb_ary_new();
+  rb_gc_register_address(&principal_name_list);
+
   rb_define_method(c_file_info, "atime", HDFS_File_Info_atime, 0);
   rb_define_method(c_file_info, "block_size", HDFS_File_Info_block_size, 0);
   rb_define_method(c_file_info, "group", HDFS_File_Info_group, 0);
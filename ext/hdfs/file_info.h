@@ -7,6 +7,16 @@
 
 VALUE new_HDFS_File_Info(hdfsFileInfo* info);
 
+/*
+ * Copies num_entries hdfsFileInfo structs into one arena, with their owners
+ * and groups interned, returning an object owning it from which
+ * wrap_HDFS_File_Info wraps each entry.  The arena lives as long as any
+ * HDFS::FileInfo object wrapping one of its entries.
+ */
+VALUE new_HDFS_File_Info_arena(hdfsFileInfo* infos, int num_entries);
+
+VALUE wrap_HDFS_File_Info(VALUE arena, int index);
+
 void init_file_info(VALUE parent);
 
 #endif /* HDFS_FILE_INFO_H */
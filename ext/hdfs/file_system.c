@@ -1,4 +1,6 @@
+#include <ctype.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ruby.h"
@@ -6,16 +8,156 @@
 
 #include "file_system.h"
 
+#include "batch.h"
+#include "block_cache.h"
+#include "codec.h"
+#include "connection_pool.h"
 #include "constants.h"
+#include "content_summary.h"
 #include "file.h"
 #include "file_info.h"
+#include "io_pool.h"
+#include "listing.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "parallel_reader.h"
+#include "staging_cache.h"
+#include "transfer.h"
 #include "utils.h"
+#include "walker.h"
 
 
 typedef struct FSData {
   hdfsFS fs;
+  int busy;            /* count of calls currently running without the GVL */
+  MetadataCache* cache;  /* caches stat, exist? and ls if not NULL */
 } FSData;
 
+/*
+ * Arguments to and results of a libhdfs call made without the GVL; each call
+ * uses only the fields it needs.
+ */
+typedef struct FSCall {
+  hdfsFS fs;
+  const char* path;
+  hdfsFS to_fs;
+  const char* to_path;
+  const char* host;
+  tPort port;
+  const char* user;
+  const char* kerb_ticket_cache;
+  const char** conf;
+  int num_conf;
+  const char* owner;
+  const char* group;
+  tOffset start;
+  tOffset length;
+  tTime mtime;
+  tTime atime;
+  int flags;
+  int buffer_size;
+  short replication;
+  tSize block_size;
+  short mode;
+  int recursive;
+  tOffset result;
+  void* pointer;
+  int num_entries;
+  int error;
+  volatile int interrupted;
+} FSCall;
+
+/* A directory listing being yielded entry by entry by each_entry. */
+typedef struct EntryListing {
+  hdfsFileInfo* infos;
+  int num_entries;
+  int names_only;      /* yields only names rather than FileInfo objects */
+} EntryListing;
+
+/* Arguments to and results of walker_next called without the GVL. */
+typedef struct WalkCall {
+  FSData* data;
+  Walker* walker;
+  WalkBatch* batch;    /* the batch being yielded, freed if the block raises */
+  VALUE listing;       /* collects entries instead of yielding them if set */
+  int result;
+  int error;
+  volatile int interrupted;
+} WalkCall;
+
+/* Arguments to and results of summing a tree without the GVL. */
+typedef struct SummaryCall {
+  FSData* data;
+  Walker* walker;
+  SummaryTable* table;
+  int root_only;       /* returns the root's summary alone, not a Hash */
+  int result;          /* as from walker_next, or -3 if memory ran out */
+  int error;
+  volatile int interrupted;
+} SummaryCall;
+
+/* Arguments to and results of parallel reader calls made without the GVL. */
+typedef struct ParallelReadCall {
+  FSData* data;
+  const char* path;
+  int num_threads;
+  tSize chunk_size;
+  int ordered;
+  ParallelReader* reader;
+  ReadChunk* chunk;    /* the chunk being copied, recycled if this raises */
+  VALUE consumer;      /* an IO-like object written to in order, or nil */
+  VALUE contents;      /* collects the whole file if set */
+  tOffset num_bytes;
+  int result;
+  int error;
+  volatile int interrupted;
+} ParallelReadCall;
+
+/* The same libhdfs call made on each of many paths by the *_many methods. */
+typedef struct BatchCall {
+  FSData* data;
+  FSCall call;         /* the arguments shared by every path */
+  VALUE path_strings;  /* the paths as Strings, to drop from the cache */
+  int subtree;         /* whether to drop everything beneath them too */
+  void* (*func)(void*);
+  const char** paths;
+  int* errors;         /* the errno of each path, or 0 */
+  long num_paths;
+  int num_threads;
+  long next;           /* the index of the next path to be made */
+  volatile int interrupted;
+} BatchCall;
+
+/* A batch of files being copied by copy_many, get_many or put_many. */
+typedef struct TransferCall {
+  FSData* data;
+  FSData* to_data;     /* the file system copied to, if not data */
+  Transfer* transfer;
+  VALUE to_paths;      /* the destination of each file, as Strings */
+  VALUE results;       /* true or the errno of each file */
+  long num_files;
+  long num_done;
+  tOffset num_bytes;
+  double started;      /* the monotonic time at which the batch started */
+  int result;
+  volatile int interrupted;
+} TransferCall;
+
+/*
+ * Client configuration applied by profile: :low_latency, as key and value
+ * pairs: short-circuit local reads, hedged reads started after 50ms and
+ * failing over from unresponsive DataNodes after 10 seconds.
+ */
+static const char* LOW_LATENCY_CONF[] = {
+  "dfs.client.read.shortcircuit", "true",
+  "dfs.client.hedged.read.threadpool.size", "16",
+  "dfs.client.hedged.read.threshold.millis", "50",
+  "dfs.client.socket-timeout", "10000",
+  NULL
+};
+
+static VALUE c_block_location;
+static VALUE c_content_summary;
 static VALUE c_file_system;
 
 static VALUE e_connect_error;
@@ -23,12 +165,105 @@ static VALUE e_could_not_open;
 static VALUE e_dfs_exception;
 static VALUE e_not_connected;
 
+/*
+ * Frozen Strings of the DataNode hostnames seen so far, keyed by name, so
+ * that each host is allocated once; host_name_list keeps them alive.
+ */
+static st_table* host_names;
+static VALUE host_name_list;
+
+/*
+ * The keys of the options taken and the Hashes returned by the methods of
+ * FileSystem, interned once by init_file_system rather than on every call,
+ * and the Hash standing in for the options of a call given none.
+ */
+static VALUE sym_active;
+static VALUE sym_allocated_bytes;
+static VALUE sym_async;
+static VALUE sym_atime;
+static VALUE sym_block_cache;
+static VALUE sym_block_size;
+static VALUE sym_budget;
+static VALUE sym_buffer_size;
+static VALUE sym_bytes;
+static VALUE sym_bytes_per_second;
+static VALUE sym_cache;
+static VALUE sym_cache_negative;
+static VALUE sym_cache_ttl;
+static VALUE sym_chunk_size;
+static VALUE sym_codec;
+static VALUE sym_conf;
+static VALUE sym_connections;
+static VALUE sym_depth;
+static VALUE sym_dir;
+static VALUE sym_directory;
+static VALUE sym_entries;
+static VALUE sym_evicted_bytes;
+static VALUE sym_evictions;
+static VALUE sym_file;
+static VALUE sym_files;
+static VALUE sym_group;
+static VALUE sym_hedge_after;
+static VALUE sym_hflush_bytes;
+static VALUE sym_hflush_interval;
+static VALUE sym_hit_ratio;
+static VALUE sym_hits;
+static VALUE sym_host;
+static VALUE sym_invalidations;
+static VALUE sym_jobs;
+static VALUE sym_kerb_ticket_cache;
+static VALUE sym_local;
+static VALUE sym_low_latency;
+static VALUE sym_max_depth;
+static VALUE sym_max_size;
+static VALUE sym_max_threads;
+static VALUE sym_min_size;
+static VALUE sym_misses;
+static VALUE sym_mtime;
+static VALUE sym_name;
+static VALUE sym_names_only;
+static VALUE sym_new_instance;
+static VALUE sym_newer_than;
+static VALUE sym_older_than;
+static VALUE sym_ordered;
+static VALUE sym_page_size;
+static VALUE sym_pages;
+static VALUE sym_port;
+static VALUE sym_profile;
+static VALUE sym_queued;
+static VALUE sym_readahead;
+static VALUE sym_readahead_size;
+static VALUE sym_recursive;
+static VALUE sym_references;
+static VALUE sym_replication;
+static VALUE sym_retries;
+static VALUE sym_retry_backoff;
+static VALUE sym_running;
+static VALUE sym_seconds;
+static VALUE sym_threads;
+static VALUE sym_to;
+static VALUE sym_to_fs;
+static VALUE sym_total;
+static VALUE sym_type;
+static VALUE sym_user;
+static VALUE sym_write_buffer;
+static VALUE no_options;
+
+static ID id_to_a;
+static ID id_to_i;
+static ID id_to_s;
+static ID id_write;
+
 
 void free_fs_data(FSData* data) {
   if (data && data->fs != NULL) {
-    hdfsDisconnect(data->fs);
+    connection_pool_release(data->fs);
     data->fs = NULL;
   }
+  if (data && data->cache != NULL) {
+    metadata_cache_free(data->cache);
+    data->cache = NULL;
+  }
 }
 
 /* Ensures that the DFS is connected; otherwise throws a NotConnectedError. */
@@ -38,9 +273,1001 @@ FSData* get_FSData(VALUE rb_object) {
   if (data->fs == NULL) {
     rb_raise(e_not_connected, "DFS is not connected");
   }
+  raise_deferred_exception();
   return data;
 }
 
+static void* call_hdfs_chmod(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsChmod(call->fs, call->path, call->mode);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_chown(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsChown(call->fs, call->path, call->owner, call->group);
+  call->error = errno;
+  return NULL;
+}
+
+/* Connects through the pool, forcing a new instance if flags is non-zero. */
+static void* call_hdfs_connect(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  ConnectionKey key;
+  key.host = call->host;
+  key.port = call->port;
+  key.user = call->user;
+  key.kerb_ticket_cache = call->kerb_ticket_cache;
+  key.conf = call->conf;
+  key.num_conf = call->num_conf;
+  call->pointer = connection_pool_acquire(&key, call->flags);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_copy(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsCopy(call->fs, call->path, call->to_fs, call->to_path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_create_directory(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsCreateDirectory(call->fs, call->path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_delete(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsDelete(call->fs, call->path, call->recursive);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_disconnect(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = connection_pool_release(call->fs);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_exists(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsExists(call->fs, call->path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_capacity(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsGetCapacity(call->fs);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_block_locations(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->pointer = NULL;
+  hdfsFileInfo* info = hdfsGetPathInfo(call->fs, call->path);
+  if (info == NULL) {
+    // A length no file has, telling the caller that the lookup failed.
+    call->length = -1;
+    call->result = 0;
+    call->error = errno;
+    return NULL;
+  }
+  call->length = info->mSize;
+  call->result = info->mBlockSize;
+  hdfsFreeFileInfo(info, 1);
+  if (call->length > 0) {
+    call->pointer = hdfsGetHosts(call->fs, call->path, 0, call->length);
+  }
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_default_block_size(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = call->path == NULL ? hdfsGetDefaultBlockSize(call->fs) :
+      hdfsGetDefaultBlockSizeAtPath(call->fs, call->path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_hosts(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->pointer = hdfsGetHosts(call->fs, call->path, call->start,
+      call->length);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_path_info(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->pointer = hdfsGetPathInfo(call->fs, call->path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_get_used(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsGetUsed(call->fs);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_list_directory(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->num_entries = -1;
+  call->pointer = hdfsListDirectory(call->fs, call->path, &call->num_entries);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_move(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsMove(call->fs, call->path, call->to_fs, call->to_path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_open_file(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->pointer = hdfsOpenFile(call->fs, call->path, call->flags,
+      call->buffer_size, call->replication, call->block_size);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_rename(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsRename(call->fs, call->path, call->to_path);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_set_replication(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsSetReplication(call->fs, call->path, call->replication);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_hdfs_utime(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->result = hdfsUtime(call->fs, call->path, call->mtime, call->atime);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_staging_cache_open(void* ptr) {
+  FSCall* call = (FSCall*) ptr;
+  call->pointer = staging_cache_open(call->fs, call->path, &call->interrupted,
+      &call->error);
+  return NULL;
+}
+
+/*
+ * Runs the supplied libhdfs call against this file system with the GVL
+ * released, marking it as busy so that it cannot be disconnected underneath
+ * the call.
+ */
+static void run_fs_call(FSData* data, void* (*func)(void*), FSCall* call) {
+  call->fs = data->fs;
+  call->interrupted = 0;
+  data->busy++;
+  call_without_gvl(func, call, &call->interrupted);
+  data->busy--;
+}
+
+/*
+ * Yields each entry of an EntryListing, wrapping it only as it is reached so
+ * that at most one entry at a time need be live.
+ */
+static VALUE yield_entries(VALUE ptr) {
+  EntryListing* listing = (EntryListing*) ptr;
+  raise_deferred_exception();
+  VALUE arena = listing->names_only ? Qnil :
+      new_HDFS_File_Info_arena(listing->infos, listing->num_entries);
+  int i;
+  for (i = 0; i < listing->num_entries; i++) {
+    hdfsFileInfo* info = listing->infos + i;
+    rb_yield(listing->names_only ? rb_str_new2(info->mName) :
+        wrap_HDFS_File_Info(arena, i));
+  }
+  RB_GC_GUARD(arena);
+  return Qnil;
+}
+
+static VALUE free_entries(VALUE ptr) {
+  EntryListing* listing = (EntryListing*) ptr;
+  if (listing->infos != NULL) {
+    hdfsFreeFileInfo(listing->infos, listing->num_entries);
+    listing->infos = NULL;
+  }
+  return Qnil;
+}
+
+static void* call_walker_next(void* ptr) {
+  WalkCall* call = (WalkCall*) ptr;
+  call->result = walker_next(call->walker, &call->batch, &call->interrupted,
+      &call->error);
+  return NULL;
+}
+
+static void* call_walker_stop(void* ptr) {
+  WalkCall* call = (WalkCall*) ptr;
+  walker_stop(call->walker);
+  return NULL;
+}
+
+static void* call_parallel_reader_start(void* ptr) {
+  ParallelReadCall* call = (ParallelReadCall*) ptr;
+  call->reader = parallel_reader_start(call->data->fs, call->path,
+      call->num_threads, call->chunk_size, call->ordered);
+  call->error = errno;
+  return NULL;
+}
+
+static void* call_parallel_reader_next(void* ptr) {
+  ParallelReadCall* call = (ParallelReadCall*) ptr;
+  call->result = parallel_reader_next(call->reader, &call->chunk,
+      &call->interrupted, &call->error);
+  return NULL;
+}
+
+static void* call_parallel_reader_stop(void* ptr) {
+  ParallelReadCall* call = (ParallelReadCall*) ptr;
+  parallel_reader_stop(call->reader);
+  return NULL;
+}
+
+/*
+ * Hands each chunk to the block, the consumer or the contents of the call as
+ * the parallel reader produces it.
+ */
+static VALUE yield_chunks(VALUE ptr) {
+  ParallelReadCall* call = (ParallelReadCall*) ptr;
+  for (;;) {
+    call->interrupted = 0;
+    call_without_gvl_wakeable(call_parallel_reader_next, call,
+        &call->interrupted, parallel_reader_wake, call->reader);
+    // Anything read is freed by stop_parallel_read if this raises.
+    raise_deferred_exception();
+    if (call->result == 0) {
+      return Qnil;
+    }
+    if (call->result == -1) {
+      raise_error(e_dfs_exception, call->error, "Failed to read %s",
+          call->path);
+    }
+    if (call->result == -2) {
+      // Runs pending interrupts such as signal handlers, which may raise, then
+      // resumes waiting.
+      check_interrupts();
+      continue;
+    }
+    ReadChunk* chunk = call->chunk;
+    tOffset offset = chunk->offset;
+    VALUE data = Qnil;
+    if (!NIL_P(call->contents)) {
+      memcpy(RSTRING_PTR(call->contents) + offset, chunk->buffer,
+          chunk->length);
+    } else {
+      data = rb_str_new(chunk->buffer, chunk->length);
+    }
+    call->num_bytes += chunk->length;
+    call->chunk = NULL;
+    parallel_reader_recycle(call->reader, chunk);
+    if (!NIL_P(call->consumer)) {
+      rb_funcall(call->consumer, id_write, 1, data);
+    } else if (!NIL_P(data)) {
+      rb_yield_values(2, data, LL2NUM(offset));
+    }
+  }
+}
+
+static VALUE stop_parallel_read(VALUE ptr) {
+  ParallelReadCall* call = (ParallelReadCall*) ptr;
+  if (call->chunk != NULL) {
+    parallel_reader_recycle(call->reader, call->chunk);
+    call->chunk = NULL;
+  }
+  call->interrupted = 0;
+  call_without_gvl(call_parallel_reader_stop, call, &call->interrupted);
+  call->data->busy--;
+  return Qnil;
+}
+
+/*
+ * Yields the matching entries of each batch as the walker produces it, or
+ * appends them to the listing of the call if it has one.
+ */
+static VALUE yield_walk_results(VALUE ptr) {
+  WalkCall* call = (WalkCall*) ptr;
+  for (;;) {
+    call->interrupted = 0;
+    call_without_gvl_wakeable(call_walker_next, call, &call->interrupted,
+        walker_wake, call->walker);
+    // The batch is freed by stop_walk if this raises.
+    raise_deferred_exception();
+    if (call->result == 0) {
+      return Qnil;
+    }
+    if (call->result == -1) {
+      raise_error(e_dfs_exception, call->error, "Failed to list directory %s",
+          walker_error_path(call->walker));
+    }
+    if (call->result == -2) {
+      // Runs pending interrupts such as signal handlers, which may raise, then
+      // resumes waiting.
+      check_interrupts();
+      continue;
+    }
+    WalkBatch* batch = call->batch;
+    if (!NIL_P(call->listing)) {
+      append_HDFS_Listing(call->listing, batch->infos, batch->num_entries,
+          batch->matches);
+    } else {
+      VALUE arena = new_HDFS_File_Info_arena(batch->infos,
+          batch->num_entries);
+      int i;
+      for (i = 0; i < batch->num_entries; i++) {
+        if (batch->matches[i]) {
+          rb_yield(wrap_HDFS_File_Info(arena, i));
+        }
+      }
+      RB_GC_GUARD(arena);
+    }
+    call->batch = NULL;
+    walker_free_batch(batch);
+  }
+}
+
+static VALUE stop_walk(VALUE ptr) {
+  WalkCall* call = (WalkCall*) ptr;
+  if (call->batch != NULL) {
+    walker_free_batch(call->batch);
+    call->batch = NULL;
+  }
+  call->interrupted = 0;
+  call_without_gvl(call_walker_stop, call, &call->interrupted);
+  call->data->busy--;
+  return Qnil;
+}
+
+/*
+ * Sums each batch of the walk into the table as it arrives, never returning
+ * to Ruby until the walk finishes, fails or is interrupted.
+ */
+static void* call_summary_walk(void* ptr) {
+  SummaryCall* call = (SummaryCall*) ptr;
+  WalkBatch* batch = NULL;
+  for (;;) {
+    call->result = walker_next(call->walker, &batch, &call->interrupted,
+        &call->error);
+    if (call->result != 1) {
+      return NULL;
+    }
+    int error = summary_table_add(call->table, batch->infos,
+        batch->num_entries);
+    walker_free_batch(batch);
+    if (error != 0) {
+      call->result = -3;
+      call->error = error;
+      return NULL;
+    }
+  }
+}
+
+static void* call_summary_stop(void* ptr) {
+  SummaryCall* call = (SummaryCall*) ptr;
+  walker_stop(call->walker);
+  return NULL;
+}
+
+static VALUE new_content_summary(ContentSummary* summary) {
+  return rb_struct_new(c_content_summary, LONG2NUM(summary->files),
+      LONG2NUM(summary->directories), LL2NUM(summary->bytes),
+      LL2NUM(summary->replicated_bytes));
+}
+
+/*
+ * Runs the walk of a summary, returning a Hash of each path's summary, or
+ * the root's alone if root_only is set.
+ */
+static VALUE run_summary_walk(VALUE ptr) {
+  SummaryCall* call = (SummaryCall*) ptr;
+  for (;;) {
+    call->interrupted = 0;
+    call_without_gvl_wakeable(call_summary_walk, call, &call->interrupted,
+        walker_wake, call->walker);
+    raise_deferred_exception();
+    if (call->result == 0) {
+      break;
+    }
+    if (call->result == -1) {
+      raise_error(e_dfs_exception, call->error, "Failed to list directory %s",
+          walker_error_path(call->walker));
+    }
+    if (call->result == -3) {
+      ContentSummary* root;
+      raise_error(e_dfs_exception, call->error, "Failed to sum directory %s",
+          summary_table_entry(call->table, 0, &root));
+    }
+    // Runs pending interrupts such as signal handlers, which may raise, then
+    // resumes the walk.
+    check_interrupts();
+  }
+  if (call->root_only) {
+    ContentSummary* root;
+    summary_table_entry(call->table, 0, &root);
+    return new_content_summary(root);
+  }
+  summary_table_sort(call->table);
+  VALUE summaries = rb_hash_new();
+  long i;
+  for (i = 0; i < summary_table_size(call->table); i++) {
+    ContentSummary* summary;
+    const char* path = summary_table_entry(call->table, i, &summary);
+    rb_hash_aset(summaries, rb_str_new2(path), new_content_summary(summary));
+  }
+  return summaries;
+}
+
+static VALUE stop_summary_walk(VALUE ptr) {
+  SummaryCall* call = (SummaryCall*) ptr;
+  call->interrupted = 0;
+  call_without_gvl(call_summary_stop, call, &call->interrupted);
+  summary_table_free(call->table);
+  call->data->busy--;
+  return Qnil;
+}
+
+/*
+ * Sums the tree beneath path with num_threads threads listing directories,
+ * returning a Hash of the summaries of path and of each directory up to
+ * max_depth levels beneath it, keyed by their names, or if root_only is
+ * non-zero the summary of path alone.  If this fails, raises a DFSException.
+ */
+static VALUE summarize(FSData* data, VALUE path, int max_depth,
+    int num_threads, int root_only) {
+  FSCall stat_call;
+  stat_call.path = StringValueCStr(path);
+  run_fs_call(data, call_hdfs_get_path_info, &stat_call);
+  hdfsFileInfo* info = (hdfsFileInfo*) stat_call.pointer;
+  if (info == NULL) {
+    raise_error(e_dfs_exception, stat_call.error, "Failed to stat file %s",
+        StringValuePtr(path));
+  }
+  if (info->mKind != kObjectKindDirectory) {
+    ContentSummary summary;
+    summary.files = 1;
+    summary.directories = 0;
+    summary.bytes = info->mSize;
+    summary.replicated_bytes = info->mSize * info->mReplication;
+    // Frees the info before creating any object, which may raise.
+    if (root_only) {
+      hdfsFreeFileInfo(info, 1);
+      raise_deferred_exception();
+      return new_content_summary(&summary);
+    }
+    char* name = strdup(info->mName);
+    hdfsFreeFileInfo(info, 1);
+    if (name == NULL) {
+      raise_error(e_dfs_exception, ENOMEM, "Failed to sum file %s",
+          StringValuePtr(path));
+    }
+    VALUE r_name = rb_str_new2(name);
+    free(name);
+    VALUE summaries = rb_hash_new();
+    rb_hash_aset(summaries, r_name, new_content_summary(&summary));
+    raise_deferred_exception();
+    return summaries;
+  }
+  SummaryCall call;
+  call.data = data;
+  call.root_only = root_only;
+  call.table = summary_table_new(info->mName, max_depth);
+  hdfsFreeFileInfo(info, 1);
+  if (call.table == NULL) {
+    raise_error(e_dfs_exception, ENOMEM, "Failed to sum directory %s",
+        StringValuePtr(path));
+  }
+  WalkOptions walk_options;
+  memset(&walk_options, 0, sizeof(walk_options));
+  walk_options.num_threads = num_threads;
+  walk_options.min_size = -1;
+  walk_options.max_size = -1;
+  walk_options.newer_than = -1;
+  walk_options.older_than = -1;
+  call.walker = walker_start(data->fs, StringValueCStr(path), &walk_options);
+  if (call.walker == NULL) {
+    int error = errno;
+    summary_table_free(call.table);
+    raise_error(e_dfs_exception, error, "Failed to start crawling %s",
+        StringValuePtr(path));
+  }
+  // Keeps the file system from being disconnected until the walk stops.
+  data->busy++;
+  VALUE summaries = rb_ensure(run_summary_walk, (VALUE) &call,
+      stop_summary_walk, (VALUE) &call);
+  raise_deferred_exception();
+  return summaries;
+}
+
+/*
+ * Returns the threads option of du and content_summary, raising unless it
+ * is positive.
+ */
+static int summary_threads(VALUE options) {
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  int num_threads = NIL_P(r_threads) ? HDFS_DEFAULT_WALK_THREADS :
+      NUM2INT(r_threads);
+  if (num_threads <= 0) {
+    rb_raise(rb_eArgError, "threads must be positive");
+  }
+  return num_threads;
+}
+
+/*
+ * Drops anything the metadata cache of the file system holds about the
+ * supplied path, and about everything beneath it if subtree is non-zero.
+ */
+static void invalidate_path(FSData* data, VALUE path, int subtree) {
+  if (data->cache != NULL) {
+    metadata_cache_invalidate(data->cache, StringValueCStr(path), subtree);
+  }
+}
+
+/*
+ * Caches the result of fetching path if the file system has a metadata cache,
+ * which then owns infos; otherwise frees infos.
+ */
+static void release_infos(FSData* data, MetadataKind kind, VALUE path,
+    hdfsFileInfo* infos, int num_entries, int error,
+    unsigned long generation) {
+  if (data->cache != NULL) {
+    metadata_cache_put(data->cache, kind, StringValueCStr(path), infos,
+        num_entries, error, generation);
+  } else if (infos != NULL) {
+    hdfsFreeFileInfo(infos, num_entries);
+  }
+}
+
+/* Adds a pair from the conf option to the configuration, as Strings. */
+static int merge_conf_pair(VALUE key, VALUE value, VALUE conf) {
+  if (!NIL_P(value)) {
+    rb_hash_aset(conf, rb_obj_as_string(key), rb_obj_as_string(value));
+  }
+  return ST_CONTINUE;
+}
+
+/*
+ * Returns the options of a method taking them either as keywords or, as
+ * before it took keywords, as a trailing Hash, or a shared empty Hash if it
+ * was given neither.
+ */
+static VALUE options_hash(VALUE options, VALUE keywords) {
+  if (!NIL_P(keywords)) {
+    if (!NIL_P(options)) {
+      rb_raise(rb_eArgError, "options given both as a Hash and as keywords");
+    }
+    return keywords;
+  }
+  if (NIL_P(options)) {
+    return no_options;
+  }
+  if (TYPE(options) != T_HASH) {
+    rb_raise(rb_eArgError, "options must be of type Hash");
+  }
+  return options;
+}
+
+/*
+ * Returns whether mode, ignoring case, is empty or is the single character
+ * flag, as open has always matched modes.
+ */
+static int mode_matches(VALUE mode, char flag) {
+  StringValue(mode);
+  long length = RSTRING_LEN(mode);
+  return length == 0 ||
+      (length == 1 && tolower((unsigned char) RSTRING_PTR(mode)[0]) == flag);
+}
+
+/* Returns whether a call failed with errnum because its path is missing. */
+static int is_missing(int errnum) {
+  return errnum == ENOENT || errnum == ENOTDIR;
+}
+
+/*
+ * Returns the result of a non-raising method which failed with errnum: what
+ * its block returns given errnum, or nil if it was given no block.
+ */
+static VALUE failed_with(int errnum) {
+  return rb_block_given_p() ? rb_yield(INT2FIX(errnum)) : Qnil;
+}
+
+/*
+ * Builds the client configuration selected by the profile and conf options
+ * as a frozen Hash of Strings, with conf taking precedence.
+ */
+static VALUE build_conf(VALUE options) {
+  VALUE conf = rb_hash_new();
+  VALUE r_profile = rb_hash_aref(options, sym_profile);
+  if (r_profile == sym_low_latency) {
+    const char** pair;
+    for (pair = LOW_LATENCY_CONF; *pair != NULL; pair += 2) {
+      rb_hash_aset(conf, rb_str_new2(pair[0]), rb_str_new2(pair[1]));
+    }
+  } else if (!NIL_P(r_profile)) {
+    rb_raise(rb_eArgError, "unknown profile %s",
+        RSTRING_PTR(rb_inspect(r_profile)));
+  }
+  VALUE r_conf = rb_hash_aref(options, sym_conf);
+  if (!NIL_P(r_conf)) {
+    Check_Type(r_conf, T_HASH);
+    rb_hash_foreach(r_conf, merge_conf_pair, conf);
+  }
+  return rb_obj_freeze(conf);
+}
+
+static void* call_transfer_wait(void* ptr) {
+  TransferCall* call = (TransferCall*) ptr;
+  call->result = transfer_wait(call->transfer, &call->num_done,
+      &call->interrupted);
+  return NULL;
+}
+
+static void* call_transfer_stop(void* ptr) {
+  TransferCall* call = (TransferCall*) ptr;
+  transfer_stop(call->transfer);
+  return NULL;
+}
+
+static double monotonic_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Describes how far a batch transfer has got as a Hash. */
+static VALUE transfer_progress(TransferCall* call) {
+  double seconds = monotonic_seconds() - call->started;
+  VALUE progress = rb_hash_new();
+  rb_hash_aset(progress, sym_files, LONG2NUM(call->num_done));
+  rb_hash_aset(progress, sym_total, LONG2NUM(call->num_files));
+  rb_hash_aset(progress, sym_bytes, LL2NUM(call->num_bytes));
+  rb_hash_aset(progress, sym_seconds, DBL2NUM(seconds));
+  rb_hash_aset(progress, sym_bytes_per_second,
+      DBL2NUM(seconds > 0 ? call->num_bytes / seconds : 0.0));
+  return progress;
+}
+
+/*
+ * Records the result of each file as the transfer finishes it, yielding the
+ * progress of the batch after each group of files if a block is given.
+ */
+static VALUE collect_transfer_results(VALUE ptr) {
+  TransferCall* call = (TransferCall*) ptr;
+  for (;;) {
+    long seen = call->num_done;
+    call->interrupted = 0;
+    call_without_gvl_wakeable(call_transfer_wait, call, &call->interrupted,
+        transfer_wake, call->transfer);
+    raise_deferred_exception();
+    if (call->result == 0) {
+      return Qnil;
+    }
+    if (call->result == -2) {
+      // Runs pending interrupts such as signal handlers, which may raise, then
+      // resumes waiting.
+      check_interrupts();
+      continue;
+    }
+    long order;
+    for (order = seen; order < call->num_done; order++) {
+      int error;
+      tOffset num_bytes;
+      long index = transfer_finished(call->transfer, order, &error,
+          &num_bytes);
+      rb_ary_store(call->results, index, error == 0 ? Qtrue : INT2NUM(error));
+      call->num_bytes += num_bytes;
+    }
+    if (rb_block_given_p()) {
+      rb_yield(transfer_progress(call));
+    }
+  }
+}
+
+static VALUE stop_transfer(VALUE ptr) {
+  TransferCall* call = (TransferCall*) ptr;
+  call->interrupted = 0;
+  call_without_gvl(call_transfer_stop, call, &call->interrupted);
+  call->data->busy--;
+  if (call->to_data != NULL) {
+    call->to_data->busy--;
+  }
+  return Qnil;
+}
+
+/*
+ * Converts path to a String and returns a frozen copy of it, whose bytes stay
+ * put however the original is changed for as long as the copy is kept, so
+ * that a batch can use them with the GVL released.
+ */
+static VALUE frozen_path(VALUE path) {
+  StringValueCStr(path);
+  return rb_str_new_frozen(path);
+}
+
+/*
+ * Copies a batch of [from_path, to_path] pairs, given as an Array or a Hash,
+ * with the supplied kind of transfer, returning an Array with true or the
+ * errno for each pair.  Drops destinations from the metadata cache of
+ * to_data, if not NULL.
+ */
+static VALUE run_transfer(FSData* data, FSData* to_data, VALUE pairs,
+    TransferKind kind, VALUE options, int invalidate) {
+  options = NIL_P(options) ? rb_hash_new() : options;
+  Check_Type(options, T_HASH);
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  TransferOptions transfer_options;
+  transfer_options.kind = kind;
+  transfer_options.fs = data->fs;
+  transfer_options.to_fs = to_data != NULL ? to_data->fs : data->fs;
+  transfer_options.num_threads = NIL_P(r_threads) ?
+      HDFS_DEFAULT_TRANSFER_THREADS : NUM2INT(r_threads);
+  transfer_options.buffer_size = HDFS_MAX_IO_CHUNK_SIZE;
+  if (transfer_options.num_threads < 1) {
+    rb_raise(rb_eArgError, "threads must be positive");
+  }
+  pairs = rb_funcall(pairs, id_to_a, 0);
+  Check_Type(pairs, T_ARRAY);
+  TransferCall call;
+  call.data = data;
+  call.to_data = to_data != data ? to_data : NULL;
+  call.num_files = RARRAY_LEN(pairs);
+  call.num_done = 0;
+  call.num_bytes = 0;
+  call.to_paths = rb_ary_new_capa(call.num_files);
+  call.results = rb_ary_new_capa(call.num_files);
+  // Keeps each converted source path alive until the transfer has copied
+  // it, as call.to_paths does the destinations.
+  VALUE from_strings = rb_ary_new_capa(call.num_files);
+  VALUE paths_tmp;
+  const char** from_paths = ALLOCV_N(const char*, paths_tmp,
+      call.num_files * 2 + 1);
+  const char** to_paths = from_paths + call.num_files;
+  long i;
+  for (i = 0; i < call.num_files; i++) {
+    VALUE pair = rb_check_array_type(rb_ary_entry(pairs, i));
+    if (NIL_P(pair) || RARRAY_LEN(pair) != 2) {
+      rb_raise(rb_eArgError, "each pair must be a [from_path, to_path] Array");
+    }
+    VALUE from_path = frozen_path(rb_ary_entry(pair, 0));
+    rb_ary_push(from_strings, from_path);
+    VALUE to_path = frozen_path(rb_ary_entry(pair, 1));
+    rb_ary_push(call.to_paths, to_path);
+  }
+  for (i = 0; i < call.num_files; i++) {
+    from_paths[i] = RSTRING_PTR(rb_ary_entry(from_strings, i));
+    to_paths[i] = RSTRING_PTR(rb_ary_entry(call.to_paths, i));
+  }
+  // Copies the paths before anything else runs so that they need not stay
+  // put.
+  call.transfer = transfer_start(&transfer_options, from_paths, to_paths,
+      call.num_files);
+  ALLOCV_END(paths_tmp);
+  RB_GC_GUARD(from_strings);
+  if (call.transfer == NULL) {
+    raise_error(e_dfs_exception, errno, "Failed to start transfer");
+  }
+  // Keeps the file systems from being disconnected until the batch stops.
+  data->busy++;
+  if (call.to_data != NULL) {
+    call.to_data->busy++;
+  }
+  call.started = monotonic_seconds();
+  rb_ensure(collect_transfer_results, (VALUE) &call, stop_transfer,
+      (VALUE) &call);
+  if (invalidate) {
+    FSData* cache_data = call.to_data != NULL ? call.to_data : data;
+    for (i = 0; i < call.num_files; i++) {
+      invalidate_path(cache_data, rb_ary_entry(call.to_paths, i), 1);
+    }
+  }
+  raise_deferred_exception();
+  return call.results;
+}
+
+static void batch_item(void* ptr, long index) {
+  BatchCall* batch = (BatchCall*) ptr;
+  FSCall call = batch->call;
+  call.path = batch->paths[index];
+  errno = 0;
+  batch->func(&call);
+  batch->errors[index] = call.result == -1 ? (call.error != 0 ? call.error :
+      EIO) : 0;
+}
+
+static void* call_batch_run(void* ptr) {
+  BatchCall* batch = (BatchCall*) ptr;
+  batch->next = batch_run(batch_item, batch, batch->next, batch->num_paths,
+      batch->num_threads, &batch->interrupted);
+  return NULL;
+}
+
+/* Makes the batch, running pending interrupts whenever it is interrupted. */
+static VALUE run_batch_calls(VALUE ptr) {
+  BatchCall* batch = (BatchCall*) ptr;
+  while (batch->next < batch->num_paths) {
+    batch->interrupted = 0;
+    call_without_gvl(call_batch_run, batch, &batch->interrupted);
+    if (batch->next < batch->num_paths) {
+      // Runs pending interrupts, which may raise, then resumes the batch.
+      batch->data->busy--;
+      check_interrupts();
+      batch->data->busy++;
+    }
+  }
+  return Qnil;
+}
+
+/*
+ * Drops the paths already made from the metadata cache, even if an interrupt
+ * raised before the rest were.
+ */
+static VALUE invalidate_batch(VALUE ptr) {
+  BatchCall* batch = (BatchCall*) ptr;
+  batch->data->busy--;
+  long i;
+  for (i = 0; i < batch->next; i++) {
+    invalidate_path(batch->data, rb_ary_entry(batch->path_strings, i),
+        batch->subtree);
+  }
+  return Qnil;
+}
+
+/*
+ * Makes the call of the supplied batch on each of the supplied paths, with
+ * the GVL released once for the whole batch, returning an Array of true or
+ * the errno for each path.  Drops each path from the metadata cache, along
+ * with everything beneath it if subtree is non-zero.
+ */
+static VALUE run_batch(FSData* data, VALUE paths, BatchCall* batch,
+    VALUE options, int subtree) {
+  options = NIL_P(options) ? rb_hash_new() : options;
+  Check_Type(options, T_HASH);
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  batch->num_threads = NIL_P(r_threads) ? 1 : NUM2INT(r_threads);
+  if (batch->num_threads < 1) {
+    rb_raise(rb_eArgError, "threads must be positive");
+  }
+  paths = rb_ary_to_ary(paths);
+  batch->num_paths = RARRAY_LEN(paths);
+  // Converts every path before taking any pointer, since a conversion may
+  // run Ruby code, and keeps the frozen copies in a frozen Array of the
+  // batch's own, which nothing else can change while the GVL is released.
+  VALUE path_strings = rb_ary_new_capa(batch->num_paths);
+  long i;
+  for (i = 0; i < batch->num_paths; i++) {
+    rb_ary_push(path_strings, frozen_path(rb_ary_entry(paths, i)));
+  }
+  rb_obj_freeze(path_strings);
+  VALUE paths_tmp, errors_tmp;
+  batch->paths = ALLOCV_N(const char*, paths_tmp, batch->num_paths + 1);
+  batch->errors = ALLOCV_N(int, errors_tmp, batch->num_paths + 1);
+  for (i = 0; i < batch->num_paths; i++) {
+    batch->paths[i] = RSTRING_PTR(rb_ary_entry(path_strings, i));
+  }
+  batch->data = data;
+  batch->call.fs = data->fs;
+  batch->path_strings = path_strings;
+  batch->subtree = subtree;
+  batch->next = 0;
+  data->busy++;
+  rb_ensure(run_batch_calls, (VALUE) batch, invalidate_batch, (VALUE) batch);
+  VALUE results = rb_ary_new_capa(batch->num_paths);
+  for (i = 0; i < batch->num_paths; i++) {
+    rb_ary_push(results, batch->errors[i] == 0 ? Qtrue :
+        INT2NUM(batch->errors[i]));
+  }
+  ALLOCV_END(paths_tmp);
+  ALLOCV_END(errors_tmp);
+  RB_GC_GUARD(path_strings);
+  raise_deferred_exception();
+  return results;
+}
+
+/* Returns the frozen String shared by every mention of the supplied host. */
+static VALUE host_name(const char* host) {
+  st_data_t name;
+  if (st_lookup(host_names, (st_data_t) host, &name)) {
+    return (VALUE) name;
+  }
+  VALUE host_string = rb_obj_freeze(rb_str_new2(host));
+  rb_ary_push(host_name_list, host_string);
+  st_insert(host_names, (st_data_t) strdup(host), (st_data_t) host_string);
+  return host_string;
+}
+
+/*
+ * Copies the hosts of one block, as returned by hdfsGetHosts, into a frozen
+ * Array of shared host Strings.
+ */
+static VALUE block_hosts(char** hosts) {
+  VALUE hosts_array = rb_ary_new();
+  size_t i;
+  for (i = 0; hosts[i]; i++) {
+    rb_ary_push(hosts_array, host_name(hosts[i]));
+  }
+  return rb_obj_freeze(hosts_array);
+}
+
+/* Converts a Time or Integer into seconds since the epoch. */
+static tTime time_option(VALUE time) {
+  return NIL_P(time) ? -1 : NUM2LONG(rb_funcall(time, id_to_i, 0));
+}
+
+/* Reads the options taken by crawl into walk_options. */
+static void parse_walk_options(VALUE options, WalkOptions* walk_options) {
+  if (TYPE(options) != T_HASH) {
+    rb_raise(rb_eArgError, "options must be of type Hash");
+  }
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  VALUE r_max_depth = rb_hash_aref(options, sym_max_depth);
+  VALUE r_name = rb_hash_aref(options, sym_name);
+  VALUE r_type = rb_hash_aref(options, sym_type);
+  VALUE r_min_size = rb_hash_aref(options, sym_min_size);
+  VALUE r_max_size = rb_hash_aref(options, sym_max_size);
+  walk_options->num_threads = NIL_P(r_threads) ? HDFS_DEFAULT_WALK_THREADS :
+      NUM2INT(r_threads);
+  walk_options->max_depth = NIL_P(r_max_depth) ? 0 : NUM2INT(r_max_depth);
+  walk_options->name_pattern = NIL_P(r_name) ? NULL :
+      StringValueCStr(r_name);
+  walk_options->kind = 0;
+  if (r_type == sym_file) {
+    walk_options->kind = kObjectKindFile;
+  } else if (r_type == sym_directory) {
+    walk_options->kind = kObjectKindDirectory;
+  } else if (!NIL_P(r_type)) {
+    rb_raise(rb_eArgError, "type must be :file or :directory");
+  }
+  walk_options->min_size = NIL_P(r_min_size) ? -1 : NUM2LL(r_min_size);
+  walk_options->max_size = NIL_P(r_max_size) ? -1 : NUM2LL(r_max_size);
+  walk_options->newer_than = time_option(rb_hash_aref(options, sym_newer_than));
+  walk_options->older_than = time_option(rb_hash_aref(options, sym_older_than));
+  if (walk_options->num_threads <= 0 || walk_options->max_depth < 0) {
+    rb_raise(rb_eArgError,
+        "threads must be positive and max_depth not negative");
+  }
+}
+
+/*
+ * Walks the tree beneath path, yielding each matching entry or appending it
+ * to listing if it is not nil.  If this fails, raises a DFSException.
+ */
+static void run_walk(FSData* data, VALUE path, WalkOptions* walk_options,
+    VALUE listing) {
+  WalkCall call;
+  call.data = data;
+  call.batch = NULL;
+  call.listing = listing;
+  call.walker = walker_start(data->fs, StringValueCStr(path), walk_options);
+  if (call.walker == NULL) {
+    raise_error(e_dfs_exception, errno, "Failed to start crawling %s",
+        StringValuePtr(path));
+  }
+  // Keeps the file system from being disconnected until the walk stops.
+  data->busy++;
+  rb_ensure(yield_walk_results, (VALUE) &call, stop_walk, (VALUE) &call);
+  raise_deferred_exception();
+}
+
 /*
  * HDFS::FileSystem
  */
@@ -48,6 +1275,8 @@ FSData* get_FSData(VALUE rb_object) {
 VALUE HDFS_File_System_alloc(VALUE klass) {
   FSData* data = ALLOC_N(FSData, 1);
   data->fs = NULL;
+  data->busy = 0;
+  data->cache = NULL;
   VALUE instance = Data_Wrap_Struct(klass, NULL, free_fs_data, data);
   return instance;
 }
@@ -62,12 +1291,68 @@ VALUE HDFS_File_System_disconnect(VALUE self) {
   FSData* data = NULL;
   Data_Get_Struct(self, FSData, data);
   if (data->fs != NULL) {
-    hdfsDisconnect(data->fs);
+    if (data->busy > 0) {
+      rb_raise(e_dfs_exception,
+          "Failed to disconnect: in use by another thread");
+      return Qnil;
+    }
+    FSCall call;
+    call.fs = data->fs;
+    call.interrupted = 0;
     data->fs = NULL;
+    call_without_gvl(call_hdfs_disconnect, &call, &call.interrupted);
+    if (data->cache != NULL) {
+      metadata_cache_clear(data->cache);
+    }
   }
+  raise_deferred_exception();
   return Qnil;
 }
 
+/**
+ * call-seq:
+ *    hdfs.block_locations(path) -> retval
+ *
+ * Returns an Array of HDFS::BlockLocation objects describing every block of
+ * the file at the supplied path, in order: the offset and length in bytes of
+ * each block, and the DataNodes holding a replica of it as a frozen Array of
+ * hostnames.  Each hostname is one frozen String shared between blocks and
+ * calls.  Lengths assume that all but the last block are the size of the
+ * file's block size.  Raises a DFSException if this fails.
+ */
+VALUE HDFS_File_System_block_locations(VALUE self, VALUE path) {
+  FSData* data = get_FSData(self);
+  FSCall call;
+  call.path = StringValueCStr(path);
+  run_fs_call(data, call_hdfs_get_block_locations, &call);
+  char*** hosts = (char***) call.pointer;
+  if (call.length < 0 ||
+      (hosts == NULL && (call.length != 0 || call.result == 0))) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while retrieving block locations at path: %s",
+        StringValueCStr(path));
+    return Qnil;
+  }
+  VALUE locations = rb_ary_new();
+  if (hosts == NULL) {
+    raise_deferred_exception();
+    return locations;
+  }
+  tOffset size = call.length;
+  tOffset block_size = call.result > 0 ? call.result : size;
+  tOffset offset = 0;
+  size_t i;
+  for (i = 0; hosts[i] && offset < size; i++) {
+    tOffset length = size - offset < block_size ? size - offset : block_size;
+    rb_ary_push(locations, rb_struct_new(c_block_location, LL2NUM(offset),
+        LL2NUM(length), block_hosts(hosts[i])));
+    offset += length;
+  }
+  hdfsFreeHosts(hosts);
+  raise_deferred_exception();
+  return locations;
+}
+
 /**
  * call-seq:
  *    hdfs.capacity -> retval
@@ -77,13 +1362,14 @@ VALUE HDFS_File_System_disconnect(VALUE self) {
  */
 VALUE HDFS_File_System_capacity(VALUE self) {
   FSData* data = get_FSData(self);
-  long capacity = hdfsGetCapacity(data->fs);
-  if (capacity < 0) {
-    rb_raise(e_dfs_exception, "Error while retrieving capacity: %s",
-        get_error(errno));
+  FSCall call;
+  run_fs_call(data, call_hdfs_get_capacity, &call);
+  if (call.result < 0) {
+    raise_error(e_dfs_exception, call.error, "Error while retrieving capacity");
     return Qnil;
   }
-  return LONG2NUM(capacity);
+  raise_deferred_exception();
+  return LONG2NUM(call.result);
 }
 
 /**
@@ -96,14 +1382,261 @@ VALUE HDFS_File_System_capacity(VALUE self) {
 VALUE HDFS_File_System_cd(VALUE self, VALUE path) {
   FSData* data = get_FSData(self);
   if (hdfsSetWorkingDirectory(data->fs, StringValuePtr(path)) < 0) {
-    rb_raise(e_dfs_exception,
-        "Failed to change current working directory to path %s: %s",
-        StringValuePtr(path), get_error(errno));
+    raise_error(e_dfs_exception, errno,
+        "Failed to change current working directory to path %s",
+        StringValuePtr(path));
     return Qnil;
   }
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    hdfs.cache_stats -> stats
+ *
+ * Returns a Hash describing the metadata cache, with the keys :hits,
+ * :misses, :evictions, :invalidations and :entries, or nil if this file
+ * system has no cache.
+ */
+VALUE HDFS_File_System_cache_stats(VALUE self) {
+  FSData* data = NULL;
+  Data_Get_Struct(self, FSData, data);
+  if (data->cache == NULL) {
+    return Qnil;
+  }
+  MetadataCacheStats stats;
+  metadata_cache_stats(data->cache, &stats);
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, sym_hits, ULONG2NUM(stats.hits));
+  rb_hash_aset(hash, sym_misses, ULONG2NUM(stats.misses));
+  rb_hash_aset(hash, sym_evictions, ULONG2NUM(stats.evictions));
+  rb_hash_aset(hash, sym_invalidations, ULONG2NUM(stats.invalidations));
+  rb_hash_aset(hash, sym_entries, LONG2NUM(stats.entries));
+  return hash;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.close_idle_connections -> num_closed
+ *
+ * Disconnects every pooled connection that no HDFS::FileSystem object is
+ * using, returning how many were closed as an Integer.
+ */
+VALUE HDFS_File_System_s_close_idle_connections(VALUE klass) {
+  return INT2NUM(connection_pool_close_idle());
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.pool_stats -> stats
+ *
+ * Returns a Hash describing the process-wide connection pool, with the keys
+ * :hits and :misses counting connections made with and without reusing a
+ * pooled one, :connections and :active counting the connections held and
+ * those in use, and :references counting the objects using them.
+ */
+VALUE HDFS_File_System_s_pool_stats(VALUE klass) {
+  ConnectionPoolStats stats;
+  connection_pool_stats(&stats);
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, sym_hits, ULONG2NUM(stats.hits));
+  rb_hash_aset(hash, sym_misses, ULONG2NUM(stats.misses));
+  rb_hash_aset(hash, sym_connections, LONG2NUM(stats.connections));
+  rb_hash_aset(hash, sym_active, LONG2NUM(stats.active));
+  rb_hash_aset(hash, sym_references, LONG2NUM(stats.references));
+  return hash;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.block_cache_stats -> stats
+ *
+ * Returns a Hash describing the process-wide cache of pages read by files
+ * opened with block_cache, with the keys :hits and :misses counting pages
+ * read from the cache and from HDFS, :hit_ratio, the fraction of pages read
+ * from the cache, :evictions and :evicted_bytes counting pages dropped and
+ * the file data they held, :pages and :bytes counting pages cached and the
+ * file data they hold, :allocated_bytes, the memory allocated for pages, and
+ * :budget and :page_size.
+ */
+VALUE HDFS_File_System_s_block_cache_stats(VALUE klass) {
+  BlockCacheStats stats;
+  block_cache_stats(&stats);
+  unsigned long reads = stats.hits + stats.misses;
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, sym_hits, ULONG2NUM(stats.hits));
+  rb_hash_aset(hash, sym_misses, ULONG2NUM(stats.misses));
+  rb_hash_aset(hash, sym_hit_ratio,
+      rb_float_new(reads > 0 ? (double) stats.hits / reads : 0.0));
+  rb_hash_aset(hash, sym_evictions, ULONG2NUM(stats.evictions));
+  rb_hash_aset(hash, sym_evicted_bytes, ULONG2NUM(stats.evicted_bytes));
+  rb_hash_aset(hash, sym_pages, LONG2NUM(stats.pages));
+  rb_hash_aset(hash, sym_bytes, LONG2NUM(stats.bytes));
+  rb_hash_aset(hash, sym_allocated_bytes, LONG2NUM(stats.allocated_bytes));
+  rb_hash_aset(hash, sym_budget, LONG2NUM(stats.budget));
+  rb_hash_aset(hash, sym_page_size, LONG2NUM(stats.page_size));
+  return hash;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.clear_block_cache -> num_evicted
+ *
+ * Evicts every page cached for files opened with block_cache that no read is
+ * copying from, freeing the memory allocated for them, and returns how many
+ * were evicted as an Integer.
+ */
+VALUE HDFS_File_System_s_clear_block_cache(VALUE klass) {
+  return LONG2NUM(block_cache_clear());
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.clear_staging_cache -> num_evicted
+ *
+ * Evicts every file staged by open with cache that no HDFS::File is reading,
+ * returning how many were evicted as an Integer.
+ */
+VALUE HDFS_File_System_s_clear_staging_cache(VALUE klass) {
+  return LONG2NUM(staging_cache_clear());
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.configure_block_cache(options={}) -> success
+ *
+ * Configures the process-wide cache of pages read by files opened with
+ * block_cache, evicting pages at once if they no longer fit the budget.
+ *
+ * options can have the following keys:
+ *
+ * * *budget*: the most bytes of pages to allocate, rounded down to whole
+ *   pages, beyond which the least recently used pages are evicted
+ *   (default: 268435456)
+ */
+VALUE HDFS_File_System_s_configure_block_cache(int argc, VALUE* argv,
+    VALUE klass) {
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  Check_Type(options, T_HASH);
+  VALUE r_budget = rb_hash_aref(options, sym_budget);
+  if (!NIL_P(r_budget)) {
+    long budget = NUM2LONG(r_budget);
+    if (budget < 0) {
+      rb_raise(rb_eArgError, "budget must be positive");
+    }
+    block_cache_configure(budget);
+  }
+  return Qtrue;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.configure_io_pool(options={}) -> success
+ *
+ * Configures the process-wide pool of threads which run the blocking calls
+ * of fibers under a Fiber scheduler, such as those of the async gem, which
+ * are then suspended until their calls finish rather than blocking every
+ * other fiber.  Calls beyond the number of threads wait in a queue.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the most calls to run at once (default: 16)
+ */
+VALUE HDFS_File_System_s_configure_io_pool(int argc, VALUE* argv,
+    VALUE klass) {
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  Check_Type(options, T_HASH);
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  if (!NIL_P(r_threads)) {
+    int threads = NUM2INT(r_threads);
+    if (threads <= 0) {
+      rb_raise(rb_eArgError, "threads must be positive");
+    }
+    io_pool_configure(threads);
+  }
+  return Qtrue;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.configure_staging_cache(options={}) -> success
+ *
+ * Configures the process-wide cache of files staged by open with cache,
+ * evicting staged files at once if they no longer fit the budget.
+ *
+ * options can have the following keys:
+ *
+ * * *dir*: the local directory to stage files in, ideally on tmpfs, such as
+ *   '/dev/shm' (default: $TMPDIR, or else '/tmp')
+ * * *budget*: the most bytes to keep staged, evicting the least recently
+ *   used files not being read beyond it (default: 1073741824)
+ */
+VALUE HDFS_File_System_s_configure_staging_cache(int argc, VALUE* argv,
+    VALUE klass) {
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  Check_Type(options, T_HASH);
+  VALUE r_dir = rb_hash_aref(options, sym_dir);
+  VALUE r_budget = rb_hash_aref(options, sym_budget);
+  long budget = NIL_P(r_budget) ? -1 : NUM2LONG(r_budget);
+  if (!NIL_P(r_budget) && budget < 0) {
+    rb_raise(rb_eArgError, "budget must be positive");
+  }
+  staging_cache_configure(NIL_P(r_dir) ? NULL : StringValueCStr(r_dir),
+      budget);
+  return Qtrue;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.io_pool_stats -> stats
+ *
+ * Returns a Hash describing the pool of threads running calls for fibers
+ * under a Fiber scheduler, with the keys :jobs counting the calls run,
+ * :queued and :running counting those waiting for a thread and being run,
+ * :threads, the threads started, and :max_threads.
+ */
+VALUE HDFS_File_System_s_io_pool_stats(VALUE klass) {
+  IOPoolStats stats;
+  io_pool_stats(&stats);
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, sym_jobs, ULONG2NUM(stats.jobs));
+  rb_hash_aset(hash, sym_queued, LONG2NUM(stats.queued));
+  rb_hash_aset(hash, sym_running, LONG2NUM(stats.running));
+  rb_hash_aset(hash, sym_threads, INT2NUM(stats.threads));
+  rb_hash_aset(hash, sym_max_threads, INT2NUM(stats.max_threads));
+  return hash;
+}
+
+/**
+ * call-seq:
+ *    HDFS::FileSystem.staging_cache_stats -> stats
+ *
+ * Returns a Hash describing the process-wide cache of files staged by open
+ * with cache, with the keys :hits and :misses counting opens served with and
+ * without a staged copy, :evictions and :evicted_bytes counting the files
+ * dropped and their size, :entries and :bytes counting the files staged and
+ * their size, and :budget.
+ */
+VALUE HDFS_File_System_s_staging_cache_stats(VALUE klass) {
+  StagingCacheStats stats;
+  staging_cache_stats(&stats);
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, sym_hits, ULONG2NUM(stats.hits));
+  rb_hash_aset(hash, sym_misses, ULONG2NUM(stats.misses));
+  rb_hash_aset(hash, sym_evictions, ULONG2NUM(stats.evictions));
+  rb_hash_aset(hash, sym_evicted_bytes, ULONG2NUM(stats.evicted_bytes));
+  rb_hash_aset(hash, sym_entries, LONG2NUM(stats.entries));
+  rb_hash_aset(hash, sym_bytes, LONG2NUM(stats.bytes));
+  rb_hash_aset(hash, sym_budget, LONG2NUM(stats.budget));
+  return hash;
+}
+
 /**
  * call-seq:
  *    hdfs.chgrp(path, group) -> success
@@ -113,12 +1646,19 @@ VALUE HDFS_File_System_cd(VALUE self, VALUE path) {
  */
 VALUE HDFS_File_System_chgrp(VALUE self, VALUE path, VALUE group) {
   FSData* data = get_FSData(self);
-  if (hdfsChown(data->fs, StringValuePtr(path), NULL,
-          StringValuePtr(group)) == -1) {
-    rb_raise(e_dfs_exception, "Failed to chgrp path %s to group %s: %s",
-        StringValuePtr(path), StringValuePtr(group), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.owner = NULL;
+  call.group = StringValuePtr(group);
+  run_fs_call(data, call_hdfs_chown, &call);
+  invalidate_path(data, path, 0);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Failed to chgrp path %s to group %s", StringValuePtr(path),
+        StringValuePtr(group));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
@@ -136,14 +1676,44 @@ VALUE HDFS_File_System_chmod(int argc, VALUE* argv, VALUE self) {
   // Sets default mode if none is supplied.
   short hdfs_mode = NIL_P(mode) ? HDFS_DEFAULT_MODE : 
       octal_decimal(NUM2INT(mode));
-  if (hdfsChmod(data->fs, StringValuePtr(path), hdfs_mode) == -1) {
-    rb_raise(e_dfs_exception, "Failed to chmod path %s to mode %d: %s",
-        StringValuePtr(path), decimal_octal(hdfs_mode), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.mode = hdfs_mode;
+  run_fs_call(data, call_hdfs_chmod, &call);
+  invalidate_path(data, path, 0);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Failed to chmod path %s to mode %d", StringValuePtr(path),
+        decimal_octal(hdfs_mode));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    hdfs.chmod_many(paths, mode=644, options={}) -> results
+ *
+ * Changes the mode of each of the supplied paths, returning an Array with,
+ * for each path in order, true if it succeeded or the errno with which it
+ * failed.  A failure does not stop the rest of the batch.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of paths changed at once (default: 1)
+ */
+VALUE HDFS_File_System_chmod_many(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE paths, mode, options;
+  rb_scan_args(argc, argv, "12", &paths, &mode, &options);
+  BatchCall batch;
+  batch.func = call_hdfs_chmod;
+  batch.call.mode = NIL_P(mode) ? HDFS_DEFAULT_MODE :
+      octal_decimal(NUM2INT(mode));
+  return run_batch(data, paths, &batch, options, 0);
+}
+
 /**
  * call-seq:
  *    hdfs.chown(path, owner) -> retval
@@ -151,14 +1721,121 @@ VALUE HDFS_File_System_chmod(int argc, VALUE* argv, VALUE self) {
  * Changes the owner of the supplied path.  Returns True if successful; raises
  * a DFSException if this fails.
  */
-VALUE HDFS_File_System_chown(VALUE self, VALUE path, VALUE owner) {
+VALUE HDFS_File_System_chown(VALUE self, VALUE path, VALUE owner) {
+  FSData* data = get_FSData(self);
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.owner = StringValuePtr(owner);
+  call.group = NULL;
+  run_fs_call(data, call_hdfs_chown, &call);
+  invalidate_path(data, path, 0);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Failed to chown user path %s to user %s", StringValuePtr(path),
+        StringValuePtr(owner));
+    return Qnil;
+  }
+  raise_deferred_exception();
+  return Qtrue;
+}
+
+/**
+ * call-seq:
+ *    hdfs.chown_many(paths, owner, options={}) -> results
+ *
+ * Changes the owner, the group or both of each of the supplied paths; owner
+ * may be nil to change only the group.  Returns an Array with, for each path
+ * in order, true if it succeeded or the errno with which it failed.  A
+ * failure does not stop the rest of the batch.
+ *
+ * options can have the following keys:
+ *
+ * * *group*: the group to change to as well (default: unchanged)
+ * * *threads*: the number of paths changed at once (default: 1)
+ */
+VALUE HDFS_File_System_chown_many(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE paths, owner, options;
+  rb_scan_args(argc, argv, "21", &paths, &owner, &options);
+  VALUE group = NIL_P(options) ? Qnil : rb_hash_aref(options, sym_group);
+  if (NIL_P(owner) && NIL_P(group)) {
+    rb_raise(rb_eArgError, "owner or group must be given");
+  }
+  BatchCall batch;
+  batch.func = call_hdfs_chown;
+  batch.call.owner = NIL_P(owner) ? NULL : StringValueCStr(owner);
+  batch.call.group = NIL_P(group) ? NULL : StringValueCStr(group);
+  return run_batch(data, paths, &batch, options, 0);
+}
+
+/**
+ * call-seq:
+ *    hdfs.clear_cache -> success
+ *
+ * Drops everything held by the metadata cache, if this file system has one.
+ */
+VALUE HDFS_File_System_clear_cache(VALUE self) {
+  FSData* data = NULL;
+  Data_Get_Struct(self, FSData, data);
+  if (data->cache != NULL) {
+    metadata_cache_clear(data->cache);
+  }
+  return Qtrue;
+}
+
+/**
+ * call-seq:
+ *    hdfs.content_summary(path, options={}) -> summary
+ *
+ * Sums the tree beneath the supplied path natively, listing directories with
+ * several threads at once, and returns an HDFS::ContentSummary with the
+ * number of files and of directories, counting path itself, the logical
+ * bytes of the files and the bytes they take up counting every replica.  No
+ * object is created for any entry.  If this fails, raises a DFSException.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of directories listed at once (default: 8)
+ */
+VALUE HDFS_File_System_content_summary(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE path, options, keywords;
+  rb_scan_args(argc, argv, "11:", &path, &options, &keywords);
+  options = options_hash(options, keywords);
+  return summarize(data, path, 0, summary_threads(options), 1);
+}
+
+/**
+ * call-seq:
+ *    hdfs.copy_many(pairs, options={}) -> results
+ *    hdfs.copy_many(pairs, options={}) { |progress| ... } -> results
+ *
+ * Copies each [from_path, to_path] pair, given as an Array of pairs or a
+ * Hash, with a pool of native threads.  Returns an Array holding, for each
+ * pair in order, true if it was copied or the errno with which it failed;
+ * a failure does not stop the rest of the batch.  If a block is given,
+ * yields a Hash of progress as files finish, with the keys :files, :total,
+ * :bytes, :seconds and :bytes_per_second.
+ *
+ * options can have the following keys:
+ *
+ * * *to_fs*: the HDFS::FileSystem to copy to (default: this one)
+ * * *threads*: the number of files copied at once (default: 8)
+ */
+VALUE HDFS_File_System_copy_many(int argc, VALUE* argv, VALUE self) {
   FSData* data = get_FSData(self);
-  if (hdfsChown(data->fs, StringValuePtr(path), StringValuePtr(owner), NULL) == -1) {
-    rb_raise(e_dfs_exception, "Failed to chown user path %s to user %s: %s",
-        StringValuePtr(path), StringValuePtr(owner), get_error(errno));
-    return Qnil;
+  VALUE pairs, options;
+  rb_scan_args(argc, argv, "11", &pairs, &options);
+  FSData* to_data = data;
+  VALUE to_fs = NIL_P(options) ? Qnil :
+      rb_hash_aref(options, sym_to_fs);
+  if (!NIL_P(to_fs)) {
+    if (CLASS_OF(to_fs) != c_file_system) {
+      rb_raise(rb_eArgError, "to_fs must be of type HDFS::FileSystem");
+    }
+    to_data = get_FSData(to_fs);
   }
-  return Qtrue;
+  return run_transfer(data, to_data, pairs, kTransferCopy, options, 1);
 }
 
 /**
@@ -174,10 +1851,10 @@ VALUE HDFS_File_System_cp(int argc, VALUE* argv, VALUE self) {
   VALUE from_path, to_path, to_fs;
   rb_scan_args(argc, argv, "21", &from_path, &to_path, &to_fs);
   hdfsFS destFS = data->fs;
+  FSData* destFSData = data;
   // If no to_fs is supplied, copies to the current file system.
   if (!NIL_P(to_fs)) {
     if (CLASS_OF(to_fs) == c_file_system) {
-      FSData* destFSData = NULL;
       Data_Get_Struct(to_fs, FSData, destFSData);
       destFS = destFSData->fs;
     } else {
@@ -185,15 +1862,58 @@ VALUE HDFS_File_System_cp(int argc, VALUE* argv, VALUE self) {
       return Qnil;
     }
   }
-  if (hdfsCopy(data->fs, StringValuePtr(from_path), destFS,
-          StringValuePtr(to_path)) == -1) {
-    rb_raise(e_dfs_exception, "Failed to copy path: %s to path: %s: %s",
-        StringValuePtr(from_path), StringValuePtr(to_path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(from_path);
+  call.to_fs = destFS;
+  call.to_path = StringValuePtr(to_path);
+  run_fs_call(data, call_hdfs_copy, &call);
+  invalidate_path(destFSData, to_path, 1);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Failed to copy path: %s to path: %s", StringValuePtr(from_path),
+        StringValuePtr(to_path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    hdfs.crawl(path, options={}) { |file_info| ... } -> self
+ *    hdfs.crawl(path, options={}) -> enumerator
+ *
+ * Recursively lists the tree beneath the supplied path with a pool of native
+ * threads, yielding an HDFS::FileInfo object for each entry that matches the
+ * supplied options as soon as its directory has been listed.  Entries arrive
+ * in no particular order.  Threads list directories concurrently, each
+ * stealing work from the others once it runs out, and pause if the block
+ * falls behind.  Returns an Enumerator if no block is given.  If listing any
+ * directory fails, stops and raises a DFSException once the entries already
+ * listed have been yielded.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of threads listing directories (default: 8)
+ * * *max_depth*: the number of levels beneath path to yield, where 1 yields
+ *   only the entries of path itself (default: no limit)
+ * * *name*: a shell glob such as '*.log' which base names must match
+ * * *type*: :file or :directory to yield only that kind of entry
+ * * *min_size*, *max_size*: the range of sizes in bytes to yield
+ * * *newer_than*, *older_than*: a Time or Integer of seconds since the epoch
+ *   after or before which entries must have last been modified
+ */
+VALUE HDFS_File_System_crawl(int argc, VALUE* argv, VALUE self) {
+  RETURN_ENUMERATOR(self, argc, argv);
+  FSData* data = get_FSData(self);
+  VALUE path, options;
+  rb_scan_args(argc, argv, "11", &path, &options);
+  WalkOptions walk_options;
+  parse_walk_options(NIL_P(options) ? rb_hash_new() : options, &walk_options);
+  run_walk(data, path, &walk_options, Qnil);
+  return self;
+}
+
 /**
  * call-seq:
  *    hdfs.cwd -> success
@@ -206,8 +1926,8 @@ VALUE HDFS_File_System_cwd(VALUE self) {
   if (hdfsGetWorkingDirectory(data->fs, hdfsCurDir,
           HDFS_DEFAULT_STRING_LENGTH) == NULL) {
     xfree(hdfsCurDir);
-    rb_raise(e_dfs_exception, "Failed to get current working directory: %s",
-        get_error(errno));
+    raise_error(e_dfs_exception, errno,
+        "Failed to get current working directory");
     return Qnil;
   }
   VALUE cur_dir = rb_str_new2(hdfsCurDir);
@@ -224,13 +1944,16 @@ VALUE HDFS_File_System_cwd(VALUE self) {
  */
 VALUE HDFS_File_System_default_block_size(VALUE self) {
   FSData* data = get_FSData(self);
-  long block_size = hdfsGetDefaultBlockSize(data->fs);
-  if (block_size == -1) {
-    rb_raise(e_dfs_exception, "Error while retrieving default block size: %s",
-        get_error(errno));
+  FSCall call;
+  call.path = NULL;
+  run_fs_call(data, call_hdfs_get_default_block_size, &call);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while retrieving default block size");
     return Qnil;
   }
-  return LONG2NUM(block_size);
+  raise_deferred_exception();
+  return LONG2NUM(call.result);
 }
 
 /**
@@ -242,15 +1965,90 @@ VALUE HDFS_File_System_default_block_size(VALUE self) {
  */
 VALUE HDFS_File_System_default_block_size_at_path(VALUE self, VALUE path) {
   FSData* data = get_FSData(self);
-  long block_size = hdfsGetDefaultBlockSizeAtPath(data->fs,
-      StringValuePtr(path));
-  if (block_size == -1) {
-    rb_raise(e_dfs_exception,
-        "Error while retrieving default block size at path %s: %s",
-        StringValuePtr(path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  run_fs_call(data, call_hdfs_get_default_block_size, &call);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while retrieving default block size at path %s",
+        StringValuePtr(path));
+    return Qnil;
+  }
+  raise_deferred_exception();
+  return LONG2NUM(call.result);
+}
+
+/**
+ * call-seq:
+ *    hdfs.du(path, options={}) -> summaries
+ *
+ * Sums the tree beneath the supplied path natively like content_summary,
+ * returning a Hash of HDFS::ContentSummary objects keyed by name for path
+ * and for each directory up to depth levels beneath it, each counting the
+ * whole subtree beneath it.  Only these summaries are returned to Ruby, so
+ * capacity can be accounted for across a large namespace without creating
+ * an object per entry.  If this fails, raises a DFSException.
+ *
+ * options can have the following keys:
+ *
+ * * *depth*: the levels of directories beneath path to summarize, or 0 for
+ *   path alone (default: 1)
+ * * *threads*: the number of directories listed at once (default: 8)
+ */
+VALUE HDFS_File_System_du(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE path, options, keywords;
+  rb_scan_args(argc, argv, "11:", &path, &options, &keywords);
+  options = options_hash(options, keywords);
+  VALUE r_depth = rb_hash_aref(options, sym_depth);
+  int depth = NIL_P(r_depth) ? 1 : NUM2INT(r_depth);
+  if (depth < 0) {
+    rb_raise(rb_eArgError, "depth must not be negative");
+  }
+  return summarize(data, path, depth, summary_threads(options), 0);
+}
+
+/**
+ * call-seq:
+ *    hdfs.each_entry(path, options={}) { |file_info| ... } -> self
+ *    hdfs.each_entry(path, options={}) -> enumerator
+ *
+ * Lists the directory at the supplied path, yielding an HDFS::FileInfo object
+ * for each entry.  Unlike ls, objects are only created as each entry is
+ * yielded, so breaking out early or discarding entries keeps few of them
+ * alive.  Returns an Enumerator if no block is given, which lists the
+ * directory each time it is iterated.  If this fails, raises a DFSException.
+ *
+ * options can have the following keys:
+ *
+ * * *names_only*: yields only the name of each entry as a String, without
+ *   creating any FileInfo objects (default: false)
+ */
+VALUE HDFS_File_System_each_entry(int argc, VALUE* argv, VALUE self) {
+  RETURN_ENUMERATOR(self, argc, argv);
+  FSData* data = get_FSData(self);
+  VALUE path, options;
+  rb_scan_args(argc, argv, "11", &path, &options);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  if (TYPE(options) != T_HASH) {
+    rb_raise(rb_eArgError, "options must be of type Hash");
+  }
+  EntryListing listing;
+  listing.names_only = RTEST(rb_hash_aref(options, sym_names_only));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  run_fs_call(data, call_hdfs_list_directory, &call);
+  listing.infos = (hdfsFileInfo*) call.pointer;
+  listing.num_entries = call.num_entries;
+  if (listing.infos == NULL && listing.num_entries == -1) {
+    raise_error(e_dfs_exception, call.error, "Failed to list directory %s",
+        StringValuePtr(path));
     return Qnil;
   }
-  return LONG2NUM(block_size);
+  // Frees the native listing even if the block breaks or raises.
+  rb_ensure(yield_entries, (VALUE) &listing, free_entries, (VALUE) &listing);
+  raise_deferred_exception();
+  return self;
 }
 
 /**
@@ -258,12 +2056,69 @@ VALUE HDFS_File_System_default_block_size_at_path(VALUE self, VALUE path) {
  *    hdfs.exist?(path) -> file_existence
  *
  * Checks if a file exists at the supplied path.  If file exists, returns True;
- * if not, returns False.
+ * if not, returns False.  Raises a DFSException carrying the errno if the
+ * check itself fails, rather than taking that to mean the file is missing.
  */
 VALUE HDFS_File_System_exist(VALUE self, VALUE path) {
   FSData* data = get_FSData(self);
-  int success = hdfsExists(data->fs, StringValuePtr(path));
-  return success == 0 ? Qtrue : Qfalse;
+  FSCall call;
+  call.path = StringValueCStr(path);
+  uint64_t started = metrics_start();
+  int error;
+  if (data->cache != NULL) {
+    // Stats the path instead, so that the result can serve stat too.
+    hdfsFileInfo* info = NULL;
+    int num_entries;
+    if (!metadata_cache_get(data->cache, kMetadataPathInfo, call.path, &info,
+            &num_entries, &error)) {
+      unsigned long generation = metadata_cache_generation(data->cache);
+      run_fs_call(data, call_hdfs_get_path_info, &call);
+      info = (hdfsFileInfo*) call.pointer;
+      error = call.error;
+      release_infos(data, kMetadataPathInfo, path, info, 1, error, generation);
+    }
+    if (info != NULL) {
+      metrics_record(kMetricExist, started, 0, 0, path);
+      raise_deferred_exception();
+      return Qtrue;
+    }
+  } else {
+    run_fs_call(data, call_hdfs_exists, &call);
+    if (call.result == 0) {
+      metrics_record(kMetricExist, started, 0, 0, path);
+      raise_deferred_exception();
+      return Qtrue;
+    }
+    error = call.error;
+  }
+  metrics_record(kMetricExist, started, 0, is_missing(error) ? 0 : error,
+      path);
+  if (!is_missing(error)) {
+    raise_error(e_dfs_exception, error, "Failed to check for file %s",
+        StringValuePtr(path));
+  }
+  raise_deferred_exception();
+  return Qfalse;
+}
+
+/**
+ * call-seq:
+ *    hdfs.get_many(pairs, options={}) -> results
+ *    hdfs.get_many(pairs, options={}) { |progress| ... } -> results
+ *
+ * Downloads each [path, local_path] pair like copy_many, streaming each file
+ * through a native buffer into a local file, which is removed if the
+ * download fails.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of files downloaded at once (default: 8)
+ */
+VALUE HDFS_File_System_get_many(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE pairs, options;
+  rb_scan_args(argc, argv, "11", &pairs, &options);
+  return run_transfer(data, NULL, pairs, kTransferGet, options, 0);
 }
 
 /**
@@ -271,31 +2126,32 @@ VALUE HDFS_File_System_exist(VALUE self, VALUE path) {
  *    hdfs.get_hosts(path, start, length) -> retval
  *
  * Returns the hostnames of the DataNodes which serve the portion of the file
- * between the provided start and length bytes.  Raises a DFSException if this
- * fails.
+ * between the provided start and length bytes, as an Array for each block.
+ * Raises a DFSException if this fails.
  */
 VALUE HDFS_File_System_get_hosts(VALUE self, VALUE path, VALUE start,
     VALUE length) {
   FSData* data = get_FSData(self);
-  char*** hosts = hdfsGetHosts(data->fs, StringValuePtr(path), NUM2LONG(start),
-      NUM2LONG(length));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.start = NUM2LONG(start);
+  call.length = NUM2LONG(length);
+  run_fs_call(data, call_hdfs_get_hosts, &call);
+  char*** hosts = (char***) call.pointer;
   if (hosts == NULL) {
-    rb_raise(e_dfs_exception,
-        "Error while retrieving hosts at path: %s, start: %s, length: %lu: %s",
-        StringValuePtr(path), StringValuePtr(start), NUM2LONG(length),
-        get_error(errno));
+    raise_error(e_dfs_exception, call.error,
+        "Error while retrieving hosts at path: %s, start: %ld, length: %ld",
+        StringValuePtr(path), NUM2LONG(start), NUM2LONG(length));
     return Qnil;
   }
   // Builds a Ruby Array object out of the hosts reported by HDFS.
   VALUE hosts_array = rb_ary_new();
-  size_t i, j;
+  size_t i;
   for (i = 0; hosts[i]; i++) {
-    VALUE cur_block_hosts = rb_ary_new();
-    for (j = 0; hosts[i][j]; j++) {
-      rb_ary_push(cur_block_hosts, rb_str_new2(hosts[i][j]));
-    }
-    rb_ary_push(hosts_array, cur_block_hosts);
+    rb_ary_push(hosts_array, block_hosts(hosts[i]));
   }
+  hdfsFreeHosts(hosts);
+  raise_deferred_exception();
   return hosts_array;
 }
 
@@ -314,58 +2170,138 @@ VALUE HDFS_File_System_get_hosts(VALUE self, VALUE path, VALUE start,
  * * *host*: hostname or IP address of a Hadoop NameNode (default: '0.0.0.0')
  * * *port*: port through which to connect to Hadoop NameNode (default: 8020)
  * * *user*: user to connect to filesystem as (default: current user)
+ * * *conf*: a Hash of Hadoop client configuration, such as
+ *   'dfs.client.socket-timeout' => 30000, applied when connecting
+ * * *profile*: a preset of client configuration to start from, which conf
+ *   overrides; :low_latency enables short-circuit local reads (which also
+ *   need dfs.domain.socket.path) and hedged reads (default: none)
+ * * *kerb_ticket_cache*: the path of the Kerberos ticket cache to use
+ * * *new_instance*: connects a file system of its own rather than sharing the
+ *   pooled connection, and so the working directory, of other objects
+ *   created with the same options (default: false)
+ * * *cache*: caches the results of stat, exist? and ls for up to this many
+ *   paths, or 10000 if true; mutations made through this object drop what
+ *   they affect, but changes made elsewhere are only seen once entries expire
+ *   (default: no cache)
+ * * *cache_ttl*: the number of seconds for which results stay cached
+ *   (default: 5)
+ * * *cache_negative*: whether to cache paths found not to exist
+ *   (default: true)
  */
 VALUE HDFS_File_System_initialize(int argc, VALUE* argv, VALUE self) {
-  VALUE options;
-  rb_scan_args(argc, argv, "01", &options);
-
-  // Sets default values for keyword args, type-checks supplied value.
-  options = NIL_P(options) ? rb_hash_new() : options;
-  if (TYPE(options) != T_HASH) {
-    rb_raise(rb_eArgError, "options must be of type Hash");
-  }
+  VALUE options, keywords;
+  rb_scan_args(argc, argv, "01:", &options, &keywords);
+  options = options_hash(options, keywords);
 
   FSData* data = NULL;
   Data_Get_Struct(self, FSData, data);
 
-  VALUE r_local = rb_hash_aref(options, rb_eval_string(":local"));
-  VALUE r_user = rb_hash_aref(options, rb_eval_string(":user"));
+  FSCall call;
+  call.interrupted = 0;
+  call.flags = RTEST(rb_hash_aref(options, sym_new_instance));
+  VALUE r_kerb_ticket_cache = rb_hash_aref(options, sym_kerb_ticket_cache);
+  call.kerb_ticket_cache = NIL_P(r_kerb_ticket_cache) ? NULL :
+      StringValueCStr(r_kerb_ticket_cache);
+  // Copies the configuration out into C strings for the builder.
+  VALUE conf = build_conf(options);
+  rb_iv_set(self, "@conf", conf);
+  VALUE conf_pairs = rb_funcall(conf, id_to_a, 0);
+  VALUE conf_tmp;
+  call.num_conf = (int) RARRAY_LEN(conf_pairs);
+  call.conf = ALLOCV_N(const char*, conf_tmp, call.num_conf * 2 + 1);
+  int i;
+  for (i = 0; i < call.num_conf; i++) {
+    VALUE pair = rb_ary_entry(conf_pairs, i);
+    VALUE key = rb_ary_entry(pair, 0), value = rb_ary_entry(pair, 1);
+    call.conf[i * 2] = StringValueCStr(key);
+    call.conf[i * 2 + 1] = StringValueCStr(value);
+  }
+  VALUE r_local = rb_hash_aref(options, sym_local);
+  VALUE r_user = rb_hash_aref(options, sym_user);
+  call.user = NIL_P(r_user) ? NULL : StringValuePtr(r_user);
   if (r_local == Qtrue) {
-    if (NIL_P(r_user)) {
-      data->fs = hdfsConnect(NULL, 0);
-    } else {
-      data->fs = hdfsConnectAsUser(NULL, 0, StringValuePtr(r_user));
-    }
+    call.host = NULL;
+    call.port = 0;
+    call_without_gvl(call_hdfs_connect, &call, &call.interrupted);
+    data->fs = (hdfsFS) call.pointer;
     rb_iv_set(self, "@local", Qtrue);
   } else {
-    VALUE r_host = rb_hash_aref(options, rb_eval_string(":host"));
-    VALUE r_port = rb_hash_aref(options, rb_eval_string(":port"));
+    VALUE r_host = rb_hash_aref(options, sym_host);
+    VALUE r_port = rb_hash_aref(options, sym_port);
     // Sets default values for host and port if not supplied by user.
     char* hdfs_host = RTEST(r_host) ? StringValuePtr(r_host) :
         (char*) HDFS_DEFAULT_HOST;
     int hdfs_port   = RTEST(r_port) ? NUM2INT(r_port) :
         HDFS_DEFAULT_PORT;
-    if (NIL_P(r_user)) {
-      data->fs = hdfsConnect(hdfs_host, hdfs_port);
-    } else {
-      data->fs = hdfsConnectAsUser(hdfs_host, hdfs_port,
-          StringValuePtr(r_user));
+    call.host = hdfs_host;
+    call.port = hdfs_port;
+    call_without_gvl(call_hdfs_connect, &call, &call.interrupted);
+    data->fs = (hdfsFS) call.pointer;
+    if (!NIL_P(r_user)) {
       rb_iv_set(self, "@user", rb_str_new2(StringValuePtr(r_user))); 
     }
     rb_iv_set(self, "@local", Qfalse);
     rb_iv_set(self, "@host", rb_str_new2(hdfs_host));
     rb_iv_set(self, "@port", INT2NUM(hdfs_port));
   }
+  ALLOCV_END(conf_tmp);
  
   if (data->fs == NULL) {
-    rb_raise(e_connect_error, "Failed to connect to HDFS: %s",
-        get_error(errno));
+    raise_error(e_connect_error, call.error, "Failed to connect to HDFS");
     return Qnil;
   } 
 
+  VALUE r_cache = rb_hash_aref(options, sym_cache);
+  if (RTEST(r_cache)) {
+    VALUE r_cache_ttl = rb_hash_aref(options, sym_cache_ttl);
+    VALUE r_cache_negative = rb_hash_aref(options, sym_cache_negative);
+    long capacity = r_cache == Qtrue ? HDFS_DEFAULT_CACHE_SIZE :
+        NUM2LONG(r_cache);
+    double ttl = NIL_P(r_cache_ttl) ? HDFS_DEFAULT_CACHE_TTL :
+        NUM2DBL(r_cache_ttl);
+    if (capacity <= 0 || ttl <= 0) {
+      rb_raise(rb_eArgError, "cache and cache_ttl must be positive");
+    }
+    data->cache = metadata_cache_new(capacity, ttl,
+        NIL_P(r_cache_negative) || RTEST(r_cache_negative));
+  }
+
+  raise_deferred_exception();
   return self;
 }
 
+/**
+ * call-seq:
+ *    hdfs.listing(path, options={}) -> listing
+ *
+ * Lists the directory at the supplied path into an HDFS::Listing, which holds
+ * the name, size, modification time and replication of every entry in
+ * contiguous native columns rather than as one HDFS::FileInfo object each.
+ * Takes the same options as crawl to select entries; unless recursive is
+ * True, lists only the entries of path itself.  If this fails, raises a
+ * DFSException.
+ *
+ * options can also have the following key:
+ *
+ * * *recursive*: lists the whole tree beneath path with crawl's thread pool
+ *   (default: false)
+ */
+VALUE HDFS_File_System_listing(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE path, options;
+  rb_scan_args(argc, argv, "11", &path, &options);
+  options = NIL_P(options) ? rb_hash_new() : options;
+  WalkOptions walk_options;
+  parse_walk_options(options, &walk_options);
+  if (!RTEST(rb_hash_aref(options, sym_recursive))) {
+    walk_options.max_depth = 1;
+    walk_options.num_threads = 1;
+  }
+  VALUE listing = new_HDFS_Listing();
+  run_walk(data, path, &walk_options, listing);
+  return listing;
+}
+
 /**
  * call-seq:
  *    hdfs.ls(path) -> file_infos
@@ -376,20 +2312,40 @@ VALUE HDFS_File_System_initialize(int argc, VALUE* argv, VALUE self) {
 VALUE HDFS_File_System_ls(VALUE self, VALUE path) {
   FSData* data = get_FSData(self);
   VALUE file_infos = rb_ary_new();
-  int num_files = -1;
-  hdfsFileInfo* infos = hdfsListDirectory(data->fs, StringValuePtr(path),
-      &num_files);
+  FSCall call;
+  call.path = StringValueCStr(path);
+  hdfsFileInfo* infos = NULL;
+  int num_files = 0, error = 0, i;
+  uint64_t started = metrics_start();
+  if (data->cache != NULL && metadata_cache_get(data->cache,
+          kMetadataListing, call.path, &infos, &num_files, &error)) {
+    VALUE arena = new_HDFS_File_Info_arena(infos, num_files);
+    for (i = 0; i < num_files; i++) {
+      rb_ary_push(file_infos, wrap_HDFS_File_Info(arena, i));
+    }
+    metrics_record(kMetricLs, started, 0, 0, path);
+    return file_infos;
+  }
+  unsigned long generation = data->cache != NULL ?
+      metadata_cache_generation(data->cache) : 0;
+  run_fs_call(data, call_hdfs_list_directory, &call);
+  infos = (hdfsFileInfo*) call.pointer;
+  num_files = call.num_entries;
   if (infos == NULL && num_files == -1) {
-    rb_raise(e_dfs_exception, "Failed to list directory %s: %s",
-        StringValuePtr(path), get_error(errno));
+    metrics_record(kMetricLs, started, 0, call.error, path);
+    raise_error(e_dfs_exception, call.error, "Failed to list directory %s",
+        StringValuePtr(path));
     return Qnil;
   }
-  int i;
+  // Copies the whole listing into one arena which the entries share.
+  VALUE arena = new_HDFS_File_Info_arena(infos, num_files);
   for (i = 0; i < num_files; i++) {
-    hdfsFileInfo* cur_info = infos + i;
-    rb_ary_push(file_infos, new_HDFS_File_Info(cur_info));
+    rb_ary_push(file_infos, wrap_HDFS_File_Info(arena, i));
   }
-  hdfsFreeFileInfo(infos, num_files);
+  release_infos(data, kMetadataListing, path, infos, num_files, 0,
+      generation);
+  metrics_record(kMetricLs, started, 0, 0, path);
+  raise_deferred_exception();
   return file_infos;
 }
 
@@ -406,10 +2362,10 @@ VALUE HDFS_File_System_mv(int argc, VALUE* argv, VALUE self) {
   VALUE from_path, to_path, to_fs;
   rb_scan_args(argc, argv, "21", &from_path, &to_path, &to_fs);
   hdfsFS destFS = data->fs;
+  FSData* destFSData = data;
   // If no to_fs is supplied, moves to the current file system.
   if (!NIL_P(to_fs)) {
     if (CLASS_OF(to_fs) == c_file_system) {
-      FSData* destFSData = NULL;
       Data_Get_Struct(to_fs, FSData, destFSData);
       destFS = destFSData->fs;
     } else {
@@ -417,12 +2373,23 @@ VALUE HDFS_File_System_mv(int argc, VALUE* argv, VALUE self) {
       return Qnil;
     }
   }
-  if (hdfsMove(data->fs, StringValuePtr(from_path), destFS,
-          StringValuePtr(to_path)) == -1) {
-    rb_raise(e_dfs_exception, "Error while moving path %s to path %s: %s",
-        StringValuePtr(from_path), StringValuePtr(to_path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(from_path);
+  call.to_fs = destFS;
+  call.to_path = StringValuePtr(to_path);
+  uint64_t started = metrics_start();
+  run_fs_call(data, call_hdfs_move, &call);
+  invalidate_path(data, from_path, 1);
+  invalidate_path(destFSData, to_path, 1);
+  metrics_record(kMetricRename, started, 0,
+      call.result == -1 ? call.error : 0, from_path);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while moving path %s to path %s", StringValuePtr(from_path),
+        StringValuePtr(to_path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
@@ -435,14 +2402,256 @@ VALUE HDFS_File_System_mv(int argc, VALUE* argv, VALUE self) {
  */
 VALUE HDFS_File_System_mkdir(VALUE self, VALUE path) {
   FSData* data = get_FSData(self);
-  if (hdfsCreateDirectory(data->fs, StringValuePtr(path)) < 0) {
-    rb_raise(e_dfs_exception, "Could not create directory at path %s: %s",
-        StringValuePtr(path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  uint64_t started = metrics_start();
+  run_fs_call(data, call_hdfs_create_directory, &call);
+  invalidate_path(data, path, 0);
+  metrics_record(kMetricMkdir, started, 0, call.result < 0 ? call.error : 0,
+      path);
+  if (call.result < 0) {
+    raise_error(e_dfs_exception, call.error,
+        "Could not create directory at path %s", StringValuePtr(path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/*
+ * Opens a reader of a staged copy of the file at path for open with cache,
+ * waking to run interrupts and starting over if staging is interrupted.  If
+ * staging fails, raises, or returns nil with *error set unless error is NULL.
+ */
+static VALUE open_staged(FSData* data, VALUE path, int flags,
+    FileOptions* file_options, VALUE r_readahead, int* error) {
+  if (flags != O_RDONLY) {
+    rb_raise(rb_eArgError, "cache requires a file opened for reading");
+  }
+  if (RTEST(r_readahead) || file_options->codec != kCodecNone ||
+      file_options->retries > 0 || file_options->hedge_after > 0) {
+    rb_raise(rb_eArgError,
+        "cache cannot be combined with readahead, codec, retries or "
+        "hedge_after");
+  }
+  FSCall call;
+  call.path = StringValueCStr(path);
+  uint64_t started = metrics_start();
+  for (;;) {
+    call.fs = data->fs;
+    call.interrupted = 0;
+    data->busy++;
+    call_without_gvl_wakeable(call_staging_cache_open, &call,
+        &call.interrupted, staging_cache_wake, NULL);
+    data->busy--;
+    if (call.pointer != NULL || call.error != EINTR || !call.interrupted) {
+      break;
+    }
+    // Runs pending interrupts, which may raise, then stages the file again.
+    check_interrupts();
+  }
+  if (call.pointer == NULL) {
+    metrics_record(kMetricOpen, started, 0, call.error, path);
+    if (error != NULL) {
+      *error = call.error;
+      raise_deferred_exception();
+      return Qnil;
+    }
+    raise_error(e_could_not_open, call.error, "Could not stage file %s",
+        StringValuePtr(path));
+  }
+  VALUE file_instance = new_staged_HDFS_File(path,
+      (StagedFile*) call.pointer);
+  metrics_record(kMetricOpen, started, 0, 0, path);
+  raise_deferred_exception();
+  return file_instance;
+}
+
+/*
+ * Opens a file for open and try_open.  If the file cannot be opened, raises a
+ * CouldNotOpenFileError, or returns nil with *error set unless error is NULL.
+ */
+static VALUE open_file(int argc, VALUE* argv, VALUE self, int* error) {
+  FSData* data = get_FSData(self);
+  VALUE path, mode, options, keywords;
+  int flags = 0;
+  rb_scan_args(argc, argv, "12:", &path, &mode, &options, &keywords);
+  options = options_hash(options, keywords);
+  // Sets file open mode if one is provided by the user.
+  if (!NIL_P(mode)) {
+    if (mode_matches(mode, 'r')) {
+      flags |= O_RDONLY;
+    } 
+    if (mode_matches(mode, 'w')) {
+      flags |= O_WRONLY;
+    } 
+    if (mode_matches(mode, 'a')) {
+      flags |= O_APPEND;
+    }
+  } else {
+    // Takes the default value of read-only mode.
+    flags = O_RDONLY;
+  }
+  VALUE r_buffer_size = rb_hash_aref(options, sym_buffer_size);
+  VALUE r_replication = rb_hash_aref(options, sym_replication);
+  VALUE r_block_size = rb_hash_aref(options, sym_block_size);
+  VALUE r_readahead = rb_hash_aref(options, sym_readahead);
+  VALUE r_readahead_size = rb_hash_aref(options, sym_readahead_size);
+  FileOptions file_options;
+  file_options.readahead_chunks = 0;
+  file_options.readahead_chunk_size = NIL_P(r_readahead_size) ?
+      HDFS_DEFAULT_READAHEAD_SIZE : NUM2LONG(r_readahead_size);
+  VALUE r_write_buffer = rb_hash_aref(options, sym_write_buffer);
+  file_options.write_buffer_size = 0;
+  if (RTEST(r_write_buffer)) {
+    file_options.write_buffer_size = r_write_buffer == Qtrue ?
+        HDFS_DEFAULT_WRITE_BUFFER : NUM2LONG(r_write_buffer);
+    if (!(flags & (O_WRONLY | O_APPEND))) {
+      rb_raise(rb_eArgError, "write_buffer requires a file opened for writing");
+    }
+    if (file_options.write_buffer_size < 0) {
+      rb_raise(rb_eArgError, "write_buffer must be positive");
+    }
+  }
+  VALUE r_async = rb_hash_aref(options, sym_async);
+  VALUE r_hflush_bytes = rb_hash_aref(options, sym_hflush_bytes);
+  VALUE r_hflush_interval = rb_hash_aref(options, sym_hflush_interval);
+  file_options.async_queue_length = 0;
+  file_options.hflush_bytes = NIL_P(r_hflush_bytes) ? 0 :
+      NUM2LONG(r_hflush_bytes);
+  file_options.hflush_interval = NIL_P(r_hflush_interval) ? 0 :
+      NUM2DBL(r_hflush_interval);
+  if (RTEST(r_async)) {
+    file_options.async_queue_length = r_async == Qtrue ?
+        HDFS_DEFAULT_ASYNC_QUEUE : NUM2INT(r_async);
+    if (!(flags & (O_WRONLY | O_APPEND))) {
+      rb_raise(rb_eArgError, "async requires a file opened for writing");
+    }
+    if (file_options.async_queue_length <= 0 ||
+        file_options.hflush_bytes < 0 || file_options.hflush_interval < 0) {
+      rb_raise(rb_eArgError,
+          "async, hflush_bytes and hflush_interval must be positive");
+    }
+    // Writes reach the background thread a buffer at a time.
+    if (file_options.write_buffer_size == 0) {
+      file_options.write_buffer_size = HDFS_DEFAULT_WRITE_BUFFER;
+    }
+  }
+  VALUE r_codec = rb_hash_aref(options, sym_codec);
+  file_options.codec = kCodecNone;
+  if (r_codec == Qtrue) {
+    file_options.codec = codec_for_path(StringValueCStr(path));
+  } else if (RTEST(r_codec)) {
+    VALUE codec_name = rb_funcall(r_codec, id_to_s, 0);
+    file_options.codec = codec_for_name(StringValueCStr(codec_name));
+    if (file_options.codec == kCodecNone) {
+      rb_raise(rb_eArgError, "unknown codec: %s", StringValueCStr(codec_name));
+    }
+  }
+  if (file_options.codec != kCodecNone &&
+      !codec_supported(file_options.codec)) {
+    rb_raise(rb_eArgError, "codec for %s is not supported by this build",
+        StringValueCStr(path));
+  }
+  VALUE r_retries = rb_hash_aref(options, sym_retries);
+  VALUE r_retry_backoff = rb_hash_aref(options, sym_retry_backoff);
+  VALUE r_hedge_after = rb_hash_aref(options, sym_hedge_after);
+  file_options.retries = r_retries == Qtrue ? HDFS_DEFAULT_RETRIES :
+      (RTEST(r_retries) ? NUM2INT(r_retries) : 0);
+  file_options.retry_backoff = NIL_P(r_retry_backoff) ?
+      HDFS_DEFAULT_RETRY_BACKOFF : NUM2DBL(r_retry_backoff);
+  file_options.hedge_after = NIL_P(r_hedge_after) ? 0 :
+      NUM2DBL(r_hedge_after);
+  if (file_options.retries > 0 || file_options.hedge_after > 0) {
+    if (flags != O_RDONLY) {
+      rb_raise(rb_eArgError,
+          "retries and hedge_after require a file opened for reading");
+    }
+    if (RTEST(r_readahead)) {
+      rb_raise(rb_eArgError,
+          "retries and hedge_after cannot be combined with readahead");
+    }
+  }
+  if (file_options.retries < 0 || file_options.retry_backoff < 0 ||
+      file_options.hedge_after < 0) {
+    rb_raise(rb_eArgError,
+        "retries, retry_backoff and hedge_after must be positive");
+  }
+  if (RTEST(r_readahead)) {
+    file_options.readahead_chunks = r_readahead == Qtrue ?
+        HDFS_DEFAULT_READAHEAD : NUM2INT(r_readahead);
+    if (flags != O_RDONLY) {
+      rb_raise(rb_eArgError, "readahead requires a file opened for reading");
+    }
+    if (file_options.readahead_chunks < 0 ||
+        file_options.readahead_chunk_size <= 0) {
+      rb_raise(rb_eArgError, "readahead and readahead_size must be positive");
+    }
+  }
+  VALUE r_cache = rb_hash_aref(options, sym_cache);
+  VALUE r_block_cache = rb_hash_aref(options, sym_block_cache);
+  file_options.block_cache = RTEST(r_block_cache);
+  if (file_options.block_cache) {
+    if (flags != O_RDONLY) {
+      rb_raise(rb_eArgError, "block_cache requires a file opened for reading");
+    }
+    if (RTEST(r_readahead) || RTEST(r_cache) ||
+        file_options.codec != kCodecNone || file_options.retries > 0 ||
+        file_options.hedge_after > 0) {
+      rb_raise(rb_eArgError,
+          "block_cache cannot be combined with readahead, codec, retries, "
+          "hedge_after or cache");
+    }
+  }
+  if (RTEST(r_cache)) {
+    return open_staged(data, path, flags, &file_options, r_readahead, error);
+  }
+  FSCall call;
+  call.path = StringValuePtr(path);
+  uint64_t started = metrics_start();
+  if (file_options.block_cache) {
+    // Keys cached pages by the version of the file about to be opened.
+    run_fs_call(data, call_hdfs_get_path_info, &call);
+    hdfsFileInfo* info = (hdfsFileInfo*) call.pointer;
+    if (info == NULL) {
+      metrics_record(kMetricOpen, started, 0, call.error, path);
+      if (error != NULL) {
+        *error = call.error;
+        raise_deferred_exception();
+        return Qnil;
+      }
+      raise_error(e_could_not_open, call.error, "Could not open file %s",
+          StringValuePtr(path));
+    }
+    file_options.mtime = info->mLastMod;
+    file_options.size = info->mSize;
+    hdfsFreeFileInfo(info, 1);
+  }
+  call.flags = flags;
+  call.buffer_size = RTEST(r_buffer_size) ? NUM2INT(r_buffer_size) : 0;
+  call.replication = RTEST(r_replication) ? NUM2INT(r_replication) : 0;
+  call.block_size = RTEST(r_block_size) ? NUM2INT(r_block_size) : 0;
+  run_fs_call(data, call_hdfs_open_file, &call);
+  if (flags & (O_WRONLY | O_APPEND)) {
+    invalidate_path(data, path, 0);
+  }
+  hdfsFile file = (hdfsFile) call.pointer;
+  if (file == NULL) {
+    metrics_record(kMetricOpen, started, 0, call.error, path);
+    if (error != NULL) {
+      *error = call.error;
+      raise_deferred_exception();
+      return Qnil;
+    }
+    raise_error(e_could_not_open, call.error, "Could not open file %s",
+        StringValuePtr(path));
+  }
+  VALUE file_instance = new_HDFS_File(path, &file, &data->fs, &file_options);
+  metrics_record(kMetricOpen, started, 0, 0, path);
+  raise_deferred_exception();
+  return file_instance;
+}
+
 /**
  * call-seq:
  *    hdfs.open(path, mode='r', options={}) -> file
@@ -465,42 +2674,143 @@ VALUE HDFS_File_System_mkdir(VALUE self, VALUE path) {
  *   (default: default replication as configured by HDFS)
  * * *block_size*: the HDFS block size in bytes to use for this file
  *   (default: default block size as configured by HDFS)
+ * * *readahead*: the number of chunks a background thread should keep read
+ *   ahead of sequential reads, or true for 4; read-only files only
+ *   (default: no readahead)
+ * * *readahead_size*: the size in bytes of each chunk read ahead
+ *   (default: 1048576)
+ * * *write_buffer*: the size in bytes of a buffer in which to collect small
+ *   writes before sending them to HDFS, or true for 65536; writable files only
+ *   (default: no write buffer)
+ * * *async*: hands writes to a background thread through a queue of this many
+ *   write buffers, or true for 8, so that writes only block once the queue is
+ *   full and hflush returns without waiting; writable files only
+ *   (default: writes block until sent to HDFS)
+ * * *hflush_bytes*: with async, the number of bytes after which the
+ *   background thread runs hflush on its own (default: never)
+ * * *hflush_interval*: with async, the number of seconds after writing out a
+ *   buffer by which the background thread runs hflush on its own
+ *   (default: never)
+ * * *codec*: decompresses reads or compresses writes natively, without the
+ *   GVL, in one of the formats Hadoop writes: :gzip, :deflate, :snappy or
+ *   :zstd, or true to pick one from the extension of path; compressed files
+ *   can only be read sequentially, and tell counts uncompressed bytes
+ *   (default: no codec)
+ * * *retries*: the number of times a read which fails with an error that may
+ *   be transient is retried, reopening the file and seeking back to where it
+ *   was, or true for 3; read-only files only (default: 0)
+ * * *retry_backoff*: the seconds to wait before the first retry, doubling
+ *   with each retry after it (default: 0.1)
+ * * *hedge_after*: the seconds after which a positional read is hedged by
+ *   issuing it again through a second stream, keeping whichever finishes
+ *   first; read-only files only (default: never)
+ * * *cache*: serves reads from a copy of the whole file staged in a local
+ *   directory and mapped into memory, with the GVL held, staging it only if
+ *   no copy with the same modification time and size is staged already; the
+ *   file is never opened in HDFS once staged; read-only files only, and
+ *   cannot be combined with readahead, codec, retries or hedge_after; see
+ *   HDFS::FileSystem.configure_staging_cache (default: false)
+ * * *block_cache*: reads through a process-wide cache of 1 MB pages shared
+ *   with every file opened with block_cache, keyed by path, modification
+ *   time and page index, so that ranges read by one file are read from HDFS
+ *   once; reads never go past the size the file had when opened; read-only
+ *   files only, and cannot be combined with readahead, codec, retries,
+ *   hedge_after or cache; see HDFS::FileSystem.configure_block_cache
+ *   (default: false)
  */
 VALUE HDFS_File_System_open(int argc, VALUE* argv, VALUE self) {
+  return open_file(argc, argv, self, NULL);
+}
+
+/**
+ * call-seq:
+ *    hdfs.parallel_read(path, options={}) { |data, offset| ... } -> num_bytes
+ *    hdfs.parallel_read(path, to: io) -> num_bytes
+ *    hdfs.parallel_read(path, options={}) -> contents
+ *
+ * Reads the file at the supplied path with a pool of native threads, each
+ * reading through its own stream with positional reads, so that many
+ * DataNodes serve the file at once.  The file is split into chunks which
+ * never cross a block boundary, and threads pause once a few chunks each are
+ * waiting to be consumed.  Yields each chunk as a String along with its
+ * offset, writes each chunk in order to the IO-like object given as to, or
+ * returns the contents of the whole file as a String.  Raises a
+ * DFSException if this fails.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of threads reading (default: 4)
+ * * *chunk_size*: the most bytes in each chunk, capped at the block size
+ *   (default: 4194304)
+ * * *ordered*: if false, yields chunks as soon as each is read rather than in
+ *   order of offset (default: true)
+ * * *to*: an object with a write method, such as an IO, to write the file to
+ */
+VALUE HDFS_File_System_parallel_read(int argc, VALUE* argv, VALUE self) {
   FSData* data = get_FSData(self);
-  VALUE path, mode, options;
-  int flags = 0;
-  rb_scan_args(argc, argv, "12", &path, &mode, &options);
+  VALUE path, options;
+  rb_scan_args(argc, argv, "11", &path, &options);
   options = NIL_P(options) ? rb_hash_new() : options;
-  // Sets file open mode if one is provided by the user.
-  if (!NIL_P(mode)) {
-    VALUE mode_lowercase = rb_funcall(mode, rb_intern("downcase"), 0);
-    if (strstr("r", StringValuePtr(mode_lowercase)) != NULL) {
-      flags |= O_RDONLY;
-    } 
-    if (strstr("w", StringValuePtr(mode_lowercase)) != NULL) {
-      flags |= O_WRONLY;
-    } 
-    if (strstr("a", StringValuePtr(mode_lowercase)) != NULL) {
-      flags |= O_APPEND;
-    }
-  } else {
-    // Takes the default value of read-only mode.
-    flags = O_RDONLY;
+  Check_Type(options, T_HASH);
+  VALUE r_threads = rb_hash_aref(options, sym_threads);
+  VALUE r_chunk_size = rb_hash_aref(options, sym_chunk_size);
+  VALUE r_ordered = rb_hash_aref(options, sym_ordered);
+  ParallelReadCall call;
+  call.data = data;
+  call.path = StringValueCStr(path);
+  call.num_threads = NIL_P(r_threads) ? HDFS_DEFAULT_READ_THREADS :
+      NUM2INT(r_threads);
+  long chunk_size = NIL_P(r_chunk_size) ? HDFS_DEFAULT_READ_CHUNK :
+      NUM2LONG(r_chunk_size);
+  call.ordered = NIL_P(r_ordered) || RTEST(r_ordered);
+  call.consumer = rb_hash_aref(options, sym_to);
+  call.contents = Qnil;
+  call.chunk = NULL;
+  call.num_bytes = 0;
+  if (call.num_threads < 1) {
+    rb_raise(rb_eArgError, "threads must be positive");
   }
-  VALUE r_buffer_size = rb_hash_aref(options, rb_eval_string(":buffer_size"));
-  VALUE r_replication = rb_hash_aref(options, rb_eval_string(":replication"));
-  VALUE r_block_size = rb_hash_aref(options, rb_eval_string(":block_size"));
-  hdfsFile file = hdfsOpenFile(data->fs, StringValuePtr(path), flags,
-      RTEST(r_buffer_size) ? NUM2INT(r_buffer_size) : 0,
-      RTEST(r_replication) ? NUM2INT(r_replication) : 0,
-      RTEST(r_block_size) ? NUM2INT(r_block_size) : 0);
-  if (file == NULL) {
-    rb_raise(e_could_not_open, "Could not open file %s: %s", StringValuePtr(path),
-        get_error(errno));
-    return Qnil;
+  if (chunk_size < 1 || chunk_size > INT_MAX) {
+    rb_raise(rb_eArgError, "chunk_size must be between 1 and %d", INT_MAX);
+  }
+  call.chunk_size = (tSize) chunk_size;
+  if (!NIL_P(call.consumer) && !call.ordered) {
+    rb_raise(rb_eArgError, "to requires ordered chunks");
   }
-  return new_HDFS_File(path, &file, &data->fs);
+  // Keeps the file system from being disconnected until the read stops.
+  data->busy++;
+  call.interrupted = 0;
+  call_without_gvl(call_parallel_reader_start, &call, &call.interrupted);
+  if (call.reader == NULL) {
+    data->busy--;
+    raise_error(e_dfs_exception, call.error, "Failed to read %s", call.path);
+  }
+  if (NIL_P(call.consumer) && !rb_block_given_p()) {
+    call.contents = rb_str_new(NULL, parallel_reader_size(call.reader));
+  }
+  rb_ensure(yield_chunks, (VALUE) &call, stop_parallel_read, (VALUE) &call);
+  raise_deferred_exception();
+  return NIL_P(call.contents) ? LL2NUM(call.num_bytes) : call.contents;
+}
+
+/**
+ * call-seq:
+ *    hdfs.put_many(pairs, options={}) -> results
+ *    hdfs.put_many(pairs, options={}) { |progress| ... } -> results
+ *
+ * Uploads each [local_path, path] pair like copy_many, streaming each local
+ * file through a native buffer into a new file, which is deleted if the
+ * upload fails.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of files uploaded at once (default: 8)
+ */
+VALUE HDFS_File_System_put_many(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE pairs, options;
+  rb_scan_args(argc, argv, "11", &pairs, &options);
+  return run_transfer(data, data, pairs, kTransferPut, options, 1);
 }
 
 /**
@@ -512,12 +2822,22 @@ VALUE HDFS_File_System_open(int argc, VALUE* argv, VALUE self) {
  */
 VALUE HDFS_File_System_rename(VALUE self, VALUE from_path, VALUE to_path) {
   FSData* data = get_FSData(self);
-  if (hdfsRename(data->fs, StringValuePtr(from_path),
-          StringValuePtr(to_path)) == -1) {
-    rb_raise(e_dfs_exception, "Could not rename path %s to path %s: %s",
-        StringValuePtr(from_path), StringValuePtr(to_path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(from_path);
+  call.to_path = StringValuePtr(to_path);
+  uint64_t started = metrics_start();
+  run_fs_call(data, call_hdfs_rename, &call);
+  invalidate_path(data, from_path, 1);
+  invalidate_path(data, to_path, 1);
+  metrics_record(kMetricRename, started, 0,
+      call.result == -1 ? call.error : 0, from_path);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Could not rename path %s to path %s", StringValuePtr(from_path),
+        StringValuePtr(to_path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
@@ -536,14 +2856,48 @@ VALUE HDFS_File_System_rm(int argc, VALUE* argv, VALUE self) {
   if (!NIL_P(recursive)) {
     hdfs_recursive = (recursive == Qtrue) ? 1 : 0;
   }
-  if (hdfsDelete(data->fs, StringValuePtr(path), hdfs_recursive) == -1) {
-    rb_raise(e_dfs_exception, "Could not delete file at path %s: %s",
-        StringValuePtr(path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.recursive = hdfs_recursive;
+  uint64_t started = metrics_start();
+  run_fs_call(data, call_hdfs_delete, &call);
+  invalidate_path(data, path, 1);
+  metrics_record(kMetricRm, started, 0, call.result == -1 ? call.error : 0,
+      path);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error, "Could not delete file at path %s",
+        StringValuePtr(path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    hdfs.rm_many(paths, options={}) -> results
+ *
+ * Deletes each of the supplied paths, returning an Array with, for each path
+ * in order, true if it was deleted or the errno with which it failed.  A
+ * failure does not stop the rest of the batch.
+ *
+ * options can have the following keys:
+ *
+ * * *recursive*: deletes directories along with their contents
+ *   (default: false)
+ * * *threads*: the number of paths deleted at once (default: 1)
+ */
+VALUE HDFS_File_System_rm_many(int argc, VALUE* argv, VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE paths, options;
+  rb_scan_args(argc, argv, "11", &paths, &options);
+  BatchCall batch;
+  batch.func = call_hdfs_delete;
+  batch.call.recursive = NIL_P(options) ? HDFS_DEFAULT_RECURSIVE_DELETE :
+      RTEST(rb_hash_aref(options, sym_recursive));
+  return run_batch(data, paths, &batch, options, 1);
+}
+
 /**
  * call-seq:
  *    hdfs.set_replication!(path, replication=3) -> success
@@ -559,14 +2913,73 @@ VALUE HDFS_File_System_set_replication(int argc, VALUE* argv, VALUE self) {
   // If no replication value is supplied, uses default replication value.
   int hdfs_replication = NIL_P(replication) ? HDFS_DEFAULT_REPLICATION :
       NUM2INT(replication);
-  if (hdfsSetReplication(data->fs, StringValuePtr(path), hdfs_replication) == -1) {
-    rb_raise(e_dfs_exception, "Failed to set replication to %d at path %s: %s",
-        hdfs_replication, StringValuePtr(path), get_error(errno));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.replication = hdfs_replication;
+  run_fs_call(data, call_hdfs_set_replication, &call);
+  invalidate_path(data, path, 0);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Failed to set replication to %d at path %s", hdfs_replication,
+        StringValuePtr(path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
+/**
+ * call-seq:
+ *    hdfs.set_replication_many(paths, replication=3, options={}) -> results
+ *
+ * Sets the replication of each of the supplied paths, returning an Array
+ * with, for each path in order, true if it succeeded or the errno with which
+ * it failed.  A failure does not stop the rest of the batch.
+ *
+ * options can have the following keys:
+ *
+ * * *threads*: the number of paths changed at once (default: 1)
+ */
+VALUE HDFS_File_System_set_replication_many(int argc, VALUE* argv,
+    VALUE self) {
+  FSData* data = get_FSData(self);
+  VALUE paths, replication, options;
+  rb_scan_args(argc, argv, "12", &paths, &replication, &options);
+  BatchCall batch;
+  batch.func = call_hdfs_set_replication;
+  batch.call.replication = NIL_P(replication) ? HDFS_DEFAULT_REPLICATION :
+      NUM2INT(replication);
+  return run_batch(data, paths, &batch, options, 0);
+}
+
+/*
+ * Returns the HDFS::FileInfo of path, from the metadata cache if it has one,
+ * or nil with *error set if this fails.
+ */
+static VALUE stat_path(FSData* data, VALUE path, int* error) {
+  FSCall call;
+  call.path = StringValueCStr(path);
+  hdfsFileInfo* info = NULL;
+  int num_entries;
+  uint64_t started = metrics_start();
+  if (data->cache != NULL && metadata_cache_get(data->cache,
+          kMetadataPathInfo, call.path, &info, &num_entries, error)) {
+    metrics_record(kMetricStat, started, 0, info != NULL ? 0 : *error, path);
+    return info != NULL ? new_HDFS_File_Info(info) : Qnil;
+  }
+  unsigned long generation = data->cache != NULL ?
+      metadata_cache_generation(data->cache) : 0;
+  run_fs_call(data, call_hdfs_get_path_info, &call);
+  info = (hdfsFileInfo*) call.pointer;
+  VALUE file_info = info != NULL ? new_HDFS_File_Info(info) : Qnil;
+  release_infos(data, kMetadataPathInfo, path, info, 1, call.error,
+      generation);
+  metrics_record(kMetricStat, started, 0, info != NULL ? 0 : call.error, path);
+  *error = call.error;
+  raise_deferred_exception();
+  return file_info;
+}
+
 /**
  * call-seq:
  *    hdfs.stat(path) -> file_info
@@ -576,18 +2989,47 @@ VALUE HDFS_File_System_set_replication(int argc, VALUE* argv, VALUE self) {
  * DFSException.
  */
 VALUE HDFS_File_System_stat(VALUE self, VALUE path) {
-  FSData* data = get_FSData(self);
-  hdfsFileInfo* info = hdfsGetPathInfo(data->fs, StringValuePtr(path));
-  if (info == NULL) {
-    rb_raise(e_dfs_exception, "Failed to stat file %s: %s",
-        StringValuePtr(path), get_error(errno));
-    return Qnil;
+  int error;
+  VALUE file_info = stat_path(get_FSData(self), path, &error);
+  if (NIL_P(file_info)) {
+    raise_error(e_dfs_exception, error, "Failed to stat file %s",
+        StringValuePtr(path));
   }
-  VALUE file_info = new_HDFS_File_Info(info);
-  hdfsFreeFileInfo(info, 1);
   return file_info;
 }
 
+/**
+ * call-seq:
+ *    hdfs.stat?(path) -> file_info or nil
+ *    hdfs.stat?(path) { |errno| ... } -> file_info or result of block
+ *
+ * Stats the supplied path like stat, but returns nil rather than raising if
+ * this fails, or yields the errno of the failure to the block if one is
+ * given and returns what it returns, so that probing many paths which may be
+ * missing costs no exceptions.
+ */
+VALUE HDFS_File_System_stat_p(VALUE self, VALUE path) {
+  int error;
+  VALUE file_info = stat_path(get_FSData(self), path, &error);
+  return NIL_P(file_info) ? failed_with(error) : file_info;
+}
+
+/**
+ * call-seq:
+ *    hdfs.try_open(path, mode='r', options={}) -> file or nil
+ *    hdfs.try_open(path, mode='r', options={}) { |errno| ... } -> file or
+ *      result of block
+ *
+ * Opens a file like open, but returns nil rather than raising if the file
+ * cannot be opened, or yields the errno of the failure to the block if one
+ * is given and returns what it returns.  Invalid options still raise.
+ */
+VALUE HDFS_File_System_try_open(int argc, VALUE* argv, VALUE self) {
+  int error;
+  VALUE file = open_file(argc, argv, self, &error);
+  return NIL_P(file) ? failed_with(error) : file;
+}
+
 /**
  * call-seq:
  *    hdfs.used -> retval
@@ -597,13 +3039,15 @@ VALUE HDFS_File_System_stat(VALUE self, VALUE path) {
  */
 VALUE HDFS_File_System_used(VALUE self) {
   FSData* data = get_FSData(self);
-  tOffset used = hdfsGetUsed(data->fs);
-  if (used == -1) {
-    rb_raise(e_dfs_exception, "Error while retrieving used capacity: %s",
-        get_error(errno));
+  FSCall call;
+  run_fs_call(data, call_hdfs_get_used, &call);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while retrieving used capacity");
     return Qnil;
   }
-  return LONG2NUM(used);
+  raise_deferred_exception();
+  return LONG2NUM(call.result);
 }
 
 /**
@@ -623,30 +3067,26 @@ VALUE HDFS_File_System_used(VALUE self) {
  */
 VALUE HDFS_File_System_utime(int argc, VALUE* argv, VALUE self) {
   FSData* data = get_FSData(self);
-  VALUE path, options;
-  rb_scan_args(argc, argv, "11", &path, &options);
-  // Sets default values for keyword args, type-checks supplied value.
-  options = NIL_P(options) ? rb_hash_new() : options;
-  if (TYPE(options) != T_HASH) {
-    rb_raise(rb_eArgError, "options must be of type Hash");
-    return Qnil;
-  }
-  VALUE r_atime = rb_hash_aref(options, rb_eval_string(":atime"));
-  VALUE r_mtime = rb_hash_aref(options, rb_eval_string(":mtime"));
-  // Converts any Time objects to seconds since the Unix epoch.
-  r_atime = rb_funcall(r_atime, rb_intern("to_i"), 0);
-  r_mtime = rb_funcall(r_mtime, rb_intern("to_i"), 0);
-  // Sets default values for last modified and/or last access time.
-  tTime hdfsAccessTime = NIL_P(r_atime) ? -1 : NUM2LONG(r_atime);
-  tTime hdfsModifiedTime = NIL_P(r_mtime) ? -1 : NUM2LONG(r_mtime);
-  if (hdfsUtime(data->fs, StringValuePtr(path), hdfsModifiedTime,
-          hdfsAccessTime) == -1) {
-    rb_raise(e_dfs_exception,
-        "Error while setting modified time %lu, access time %lu at path %s: %s",
-        (long) hdfsModifiedTime, (long) hdfsAccessTime, StringValuePtr(path),
-        get_error(errno));
+  VALUE path, options, keywords;
+  rb_scan_args(argc, argv, "11:", &path, &options, &keywords);
+  options = options_hash(options, keywords);
+  // Converts any Time objects to seconds since the Unix epoch, leaving times
+  // not supplied unchanged.
+  tTime hdfsAccessTime = time_option(rb_hash_aref(options, sym_atime));
+  tTime hdfsModifiedTime = time_option(rb_hash_aref(options, sym_mtime));
+  FSCall call;
+  call.path = StringValuePtr(path);
+  call.mtime = hdfsModifiedTime;
+  call.atime = hdfsAccessTime;
+  run_fs_call(data, call_hdfs_utime, &call);
+  invalidate_path(data, path, 0);
+  if (call.result == -1) {
+    raise_error(e_dfs_exception, call.error,
+        "Error while setting modified time %lu, access time %lu at path %s",
+        (long) hdfsModifiedTime, (long) hdfsAccessTime, StringValuePtr(path));
     return Qnil;
   }
+  raise_deferred_exception();
   return Qtrue;
 }
 
@@ -654,37 +3094,172 @@ void init_file_system(VALUE parent) {
   c_file_system = rb_define_class_under(parent, "FileSystem", rb_cObject);
   rb_define_alloc_func(c_file_system, HDFS_File_System_alloc);
 
+  c_block_location = rb_struct_define_under(parent, "BlockLocation", "offset",
+      "length", "hosts", NULL);
+  c_content_summary = rb_struct_define_under(parent, "ContentSummary",
+      "files", "directories", "bytes", "replicated_bytes", NULL);
+
+  host_names = st_init_strtable();
+  host_name_list = rb_ary_new();
+  rb_gc_register_address(&host_name_list);
+
+  sym_active = ID2SYM(rb_intern("active"));
+  sym_allocated_bytes = ID2SYM(rb_intern("allocated_bytes"));
+  sym_async = ID2SYM(rb_intern("async"));
+  sym_atime = ID2SYM(rb_intern("atime"));
+  sym_block_cache = ID2SYM(rb_intern("block_cache"));
+  sym_block_size = ID2SYM(rb_intern("block_size"));
+  sym_budget = ID2SYM(rb_intern("budget"));
+  sym_buffer_size = ID2SYM(rb_intern("buffer_size"));
+  sym_bytes = ID2SYM(rb_intern("bytes"));
+  sym_bytes_per_second = ID2SYM(rb_intern("bytes_per_second"));
+  sym_cache = ID2SYM(rb_intern("cache"));
+  sym_cache_negative = ID2SYM(rb_intern("cache_negative"));
+  sym_cache_ttl = ID2SYM(rb_intern("cache_ttl"));
+  sym_chunk_size = ID2SYM(rb_intern("chunk_size"));
+  sym_codec = ID2SYM(rb_intern("codec"));
+  sym_conf = ID2SYM(rb_intern("conf"));
+  sym_connections = ID2SYM(rb_intern("connections"));
+  sym_depth = ID2SYM(rb_intern("depth"));
+  sym_dir = ID2SYM(rb_intern("dir"));
+  sym_directory = ID2SYM(rb_intern("directory"));
+  sym_entries = ID2SYM(rb_intern("entries"));
+  sym_evicted_bytes = ID2SYM(rb_intern("evicted_bytes"));
+  sym_evictions = ID2SYM(rb_intern("evictions"));
+  sym_file = ID2SYM(rb_intern("file"));
+  sym_files = ID2SYM(rb_intern("files"));
+  sym_group = ID2SYM(rb_intern("group"));
+  sym_hedge_after = ID2SYM(rb_intern("hedge_after"));
+  sym_hflush_bytes = ID2SYM(rb_intern("hflush_bytes"));
+  sym_hflush_interval = ID2SYM(rb_intern("hflush_interval"));
+  sym_hit_ratio = ID2SYM(rb_intern("hit_ratio"));
+  sym_hits = ID2SYM(rb_intern("hits"));
+  sym_host = ID2SYM(rb_intern("host"));
+  sym_invalidations = ID2SYM(rb_intern("invalidations"));
+  sym_jobs = ID2SYM(rb_intern("jobs"));
+  sym_kerb_ticket_cache = ID2SYM(rb_intern("kerb_ticket_cache"));
+  sym_local = ID2SYM(rb_intern("local"));
+  sym_low_latency = ID2SYM(rb_intern("low_latency"));
+  sym_max_depth = ID2SYM(rb_intern("max_depth"));
+  sym_max_size = ID2SYM(rb_intern("max_size"));
+  sym_max_threads = ID2SYM(rb_intern("max_threads"));
+  sym_min_size = ID2SYM(rb_intern("min_size"));
+  sym_misses = ID2SYM(rb_intern("misses"));
+  sym_mtime = ID2SYM(rb_intern("mtime"));
+  sym_name = ID2SYM(rb_intern("name"));
+  sym_names_only = ID2SYM(rb_intern("names_only"));
+  sym_new_instance = ID2SYM(rb_intern("new_instance"));
+  sym_newer_than = ID2SYM(rb_intern("newer_than"));
+  sym_older_than = ID2SYM(rb_intern("older_than"));
+  sym_ordered = ID2SYM(rb_intern("ordered"));
+  sym_page_size = ID2SYM(rb_intern("page_size"));
+  sym_pages = ID2SYM(rb_intern("pages"));
+  sym_port = ID2SYM(rb_intern("port"));
+  sym_profile = ID2SYM(rb_intern("profile"));
+  sym_queued = ID2SYM(rb_intern("queued"));
+  sym_readahead = ID2SYM(rb_intern("readahead"));
+  sym_readahead_size = ID2SYM(rb_intern("readahead_size"));
+  sym_recursive = ID2SYM(rb_intern("recursive"));
+  sym_references = ID2SYM(rb_intern("references"));
+  sym_replication = ID2SYM(rb_intern("replication"));
+  sym_retries = ID2SYM(rb_intern("retries"));
+  sym_retry_backoff = ID2SYM(rb_intern("retry_backoff"));
+  sym_running = ID2SYM(rb_intern("running"));
+  sym_seconds = ID2SYM(rb_intern("seconds"));
+  sym_threads = ID2SYM(rb_intern("threads"));
+  sym_to = ID2SYM(rb_intern("to"));
+  sym_to_fs = ID2SYM(rb_intern("to_fs"));
+  sym_total = ID2SYM(rb_intern("total"));
+  sym_type = ID2SYM(rb_intern("type"));
+  sym_user = ID2SYM(rb_intern("user"));
+  sym_write_buffer = ID2SYM(rb_intern("write_buffer"));
+  id_to_a = rb_intern("to_a");
+  id_to_i = rb_intern("to_i");
+  id_to_s = rb_intern("to_s");
+  id_write = rb_intern("write");
+  no_options = rb_obj_freeze(rb_hash_new());
+  rb_gc_register_address(&no_options);
+
+  rb_define_singleton_method(c_file_system, "block_cache_stats",
+      HDFS_File_System_s_block_cache_stats, 0);
+  rb_define_singleton_method(c_file_system, "clear_block_cache",
+      HDFS_File_System_s_clear_block_cache, 0);
+  rb_define_singleton_method(c_file_system, "clear_staging_cache",
+      HDFS_File_System_s_clear_staging_cache, 0);
+  rb_define_singleton_method(c_file_system, "close_idle_connections",
+      HDFS_File_System_s_close_idle_connections, 0);
+  rb_define_singleton_method(c_file_system, "configure_block_cache",
+      HDFS_File_System_s_configure_block_cache, -1);
+  rb_define_singleton_method(c_file_system, "configure_io_pool",
+      HDFS_File_System_s_configure_io_pool, -1);
+  rb_define_singleton_method(c_file_system, "configure_staging_cache",
+      HDFS_File_System_s_configure_staging_cache, -1);
+  rb_define_singleton_method(c_file_system, "io_pool_stats",
+      HDFS_File_System_s_io_pool_stats, 0);
+  rb_define_singleton_method(c_file_system, "pool_stats",
+      HDFS_File_System_s_pool_stats, 0);
+  rb_define_singleton_method(c_file_system, "staging_cache_stats",
+      HDFS_File_System_s_staging_cache_stats, 0);
+
+  rb_define_method(c_file_system, "block_locations",
+      HDFS_File_System_block_locations, 1);
+  rb_define_method(c_file_system, "cache_stats", HDFS_File_System_cache_stats,
+      0);
   rb_define_method(c_file_system, "capacity", HDFS_File_System_capacity, 0);
   rb_define_method(c_file_system, "cd", HDFS_File_System_cd, 1);
   rb_define_method(c_file_system, "chgrp", HDFS_File_System_chgrp, 2);
   rb_define_method(c_file_system, "chmod", HDFS_File_System_chmod, -1);
+  rb_define_method(c_file_system, "chmod_many", HDFS_File_System_chmod_many,
+      -1);
   rb_define_method(c_file_system, "chown", HDFS_File_System_chown, 2);
+  rb_define_method(c_file_system, "chown_many", HDFS_File_System_chown_many,
+      -1);
+  rb_define_method(c_file_system, "clear_cache", HDFS_File_System_clear_cache,
+      0);
+  rb_define_method(c_file_system, "content_summary",
+      HDFS_File_System_content_summary, -1);
+  rb_define_method(c_file_system, "copy_many", HDFS_File_System_copy_many, -1);
   rb_define_method(c_file_system, "cp", HDFS_File_System_cp, -1);
+  rb_define_method(c_file_system, "crawl", HDFS_File_System_crawl, -1);
   rb_define_method(c_file_system, "cwd", HDFS_File_System_cwd, 0);
   rb_define_method(c_file_system, "disconnect", HDFS_File_System_disconnect,
       0);
+  rb_define_method(c_file_system, "du", HDFS_File_System_du, -1);
+  rb_define_method(c_file_system, "each_entry", HDFS_File_System_each_entry,
+      -1);
   rb_define_method(c_file_system, "exist?", HDFS_File_System_exist, 1);
   rb_define_method(c_file_system, "default_block_size",
       HDFS_File_System_default_block_size, 0);
   rb_define_method(c_file_system, "default_block_size_at_path",
       HDFS_File_System_default_block_size_at_path, 1);
   rb_define_method(c_file_system, "get_hosts", HDFS_File_System_get_hosts, 3);
+  rb_define_method(c_file_system, "get_many", HDFS_File_System_get_many, -1);
   rb_define_method(c_file_system, "initialize", HDFS_File_System_initialize,
       -1);
+  rb_define_method(c_file_system, "listing", HDFS_File_System_listing, -1);
   rb_define_method(c_file_system, "ls", HDFS_File_System_ls, 1);
   rb_define_method(c_file_system, "mkdir", HDFS_File_System_mkdir, 1);
   rb_define_method(c_file_system, "mv", HDFS_File_System_mv, -1);
   rb_define_method(c_file_system, "open", HDFS_File_System_open, -1);
+  rb_define_method(c_file_system, "parallel_read",
+      HDFS_File_System_parallel_read, -1);
+  rb_define_method(c_file_system, "put_many", HDFS_File_System_put_many, -1);
   rb_define_method(c_file_system, "rename", HDFS_File_System_rename, 2);
   rb_define_method(c_file_system, "rm", HDFS_File_System_rm, -1);
+  rb_define_method(c_file_system, "rm_many", HDFS_File_System_rm_many, -1);
   rb_define_method(c_file_system, "stat", HDFS_File_System_stat, 1);
+  rb_define_method(c_file_system, "stat?", HDFS_File_System_stat_p, 1);
   rb_define_method(c_file_system, "set_replication!",
       HDFS_File_System_set_replication, -1);
+  rb_define_method(c_file_system, "set_replication_many",
+      HDFS_File_System_set_replication_many, -1);
+  rb_define_method(c_file_system, "try_open", HDFS_File_System_try_open, -1);
   rb_define_method(c_file_system, "used", HDFS_File_System_used, 0);
   rb_define_method(c_file_system, "utime", HDFS_File_System_utime, -1);
 
   e_dfs_exception = rb_define_class_under(parent, "DFSException",
       rb_eException);
+  define_error_class(e_dfs_exception);
   e_connect_error = rb_define_class_under(parent, "ConnectError",
       e_dfs_exception);  
   e_could_not_open = rb_define_class_under(parent, "CouldNotOpenFileError",
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "io_pool.h"
+
+#include "constants.h"
+
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static IOPoolJob* queue_head = NULL;   /* jobs waiting, in order */
+static IOPoolJob* queue_tail = NULL;
+static int num_threads = 0;
+static int num_idle = 0;               /* threads waiting for a job */
+static int max_threads = HDFS_DEFAULT_IO_THREADS;
+static unsigned long num_jobs = 0;
+static long num_queued = 0;
+static long num_running = 0;
+
+
+static void* run_io_worker(void* unused) {
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    while (queue_head == NULL && num_threads <= max_threads) {
+      num_idle++;
+      pthread_cond_wait(&pool_work, &pool_lock);
+      num_idle--;
+    }
+    if (queue_head == NULL) {
+      // The pool shrank, and this thread is no longer needed.
+      num_threads--;
+      pthread_mutex_unlock(&pool_lock);
+      return NULL;
+    }
+    IOPoolJob* job = queue_head;
+    queue_head = job->next;
+    queue_tail = queue_head != NULL ? queue_tail : NULL;
+    num_queued--;
+    num_running++;
+    pthread_mutex_unlock(&pool_lock);
+    void* result = job->func(job->arg);
+    pthread_mutex_lock(&pool_lock);
+    num_running--;
+    num_jobs++;
+    job->result = result;
+    // Reads the descriptor before waking the job, which may free it, and
+    // touches neither once the byte is written, since the waiter may then
+    // have closed or reused the descriptor.
+    int notify_fd = job->notify_fd;
+    pthread_mutex_unlock(&pool_lock);
+    char byte = 1;
+    while (write(notify_fd, &byte, 1) == -1 && errno == EINTR) {
+    }
+    pthread_mutex_lock(&pool_lock);
+  }
+}
+
+void io_pool_configure(int threads) {
+  pthread_mutex_lock(&pool_lock);
+  max_threads = threads > 0 ? threads : 1;
+  // Lets idle threads beyond the new limit exit.
+  pthread_cond_broadcast(&pool_work);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+int io_pool_submit(IOPoolJob* job) {
+  job->next = NULL;
+  pthread_mutex_lock(&pool_lock);
+  if (num_idle <= num_queued && num_threads < max_threads) {
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, run_io_worker, NULL);
+    if (result == 0) {
+      pthread_detach(thread);
+      num_threads++;
+    } else if (num_threads == 0) {
+      pthread_mutex_unlock(&pool_lock);
+      return result;
+    }
+  }
+  if (queue_tail != NULL) {
+    queue_tail->next = job;
+  } else {
+    queue_head = job;
+  }
+  queue_tail = job;
+  num_queued++;
+  pthread_cond_signal(&pool_work);
+  pthread_mutex_unlock(&pool_lock);
+  return 0;
+}
+
+void io_pool_stats(IOPoolStats* stats) {
+  pthread_mutex_lock(&pool_lock);
+  stats->jobs = num_jobs;
+  stats->queued = num_queued;
+  stats->running = num_running;
+  stats->threads = num_threads;
+  stats->max_threads = max_threads;
+  pthread_mutex_unlock(&pool_lock);
+}
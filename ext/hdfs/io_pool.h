@@ -0,0 +1,44 @@
+#ifndef HDFS_IO_POOL_H
+#define HDFS_IO_POOL_H
+
+
+/*
+ * A process-wide pool of threads running blocking calls handed over by
+ * fibers under a Fiber scheduler, so that the thread running the scheduler
+ * never blocks in libhdfs.  Each job signals that it has finished by writing
+ * one byte to a file descriptor, which the scheduler can wait on; reading
+ * that byte is what tells the waiter that the job is done, since the pool
+ * is then finished with both the job and the descriptor.  Threads are
+ * started as jobs arrive, up to the configured number, and live for the
+ * process.  All functions are thread-safe; none calls into Ruby.
+ */
+typedef struct IOPoolJob {
+  void* (*func)(void*);
+  void* arg;
+  void* result;
+  int notify_fd;             /* written to once the job has finished */
+  struct IOPoolJob* next;
+} IOPoolJob;
+
+typedef struct IOPoolStats {
+  unsigned long jobs;        /* jobs run since the process started */
+  long queued;               /* jobs waiting for a thread */
+  long running;              /* jobs being run */
+  int threads;               /* threads started */
+  int max_threads;
+} IOPoolStats;
+
+/* Runs at most max_threads jobs at once, letting idle threads beyond it go. */
+void io_pool_configure(int max_threads);
+
+/*
+ * Queues job to be run, starting another thread if every one is busy.
+ * Returns 0, or an errno if no thread could be started to run it.  The job
+ * and notify_fd must stay alive until the byte written to notify_fd has been
+ * read, after which job->result holds its result.
+ */
+int io_pool_submit(IOPoolJob* job);
+
+void io_pool_stats(IOPoolStats* stats);
+
+#endif /* HDFS_IO_POOL_H */
@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hdfs.h"
+#include "ruby.h"
+
+#include "listing.h"
+
+
+/*
+ * The name, size, modification time and replication of many entries, held
+ * column by column in contiguous arrays so that no Ruby object is needed per
+ * entry.  Names are packed back to back in one arena; the name of entry i
+ * runs from name_offsets[i] to name_offsets[i + 1].
+ */
+typedef struct Listing {
+  long num_entries;
+  long capacity;
+  int64_t* sizes;
+  int64_t* mtimes;
+  int16_t* replications;
+  long* name_offsets;  /* num_entries + 1 offsets into names */
+  char* names;
+  long names_capacity;
+} Listing;
+
+static VALUE c_listing;
+
+
+void free_listing(Listing* listing) {
+  if (listing) {
+    xfree(listing->sizes);
+    xfree(listing->mtimes);
+    xfree(listing->replications);
+    xfree(listing->name_offsets);
+    xfree(listing->names);
+    xfree(listing);
+  }
+}
+
+static Listing* get_Listing(VALUE rb_object) {
+  Listing* listing = NULL;
+  Data_Get_Struct(rb_object, Listing, listing);
+  return listing;
+}
+
+/* Grows the columns of a listing to hold at least capacity entries. */
+static void reserve_entries(Listing* listing, long capacity) {
+  if (capacity <= listing->capacity) {
+    return;
+  }
+  long new_capacity = listing->capacity < 64 ? 64 : listing->capacity;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+  REALLOC_N(listing->sizes, int64_t, new_capacity);
+  REALLOC_N(listing->mtimes, int64_t, new_capacity);
+  REALLOC_N(listing->replications, int16_t, new_capacity);
+  REALLOC_N(listing->name_offsets, long, new_capacity + 1);
+  listing->capacity = new_capacity;
+}
+
+/* Appends a single entry, copying its name into the arena. */
+static void append_entry(Listing* listing, const char* name, long name_length,
+    int64_t size, int64_t mtime, int16_t replication) {
+  reserve_entries(listing, listing->num_entries + 1);
+  long names_length = listing->name_offsets[listing->num_entries];
+  if (names_length + name_length > listing->names_capacity) {
+    long new_capacity = listing->names_capacity < 4096 ? 4096 :
+        listing->names_capacity;
+    while (new_capacity < names_length + name_length) {
+      new_capacity *= 2;
+    }
+    REALLOC_N(listing->names, char, new_capacity);
+    listing->names_capacity = new_capacity;
+  }
+  memcpy(listing->names + names_length, name, name_length);
+  long i = listing->num_entries++;
+  listing->sizes[i] = size;
+  listing->mtimes[i] = mtime;
+  listing->replications[i] = replication;
+  listing->name_offsets[i + 1] = names_length + name_length;
+}
+
+/* Converts a Time or Integer into seconds since the epoch. */
+static int64_t time_value(VALUE time) {
+  return NUM2LL(rb_funcall(time, rb_intern("to_i"), 0));
+}
+
+VALUE new_HDFS_Listing(void) {
+  Listing* listing;
+  // Wraps the zeroed listing before allocating any of its arrays, so that the
+  // object frees whatever was allocated if a later allocation raises.
+  VALUE rb_listing = Data_Make_Struct(c_listing, Listing, NULL, free_listing,
+      listing);
+  listing->name_offsets = ALLOC_N(long, 1);
+  listing->name_offsets[0] = 0;
+  return rb_listing;
+}
+
+void append_HDFS_Listing(VALUE rb_listing, hdfsFileInfo* infos,
+    int num_entries, const char* matches) {
+  Listing* listing = get_Listing(rb_listing);
+  int i;
+  for (i = 0; i < num_entries; i++) {
+    if (matches == NULL || matches[i]) {
+      hdfsFileInfo* info = infos + i;
+      append_entry(listing, info->mName, strlen(info->mName), info->mSize,
+          info->mLastMod, info->mReplication);
+    }
+  }
+}
+
+/**
+ * HDFS Listing interface
+ */
+
+/**
+ * call-seq:
+ *    listing.each { |name, size, mtime, replication| ... } -> self
+ *
+ * Yields the name, size in bytes, modification time in seconds since the
+ * epoch and replication of each entry in turn.
+ */
+VALUE HDFS_Listing_each(VALUE self) {
+  RETURN_ENUMERATOR(self, 0, 0);
+  Listing* listing = get_Listing(self);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    long offset = listing->name_offsets[i];
+    rb_yield_values(4,
+        rb_str_new(listing->names + offset,
+            listing->name_offsets[i + 1] - offset),
+        LL2NUM(listing->sizes[i]), LL2NUM(listing->mtimes[i]),
+        INT2NUM(listing->replications[i]));
+  }
+  return self;
+}
+
+/**
+ * call-seq:
+ *    listing.filter_by_mtime(newer_than, older_than=nil) -> listing
+ *
+ * Returns a new HDFS::Listing holding only the entries last modified after
+ * newer_than and before older_than, each a Time or Integer of seconds since
+ * the epoch, or nil for no bound.
+ */
+VALUE HDFS_Listing_filter_by_mtime(int argc, VALUE* argv, VALUE self) {
+  VALUE newer_than, older_than;
+  rb_scan_args(argc, argv, "11", &newer_than, &older_than);
+  int has_newer = !NIL_P(newer_than), has_older = !NIL_P(older_than);
+  int64_t newer = has_newer ? time_value(newer_than) : 0;
+  int64_t older = has_older ? time_value(older_than) : 0;
+  Listing* listing = get_Listing(self);
+  VALUE rb_filtered = new_HDFS_Listing();
+  Listing* filtered = get_Listing(rb_filtered);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    int64_t mtime = listing->mtimes[i];
+    if ((!has_newer || mtime > newer) && (!has_older || mtime < older)) {
+      long offset = listing->name_offsets[i];
+      append_entry(filtered, listing->names + offset,
+          listing->name_offsets[i + 1] - offset, listing->sizes[i], mtime,
+          listing->replications[i]);
+    }
+  }
+  return rb_filtered;
+}
+
+/**
+ * call-seq:
+ *    listing.length -> num_entries
+ *
+ * Returns the number of entries in this listing as an Integer.
+ */
+VALUE HDFS_Listing_length(VALUE self) {
+  return LONG2NUM(get_Listing(self)->num_entries);
+}
+
+/**
+ * call-seq:
+ *    listing.mtimes -> mtimes
+ *
+ * Returns the modification time of every entry in seconds since the epoch as
+ * an Array of Integers.
+ */
+VALUE HDFS_Listing_mtimes(VALUE self) {
+  Listing* listing = get_Listing(self);
+  VALUE mtimes = rb_ary_new2(listing->num_entries);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    rb_ary_push(mtimes, LL2NUM(listing->mtimes[i]));
+  }
+  return mtimes;
+}
+
+/**
+ * call-seq:
+ *    listing.names -> names
+ *
+ * Returns the name of every entry as an Array of Strings.
+ */
+VALUE HDFS_Listing_names(VALUE self) {
+  Listing* listing = get_Listing(self);
+  VALUE names = rb_ary_new2(listing->num_entries);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    long offset = listing->name_offsets[i];
+    rb_ary_push(names, rb_str_new(listing->names + offset,
+        listing->name_offsets[i + 1] - offset));
+  }
+  return names;
+}
+
+/**
+ * call-seq:
+ *    listing.replications -> replications
+ *
+ * Returns the replication of every entry as an Array of Integers.
+ */
+VALUE HDFS_Listing_replications(VALUE self) {
+  Listing* listing = get_Listing(self);
+  VALUE replications = rb_ary_new2(listing->num_entries);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    rb_ary_push(replications, INT2NUM(listing->replications[i]));
+  }
+  return replications;
+}
+
+/**
+ * call-seq:
+ *    listing.sizes -> sizes
+ *
+ * Returns the size in bytes of every entry as an Array of Integers.
+ */
+VALUE HDFS_Listing_sizes(VALUE self) {
+  Listing* listing = get_Listing(self);
+  VALUE sizes = rb_ary_new2(listing->num_entries);
+  long i;
+  for (i = 0; i < listing->num_entries; i++) {
+    rb_ary_push(sizes, LL2NUM(listing->sizes[i]));
+  }
+  return sizes;
+}
+
+/**
+ * call-seq:
+ *    listing.sum_size(replicated=false) -> total_bytes
+ *
+ * Returns the total size in bytes of every entry as an Integer, multiplied
+ * by the replication of each entry if replicated is True.
+ */
+VALUE HDFS_Listing_sum_size(int argc, VALUE* argv, VALUE self) {
+  VALUE replicated;
+  rb_scan_args(argc, argv, "01", &replicated);
+  Listing* listing = get_Listing(self);
+  int64_t total = 0;
+  long i;
+  if (RTEST(replicated)) {
+    for (i = 0; i < listing->num_entries; i++) {
+      total += listing->sizes[i] * listing->replications[i];
+    }
+  } else {
+    for (i = 0; i < listing->num_entries; i++) {
+      total += listing->sizes[i];
+    }
+  }
+  return LL2NUM(total);
+}
+
+/**
+ * call-seq:
+ *    listing.to_s -> retval
+ *
+ * Returns a human-readable representation of an HDFS::Listing object as a
+ * String.
+ */
+VALUE HDFS_Listing_to_s(VALUE self) {
+  Listing* listing = get_Listing(self);
+  return rb_sprintf("#<HDFS::Listing: %ld entries>", listing->num_entries);
+}
+
+void init_listing(VALUE parent) {
+  c_listing = rb_define_class_under(parent, "Listing", rb_cObject);
+
+  rb_define_method(c_listing, "each", HDFS_Listing_each, 0);
+  rb_define_method(c_listing, "filter_by_mtime", HDFS_Listing_filter_by_mtime,
+      -1);
+  rb_define_method(c_listing, "length", HDFS_Listing_length, 0);
+  rb_define_method(c_listing, "mtimes", HDFS_Listing_mtimes, 0);
+  rb_define_method(c_listing, "names", HDFS_Listing_names, 0);
+  rb_define_method(c_listing, "replications", HDFS_Listing_replications, 0);
+  rb_define_method(c_listing, "sizes", HDFS_Listing_sizes, 0);
+  rb_define_method(c_listing, "sum_size", HDFS_Listing_sum_size, -1);
+  rb_define_method(c_listing, "to_s", HDFS_Listing_to_s, 0);
+}
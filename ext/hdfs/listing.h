@@ -0,0 +1,20 @@
+#ifndef HDFS_LISTING_H
+#define HDFS_LISTING_H
+
+#include "hdfs.h"
+#include "ruby.h"
+
+
+/* Creates an empty HDFS::Listing. */
+VALUE new_HDFS_Listing(void);
+
+/*
+ * Appends the supplied entries to an HDFS::Listing, or only those with a
+ * non-zero flag in matches if it is not NULL.
+ */
+void append_HDFS_Listing(VALUE listing, hdfsFileInfo* infos, int num_entries,
+    const char* matches);
+
+void init_listing(VALUE parent);
+
+#endif /* HDFS_LISTING_H */
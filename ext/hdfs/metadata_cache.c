@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "hdfs.h"
+#include "ruby.h"
+
+#include "metadata_cache.h"
+
+
+typedef struct CacheEntry {
+  char* key;           /* the kind followed by the path */
+  hdfsFileInfo* infos; /* NULL if the path was found not to exist */
+  int num_entries;
+  int error;
+  double expires_at;
+  struct CacheEntry* prev;  /* the next more recently used entry */
+  struct CacheEntry* next;  /* the next less recently used entry */
+} CacheEntry;
+
+struct MetadataCache {
+  st_table* entries;   /* maps keys to CacheEntry pointers */
+  CacheEntry* head;    /* the most recently used entry */
+  CacheEntry* tail;    /* the least recently used entry */
+  long capacity;
+  double ttl;
+  int negative;
+  unsigned long generation;
+  MetadataCacheStats stats;
+};
+
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Builds the key for a path, which the caller must free. */
+static char* make_key(MetadataKind kind, const char* path, size_t length) {
+  char* key = ALLOC_N(char, length + 2);
+  key[0] = (char) kind;
+  memcpy(key + 1, path, length);
+  key[length + 1] = '\0';
+  return key;
+}
+
+static void unlink_entry(MetadataCache* cache, CacheEntry* entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+}
+
+static void push_front(MetadataCache* cache, CacheEntry* entry) {
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+}
+
+static void remove_entry(MetadataCache* cache, CacheEntry* entry) {
+  st_data_t key = (st_data_t) entry->key;
+  st_delete(cache->entries, &key, NULL);
+  unlink_entry(cache, entry);
+  if (entry->infos != NULL) {
+    hdfsFreeFileInfo(entry->infos, entry->num_entries);
+  }
+  xfree(entry->key);
+  xfree(entry);
+  cache->stats.entries--;
+}
+
+static CacheEntry* find_entry(MetadataCache* cache, const char* key) {
+  st_data_t value;
+  if (st_lookup(cache->entries, (st_data_t) key, &value)) {
+    return (CacheEntry*) value;
+  }
+  return NULL;
+}
+
+/* Drops the entry of the supplied kind for path if cached. */
+static int drop(MetadataCache* cache, MetadataKind kind, const char* path,
+    size_t length, int negative_only) {
+  char* key = make_key(kind, path, length);
+  CacheEntry* entry = find_entry(cache, key);
+  xfree(key);
+  if (entry == NULL || (negative_only && entry->infos != NULL)) {
+    return 0;
+  }
+  remove_entry(cache, entry);
+  return 1;
+}
+
+MetadataCache* metadata_cache_new(long capacity, double ttl, int negative) {
+  MetadataCache* cache = ALLOC_N(MetadataCache, 1);
+  cache->entries = st_init_strtable();
+  cache->head = cache->tail = NULL;
+  cache->capacity = capacity;
+  cache->ttl = ttl;
+  cache->negative = negative;
+  cache->generation = 0;
+  memset(&cache->stats, 0, sizeof(MetadataCacheStats));
+  return cache;
+}
+
+void metadata_cache_free(MetadataCache* cache) {
+  metadata_cache_clear(cache);
+  st_free_table(cache->entries);
+  xfree(cache);
+}
+
+int metadata_cache_get(MetadataCache* cache, MetadataKind kind,
+    const char* path, hdfsFileInfo** infos, int* num_entries, int* error) {
+  char* key = make_key(kind, path, strlen(path));
+  CacheEntry* entry = find_entry(cache, key);
+  xfree(key);
+  if (entry != NULL && entry->expires_at <= now_seconds()) {
+    remove_entry(cache, entry);
+    entry = NULL;
+  }
+  if (entry == NULL) {
+    cache->stats.misses++;
+    return 0;
+  }
+  unlink_entry(cache, entry);
+  push_front(cache, entry);
+  cache->stats.hits++;
+  *infos = entry->infos;
+  *num_entries = entry->num_entries;
+  *error = entry->error;
+  return 1;
+}
+
+unsigned long metadata_cache_generation(MetadataCache* cache) {
+  return cache->generation;
+}
+
+void metadata_cache_put(MetadataCache* cache, MetadataKind kind,
+    const char* path, hdfsFileInfo* infos, int num_entries, int error,
+    unsigned long generation) {
+  // Only caches paths known not to exist, rather than transient failures.
+  if (generation != cache->generation ||
+      (infos == NULL && (!cache->negative || error != ENOENT ||
+          kind != kMetadataPathInfo))) {
+    if (infos != NULL) {
+      hdfsFreeFileInfo(infos, num_entries);
+    }
+    return;
+  }
+  char* key = make_key(kind, path, strlen(path));
+  CacheEntry* entry = find_entry(cache, key);
+  if (entry != NULL) {
+    remove_entry(cache, entry);
+  }
+  while (cache->stats.entries >= cache->capacity && cache->tail != NULL) {
+    remove_entry(cache, cache->tail);
+    cache->stats.evictions++;
+  }
+  entry = ALLOC_N(CacheEntry, 1);
+  entry->key = key;
+  entry->infos = infos;
+  entry->num_entries = num_entries;
+  entry->error = error;
+  entry->expires_at = now_seconds() + cache->ttl;
+  push_front(cache, entry);
+  st_insert(cache->entries, (st_data_t) entry->key, (st_data_t) entry);
+  cache->stats.entries++;
+}
+
+void metadata_cache_invalidate(MetadataCache* cache, const char* path,
+    int subtree) {
+  cache->generation++;
+  size_t length = strlen(path);
+  // Ignores trailing slashes, so that "/a/" and "/a" affect the same entries.
+  while (length > 1 && path[length - 1] == '/') {
+    length--;
+  }
+  int dropped = drop(cache, kMetadataPathInfo, path, length, 0) +
+      drop(cache, kMetadataListing, path, length, 0);
+  // Walks up through the ancestors, whose listings include path just below
+  // them and which a create may just have brought into existence.
+  size_t end = length;
+  int parent = 1;
+  while (end > 0) {
+    while (end > 0 && path[end - 1] != '/') {
+      end--;
+    }
+    if (end == 0) {
+      break;
+    }
+    size_t ancestor_length = end > 1 ? end - 1 : 1;
+    if (parent) {
+      dropped += drop(cache, kMetadataListing, path, ancestor_length, 0);
+      parent = 0;
+    }
+    dropped += drop(cache, kMetadataPathInfo, path, ancestor_length, 1);
+    end = ancestor_length == 1 ? 0 : ancestor_length;
+  }
+  if (subtree) {
+    // Only the root keeps its trailing slash, and everything lies beneath it.
+    int root = length > 0 && path[length - 1] == '/';
+    CacheEntry* entry = cache->head;
+    while (entry != NULL) {
+      CacheEntry* next = entry->next;
+      const char* entry_path = entry->key + 1;
+      if (strncmp(entry_path, path, length) == 0 &&
+          entry_path[length] != '\0' &&
+          (root || entry_path[length] == '/')) {
+        remove_entry(cache, entry);
+        dropped++;
+      }
+      entry = next;
+    }
+  }
+  cache->stats.invalidations += dropped;
+}
+
+void metadata_cache_clear(MetadataCache* cache) {
+  cache->generation++;
+  while (cache->head != NULL) {
+    remove_entry(cache, cache->head);
+  }
+}
+
+void metadata_cache_stats(MetadataCache* cache, MetadataCacheStats* stats) {
+  *stats = cache->stats;
+}
@@ -0,0 +1,69 @@
+#ifndef HDFS_METADATA_CACHE_H
+#define HDFS_METADATA_CACHE_H
+
+#include "hdfs.h"
+
+
+/*
+ * An LRU cache of the results of hdfsGetPathInfo and hdfsListDirectory,
+ * keyed by path as given, whose entries expire after a fixed number of
+ * seconds.  Paths found not to exist can be cached too.  The cache is not
+ * thread-safe and must only be used with the GVL held.
+ */
+typedef struct MetadataCache MetadataCache;
+
+typedef enum MetadataKind {
+  kMetadataPathInfo = 's',
+  kMetadataListing = 'l'
+} MetadataKind;
+
+typedef struct MetadataCacheStats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long invalidations;
+  long entries;
+} MetadataCacheStats;
+
+MetadataCache* metadata_cache_new(long capacity, double ttl, int negative);
+
+void metadata_cache_free(MetadataCache* cache);
+
+/*
+ * Looks up a cached result for path.  Returns 1 on a hit, setting *infos and
+ * *num_entries to entries still owned by the cache, or *infos to NULL and
+ * *error to the errno with which path was found not to exist; returns 0 on a
+ * miss.
+ */
+int metadata_cache_get(MetadataCache* cache, MetadataKind kind,
+    const char* path, hdfsFileInfo** infos, int* num_entries, int* error);
+
+/*
+ * Returns a number that changes whenever anything is invalidated, to be read
+ * before fetching a result to put.
+ */
+unsigned long metadata_cache_generation(MetadataCache* cache);
+
+/*
+ * Caches the result of fetching path, taking ownership of infos, which is
+ * NULL if the fetch failed with error.  Frees infos instead if anything was
+ * invalidated since generation was read, as the result may then be stale, or
+ * if it is a failure that should not be cached.
+ */
+void metadata_cache_put(MetadataCache* cache, MetadataKind kind,
+    const char* path, hdfsFileInfo* infos, int num_entries, int error,
+    unsigned long generation);
+
+/*
+ * Drops everything cached about path, the listing of its parent and any
+ * cached nonexistence of its ancestors, along with everything beneath it if
+ * subtree is non-zero.
+ */
+void metadata_cache_invalidate(MetadataCache* cache, const char* path,
+    int subtree);
+
+void metadata_cache_clear(MetadataCache* cache);
+
+void metadata_cache_stats(MetadataCache* cache, MetadataCacheStats* stats);
+
+#endif /* HDFS_METADATA_CACHE_H */
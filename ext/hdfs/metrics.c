@@ -0,0 +1,313 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ruby.h"
+
+#include "metrics.h"
+
+
+/*
+ * Latencies are counted in buckets whose upper bounds double from 1 us, the
+ * last also counting anything slower.
+ */
+#define METRICS_NUM_BUCKETS 24
+
+typedef struct OpCounters {
+  unsigned long calls;
+  unsigned long errors;
+  unsigned long bytes;
+  uint64_t nanoseconds;
+  unsigned long buckets[METRICS_NUM_BUCKETS];
+} OpCounters;
+
+/*
+ * The counters of one thread, written only by that thread, and read by
+ * others merging them without a lock, which at worst sees a call half
+ * recorded.
+ */
+typedef struct ThreadMetrics {
+  OpCounters ops[kNumMetrics];
+  struct ThreadMetrics* prev;
+  struct ThreadMetrics* next;
+} ThreadMetrics;
+
+static const char* METRIC_NAMES[kNumMetrics] = {
+  "open", "close", "read", "pread", "write", "flush", "hflush", "ls", "stat",
+  "exist", "mkdir", "rm", "rename"
+};
+
+static VALUE m_hdfs;
+
+static pthread_key_t metrics_key;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadMetrics* live_metrics = NULL;
+static ThreadMetrics exited_metrics;  /* merged from threads that exited */
+static ThreadMetrics reset_metrics;   /* the totals as of reset_stats */
+
+static VALUE metric_symbols[kNumMetrics];
+static VALUE event_names[kNumMetrics];
+static VALUE subscriber = Qnil;       /* publishes events if not nil */
+static ID subscriber_method;
+static unsigned long next_event_id = 0;
+
+static ID id_bytes;
+static ID id_buckets;
+static ID id_calls;
+static ID id_errno;
+static ID id_errors;
+static ID id_path;
+static ID id_seconds;
+
+
+static void add_counters(ThreadMetrics* total, ThreadMetrics* metrics,
+    int sign) {
+  int i, j;
+  for (i = 0; i < kNumMetrics; i++) {
+    OpCounters* to = total->ops + i;
+    OpCounters* from = metrics->ops + i;
+    to->calls += sign * from->calls;
+    to->errors += sign * from->errors;
+    to->bytes += sign * from->bytes;
+    to->nanoseconds += sign * from->nanoseconds;
+    for (j = 0; j < METRICS_NUM_BUCKETS; j++) {
+      to->buckets[j] += sign * from->buckets[j];
+    }
+  }
+}
+
+/* Folds the counters of an exiting thread into exited_metrics. */
+static void retire_thread_metrics(void* ptr) {
+  ThreadMetrics* metrics = (ThreadMetrics*) ptr;
+  pthread_mutex_lock(&metrics_lock);
+  add_counters(&exited_metrics, metrics, 1);
+  if (metrics->prev != NULL) {
+    metrics->prev->next = metrics->next;
+  } else {
+    live_metrics = metrics->next;
+  }
+  if (metrics->next != NULL) {
+    metrics->next->prev = metrics->prev;
+  }
+  pthread_mutex_unlock(&metrics_lock);
+  free(metrics);
+}
+
+/* Returns the counters of the calling thread, or NULL if out of memory. */
+static ThreadMetrics* thread_metrics(void) {
+  ThreadMetrics* metrics = pthread_getspecific(metrics_key);
+  if (metrics != NULL) {
+    return metrics;
+  }
+  metrics = calloc(1, sizeof(ThreadMetrics));
+  if (metrics == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&metrics_lock);
+  metrics->next = live_metrics;
+  if (live_metrics != NULL) {
+    live_metrics->prev = metrics;
+  }
+  live_metrics = metrics;
+  pthread_mutex_unlock(&metrics_lock);
+  pthread_setspecific(metrics_key, metrics);
+  return metrics;
+}
+
+static int latency_bucket(uint64_t nanoseconds) {
+  uint64_t microseconds = nanoseconds / 1000;
+  int bucket = 0;
+  while (microseconds > 0 && bucket < METRICS_NUM_BUCKETS - 1) {
+    microseconds >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+uint64_t metrics_start(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Publishes an event to the subscriber as ActiveSupport::Notifications
+ * does: its name, the Times it started and finished, a unique id and a Hash
+ * of its details.
+ */
+static void publish_event(Metric metric, uint64_t elapsed, long bytes,
+    int error, VALUE path) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t finished_at = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  uint64_t started_at = finished_at - elapsed;
+  VALUE payload = rb_hash_new();
+  if (!NIL_P(path)) {
+    rb_hash_aset(payload, ID2SYM(id_path), path);
+  }
+  rb_hash_aset(payload, ID2SYM(id_bytes), LONG2NUM(bytes));
+  if (error != 0) {
+    rb_hash_aset(payload, ID2SYM(id_errno), INT2FIX(error));
+  }
+  VALUE args[5];
+  args[0] = event_names[metric];
+  args[1] = rb_time_nano_new(started_at / 1000000000,
+      started_at % 1000000000);
+  args[2] = rb_time_nano_new(finished_at / 1000000000,
+      finished_at % 1000000000);
+  args[3] = ULONG2NUM(++next_event_id);
+  args[4] = payload;
+  rb_funcallv(subscriber, subscriber_method, 5, args);
+}
+
+void metrics_record(Metric metric, uint64_t started, long bytes, int error,
+    VALUE path) {
+  uint64_t elapsed = metrics_start() - started;
+  ThreadMetrics* metrics = thread_metrics();
+  if (metrics != NULL) {
+    OpCounters* counters = metrics->ops + metric;
+    counters->calls++;
+    counters->errors += error != 0;
+    counters->bytes += bytes > 0 ? bytes : 0;
+    counters->nanoseconds += elapsed;
+    counters->buckets[latency_bucket(elapsed)]++;
+  }
+  if (!NIL_P(subscriber)) {
+    publish_event(metric, elapsed, bytes, error, path);
+  }
+}
+
+/* Merges the counters of every thread since reset_stats into total. */
+static void merge_metrics(ThreadMetrics* total) {
+  memset(total, 0, sizeof(ThreadMetrics));
+  pthread_mutex_lock(&metrics_lock);
+  add_counters(total, &exited_metrics, 1);
+  ThreadMetrics* metrics;
+  for (metrics = live_metrics; metrics != NULL; metrics = metrics->next) {
+    add_counters(total, metrics, 1);
+  }
+  pthread_mutex_unlock(&metrics_lock);
+}
+
+/**
+ * call-seq:
+ *    HDFS.stats -> stats
+ *
+ * Returns a Hash with an entry for each instrumented operation, keyed by
+ * names such as :open, :read, :pread, :write, :ls and :stat, counting what
+ * every thread has done since the process started or reset_stats was last
+ * called.  Each entry is a Hash with the keys calls, errors, bytes, seconds,
+ * the total time spent in calls, and buckets, a Hash counting calls by the
+ * upper bound of their latency in seconds, from 1 us doubling up to
+ * Float::INFINITY, holding only the buckets which counted any.
+ */
+VALUE HDFS_s_stats(VALUE self) {
+  ThreadMetrics total;
+  merge_metrics(&total);
+  add_counters(&total, &reset_metrics, -1);
+  VALUE stats = rb_hash_new();
+  int i, j;
+  for (i = 0; i < kNumMetrics; i++) {
+    OpCounters* counters = total.ops + i;
+    VALUE buckets = rb_hash_new();
+    for (j = 0; j < METRICS_NUM_BUCKETS; j++) {
+      if (counters->buckets[j] > 0) {
+        double bound = j == METRICS_NUM_BUCKETS - 1 ? HUGE_VAL :
+            (double) (1UL << j) / 1e6;
+        rb_hash_aset(buckets, DBL2NUM(bound),
+            ULONG2NUM(counters->buckets[j]));
+      }
+    }
+    VALUE op = rb_hash_new();
+    rb_hash_aset(op, ID2SYM(id_calls), ULONG2NUM(counters->calls));
+    rb_hash_aset(op, ID2SYM(id_errors), ULONG2NUM(counters->errors));
+    rb_hash_aset(op, ID2SYM(id_bytes), ULONG2NUM(counters->bytes));
+    rb_hash_aset(op, ID2SYM(id_seconds),
+        DBL2NUM(counters->nanoseconds / 1e9));
+    rb_hash_aset(op, ID2SYM(id_buckets), buckets);
+    rb_hash_aset(stats, metric_symbols[i], op);
+  }
+  return stats;
+}
+
+/**
+ * call-seq:
+ *    HDFS.reset_stats -> nil
+ *
+ * Starts the counts returned by stats over from 0.  The counters of threads
+ * are left alone, so this takes no lock any of them contend on.
+ */
+VALUE HDFS_s_reset_stats(VALUE self) {
+  merge_metrics(&reset_metrics);
+  return Qnil;
+}
+
+/**
+ * call-seq:
+ *    HDFS.subscribe(subscriber) -> subscriber
+ *    HDFS.subscribe { |name, started, finished, id, payload| ... } -> block
+ *
+ * Publishes every instrumented call from now on as an event named after its
+ * operation, such as "read.hdfs", along with the Times it started and
+ * finished, a unique id, and a payload Hash with the keys path, if the call
+ * had one, bytes, and errno, if it failed.  Events are published with
+ * subscriber.publish if it responds to publish, so that
+ * HDFS.subscribe(ActiveSupport::Notifications) hands them to
+ * ActiveSupport subscribers, or else with subscriber.call, as for a block.
+ * Replaces any previous subscriber.
+ */
+VALUE HDFS_s_subscribe(int argc, VALUE* argv, VALUE self) {
+  VALUE new_subscriber;
+  rb_scan_args(argc, argv, "01", &new_subscriber);
+  if (NIL_P(new_subscriber)) {
+    if (!rb_block_given_p()) {
+      rb_raise(rb_eArgError, "a subscriber or a block is required");
+    }
+    new_subscriber = rb_block_proc();
+  }
+  ID id_publish = rb_intern("publish");
+  subscriber_method = rb_respond_to(new_subscriber, id_publish) ?
+      id_publish : rb_intern("call");
+  subscriber = new_subscriber;
+  return subscriber;
+}
+
+/**
+ * call-seq:
+ *    HDFS.unsubscribe -> nil
+ *
+ * Stops publishing events to the subscriber.
+ */
+VALUE HDFS_s_unsubscribe(VALUE self) {
+  subscriber = Qnil;
+  return Qnil;
+}
+
+void init_metrics(VALUE parent) {
+  m_hdfs = parent;
+
+  pthread_key_create(&metrics_key, retire_thread_metrics);
+  rb_gc_register_address(&subscriber);
+
+  int i;
+  for (i = 0; i < kNumMetrics; i++) {
+    metric_symbols[i] = ID2SYM(rb_intern(METRIC_NAMES[i]));
+    event_names[i] = rb_obj_freeze(rb_sprintf("%s.hdfs", METRIC_NAMES[i]));
+    rb_gc_register_address(event_names + i);
+  }
+  id_bytes = rb_intern("bytes");
+  id_buckets = rb_intern("buckets");
+  id_calls = rb_intern("calls");
+  id_errno = rb_intern("errno");
+  id_errors = rb_intern("errors");
+  id_path = rb_intern("path");
+  id_seconds = rb_intern("seconds");
+
+  rb_define_singleton_method(m_hdfs, "reset_stats", HDFS_s_reset_stats, 0);
+  rb_define_singleton_method(m_hdfs, "stats", HDFS_s_stats, 0);
+  rb_define_singleton_method(m_hdfs, "subscribe", HDFS_s_subscribe, -1);
+  rb_define_singleton_method(m_hdfs, "unsubscribe", HDFS_s_unsubscribe, 0);
+}
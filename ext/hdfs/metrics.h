@@ -0,0 +1,46 @@
+#ifndef HDFS_METRICS_H
+#define HDFS_METRICS_H
+
+#include <stdint.h>
+
+#include "ruby.h"
+
+
+/*
+ * Counts the calls, errors, bytes and latency of each instrumented operation
+ * into counters belonging to the calling thread, which HDFS.stats merges, so
+ * that recording never contends on a lock.  If a subscriber has been set
+ * with HDFS.subscribe, also publishes each call to it as an event.
+ */
+typedef enum Metric {
+  kMetricOpen,
+  kMetricClose,
+  kMetricRead,
+  kMetricPread,
+  kMetricWrite,
+  kMetricFlush,
+  kMetricHflush,
+  kMetricLs,
+  kMetricStat,
+  kMetricExist,
+  kMetricMkdir,
+  kMetricRm,
+  kMetricRename,
+  kNumMetrics
+} Metric;
+
+/* Returns the time at which an operation starts, for metrics_record. */
+uint64_t metrics_start(void);
+
+/*
+ * Records an operation on path, which may be nil, started at started, which
+ * moved bytes bytes and failed with error unless it is 0.  Must be called
+ * with the GVL held, before raising any error, and may raise if the
+ * subscriber does.
+ */
+void metrics_record(Metric metric, uint64_t started, long bytes, int error,
+    VALUE path);
+
+void init_metrics(VALUE parent);
+
+#endif /* HDFS_METRICS_H */
@@ -0,0 +1,339 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "parallel_reader.h"
+
+
+/* The chunks each worker may have read ahead of the consumer. */
+#define PARALLEL_READER_CHUNKS_PER_THREAD 2
+
+struct ParallelReader {
+  hdfsFS fs;
+  char* path;
+  tOffset size;
+  tOffset block_size;
+  tSize chunk_size;
+  long chunks_per_block;
+  long num_chunks;
+  int ordered;
+  int num_workers;
+  pthread_t* threads;
+  pthread_mutex_t lock;      /* guards everything below */
+  pthread_cond_t space_cond;  /* signaled for workers awaiting room */
+  pthread_cond_t result_cond;  /* signaled for the consumer */
+  long next_claimed;         /* the index of the next chunk to read */
+  long next_taken;           /* the index of the next chunk to hand out */
+  int outstanding;           /* chunks claimed but not yet handed out */
+  int max_outstanding;
+  ReadChunk** slots;         /* if ordered, chunks read by index modulo */
+  ReadChunk* done_head;      /* if not ordered, chunks in order read */
+  ReadChunk* done_tail;
+  ReadChunk* free_chunks;    /* chunks recycled for their buffers */
+  int error;                 /* errno of the first failure, or 0 */
+  int stopping;
+};
+
+
+/* Fills in the offset and length of the chunk with the supplied index. */
+static void locate_chunk(ParallelReader* reader, long index,
+    ReadChunk* chunk) {
+  long block = index / reader->chunks_per_block;
+  chunk->index = index;
+  tOffset block_start = block * reader->block_size;
+  tOffset block_end = block_start + reader->block_size;
+  chunk->offset = block_start +
+      (index % reader->chunks_per_block) * (tOffset) reader->chunk_size;
+  tOffset end = chunk->offset + reader->chunk_size;
+  end = end < block_end ? end : block_end;
+  end = end < reader->size ? end : reader->size;
+  chunk->length = (tSize) (end - chunk->offset);
+}
+
+/* Records the first failure and stops the workers. */
+static void fail(ParallelReader* reader, int error) {
+  pthread_mutex_lock(&reader->lock);
+  if (reader->error == 0) {
+    reader->error = error;
+  }
+  reader->stopping = 1;
+  pthread_cond_broadcast(&reader->space_cond);
+  pthread_cond_broadcast(&reader->result_cond);
+  pthread_mutex_unlock(&reader->lock);
+}
+
+static void free_chunk(ReadChunk* chunk) {
+  free(chunk->buffer);
+  free(chunk);
+}
+
+/*
+ * Claims the next chunk to read along with a buffer for it, waiting while
+ * too many are outstanding.  Returns NULL once there are none left or the
+ * read has stopped.
+ */
+static ReadChunk* claim_chunk(ParallelReader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  while (reader->outstanding >= reader->max_outstanding &&
+      !reader->stopping) {
+    pthread_cond_wait(&reader->space_cond, &reader->lock);
+  }
+  if (reader->stopping || reader->next_claimed >= reader->num_chunks) {
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+  }
+  long index = reader->next_claimed++;
+  reader->outstanding++;
+  ReadChunk* chunk = reader->free_chunks;
+  if (chunk != NULL) {
+    reader->free_chunks = chunk->next;
+  }
+  pthread_mutex_unlock(&reader->lock);
+  if (chunk == NULL) {
+    chunk = malloc(sizeof(ReadChunk));
+    char* buffer = malloc(reader->chunk_size);
+    if (chunk == NULL || buffer == NULL) {
+      free(chunk);
+      free(buffer);
+      fail(reader, ENOMEM);
+      return NULL;
+    }
+    chunk->buffer = buffer;
+  }
+  locate_chunk(reader, index, chunk);
+  return chunk;
+}
+
+/* Reads the whole of a chunk, returning 0 or an errno. */
+static int read_chunk(ParallelReader* reader, hdfsFile file,
+    ReadChunk* chunk) {
+  tSize total = 0;
+  while (total < chunk->length) {
+    tSize bytes_read = hdfsPread(reader->fs, file, chunk->offset + total,
+        chunk->buffer + total, chunk->length - total);
+    if (bytes_read < 0) {
+      return errno == 0 ? EIO : errno;
+    }
+    if (bytes_read == 0) {
+      // The file is shorter than when it was stated.
+      return EIO;
+    }
+    total += bytes_read;
+  }
+  return 0;
+}
+
+/* Hands a chunk which has been read to the consumer. */
+static void publish_chunk(ParallelReader* reader, ReadChunk* chunk) {
+  pthread_mutex_lock(&reader->lock);
+  if (reader->ordered) {
+    reader->slots[chunk->index % reader->max_outstanding] = chunk;
+  } else {
+    chunk->next = NULL;
+    if (reader->done_tail != NULL) {
+      reader->done_tail->next = chunk;
+    } else {
+      reader->done_head = chunk;
+    }
+    reader->done_tail = chunk;
+  }
+  pthread_cond_signal(&reader->result_cond);
+  pthread_mutex_unlock(&reader->lock);
+}
+
+static void* run_read_worker(void* ptr) {
+  ParallelReader* reader = (ParallelReader*) ptr;
+  hdfsFile file = hdfsOpenFile(reader->fs, reader->path, O_RDONLY, 0, 0, 0);
+  if (file == NULL) {
+    fail(reader, errno == 0 ? EIO : errno);
+    return NULL;
+  }
+  ReadChunk* chunk;
+  while ((chunk = claim_chunk(reader)) != NULL) {
+    int error = read_chunk(reader, file, chunk);
+    if (error != 0) {
+      free_chunk(chunk);
+      fail(reader, error);
+      break;
+    }
+    publish_chunk(reader, chunk);
+  }
+  hdfsCloseFile(reader->fs, file);
+  return NULL;
+}
+
+static void free_reader(ParallelReader* reader) {
+  int i;
+  for (i = 0; i < reader->max_outstanding; i++) {
+    if (reader->slots[i] != NULL) {
+      free_chunk(reader->slots[i]);
+    }
+  }
+  while (reader->done_head != NULL) {
+    ReadChunk* chunk = reader->done_head;
+    reader->done_head = chunk->next;
+    free_chunk(chunk);
+  }
+  while (reader->free_chunks != NULL) {
+    ReadChunk* chunk = reader->free_chunks;
+    reader->free_chunks = chunk->next;
+    free_chunk(chunk);
+  }
+  pthread_mutex_destroy(&reader->lock);
+  pthread_cond_destroy(&reader->space_cond);
+  pthread_cond_destroy(&reader->result_cond);
+  free(reader->slots);
+  free(reader->threads);
+  free(reader->path);
+  free(reader);
+}
+
+ParallelReader* parallel_reader_start(hdfsFS fs, const char* path,
+    int num_threads, tSize chunk_size, int ordered) {
+  hdfsFileInfo* info = hdfsGetPathInfo(fs, path);
+  if (info == NULL) {
+    errno = errno == 0 ? EIO : errno;
+    return NULL;
+  }
+  if (info->mKind != kObjectKindFile) {
+    hdfsFreeFileInfo(info, 1);
+    errno = EISDIR;
+    return NULL;
+  }
+  ParallelReader* reader = calloc(1, sizeof(ParallelReader));
+  if (reader == NULL) {
+    hdfsFreeFileInfo(info, 1);
+    errno = ENOMEM;
+    return NULL;
+  }
+  reader->fs = fs;
+  reader->size = info->mSize;
+  reader->block_size = info->mBlockSize > 0 ? info->mBlockSize :
+      (info->mSize > 0 ? info->mSize : 1);
+  hdfsFreeFileInfo(info, 1);
+  // Keeps chunks within blocks, and no larger than a block.
+  reader->chunk_size = reader->block_size < chunk_size ?
+      (tSize) reader->block_size : chunk_size;
+  reader->chunks_per_block = (long) ((reader->block_size +
+      reader->chunk_size - 1) / reader->chunk_size);
+  tOffset full_blocks = reader->size / reader->block_size;
+  tOffset remainder = reader->size % reader->block_size;
+  reader->num_chunks = (long) (full_blocks * reader->chunks_per_block +
+      (remainder + reader->chunk_size - 1) / reader->chunk_size);
+  reader->ordered = ordered;
+  reader->num_workers = reader->num_chunks < num_threads ?
+      (int) reader->num_chunks : num_threads;
+  reader->max_outstanding = reader->num_workers > 0 ?
+      reader->num_workers * PARALLEL_READER_CHUNKS_PER_THREAD : 1;
+  reader->path = strdup(path);
+  reader->slots = calloc(reader->max_outstanding, sizeof(ReadChunk*));
+  reader->threads = calloc(reader->num_workers > 0 ? reader->num_workers : 1,
+      sizeof(pthread_t));
+  if (reader->path == NULL || reader->slots == NULL ||
+      reader->threads == NULL) {
+    free(reader->path);
+    free(reader->slots);
+    free(reader->threads);
+    free(reader);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->space_cond, NULL);
+  pthread_cond_init(&reader->result_cond, NULL);
+  int i;
+  for (i = 0; i < reader->num_workers; i++) {
+    int result = pthread_create(reader->threads + i, NULL, run_read_worker,
+        reader);
+    if (result != 0) {
+      // Stops the workers already started before giving up.
+      reader->num_workers = i;
+      parallel_reader_stop(reader);
+      errno = result;
+      return NULL;
+    }
+  }
+  return reader;
+}
+
+tOffset parallel_reader_size(ParallelReader* reader) {
+  return reader->size;
+}
+
+void parallel_reader_stop(ParallelReader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  reader->stopping = 1;
+  pthread_cond_broadcast(&reader->space_cond);
+  pthread_mutex_unlock(&reader->lock);
+  int i;
+  for (i = 0; i < reader->num_workers; i++) {
+    pthread_join(reader->threads[i], NULL);
+  }
+  free_reader(reader);
+}
+
+int parallel_reader_next(ParallelReader* reader, ReadChunk** chunk,
+    volatile int* interrupted, int* error) {
+  int result;
+  pthread_mutex_lock(&reader->lock);
+  for (;;) {
+    if (reader->next_taken >= reader->num_chunks) {
+      result = 0;
+      break;
+    }
+    ReadChunk* ready;
+    if (reader->ordered) {
+      ReadChunk** slot = reader->slots +
+          reader->next_taken % reader->max_outstanding;
+      ready = *slot;
+      *slot = NULL;
+    } else {
+      ready = reader->done_head;
+      if (ready != NULL) {
+        reader->done_head = ready->next;
+        if (reader->done_head == NULL) {
+          reader->done_tail = NULL;
+        }
+      }
+    }
+    if (ready != NULL) {
+      // Hands out what was read before any failure first.
+      *chunk = ready;
+      reader->next_taken++;
+      reader->outstanding--;
+      pthread_cond_signal(&reader->space_cond);
+      result = 1;
+      break;
+    }
+    if (reader->error != 0) {
+      *error = reader->error;
+      result = -1;
+      break;
+    }
+    if (*interrupted) {
+      result = -2;
+      break;
+    }
+    pthread_cond_wait(&reader->result_cond, &reader->lock);
+  }
+  pthread_mutex_unlock(&reader->lock);
+  return result;
+}
+
+void parallel_reader_recycle(ParallelReader* reader, ReadChunk* chunk) {
+  pthread_mutex_lock(&reader->lock);
+  chunk->next = reader->free_chunks;
+  reader->free_chunks = chunk;
+  pthread_mutex_unlock(&reader->lock);
+}
+
+void parallel_reader_wake(void* reader) {
+  ParallelReader* self = (ParallelReader*) reader;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->result_cond);
+  pthread_mutex_unlock(&self->lock);
+}
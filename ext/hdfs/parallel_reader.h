@@ -0,0 +1,60 @@
+#ifndef HDFS_PARALLEL_READER_H
+#define HDFS_PARALLEL_READER_H
+
+#include "hdfs.h"
+
+
+/*
+ * A pool of threads which reads one file with hdfsPread, each worker through
+ * its own hdfsFile.  The file is split into chunks which never cross a block
+ * boundary, so that every read is served by a single DataNode; workers claim
+ * chunks in order and pause once a bounded number are waiting for the
+ * consumer, so that a slow consumer holds back the read rather than letting
+ * chunks pile up in memory.
+ */
+typedef struct ParallelReader ParallelReader;
+
+/* A range of the file which has been read. */
+typedef struct ReadChunk {
+  long index;                /* the position of the chunk within the file */
+  char* buffer;
+  tOffset offset;
+  tSize length;
+  struct ReadChunk* next;
+} ReadChunk;
+
+/*
+ * Stats the file at path and starts reading it in chunks of at most
+ * chunk_size bytes with num_threads threads.  If ordered is non-zero, chunks
+ * are handed out in order of offset; otherwise as soon as each is read.
+ * Returns NULL and sets errno if the file cannot be stated or the threads
+ * cannot be started.  Blocks in libhdfs, so call it without the GVL.
+ */
+ParallelReader* parallel_reader_start(hdfsFS fs, const char* path,
+    int num_threads, tSize chunk_size, int ordered);
+
+/* Returns the size in bytes of the file being read. */
+tOffset parallel_reader_size(ParallelReader* reader);
+
+/*
+ * Stops the read if it is still running, waits for its threads and frees
+ * the reader along with any chunks not yet taken.
+ */
+void parallel_reader_stop(ParallelReader* reader);
+
+/*
+ * Waits for the next chunk, which the caller must hand back with
+ * parallel_reader_recycle.  Returns 1 and sets *chunk, 0 once every chunk
+ * has been taken, -1 with *error set if opening or reading the file failed,
+ * or -2 if *interrupted was set first.
+ */
+int parallel_reader_next(ParallelReader* reader, ReadChunk** chunk,
+    volatile int* interrupted, int* error);
+
+/* Returns a chunk taken with parallel_reader_next so its buffer is reused. */
+void parallel_reader_recycle(ParallelReader* reader, ReadChunk* chunk);
+
+/* Wakes a caller waiting in parallel_reader_next so it rechecks interrupts. */
+void parallel_reader_wake(void* reader);
+
+#endif /* HDFS_PARALLEL_READER_H */
@@ -0,0 +1,249 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "readahead.h"
+
+
+/* A filled chunk of the ring. */
+typedef struct ReadaheadChunk {
+  tOffset offset;      /* the offset in the file of the first byte */
+  long length;         /* the number of bytes read into the chunk */
+} ReadaheadChunk;
+
+struct Readahead {
+  hdfsFS fs;
+  hdfsFile file;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;   /* signaled whenever any of the below changes */
+  char* buffer;          /* num_chunks * chunk_size bytes */
+  ReadaheadChunk* chunks;
+  int num_chunks;
+  long chunk_size;
+  int head;              /* index of the oldest filled chunk */
+  int count;             /* the number of filled chunks */
+  long head_consumed;    /* bytes of the head chunk already read */
+  tOffset position;      /* the position of the reader */
+  tOffset fetch_position;  /* the offset the thread reads next */
+  unsigned long generation;  /* bumped whenever the thread must restart */
+  int eof;
+  int error;
+  int stopping;
+};
+
+
+/*
+ * Reads until length bytes have been read or the end of the file is reached,
+ * returning the number of bytes read or -1 on failure.
+ */
+static long read_chunk(Readahead* readahead, char* buffer, long length) {
+  long total = 0;
+  while (total < length) {
+    tSize bytes_read = hdfsRead(readahead->fs, readahead->file,
+        buffer + total, (tSize) (length - total));
+    if (bytes_read == -1) {
+      return -1;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    total += bytes_read;
+  }
+  return total;
+}
+
+static void* run_readahead(void* ptr) {
+  Readahead* readahead = (Readahead*) ptr;
+  unsigned long seeked_generation = readahead->generation;
+  pthread_mutex_lock(&readahead->lock);
+  while (!readahead->stopping) {
+    if (readahead->count == readahead->num_chunks || readahead->eof ||
+        readahead->error) {
+      pthread_cond_wait(&readahead->cond, &readahead->lock);
+      continue;
+    }
+    unsigned long generation = readahead->generation;
+    tOffset offset = readahead->fetch_position;
+    int slot = (readahead->head + readahead->count) % readahead->num_chunks;
+    pthread_mutex_unlock(&readahead->lock);
+
+    // The reader never touches the slot being filled, as it only reads
+    // chunks that have been committed below.
+    long bytes_read = 0;
+    int error = 0;
+    if (generation != seeked_generation &&
+        hdfsSeek(readahead->fs, readahead->file, offset) == -1) {
+      bytes_read = -1;
+    } else {
+      seeked_generation = generation;
+      bytes_read = read_chunk(readahead,
+          readahead->buffer + (long) slot * readahead->chunk_size,
+          readahead->chunk_size);
+    }
+    if (bytes_read == -1) {
+      error = errno == 0 ? EIO : errno;
+    }
+
+    pthread_mutex_lock(&readahead->lock);
+    if (generation != readahead->generation) {
+      // The reader seeked elsewhere while this chunk was in flight.
+      continue;
+    }
+    if (bytes_read == -1) {
+      readahead->error = error;
+    } else {
+      if (bytes_read > 0) {
+        readahead->chunks[slot].offset = offset;
+        readahead->chunks[slot].length = bytes_read;
+        readahead->count++;
+        readahead->fetch_position += bytes_read;
+      }
+      if (bytes_read < readahead->chunk_size) {
+        readahead->eof = 1;
+      }
+    }
+    pthread_cond_broadcast(&readahead->cond);
+  }
+  pthread_mutex_unlock(&readahead->lock);
+  return NULL;
+}
+
+Readahead* readahead_start(hdfsFS fs, hdfsFile file, tOffset position,
+    int num_chunks, long chunk_size) {
+  Readahead* readahead = calloc(1, sizeof(Readahead));
+  if (readahead == NULL) {
+    return NULL;
+  }
+  readahead->fs = fs;
+  readahead->file = file;
+  readahead->num_chunks = num_chunks;
+  readahead->chunk_size = chunk_size;
+  readahead->position = position;
+  readahead->fetch_position = position;
+  readahead->buffer = malloc((size_t) num_chunks * chunk_size);
+  readahead->chunks = calloc(num_chunks, sizeof(ReadaheadChunk));
+  if (readahead->buffer == NULL || readahead->chunks == NULL) {
+    free(readahead->buffer);
+    free(readahead->chunks);
+    free(readahead);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&readahead->lock, NULL);
+  pthread_cond_init(&readahead->cond, NULL);
+  int result = pthread_create(&readahead->thread, NULL, run_readahead,
+      readahead);
+  if (result != 0) {
+    pthread_mutex_destroy(&readahead->lock);
+    pthread_cond_destroy(&readahead->cond);
+    free(readahead->buffer);
+    free(readahead->chunks);
+    free(readahead);
+    errno = result;
+    return NULL;
+  }
+  return readahead;
+}
+
+void readahead_stop(Readahead* readahead) {
+  pthread_mutex_lock(&readahead->lock);
+  readahead->stopping = 1;
+  pthread_cond_broadcast(&readahead->cond);
+  pthread_mutex_unlock(&readahead->lock);
+  pthread_join(readahead->thread, NULL);
+  pthread_mutex_destroy(&readahead->lock);
+  pthread_cond_destroy(&readahead->cond);
+  free(readahead->buffer);
+  free(readahead->chunks);
+  free(readahead);
+}
+
+long readahead_read(Readahead* readahead, char* buffer, long length,
+    volatile int* interrupted, int* error) {
+  long total = 0;
+  pthread_mutex_lock(&readahead->lock);
+  while (total < length) {
+    if (readahead->count > 0) {
+      ReadaheadChunk* chunk = readahead->chunks + readahead->head;
+      long available = chunk->length - readahead->head_consumed;
+      long wanted = length - total;
+      long copied = wanted < available ? wanted : available;
+      memcpy(buffer + total, readahead->buffer +
+          (long) readahead->head * readahead->chunk_size +
+          readahead->head_consumed, copied);
+      total += copied;
+      readahead->position += copied;
+      readahead->head_consumed += copied;
+      if (readahead->head_consumed == chunk->length) {
+        // Hands the drained chunk back to the thread.
+        readahead->head = (readahead->head + 1) % readahead->num_chunks;
+        readahead->count--;
+        readahead->head_consumed = 0;
+        pthread_cond_broadcast(&readahead->cond);
+      }
+    } else if (readahead->error && total == 0) {
+      *error = readahead->error;
+      total = -1;
+      break;
+    } else if (readahead->eof || readahead->error || *interrupted) {
+      break;
+    } else {
+      pthread_cond_wait(&readahead->cond, &readahead->lock);
+    }
+  }
+  pthread_mutex_unlock(&readahead->lock);
+  return total;
+}
+
+void readahead_seek(Readahead* readahead, tOffset position) {
+  pthread_mutex_lock(&readahead->lock);
+  tOffset window_start = readahead->count > 0 ?
+      readahead->chunks[readahead->head].offset : readahead->position;
+  if (position >= window_start && position < readahead->fetch_position) {
+    // Drops the chunks before position, keeping the rest of the window.
+    while (position >= readahead->chunks[readahead->head].offset +
+        readahead->chunks[readahead->head].length) {
+      readahead->head = (readahead->head + 1) % readahead->num_chunks;
+      readahead->count--;
+    }
+    readahead->head_consumed = (long) (position -
+        readahead->chunks[readahead->head].offset);
+    readahead->position = position;
+  } else if (position != readahead->position) {
+    readahead->generation++;
+    readahead->head = 0;
+    readahead->count = 0;
+    readahead->head_consumed = 0;
+    readahead->position = position;
+    readahead->fetch_position = position;
+    readahead->eof = 0;
+    readahead->error = 0;
+  }
+  pthread_cond_broadcast(&readahead->cond);
+  pthread_mutex_unlock(&readahead->lock);
+}
+
+tOffset readahead_tell(Readahead* readahead) {
+  pthread_mutex_lock(&readahead->lock);
+  tOffset position = readahead->position;
+  pthread_mutex_unlock(&readahead->lock);
+  return position;
+}
+
+long readahead_buffered(Readahead* readahead) {
+  pthread_mutex_lock(&readahead->lock);
+  long buffered = (long) (readahead->fetch_position - readahead->position);
+  pthread_mutex_unlock(&readahead->lock);
+  return buffered;
+}
+
+void readahead_wake(void* readahead) {
+  Readahead* self = (Readahead*) readahead;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->lock);
+}
@@ -0,0 +1,52 @@
+#ifndef HDFS_READAHEAD_H
+#define HDFS_READAHEAD_H
+
+#include "hdfs.h"
+
+
+/*
+ * A background thread which reads a file sequentially into a ring of chunks
+ * ahead of the reader, so that DataNode round trips overlap with whatever the
+ * reader does between reads.  While active, the thread owns the stream
+ * position of the file; the reader's position is tracked separately.
+ */
+typedef struct Readahead Readahead;
+
+/*
+ * Starts reading ahead from position in num_chunks chunks of chunk_size
+ * bytes.  Returns NULL and sets errno if the thread cannot be started.
+ */
+Readahead* readahead_start(hdfsFS fs, hdfsFile file, tOffset position,
+    int num_chunks, long chunk_size);
+
+/*
+ * Stops the thread, waiting for any read in flight, and frees the readahead.
+ * Must be called before the file is closed.
+ */
+void readahead_stop(Readahead* readahead);
+
+/*
+ * Copies up to length bytes from the ring into buffer, waiting for the thread
+ * as needed.  Returns fewer bytes only at the end of the file or once
+ * *interrupted is set, and -1 with *error set if the thread failed to read.
+ * Blocks, so should be called without the GVL.
+ */
+long readahead_read(Readahead* readahead, char* buffer, long length,
+    volatile int* interrupted, int* error);
+
+/*
+ * Moves the reader to position.  Keeps the buffered chunks if position falls
+ * within them; otherwise discards them and restarts the thread there.
+ */
+void readahead_seek(Readahead* readahead, tOffset position);
+
+/* Returns the position of the reader. */
+tOffset readahead_tell(Readahead* readahead);
+
+/* Returns the number of bytes buffered ahead of the reader. */
+long readahead_buffered(Readahead* readahead);
+
+/* Wakes a reader waiting in readahead_read so that it rechecks interrupts. */
+void readahead_wake(void* readahead);
+
+#endif /* HDFS_READAHEAD_H */
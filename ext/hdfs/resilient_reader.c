@@ -0,0 +1,525 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "hdfs.h"
+
+#include "resilient_reader.h"
+
+
+/* The longest wait before a retry, however many have come before it. */
+#define RESILIENT_MAX_BACKOFF 10.0
+
+/* A stream, closed once neither the reader nor a hedged read holds it. */
+typedef struct Stream {
+  hdfsFile file;
+  int refs;
+} Stream;
+
+struct HedgedRead;
+
+/* The arguments of a thread issuing one of the reads of a hedged read. */
+typedef struct HedgeTask {
+  ResilientReader* reader;
+  struct HedgedRead* read;
+  int which;                 /* 0 for the first read, 1 for the hedge */
+} HedgeTask;
+
+/*
+ * A pread issued first through the stream of the reader, then again through
+ * the hedge stream if it takes too long.  Each read lands in a buffer of its
+ * own, so that the caller can return as soon as either finishes and leave
+ * the other to finish and free the read.
+ */
+typedef struct HedgedRead {
+  tOffset position;
+  long length;
+  HedgeTask tasks[2];
+  Stream* streams[2];
+  char* buffers[2];
+  long results[2];           /* the bytes read, or -1 */
+  int errors[2];
+  int started[2];
+  int done[2];
+  int refs;                  /* the caller and each thread still running */
+} HedgedRead;
+
+struct ResilientReader {
+  hdfsFS fs;
+  char* path;
+  ResilientOptions options;
+  pthread_mutex_t lock;      /* guards everything below */
+  pthread_cond_t cond;       /* signaled as reads finish and on wake */
+  Stream* stream;            /* the stream read through, reopened on failure */
+  Stream* hedge_stream;      /* the second stream, opened by the first hedge */
+  int opening_hedge;
+  int running;               /* threads of hedged reads still running */
+  ResilientStats stats;
+};
+
+
+static int errno_or(int error) {
+  return errno != 0 ? errno : error;
+}
+
+static double now_seconds(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static struct timespec to_timespec(double seconds) {
+  struct timespec ts;
+  ts.tv_sec = (time_t) seconds;
+  ts.tv_nsec = (long) ((seconds - (double) ts.tv_sec) * 1e9);
+  return ts;
+}
+
+/* Returns non-zero unless error means a retry would fail the same way. */
+static int is_transient(int error) {
+  switch (error) {
+    case EACCES:
+    case EINVAL:
+    case EISDIR:
+    case ENOENT:
+    case ENOMEM:
+    case ENOTSUP:
+    case EPERM:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+static Stream* new_stream(hdfsFile file, int refs) {
+  Stream* stream = malloc(sizeof(Stream));
+  if (stream != NULL) {
+    stream->file = file;
+    stream->refs = refs;
+  }
+  return stream;
+}
+
+/* Returns the stream of the reader with a reference held. */
+static Stream* acquire_stream(ResilientReader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  Stream* stream = reader->stream;
+  stream->refs++;
+  pthread_mutex_unlock(&reader->lock);
+  return stream;
+}
+
+/* Drops a reference to stream, closing it if it was the last. */
+static void release_stream(ResilientReader* reader, Stream* stream) {
+  pthread_mutex_lock(&reader->lock);
+  int last = --stream->refs == 0;
+  pthread_mutex_unlock(&reader->lock);
+  if (last) {
+    hdfsCloseFile(reader->fs, stream->file);
+    free(stream);
+  }
+}
+
+/*
+ * Returns the hedge stream with a reference held, opening it if no hedged
+ * read has yet, or NULL with *error set if it cannot be opened.
+ */
+static Stream* acquire_hedge_stream(ResilientReader* reader, int* error) {
+  pthread_mutex_lock(&reader->lock);
+  while (reader->opening_hedge) {
+    pthread_cond_wait(&reader->cond, &reader->lock);
+  }
+  Stream* stream = reader->hedge_stream;
+  if (stream != NULL) {
+    stream->refs++;
+    pthread_mutex_unlock(&reader->lock);
+    return stream;
+  }
+  reader->opening_hedge = 1;
+  pthread_mutex_unlock(&reader->lock);
+  errno = 0;
+  hdfsFile file = hdfsOpenFile(reader->fs, reader->path, O_RDONLY, 0, 0, 0);
+  *error = file == NULL ? errno_or(EIO) : 0;
+  stream = file == NULL ? NULL : new_stream(file, 2);
+  if (file != NULL && stream == NULL) {
+    hdfsCloseFile(reader->fs, file);
+    *error = ENOMEM;
+  }
+  pthread_mutex_lock(&reader->lock);
+  reader->opening_hedge = 0;
+  reader->hedge_stream = stream;
+  pthread_cond_broadcast(&reader->cond);
+  pthread_mutex_unlock(&reader->lock);
+  return stream;
+}
+
+static void free_hedged_read(HedgedRead* read) {
+  free(read->buffers[0]);
+  free(read->buffers[1]);
+  free(read);
+}
+
+static void* run_hedged_read(void* ptr) {
+  HedgeTask* task = (HedgeTask*) ptr;
+  ResilientReader* reader = task->reader;
+  HedgedRead* read = task->read;
+  int which = task->which;
+  int error = 0;
+  Stream* stream = read->streams[which] != NULL ? read->streams[which] :
+      acquire_hedge_stream(reader, &error);
+  long total = 0;
+  while (stream != NULL && total < read->length) {
+    errno = 0;
+    tSize bytes_read = hdfsPread(reader->fs, stream->file,
+        read->position + total, read->buffers[which] + total,
+        (tSize) (read->length - total));
+    if (bytes_read < 0) {
+      error = errno_or(EIO);
+      break;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    total += bytes_read;
+  }
+  // Lets go of the stream while the reader is certainly still running.
+  if (stream != NULL) {
+    release_stream(reader, stream);
+  }
+  pthread_mutex_lock(&reader->lock);
+  read->results[which] = error != 0 ? -1 : total;
+  read->errors[which] = error;
+  read->done[which] = 1;
+  int last = --read->refs == 0;
+  reader->running--;
+  pthread_cond_broadcast(&reader->cond);
+  pthread_mutex_unlock(&reader->lock);
+  if (last) {
+    free_hedged_read(read);
+  }
+  return NULL;
+}
+
+/*
+ * Starts the thread issuing one of the reads of a hedged read.  Must be
+ * called with the lock held.  Returns 0 or an errno.
+ */
+static int start_hedged_read(ResilientReader* reader, HedgedRead* read,
+    int which) {
+  HedgeTask* task = read->tasks + which;
+  task->reader = reader;
+  task->read = read;
+  task->which = which;
+  if (read->buffers[which] == NULL) {
+    read->buffers[which] = malloc(read->length);
+    if (read->buffers[which] == NULL) {
+      return ENOMEM;
+    }
+  }
+  pthread_t thread;
+  int result = pthread_create(&thread, NULL, run_hedged_read, task);
+  if (result != 0) {
+    return result;
+  }
+  pthread_detach(thread);
+  read->started[which] = 1;
+  read->refs++;
+  reader->running++;
+  return 0;
+}
+
+/*
+ * Reads length bytes from position through stream, hedging the read if it
+ * has not finished within hedge_after seconds.  Returns the bytes read by
+ * whichever read finished first, 0 at the end of the file or if interrupted
+ * first, or -1 with *error set if every read failed.
+ */
+static long hedged_pread(ResilientReader* reader, Stream* stream,
+    tOffset position, char* buffer, long length, volatile int* interrupted,
+    int* error) {
+  HedgedRead* read = calloc(1, sizeof(HedgedRead));
+  if (read == NULL) {
+    *error = ENOMEM;
+    return -1;
+  }
+  read->position = position;
+  read->length = length;
+  read->refs = 1;
+  pthread_mutex_lock(&reader->lock);
+  read->streams[0] = stream;
+  stream->refs++;
+  int result = start_hedged_read(reader, read, 0);
+  if (result != 0) {
+    stream->refs--;
+    pthread_mutex_unlock(&reader->lock);
+    free_hedged_read(read);
+    *error = result;
+    return -1;
+  }
+  struct timespec hedge_at = to_timespec(now_seconds() +
+      reader->options.hedge_after);
+  while (!read->done[0] && !*interrupted) {
+    if (pthread_cond_timedwait(&reader->cond, &reader->lock,
+        &hedge_at) == ETIMEDOUT) {
+      break;
+    }
+  }
+  if (!read->done[0] && !*interrupted &&
+      start_hedged_read(reader, read, 1) == 0) {
+    reader->stats.hedges++;
+  }
+  // Takes the first read to succeed, or waits until both have failed.
+  int winner = -1;
+  for (;;) {
+    int i, pending = 0;
+    for (i = 0; i < 2 && winner == -1; i++) {
+      if (read->done[i] && read->results[i] >= 0) {
+        winner = i;
+      }
+      pending |= read->started[i] && !read->done[i];
+    }
+    if (winner != -1 || !pending || *interrupted) {
+      break;
+    }
+    pthread_cond_wait(&reader->cond, &reader->lock);
+  }
+  long total = 0;
+  if (winner != -1) {
+    total = read->results[winner];
+    memcpy(buffer, read->buffers[winner], total);
+    reader->stats.hedge_wins += winner == 1;
+  } else if (!*interrupted) {
+    total = -1;
+    *error = read->errors[0] != 0 ? read->errors[0] : read->errors[1];
+  }
+  int last = --read->refs == 0;
+  pthread_mutex_unlock(&reader->lock);
+  if (last) {
+    free_hedged_read(read);
+  }
+  return total;
+}
+
+/* Sleeps before the supplied retry, waking early if interrupted. */
+static void wait_to_retry(ResilientReader* reader, int attempt,
+    volatile int* interrupted) {
+  double delay = reader->options.backoff;
+  int i;
+  for (i = 1; i < attempt && delay < RESILIENT_MAX_BACKOFF; i++) {
+    delay *= 2;
+  }
+  delay = delay < RESILIENT_MAX_BACKOFF ? delay : RESILIENT_MAX_BACKOFF;
+  struct timespec retry_at = to_timespec(now_seconds() + delay);
+  pthread_mutex_lock(&reader->lock);
+  while (!*interrupted) {
+    if (pthread_cond_timedwait(&reader->cond, &reader->lock,
+        &retry_at) == ETIMEDOUT) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&reader->lock);
+}
+
+/* Returns whether the stream of the reader is still failed. */
+static int is_current_stream(ResilientReader* reader, Stream* failed) {
+  pthread_mutex_lock(&reader->lock);
+  int current = reader->stream == failed;
+  pthread_mutex_unlock(&reader->lock);
+  return current;
+}
+
+/*
+ * Replaces failed, the stream of the reader, with a newly opened one sought
+ * to offset, or to the offset of failed if offset is -1, and drops the hedge
+ * stream so that the next hedge opens another.  If another thread has
+ * replaced failed already, leaves its stream be.  Returns 0 or an errno.
+ */
+static int reopen(ResilientReader* reader, Stream* failed, tOffset offset) {
+  if (!is_current_stream(reader, failed)) {
+    return 0;
+  }
+  if (offset == -1) {
+    offset = hdfsTell(reader->fs, failed->file);
+  }
+  errno = 0;
+  hdfsFile file = hdfsOpenFile(reader->fs, reader->path, O_RDONLY, 0, 0, 0);
+  if (file == NULL) {
+    return errno_or(EIO);
+  }
+  errno = 0;
+  if (offset > 0 && hdfsSeek(reader->fs, file, offset) != 0) {
+    int error = errno_or(EIO);
+    hdfsCloseFile(reader->fs, file);
+    return error;
+  }
+  Stream* stream = new_stream(file, 1);
+  if (stream == NULL) {
+    hdfsCloseFile(reader->fs, file);
+    return ENOMEM;
+  }
+  pthread_mutex_lock(&reader->lock);
+  if (reader->stream != failed) {
+    // Another thread reopened the file meanwhile.
+    pthread_mutex_unlock(&reader->lock);
+    hdfsCloseFile(reader->fs, file);
+    free(stream);
+    return 0;
+  }
+  reader->stream = stream;
+  Stream* hedge = reader->opening_hedge ? NULL : reader->hedge_stream;
+  if (hedge != NULL) {
+    reader->hedge_stream = NULL;
+  }
+  reader->stats.reopens++;
+  pthread_mutex_unlock(&reader->lock);
+  release_stream(reader, failed);
+  if (hedge != NULL) {
+    release_stream(reader, hedge);
+  }
+  return 0;
+}
+
+/*
+ * Retries a read through failed which failed with *error, reopening the
+ * stream at offset, after waiting as long as the attempt calls for, for as
+ * long as attempts remain and each failure may be transient.  Returns 1 once
+ * the stream has been reopened, or 0 with *error set to the last failure.
+ */
+static int retry(ResilientReader* reader, Stream* failed, int* attempt,
+    int* error, tOffset offset, volatile int* interrupted) {
+  while (*attempt < reader->options.retries && is_transient(*error)) {
+    (*attempt)++;
+    pthread_mutex_lock(&reader->lock);
+    reader->stats.retries++;
+    pthread_mutex_unlock(&reader->lock);
+    wait_to_retry(reader, *attempt, interrupted);
+    int reopen_error = reopen(reader, failed, offset);
+    if (reopen_error == 0) {
+      return 1;
+    }
+    *error = reopen_error;
+  }
+  return 0;
+}
+
+ResilientReader* resilient_reader_start(hdfsFS fs, hdfsFile file,
+    const char* path, ResilientOptions* options) {
+  ResilientReader* reader = calloc(1, sizeof(ResilientReader));
+  if (reader == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  reader->fs = fs;
+  reader->options = *options;
+  reader->path = strdup(path);
+  reader->stream = new_stream(file, 1);
+  if (reader->path == NULL || reader->stream == NULL) {
+    free(reader->path);
+    free(reader->stream);
+    free(reader);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->cond, NULL);
+  return reader;
+}
+
+hdfsFile resilient_reader_stop(ResilientReader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  while (reader->running > 0) {
+    pthread_cond_wait(&reader->cond, &reader->lock);
+  }
+  Stream* hedge = reader->hedge_stream;
+  reader->hedge_stream = NULL;
+  pthread_mutex_unlock(&reader->lock);
+  if (hedge != NULL) {
+    release_stream(reader, hedge);
+  }
+  hdfsFile file = reader->stream->file;
+  free(reader->stream);
+  pthread_mutex_destroy(&reader->lock);
+  pthread_cond_destroy(&reader->cond);
+  free(reader->path);
+  free(reader);
+  return file;
+}
+
+hdfsFile resilient_reader_file(ResilientReader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  hdfsFile file = reader->stream->file;
+  pthread_mutex_unlock(&reader->lock);
+  return file;
+}
+
+long resilient_reader_read(ResilientReader* reader, tOffset position,
+    char* buffer, long length, volatile int* interrupted, int* error) {
+  // Tracks the offset of sequential reads, to seek a new stream back to.
+  tOffset offset = position;
+  if (position == -1) {
+    Stream* stream = acquire_stream(reader);
+    errno = 0;
+    offset = hdfsTell(reader->fs, stream->file);
+    *error = offset == -1 ? errno_or(EIO) : 0;
+    release_stream(reader, stream);
+    if (offset == -1) {
+      return -1;
+    }
+  }
+  long total = 0;
+  int attempt = 0;
+  do {
+    long remaining = length - total;
+    tSize chunk = remaining > reader->options.max_chunk ?
+        reader->options.max_chunk : (tSize) remaining;
+    long bytes_read;
+    int read_error = 0;
+    // Holds the stream, so that a retry in another thread cannot close it
+    // mid-read.
+    Stream* stream = acquire_stream(reader);
+    errno = 0;
+    if (position == -1) {
+      bytes_read = hdfsRead(reader->fs, stream->file, buffer + total, chunk);
+    } else if (reader->options.hedge_after > 0) {
+      bytes_read = hedged_pread(reader, stream, offset + total,
+          buffer + total, chunk, interrupted, &read_error);
+    } else {
+      bytes_read = hdfsPread(reader->fs, stream->file, offset + total,
+          buffer + total, chunk);
+    }
+    if (bytes_read > 0) {
+      total += bytes_read;
+      attempt = 0;
+    } else if (bytes_read < 0) {
+      read_error = read_error != 0 ? read_error : errno_or(EIO);
+      if (!retry(reader, stream, &attempt, &read_error,
+          position == -1 ? offset + total : -1, interrupted)) {
+        release_stream(reader, stream);
+        *error = read_error;
+        return -1;
+      }
+    }
+    release_stream(reader, stream);
+    if (bytes_read == 0) {
+      break;
+    }
+  } while (total < length && !*interrupted);
+  return total;
+}
+
+void resilient_reader_stats(ResilientReader* reader, ResilientStats* stats) {
+  pthread_mutex_lock(&reader->lock);
+  *stats = reader->stats;
+  pthread_mutex_unlock(&reader->lock);
+}
+
+void resilient_reader_wake(void* reader) {
+  ResilientReader* self = (ResilientReader*) reader;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->lock);
+}
@@ -0,0 +1,66 @@
+#ifndef HDFS_RESILIENT_READER_H
+#define HDFS_RESILIENT_READER_H
+
+#include "hdfs.h"
+
+
+/*
+ * Reads a file through a stream which is reopened, and sought back to where
+ * it was, whenever a read fails with an error which may be transient, such
+ * as a DataNode going away, waiting a little longer before each retry.
+ * Positional reads which take too long can also be hedged: the same range is
+ * read through a second stream, and whichever read finishes first is used.
+ * The reader owns the file it was started with and any it reopens.
+ */
+typedef struct ResilientReader ResilientReader;
+
+typedef struct ResilientOptions {
+  int retries;               /* times a failed read is retried */
+  double backoff;            /* seconds before the first retry, then doubled */
+  double hedge_after;        /* seconds before hedging a pread, or 0 */
+  tSize max_chunk;           /* the most bytes passed to each libhdfs read */
+} ResilientOptions;
+
+typedef struct ResilientStats {
+  unsigned long retries;     /* reads retried after failing */
+  unsigned long reopens;     /* streams reopened for a retry */
+  unsigned long hedges;      /* preads hedged after hedge_after */
+  unsigned long hedge_wins;  /* hedged preads the hedge finished first */
+} ResilientStats;
+
+/*
+ * Starts reading file, which was opened from path for reading.  Returns NULL
+ * and sets errno if memory runs out.
+ */
+ResilientReader* resilient_reader_start(hdfsFS fs, hdfsFile file,
+    const char* path, ResilientOptions* options);
+
+/*
+ * Waits for any hedged reads still running and frees the reader, returning
+ * the stream it last read through, which the caller must then close.
+ * Blocks, so should be called without the GVL.
+ */
+hdfsFile resilient_reader_stop(ResilientReader* reader);
+
+/* Returns the stream the reader currently reads through. */
+hdfsFile resilient_reader_file(ResilientReader* reader);
+
+/*
+ * Reads sequentially from the current offset of the stream, or positionally
+ * from position unless it is -1, until length bytes have been read, the end
+ * of the file is reached, or *interrupted is set.  Retries failures as
+ * configured, then returns -1 with *error set if they persist.  Several
+ * threads may read at once, each holding the stream it reads through so
+ * that a retry in another cannot close it.  Blocks, so should be called
+ * without the GVL.
+ */
+long resilient_reader_read(ResilientReader* reader, tOffset position,
+    char* buffer, long length, volatile int* interrupted, int* error);
+
+/* Copies the counts of retries and hedges so far into stats. */
+void resilient_reader_stats(ResilientReader* reader, ResilientStats* stats);
+
+/* Wakes a caller waiting to retry or on a hedge so it rechecks interrupts. */
+void resilient_reader_wake(void* reader);
+
+#endif /* HDFS_RESILIENT_READER_H */
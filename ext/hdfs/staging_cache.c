@@ -0,0 +1,404 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "hdfs.h"
+
+#include "staging_cache.h"
+
+
+#define STAGING_DEFAULT_BUDGET 1073741824L
+#define STAGING_READ_CHUNK 1048576
+
+typedef struct StagedEntry {
+  char* path;
+  tTime mtime;
+  tOffset size;
+  char* data;          /* the mapping, or NULL while staging or if empty */
+  int references;      /* readers of the entry, counting the one staging it */
+  int staging;         /* set until the file has been copied */
+  int cached;          /* cleared once evicted, to be freed when unused */
+  struct StagedEntry* prev;  /* the next more recently used entry */
+  struct StagedEntry* next;  /* the next less recently used entry */
+} StagedEntry;
+
+struct StagedFile {
+  StagedEntry* entry;
+  tOffset position;
+};
+
+static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t staged_cond = PTHREAD_COND_INITIALIZER;
+static StagedEntry* head = NULL;
+static StagedEntry* tail = NULL;
+static char* staging_dir = NULL;
+static long staging_budget = STAGING_DEFAULT_BUDGET;
+static StagingCacheStats staging_stats;
+
+
+static int errno_or(int error) {
+  return errno != 0 ? errno : error;
+}
+
+static void unlink_entry(StagedEntry* entry) {
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    head = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+}
+
+static void push_entry(StagedEntry* entry) {
+  entry->prev = NULL;
+  entry->next = head;
+  if (head != NULL) {
+    head->prev = entry;
+  } else {
+    tail = entry;
+  }
+  head = entry;
+}
+
+static void free_entry(StagedEntry* entry) {
+  if (entry->data != NULL) {
+    munmap(entry->data, (size_t) entry->size);
+  }
+  free(entry->path);
+  free(entry);
+}
+
+/*
+ * Drops an entry from the cache, freeing it unless it is still being read.
+ * Must be called with the lock held.
+ */
+static void remove_entry(StagedEntry* entry) {
+  if (entry->cached) {
+    unlink_entry(entry);
+    entry->cached = 0;
+    staging_stats.entries--;
+    staging_stats.bytes -= entry->size;
+  }
+  if (entry->references == 0) {
+    free_entry(entry);
+  }
+}
+
+static void evict_entry(StagedEntry* entry) {
+  staging_stats.evictions++;
+  staging_stats.evicted_bytes += entry->size;
+  remove_entry(entry);
+}
+
+/*
+ * Evicts unused entries, least recently used first, until the bytes staged
+ * fit the budget.  Entries being read are skipped, so a file bigger than the
+ * budget stays staged only while it is open.  Must be called with the lock
+ * held.
+ */
+static void evict_to_budget(void) {
+  StagedEntry* entry = tail;
+  while (entry != NULL && staging_stats.bytes > staging_budget) {
+    StagedEntry* prev = entry->prev;
+    if (entry->references == 0) {
+      evict_entry(entry);
+    }
+    entry = prev;
+  }
+}
+
+/*
+ * Finds the entry staged for path as last modified at mtime with size bytes,
+ * evicting unused copies of older versions of it along the way.  Entries are
+ * whole files bounded by the budget, so there are few enough to scan.  Must
+ * be called with the lock held.
+ */
+static StagedEntry* find_entry(const char* path, tTime mtime, tOffset size) {
+  StagedEntry* found = NULL;
+  StagedEntry* entry = head;
+  while (entry != NULL) {
+    StagedEntry* next = entry->next;
+    if (strcmp(entry->path, path) == 0) {
+      if (entry->mtime == mtime && entry->size == size) {
+        found = entry;
+      } else if (entry->references == 0) {
+        evict_entry(entry);
+      }
+    }
+    entry = next;
+  }
+  return found;
+}
+
+/*
+ * Copies size bytes of the file at path into a new file in dir, which is
+ * unlinked at once, and maps it read-only into *data.  The space is
+ * allocated up front so that running out of it fails here rather than
+ * faulting when the mapping is written.  Returns 0 or an errno.
+ */
+static int stage_file(hdfsFS fs, const char* path, tOffset size,
+    const char* dir, char** data, volatile int* interrupted) {
+  *data = NULL;
+  if (size == 0) {
+    return 0;
+  }
+  if ((tOffset) (size_t) size != size) {
+    return EFBIG;
+  }
+  size_t template_length = strlen(dir) + sizeof("/hdfs-staged-XXXXXX");
+  char* template = malloc(template_length);
+  if (template == NULL) {
+    return ENOMEM;
+  }
+  snprintf(template, template_length, "%s/hdfs-staged-XXXXXX", dir);
+  int fd = mkstemp(template);
+  int error = fd < 0 ? errno : 0;
+  if (fd >= 0) {
+    unlink(template);
+  }
+  free(template);
+  if (error != 0) {
+    return error;
+  }
+  error = posix_fallocate(fd, 0, (off_t) size);
+  char* map = MAP_FAILED;
+  if (error == 0) {
+    map = mmap(NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        0);
+    error = map == MAP_FAILED ? errno : 0;
+  }
+  // The mapping keeps the unlinked file alive on its own.
+  close(fd);
+  if (error != 0) {
+    return error;
+  }
+  errno = 0;
+  hdfsFile file = hdfsOpenFile(fs, path, O_RDONLY, 0, 0, 0);
+  if (file == NULL) {
+    error = errno_or(EIO);
+  }
+  tOffset total = 0;
+  while (error == 0 && total < size) {
+    if (*interrupted) {
+      error = EINTR;
+      break;
+    }
+    tOffset remaining = size - total;
+    tSize chunk = remaining > STAGING_READ_CHUNK ? STAGING_READ_CHUNK :
+        (tSize) remaining;
+    errno = 0;
+    tSize bytes_read = hdfsRead(fs, file, map + total, chunk);
+    if (bytes_read < 0) {
+      error = errno_or(EIO);
+    } else if (bytes_read == 0) {
+      // The file was truncated since it was stat'ed.
+      error = ESTALE;
+    }
+    total += bytes_read > 0 ? bytes_read : 0;
+  }
+  if (file != NULL) {
+    hdfsCloseFile(fs, file);
+  }
+  if (error != 0) {
+    munmap(map, (size_t) size);
+    return error;
+  }
+  mprotect(map, (size_t) size, PROT_READ);
+  *data = map;
+  return 0;
+}
+
+void staging_cache_configure(const char* dir, long budget) {
+  char* dir_copy = dir != NULL ? strdup(dir) : NULL;
+  pthread_mutex_lock(&staging_lock);
+  if (dir_copy != NULL) {
+    free(staging_dir);
+    staging_dir = dir_copy;
+  }
+  if (budget >= 0) {
+    staging_budget = budget;
+  }
+  evict_to_budget();
+  pthread_mutex_unlock(&staging_lock);
+}
+
+StagedFile* staging_cache_open(hdfsFS fs, const char* path,
+    volatile int* interrupted, int* error) {
+  errno = 0;
+  hdfsFileInfo* info = hdfsGetPathInfo(fs, path);
+  if (info == NULL) {
+    *error = errno_or(EIO);
+    return NULL;
+  }
+  int is_directory = info->mKind == kObjectKindDirectory;
+  tTime mtime = info->mLastMod;
+  tOffset size = info->mSize;
+  hdfsFreeFileInfo(info, 1);
+  if (is_directory) {
+    *error = EISDIR;
+    return NULL;
+  }
+  StagedFile* file = malloc(sizeof(StagedFile));
+  if (file == NULL) {
+    *error = ENOMEM;
+    return NULL;
+  }
+  file->position = 0;
+  pthread_mutex_lock(&staging_lock);
+  StagedEntry* entry;
+  // Waits out another thread staging the same file, then takes its copy, or
+  // stages the file again if that failed.
+  while ((entry = find_entry(path, mtime, size)) != NULL && entry->staging) {
+    if (*interrupted) {
+      pthread_mutex_unlock(&staging_lock);
+      free(file);
+      *error = EINTR;
+      return NULL;
+    }
+    pthread_cond_wait(&staged_cond, &staging_lock);
+  }
+  if (entry != NULL) {
+    entry->references++;
+    unlink_entry(entry);
+    push_entry(entry);
+    staging_stats.hits++;
+    pthread_mutex_unlock(&staging_lock);
+    file->entry = entry;
+    return file;
+  }
+  staging_stats.misses++;
+  entry = calloc(1, sizeof(StagedEntry));
+  char* path_copy = strdup(path);
+  const char* tmpdir = getenv("TMPDIR");
+  char* dir = strdup(staging_dir != NULL ? staging_dir :
+      (tmpdir != NULL && tmpdir[0] != '\0' ? tmpdir : "/tmp"));
+  if (entry == NULL || path_copy == NULL || dir == NULL) {
+    pthread_mutex_unlock(&staging_lock);
+    free(entry);
+    free(path_copy);
+    free(dir);
+    free(file);
+    *error = ENOMEM;
+    return NULL;
+  }
+  entry->path = path_copy;
+  entry->mtime = mtime;
+  entry->size = size;
+  entry->references = 1;
+  entry->staging = 1;
+  entry->cached = 1;
+  // Counts the file against the budget before it is staged, so that threads
+  // staging different files at once stay within it between them.
+  push_entry(entry);
+  staging_stats.entries++;
+  staging_stats.bytes += size;
+  evict_to_budget();
+  pthread_mutex_unlock(&staging_lock);
+
+  char* data = NULL;
+  int result = stage_file(fs, path, size, dir, &data, interrupted);
+  free(dir);
+
+  pthread_mutex_lock(&staging_lock);
+  entry->staging = 0;
+  entry->data = data;
+  if (result != 0) {
+    entry->references--;
+    remove_entry(entry);
+  }
+  pthread_cond_broadcast(&staged_cond);
+  pthread_mutex_unlock(&staging_lock);
+  if (result != 0) {
+    free(file);
+    *error = result;
+    return NULL;
+  }
+  file->entry = entry;
+  return file;
+}
+
+long staged_file_read(StagedFile* file, tOffset position, char* buffer,
+    long length) {
+  tOffset offset = position == -1 ? file->position : position;
+  tOffset available = file->entry->size - offset;
+  long copied = available <= 0 ? 0 :
+      (available < length ? (long) available : length);
+  if (copied > 0) {
+    memcpy(buffer, file->entry->data + offset, copied);
+  }
+  if (position == -1) {
+    file->position += copied;
+  }
+  return copied;
+}
+
+int staged_file_seek(StagedFile* file, tOffset position) {
+  if (position < 0 || position > file->entry->size) {
+    return -1;
+  }
+  file->position = position;
+  return 0;
+}
+
+tOffset staged_file_tell(StagedFile* file) {
+  return file->position;
+}
+
+tOffset staged_file_size(StagedFile* file) {
+  return file->entry->size;
+}
+
+void staged_file_close(StagedFile* file) {
+  pthread_mutex_lock(&staging_lock);
+  StagedEntry* entry = file->entry;
+  entry->references--;
+  if (entry->references == 0) {
+    if (entry->cached) {
+      evict_to_budget();
+    } else {
+      free_entry(entry);
+    }
+  }
+  pthread_mutex_unlock(&staging_lock);
+  free(file);
+}
+
+long staging_cache_clear(void) {
+  long num_evicted = 0;
+  pthread_mutex_lock(&staging_lock);
+  StagedEntry* entry = head;
+  while (entry != NULL) {
+    StagedEntry* next = entry->next;
+    if (entry->references == 0) {
+      evict_entry(entry);
+      num_evicted++;
+    }
+    entry = next;
+  }
+  pthread_mutex_unlock(&staging_lock);
+  return num_evicted;
+}
+
+void staging_cache_stats(StagingCacheStats* stats) {
+  pthread_mutex_lock(&staging_lock);
+  *stats = staging_stats;
+  stats->budget = staging_budget;
+  pthread_mutex_unlock(&staging_lock);
+}
+
+void staging_cache_wake(void* unused) {
+  pthread_mutex_lock(&staging_lock);
+  pthread_cond_broadcast(&staged_cond);
+  pthread_mutex_unlock(&staging_lock);
+}
@@ -0,0 +1,69 @@
+#ifndef HDFS_STAGING_CACHE_H
+#define HDFS_STAGING_CACHE_H
+
+#include "hdfs.h"
+
+
+/*
+ * A process-wide cache of whole files copied out of HDFS into a local
+ * directory, such as one on tmpfs, and read through a read-only mapping.
+ * Entries are keyed by path, modification time and size, so a file that
+ * changes in HDFS is staged afresh the next time it is opened, and are
+ * evicted least recently used first once the bytes staged exceed a budget.
+ * The staged copies are unlinked as soon as they are created, so nothing is
+ * left behind if the process dies.  All functions are thread-safe; none
+ * calls into Ruby.
+ */
+typedef struct StagedFile StagedFile;
+
+typedef struct StagingCacheStats {
+  unsigned long hits;        /* opens served by a file already staged */
+  unsigned long misses;      /* opens which had to stage the file */
+  unsigned long evictions;   /* files dropped to stay within the budget */
+  unsigned long evicted_bytes;
+  long entries;              /* files currently staged */
+  long bytes;                /* bytes currently staged */
+  long budget;
+} StagingCacheStats;
+
+/*
+ * Stages files into dir from now on, unless it is NULL, and keeps at most
+ * budget bytes staged, unless it is negative, evicting as needed.
+ */
+void staging_cache_configure(const char* dir, long budget);
+
+/*
+ * Returns a reader of the file at path, staging it first unless a copy with
+ * the same modification time and size is already staged, or waiting for
+ * another thread staging it.  Returns NULL with *error set if this fails or
+ * *interrupted is set first.  Blocks, so should be called without the GVL.
+ */
+StagedFile* staging_cache_open(hdfsFS fs, const char* path,
+    volatile int* interrupted, int* error);
+
+/*
+ * Copies up to length bytes from position, or from the offset of the reader
+ * if position is -1, advancing it, into buffer.  Returns the bytes copied,
+ * which is fewer than length only at the end of the file.
+ */
+long staged_file_read(StagedFile* file, tOffset position, char* buffer,
+    long length);
+
+/* Moves the offset of the reader, returning -1 if it is past the end. */
+int staged_file_seek(StagedFile* file, tOffset position);
+
+tOffset staged_file_tell(StagedFile* file);
+tOffset staged_file_size(StagedFile* file);
+
+/* Frees the reader, dropping its file if it was evicted meanwhile. */
+void staged_file_close(StagedFile* file);
+
+/* Evicts every staged file not being read, returning how many. */
+long staging_cache_clear(void);
+
+void staging_cache_stats(StagingCacheStats* stats);
+
+/* Wakes callers waiting on another thread staging a file. */
+void staging_cache_wake(void* unused);
+
+#endif /* HDFS_STAGING_CACHE_H */
@@ -0,0 +1,327 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hdfs.h"
+
+#include "transfer.h"
+
+
+struct Transfer {
+  TransferOptions options;
+  char** from_paths;
+  char** to_paths;
+  long num_files;
+  int num_workers;
+  pthread_t* threads;
+  int* errors;               /* the errno of each file, or 0 */
+  tOffset* num_bytes;        /* the bytes streamed for each file */
+  long* finished;            /* the indices of files in order finished */
+  pthread_mutex_t lock;      /* guards everything below */
+  pthread_cond_t done_cond;  /* signaled for the consumer */
+  long next_file;            /* the index of the next file to start */
+  long num_finished;
+  int stopping;
+};
+
+
+static int errno_or(int error) {
+  return errno != 0 ? errno : error;
+}
+
+/* Writes the whole of a buffer to a local file, returning 0 or an errno. */
+static int write_local(int fd, const char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, buffer, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    buffer += written;
+    length -= written;
+  }
+  return 0;
+}
+
+/* Writes the whole of a buffer to an HDFS file, returning 0 or an errno. */
+static int write_hdfs(hdfsFS fs, hdfsFile file, const char* buffer,
+    tSize length) {
+  while (length > 0) {
+    errno = 0;
+    tSize written = hdfsWrite(fs, file, buffer, length);
+    if (written <= 0) {
+      return errno_or(EIO);
+    }
+    buffer += written;
+    length -= written;
+  }
+  return 0;
+}
+
+/* Copies an HDFS file between file systems, deleting the copy if this fails. */
+static int copy_file(Transfer* transfer, long index) {
+  errno = 0;
+  if (hdfsCopy(transfer->options.fs, transfer->from_paths[index],
+      transfer->options.to_fs, transfer->to_paths[index]) == 0) {
+    return 0;
+  }
+  int error = errno_or(EIO);
+  hdfsDelete(transfer->options.to_fs, transfer->to_paths[index], 0);
+  return error;
+}
+
+/* Streams a local file into a new HDFS file, deleting it if this fails. */
+static int put_file(Transfer* transfer, long index, char* buffer,
+    tOffset* num_bytes) {
+  hdfsFS fs = transfer->options.fs;
+  int fd = open(transfer->from_paths[index], O_RDONLY);
+  if (fd < 0) {
+    return errno;
+  }
+  errno = 0;
+  hdfsFile file = hdfsOpenFile(fs, transfer->to_paths[index], O_WRONLY, 0, 0,
+      0);
+  if (file == NULL) {
+    int error = errno_or(EIO);
+    close(fd);
+    return error;
+  }
+  int error = 0;
+  for (;;) {
+    ssize_t bytes_read = read(fd, buffer, transfer->options.buffer_size);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0) {
+      error = errno;
+      break;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    error = write_hdfs(fs, file, buffer, (tSize) bytes_read);
+    if (error != 0) {
+      break;
+    }
+    *num_bytes += bytes_read;
+  }
+  errno = 0;
+  if (hdfsCloseFile(fs, file) != 0 && error == 0) {
+    error = errno_or(EIO);
+  }
+  close(fd);
+  if (error != 0) {
+    hdfsDelete(fs, transfer->to_paths[index], 0);
+  }
+  return error;
+}
+
+/* Streams an HDFS file into a local file, unlinking it if this fails. */
+static int get_file(Transfer* transfer, long index, char* buffer,
+    tOffset* num_bytes) {
+  hdfsFS fs = transfer->options.fs;
+  errno = 0;
+  hdfsFile file = hdfsOpenFile(fs, transfer->from_paths[index], O_RDONLY, 0,
+      0, 0);
+  if (file == NULL) {
+    return errno_or(EIO);
+  }
+  int fd = open(transfer->to_paths[index], O_WRONLY | O_CREAT | O_TRUNC,
+      0666);
+  if (fd < 0) {
+    int error = errno;
+    hdfsCloseFile(fs, file);
+    return error;
+  }
+  int error = 0;
+  for (;;) {
+    errno = 0;
+    tSize bytes_read = hdfsRead(fs, file, buffer,
+        transfer->options.buffer_size);
+    if (bytes_read < 0) {
+      error = errno_or(EIO);
+      break;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    error = write_local(fd, buffer, bytes_read);
+    if (error != 0) {
+      break;
+    }
+    *num_bytes += bytes_read;
+  }
+  hdfsCloseFile(fs, file);
+  if (close(fd) != 0 && error == 0) {
+    error = errno;
+  }
+  if (error != 0) {
+    unlink(transfer->to_paths[index]);
+  }
+  return error;
+}
+
+static int transfer_file(Transfer* transfer, long index, char* buffer,
+    tOffset* num_bytes) {
+  switch (transfer->options.kind) {
+    case kTransferCopy:
+      return copy_file(transfer, index);
+    case kTransferGet:
+      return buffer != NULL ? get_file(transfer, index, buffer, num_bytes) :
+          ENOMEM;
+    case kTransferPut:
+      return buffer != NULL ? put_file(transfer, index, buffer, num_bytes) :
+          ENOMEM;
+  }
+  return EINVAL;
+}
+
+static void* run_transfer_worker(void* ptr) {
+  Transfer* transfer = (Transfer*) ptr;
+  char* buffer = transfer->options.kind == kTransferCopy ? NULL :
+      malloc(transfer->options.buffer_size);
+  for (;;) {
+    pthread_mutex_lock(&transfer->lock);
+    if (transfer->stopping || transfer->next_file >= transfer->num_files) {
+      pthread_mutex_unlock(&transfer->lock);
+      break;
+    }
+    long index = transfer->next_file++;
+    pthread_mutex_unlock(&transfer->lock);
+    tOffset num_bytes = 0;
+    int error = transfer_file(transfer, index, buffer, &num_bytes);
+    pthread_mutex_lock(&transfer->lock);
+    transfer->errors[index] = error;
+    transfer->num_bytes[index] = num_bytes;
+    transfer->finished[transfer->num_finished++] = index;
+    pthread_cond_signal(&transfer->done_cond);
+    pthread_mutex_unlock(&transfer->lock);
+  }
+  free(buffer);
+  return NULL;
+}
+
+static void free_transfer(Transfer* transfer) {
+  long i;
+  for (i = 0; i < transfer->num_files; i++) {
+    if (transfer->from_paths != NULL) {
+      free(transfer->from_paths[i]);
+    }
+    if (transfer->to_paths != NULL) {
+      free(transfer->to_paths[i]);
+    }
+  }
+  pthread_mutex_destroy(&transfer->lock);
+  pthread_cond_destroy(&transfer->done_cond);
+  free(transfer->from_paths);
+  free(transfer->to_paths);
+  free(transfer->threads);
+  free(transfer->errors);
+  free(transfer->num_bytes);
+  free(transfer->finished);
+  free(transfer);
+}
+
+Transfer* transfer_start(TransferOptions* options, const char** from_paths,
+    const char** to_paths, long num_files) {
+  Transfer* transfer = calloc(1, sizeof(Transfer));
+  if (transfer == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&transfer->lock, NULL);
+  pthread_cond_init(&transfer->done_cond, NULL);
+  transfer->options = *options;
+  transfer->num_files = num_files;
+  transfer->num_workers = num_files < options->num_threads ? (int) num_files :
+      options->num_threads;
+  // Allocates at least one of each, as calloc may return NULL for none.
+  size_t length = num_files > 0 ? num_files : 1;
+  transfer->from_paths = calloc(length, sizeof(char*));
+  transfer->to_paths = calloc(length, sizeof(char*));
+  transfer->threads = calloc(transfer->num_workers > 0 ?
+      transfer->num_workers : 1, sizeof(pthread_t));
+  transfer->errors = calloc(length, sizeof(int));
+  transfer->num_bytes = calloc(length, sizeof(tOffset));
+  transfer->finished = calloc(length, sizeof(long));
+  int failed = transfer->from_paths == NULL || transfer->to_paths == NULL ||
+      transfer->threads == NULL || transfer->errors == NULL ||
+      transfer->num_bytes == NULL || transfer->finished == NULL;
+  long i;
+  for (i = 0; !failed && i < num_files; i++) {
+    transfer->from_paths[i] = strdup(from_paths[i]);
+    transfer->to_paths[i] = strdup(to_paths[i]);
+    failed = transfer->from_paths[i] == NULL || transfer->to_paths[i] == NULL;
+  }
+  if (failed) {
+    free_transfer(transfer);
+    errno = ENOMEM;
+    return NULL;
+  }
+  int j;
+  for (j = 0; j < transfer->num_workers; j++) {
+    int result = pthread_create(transfer->threads + j, NULL,
+        run_transfer_worker, transfer);
+    if (result != 0) {
+      // Stops the workers already started before giving up.
+      transfer->num_workers = j;
+      transfer_stop(transfer);
+      errno = result;
+      return NULL;
+    }
+  }
+  return transfer;
+}
+
+void transfer_stop(Transfer* transfer) {
+  pthread_mutex_lock(&transfer->lock);
+  transfer->stopping = 1;
+  pthread_mutex_unlock(&transfer->lock);
+  int i;
+  for (i = 0; i < transfer->num_workers; i++) {
+    pthread_join(transfer->threads[i], NULL);
+  }
+  free_transfer(transfer);
+}
+
+int transfer_wait(Transfer* transfer, long* num_done,
+    volatile int* interrupted) {
+  int result;
+  pthread_mutex_lock(&transfer->lock);
+  while (transfer->num_finished == *num_done &&
+      *num_done < transfer->num_files && !*interrupted) {
+    pthread_cond_wait(&transfer->done_cond, &transfer->lock);
+  }
+  if (transfer->num_finished > *num_done) {
+    *num_done = transfer->num_finished;
+    result = 1;
+  } else if (*num_done >= transfer->num_files) {
+    result = 0;
+  } else {
+    result = -2;
+  }
+  pthread_mutex_unlock(&transfer->lock);
+  return result;
+}
+
+long transfer_finished(Transfer* transfer, long order, int* error,
+    tOffset* num_bytes) {
+  pthread_mutex_lock(&transfer->lock);
+  long index = transfer->finished[order];
+  *error = transfer->errors[index];
+  *num_bytes = transfer->num_bytes[index];
+  pthread_mutex_unlock(&transfer->lock);
+  return index;
+}
+
+void transfer_wake(void* transfer) {
+  Transfer* self = (Transfer*) transfer;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->done_cond);
+  pthread_mutex_unlock(&self->lock);
+}
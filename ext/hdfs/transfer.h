@@ -0,0 +1,62 @@
+#ifndef HDFS_TRANSFER_H
+#define HDFS_TRANSFER_H
+
+#include "hdfs.h"
+
+
+/*
+ * A pool of threads which copies a batch of files, each thread taking the
+ * next file not yet started until none are left.  A failure is recorded
+ * against its file and the batch carries on, so that the consumer learns
+ * the outcome of every file rather than only the first failure.
+ */
+typedef struct Transfer Transfer;
+
+typedef enum TransferKind {
+  kTransferCopy,             /* copies between HDFS paths with hdfsCopy */
+  kTransferGet,              /* streams HDFS files into local files */
+  kTransferPut,              /* streams local files into HDFS files */
+} TransferKind;
+
+typedef struct TransferOptions {
+  TransferKind kind;
+  hdfsFS fs;                 /* the file system copied from, or put to */
+  hdfsFS to_fs;              /* the file system copied to by kTransferCopy */
+  int num_threads;
+  tSize buffer_size;         /* bytes each thread streams at a time */
+} TransferOptions;
+
+/*
+ * Starts copying each of from_paths to the same index of to_paths, which
+ * are copied first.  Returns NULL and sets errno if the threads cannot be
+ * started.
+ */
+Transfer* transfer_start(TransferOptions* options, const char** from_paths,
+    const char** to_paths, long num_files);
+
+/*
+ * Stops starting new files, waits for those under way to finish and frees
+ * the transfer.
+ */
+void transfer_stop(Transfer* transfer);
+
+/*
+ * Waits until more files have finished than the *num_done already seen,
+ * then updates it.  Returns 1 if more had finished, 0 once every file has
+ * finished and been seen, or -2 if *interrupted was set first.
+ */
+int transfer_wait(Transfer* transfer, long* num_done,
+    volatile int* interrupted);
+
+/*
+ * Returns the index of the file which finished in the supplied order, along
+ * with its errno, 0 if it succeeded, and the bytes streamed for it.  Only
+ * valid for orders below the count seen through transfer_wait.
+ */
+long transfer_finished(Transfer* transfer, long order, int* error,
+    tOffset* num_bytes);
+
+/* Wakes a caller waiting in transfer_wait so it rechecks interrupts. */
+void transfer_wake(void* transfer);
+
+#endif /* HDFS_TRANSFER_H */
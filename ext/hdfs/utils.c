@@ -1,11 +1,24 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "ruby.h"
+#include "ruby/io.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include "ruby/fiber/scheduler.h"
+#endif
 
 #include "utils.h"
 
 #include "constants.h"
+#include "io_pool.h"
 
 
 /*
@@ -36,15 +49,278 @@ int octal_decimal(int n) {
   return decimal;
 }
 
-char* get_error(int errnum) {
+static ID id_errno;
+
+const char* get_error(int errnum) {
   // Renames EINTERNAL to something a bit more intelligible.
   if (errnum == 255) {
-    return RSTRING_PTR(rb_str_new2("Internal Error"));
-  }
-  char* buffer = ALLOC_N(char, HDFS_DEFAULT_STRING_LENGTH);
-  char* error_string = strerror_r(errnum, buffer, HDFS_DEFAULT_STRING_LENGTH);
-  // Wraps the message in a Ruby string so that it will be garbage collected.
-  VALUE error_msg = rb_str_new2(error_string);
-  xfree(buffer);
-  return RSTRING_PTR(error_msg);
+    return "Internal Error";
+  }
+  // Only ever called with the GVL held, and glibc returns its own constant
+  // string for any errno it knows, so strerror needs no buffer here.
+  return strerror(errnum);
+}
+
+void raise_error(VALUE klass, int errnum, const char* format, ...) {
+  // An exception deferred while the failed call ran, such as a stop, is what
+  // the caller should see.
+  raise_deferred_exception();
+  va_list args;
+  va_start(args, format);
+  VALUE message = rb_vsprintf(format, args);
+  va_end(args);
+  VALUE exception = rb_exc_new_str(klass, message);
+  rb_ivar_set(exception, id_errno, INT2FIX(errnum));
+  rb_exc_raise(exception);
+}
+
+/*
+ * call-seq:
+ *    error.to_s -> message
+ *
+ * Returns the message of the error, followed by a description of its errno
+ * if it has one.
+ */
+static VALUE HDFS_Error_to_s(VALUE self) {
+  VALUE message = rb_call_super(0, NULL);
+  VALUE r_errno = rb_attr_get(self, id_errno);
+  if (NIL_P(r_errno)) {
+    return message;
+  }
+  return rb_sprintf("%"PRIsVALUE": %s", message, get_error(FIX2INT(r_errno)));
+}
+
+void define_error_class(VALUE klass) {
+  id_errno = rb_intern("@errno");
+  rb_define_attr(klass, "errno", 1, 0);
+  rb_define_method(klass, "to_s", HDFS_Error_to_s, 0);
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+typedef struct NoGVLCall {
+  void* (*func)(void*);
+  void* arg;
+  void* result;
+  int ran;
+  volatile int* interrupted;
+  void (*wake)(void*);
+  void* wake_arg;
+} NoGVLCall;
+
+static void* run_no_gvl_call(void* ptr) {
+  NoGVLCall* call = (NoGVLCall*) ptr;
+  call->ran = 1;
+  call->result = call->func(call->arg);
+  return NULL;
+}
+
+static void interrupt_no_gvl_call(void* ptr) {
+  NoGVLCall* call = (NoGVLCall*) ptr;
+  *call->interrupted = 1;
+  if (call->wake != NULL) {
+    call->wake(call->wake_arg);
+  }
+}
+#endif
+
+static void* release_gvl(void* (*func)(void*), void* arg,
+    volatile int* interrupted, void (*wake)(void*), void* wake_arg) {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+  NoGVLCall call = { func, arg, NULL, 0, interrupted, wake, wake_arg };
+  // Unlike rb_thread_call_without_gvl, this variant never raises, so callers
+  // get the chance to clean up before a pending interrupt is delivered.
+  rb_thread_call_without_gvl2(run_no_gvl_call, &call, interrupt_no_gvl_call,
+      &call);
+  if (!call.ran) {
+    // An interrupt was already pending, so Ruby declined to release the GVL;
+    // runs the call anyway and lets the interrupt fire once we return.
+    *interrupted = 1;
+    call.result = func(arg);
+  }
+  return call.result;
+#else
+  return func(arg);
+#endif
+}
+
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+static VALUE idle_pipes = Qnil;   /* [reader, writer] pipes not waited on */
+static long num_deferred = 0;     /* fibers holding one, or that died so */
+static ID id_deferred_exception;  /* the fiber-local holding it */
+static ID id_fileno;
+static ID id_pipe;
+
+typedef struct SchedulerWait {
+  VALUE scheduler;
+  VALUE reader;
+  int reader_fd;             /* read while the GVL is held */
+  int done;                  /* set once the job's byte has been read */
+} SchedulerWait;
+
+static int io_fileno(VALUE io) {
+  return NUM2INT(rb_funcall(io, id_fileno, 0));
+}
+
+/* Takes a pipe through which pool threads signal that a job has finished. */
+static VALUE take_pipe(void) {
+  if (RARRAY_LEN(idle_pipes) > 0) {
+    return rb_ary_pop(idle_pipes);
+  }
+  VALUE pipe = rb_funcall(rb_cIO, id_pipe, 0);
+  int reader_fd = io_fileno(rb_ary_entry(pipe, 0));
+  fcntl(reader_fd, F_SETFL, fcntl(reader_fd, F_GETFL) | O_NONBLOCK);
+  return pipe;
+}
+
+/* Keeps a pipe for the next call, unless enough are kept already. */
+static void return_pipe(VALUE pipe) {
+  if (RARRAY_LEN(idle_pipes) < HDFS_MAX_IDLE_PIPES) {
+    rb_ary_push(idle_pipes, pipe);
+    return;
+  }
+  rb_io_close(rb_ary_entry(pipe, 0));
+  rb_io_close(rb_ary_entry(pipe, 1));
+}
+
+/*
+ * Reads the byte the pool writes once the job has finished, which is the
+ * last the pool does with the job or the pipe, so that only then may the
+ * pipe be reused or closed.  Sets wait->done if the byte was there.
+ */
+static void read_job_byte(SchedulerWait* wait) {
+  char byte;
+  ssize_t result;
+  do {
+    result = read(wait->reader_fd, &byte, 1);
+  } while (result == -1 && errno == EINTR);
+  wait->done = result == 1;
+}
+
+/* Suspends the calling fiber until the job has finished. */
+static VALUE wait_for_job(VALUE ptr) {
+  SchedulerWait* wait = (SchedulerWait*) ptr;
+  while (!wait->done) {
+    rb_fiber_scheduler_io_wait(wait->scheduler, wait->reader,
+        RB_INT2NUM(RUBY_IO_READABLE), Qnil);
+    read_job_byte(wait);
+  }
+  return Qnil;
+}
+
+/* Blocks the thread until the job has finished; called without the GVL. */
+static void* block_for_job(void* ptr) {
+  SchedulerWait* wait = (SchedulerWait*) ptr;
+  struct pollfd poll_fd;
+  poll_fd.fd = wait->reader_fd;
+  poll_fd.events = POLLIN;
+  while (!wait->done) {
+    poll(&poll_fd, 1, -1);
+    read_job_byte(wait);
+  }
+  return NULL;
+}
+
+/*
+ * Hands func(arg) to the IO pool and suspends the calling fiber until it has
+ * finished, so that the scheduler can run other fibers meanwhile.  If an
+ * exception is raised into the fiber as it waits, such as when its task is
+ * stopped, sets *interrupted and wakes the call, then waits for it with the
+ * thread blocked, since the call cannot be abandoned while it uses arg.  The
+ * exception is then deferred until raise_deferred_exception, which the
+ * method making the call runs once it has cleaned up.
+ */
+static void* call_in_io_pool(VALUE scheduler, void* (*func)(void*),
+    void* arg, volatile int* interrupted, void (*wake)(void*),
+    void* wake_arg) {
+  VALUE pipe = take_pipe();
+  IOPoolJob job;
+  job.func = func;
+  job.arg = arg;
+  job.result = NULL;
+  job.notify_fd = io_fileno(rb_ary_entry(pipe, 1));
+  if (io_pool_submit(&job) != 0) {
+    return_pipe(pipe);
+    return release_gvl(func, arg, interrupted, wake, wake_arg);
+  }
+  SchedulerWait wait;
+  wait.scheduler = scheduler;
+  wait.reader = rb_ary_entry(pipe, 0);
+  wait.reader_fd = io_fileno(wait.reader);
+  wait.done = 0;
+  int state = 0;
+  rb_protect(wait_for_job, (VALUE) &wait, &state);
+  if (state != 0) {
+    VALUE exception = rb_errinfo();
+    rb_set_errinfo(Qnil);
+    *interrupted = 1;
+    if (wake != NULL) {
+      wake(wake_arg);
+    }
+    volatile int ignored = 0;
+    release_gvl(block_for_job, &wait, &ignored, NULL, NULL);
+    return_pipe(pipe);
+    if (!rb_obj_is_kind_of(exception, rb_eException)) {
+      // A throw or break cannot be deferred, so carries on at once.
+      rb_jump_tag(state);
+    }
+    // Kept as a fiber-local, so that it goes with the fiber if never raised.
+    VALUE thread = rb_thread_current();
+    if (NIL_P(rb_thread_local_aref(thread, id_deferred_exception))) {
+      num_deferred++;
+    }
+    rb_thread_local_aset(thread, id_deferred_exception, exception);
+    return job.result;
+  }
+  return_pipe(pipe);
+  RB_GC_GUARD(pipe);
+  return job.result;
+}
+#endif
+
+void raise_deferred_exception(void) {
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+  if (num_deferred == 0) {
+    return;
+  }
+  VALUE thread = rb_thread_current();
+  VALUE exception = rb_thread_local_aref(thread, id_deferred_exception);
+  if (!NIL_P(exception)) {
+    rb_thread_local_aset(thread, id_deferred_exception, Qnil);
+    num_deferred--;
+    rb_exc_raise(exception);
+  }
+#endif
+}
+
+void check_interrupts(void) {
+  rb_thread_check_ints();
+  raise_deferred_exception();
+}
+
+void* call_without_gvl(void* (*func)(void*), void* arg,
+    volatile int* interrupted) {
+  return call_without_gvl_wakeable(func, arg, interrupted, NULL, NULL);
+}
+
+void* call_without_gvl_wakeable(void* (*func)(void*), void* arg,
+    volatile int* interrupted, void (*wake)(void*), void* wake_arg) {
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+  // Only non-blocking fibers have a scheduler to yield to.
+  VALUE scheduler = rb_fiber_scheduler_current();
+  if (!NIL_P(scheduler)) {
+    return call_in_io_pool(scheduler, func, arg, interrupted, wake,
+        wake_arg);
+  }
+#endif
+  return release_gvl(func, arg, interrupted, wake, wake_arg);
+}
+
+void init_utils(void) {
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+  id_fileno = rb_intern("fileno");
+  id_pipe = rb_intern("pipe");
+  id_deferred_exception = rb_intern("__hdfs_deferred_exception__");
+  idle_pipes = rb_ary_new();
+  rb_gc_register_address(&idle_pipes);
+#endif
 }
@@ -1,6 +1,8 @@
 #ifndef HDFS_UTILS_H
 #define HDFS_UTILS_H
 
+#include "ruby.h"
+
 
 /* Converts a decimal-formatted integer to an octal-formatted integer. */
 int decimal_octal(int n);
@@ -8,7 +10,61 @@ int decimal_octal(int n);
 /* Converts an octal-formatted integer to a decimal-formatted integer. */
 int octal_decimal(int n);
 
-/* Returns a string representation of errno in a thread-safe manner. */
-char* get_error(int errnum);
+/* Describes errnum; must be called with the GVL held. */
+const char* get_error(int errnum);
+
+/*
+ * Raises an exception of klass, which must descend from a class set up by
+ * define_error_class, carrying errnum as its errno.  Its message is format
+ * followed by a description of errnum, which is only looked up if the
+ * message is asked for.  Raises any deferred exception instead.
+ */
+PRINTF_ARGS(NORETURN(void raise_error(VALUE klass, int errnum,
+    const char* format, ...)), 3, 4);
+
+/*
+ * Defines errno and a to_s describing it on klass, the root of a hierarchy
+ * of exceptions raised by raise_error.
+ */
+void define_error_class(VALUE klass);
+
+/*
+ * Calls func(arg) with the GVL released so that other Ruby threads can run
+ * while libhdfs blocks in the JVM.  If Ruby asks the thread to stop, sets
+ * *interrupted; a JNI call cannot be cancelled midway, so looping callers
+ * check the flag between steps instead.  Pending interrupts are delivered
+ * after this returns, never from within it.
+ *
+ * Called from a non-blocking fiber, instead runs func(arg) on a thread of the
+ * IO pool and suspends the fiber until it finishes, leaving the thread free
+ * to run the Fiber scheduler.  An exception raised into the fiber meanwhile
+ * sets *interrupted and is deferred until raise_deferred_exception.
+ */
+void* call_without_gvl(void* (*func)(void*), void* arg,
+    volatile int* interrupted);
+
+/*
+ * Like call_without_gvl, but also calls wake(wake_arg) after setting
+ * *interrupted, for calls that sleep on a condition variable and would
+ * otherwise not notice the flag.
+ */
+void* call_without_gvl_wakeable(void* (*func)(void*), void* arg,
+    volatile int* interrupted, void (*wake)(void*), void* wake_arg);
+
+/*
+ * Raises the exception raised into the calling fiber while call_without_gvl
+ * waited, if there was one.  Every method making such a call runs this on
+ * its way out, once it has cleaned up and before returning to Ruby, so that
+ * a stopped fiber sees its stop.
+ */
+void raise_deferred_exception(void);
+
+/*
+ * Runs pending interrupts and raises any deferred exception, either of which
+ * may raise; for looping callers to call between steps.
+ */
+void check_interrupts(void);
+
+void init_utils(void);
 
 #endif /* HDFS_UTILS_H */
@@ -0,0 +1,415 @@
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdfs.h"
+
+#include "walker.h"
+
+
+/* The most batches left waiting for the consumer before workers block. */
+#define WALKER_MAX_BATCHES 64
+
+/* A directory still to be listed. */
+typedef struct WalkDir {
+  char* path;
+  int depth;                 /* the depth of the entries within it */
+  struct WalkDir* prev;
+  struct WalkDir* next;
+} WalkDir;
+
+/*
+ * The directories queued by one worker.  Its owner pushes and pops at the
+ * tail, so that it works depth-first, while thieves take from the head,
+ * where the directories nearest the root and so the largest subtrees are.
+ */
+typedef struct WalkDeque {
+  pthread_mutex_t lock;
+  WalkDir* head;
+  WalkDir* tail;
+} WalkDeque;
+
+typedef struct WalkWorker {
+  Walker* walker;
+  int index;
+  pthread_t thread;
+} WalkWorker;
+
+struct Walker {
+  hdfsFS fs;
+  WalkOptions options;
+  int num_workers;
+  WalkWorker* workers;
+  WalkDeque* deques;
+  pthread_mutex_t lock;      /* guards everything below */
+  pthread_cond_t work_cond;  /* signaled for workers awaiting work */
+  pthread_cond_t space_cond;  /* signaled for workers awaiting room */
+  pthread_cond_t result_cond;  /* signaled for the consumer */
+  int queued;                /* directories sitting in deques */
+  int pending;               /* directories queued or being listed */
+  WalkBatch* results_head;
+  WalkBatch* results_tail;
+  int num_results;
+  int error;                 /* errno of the first failed listing, or 0 */
+  char* error_path;
+  int stopping;
+};
+
+
+static void push_dir(Walker* walker, int index, char* path, int depth) {
+  WalkDir* dir = malloc(sizeof(WalkDir));
+  if (dir == NULL) {
+    free(path);
+    pthread_mutex_lock(&walker->lock);
+    if (walker->error == 0) {
+      walker->error = ENOMEM;
+    }
+    walker->stopping = 1;
+    pthread_cond_broadcast(&walker->work_cond);
+    pthread_cond_broadcast(&walker->space_cond);
+    pthread_cond_broadcast(&walker->result_cond);
+    pthread_mutex_unlock(&walker->lock);
+    return;
+  }
+  dir->path = path;
+  dir->depth = depth;
+  dir->next = NULL;
+  WalkDeque* deque = walker->deques + index;
+  pthread_mutex_lock(&deque->lock);
+  dir->prev = deque->tail;
+  if (deque->tail != NULL) {
+    deque->tail->next = dir;
+  } else {
+    deque->head = dir;
+  }
+  deque->tail = dir;
+  pthread_mutex_unlock(&deque->lock);
+  pthread_mutex_lock(&walker->lock);
+  walker->queued++;
+  walker->pending++;
+  pthread_cond_signal(&walker->work_cond);
+  pthread_mutex_unlock(&walker->lock);
+}
+
+/* Removes a directory from the tail of a deque if own, else its head. */
+static WalkDir* pop_dir(WalkDeque* deque, int own) {
+  pthread_mutex_lock(&deque->lock);
+  WalkDir* dir = own ? deque->tail : deque->head;
+  if (dir != NULL) {
+    if (dir->prev != NULL) {
+      dir->prev->next = dir->next;
+    } else {
+      deque->head = dir->next;
+    }
+    if (dir->next != NULL) {
+      dir->next->prev = dir->prev;
+    } else {
+      deque->tail = dir->prev;
+    }
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return dir;
+}
+
+/*
+ * Takes the next directory for a worker from its own deque or by stealing,
+ * sleeping while there is none.  Returns NULL once the walk is over.
+ */
+static WalkDir* take_dir(Walker* walker, int index) {
+  for (;;) {
+    WalkDir* dir = pop_dir(walker->deques + index, 1);
+    int i;
+    for (i = 1; dir == NULL && i < walker->num_workers; i++) {
+      dir = pop_dir(walker->deques + (index + i) % walker->num_workers, 0);
+    }
+    pthread_mutex_lock(&walker->lock);
+    if (dir != NULL) {
+      walker->queued--;
+      pthread_mutex_unlock(&walker->lock);
+      return dir;
+    }
+    while (walker->queued == 0 && walker->pending > 0 && !walker->stopping) {
+      pthread_cond_wait(&walker->work_cond, &walker->lock);
+    }
+    int over = walker->pending == 0 || walker->stopping;
+    pthread_mutex_unlock(&walker->lock);
+    if (over) {
+      return NULL;
+    }
+  }
+}
+
+static int entry_matches(WalkOptions* options, hdfsFileInfo* info) {
+  if (options->kind != 0 && info->mKind != options->kind) {
+    return 0;
+  }
+  if (options->min_size != -1 && info->mSize < options->min_size) {
+    return 0;
+  }
+  if (options->max_size != -1 && info->mSize > options->max_size) {
+    return 0;
+  }
+  if (options->newer_than != -1 && info->mLastMod <= options->newer_than) {
+    return 0;
+  }
+  if (options->older_than != -1 && info->mLastMod >= options->older_than) {
+    return 0;
+  }
+  if (options->name_pattern != NULL) {
+    const char* base_name = strrchr(info->mName, '/');
+    base_name = base_name != NULL ? base_name + 1 : info->mName;
+    if (fnmatch(options->name_pattern, base_name, 0) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Queues a batch for the consumer, waiting while too many are queued.
+ * Returns 0, or -1 if the walk stopped first, in which case the batch is
+ * freed.
+ */
+static int push_batch(Walker* walker, WalkBatch* batch) {
+  pthread_mutex_lock(&walker->lock);
+  while (walker->num_results >= WALKER_MAX_BATCHES && !walker->stopping) {
+    pthread_cond_wait(&walker->space_cond, &walker->lock);
+  }
+  if (walker->stopping) {
+    pthread_mutex_unlock(&walker->lock);
+    walker_free_batch(batch);
+    return -1;
+  }
+  batch->next = NULL;
+  if (walker->results_tail != NULL) {
+    walker->results_tail->next = batch;
+  } else {
+    walker->results_head = batch;
+  }
+  walker->results_tail = batch;
+  walker->num_results++;
+  pthread_cond_signal(&walker->result_cond);
+  pthread_mutex_unlock(&walker->lock);
+  return 0;
+}
+
+static void list_dir(Walker* walker, int index, WalkDir* dir) {
+  int num_entries = -1;
+  hdfsFileInfo* infos = hdfsListDirectory(walker->fs, dir->path,
+      &num_entries);
+  if (infos == NULL && num_entries == -1) {
+    int error = errno == 0 ? EIO : errno;
+    pthread_mutex_lock(&walker->lock);
+    if (walker->error == 0) {
+      walker->error = error;
+      walker->error_path = strdup(dir->path);
+    }
+    // Stops the walk at the first failure, as a serial walk would.
+    walker->stopping = 1;
+    pthread_cond_broadcast(&walker->work_cond);
+    pthread_cond_broadcast(&walker->space_cond);
+    pthread_cond_broadcast(&walker->result_cond);
+    pthread_mutex_unlock(&walker->lock);
+    return;
+  }
+  if (num_entries <= 0) {
+    return;
+  }
+  WalkOptions* options = &walker->options;
+  char* matches = calloc(num_entries, 1);
+  int num_matches = 0;
+  int i;
+  for (i = 0; i < num_entries; i++) {
+    hdfsFileInfo* info = infos + i;
+    if (info->mKind == kObjectKindDirectory &&
+        (options->max_depth == 0 || dir->depth < options->max_depth)) {
+      char* path = strdup(info->mName);
+      if (path != NULL) {
+        push_dir(walker, index, path, dir->depth + 1);
+      }
+    }
+    if (matches != NULL && entry_matches(options, info)) {
+      matches[i] = 1;
+      num_matches++;
+    }
+  }
+  WalkBatch* batch = num_matches > 0 ? malloc(sizeof(WalkBatch)) : NULL;
+  if (batch == NULL) {
+    hdfsFreeFileInfo(infos, num_entries);
+    free(matches);
+    return;
+  }
+  batch->infos = infos;
+  batch->num_entries = num_entries;
+  batch->matches = matches;
+  push_batch(walker, batch);
+}
+
+static void* run_walk_worker(void* ptr) {
+  WalkWorker* worker = (WalkWorker*) ptr;
+  Walker* walker = worker->walker;
+  WalkDir* dir;
+  while ((dir = take_dir(walker, worker->index)) != NULL) {
+    list_dir(walker, worker->index, dir);
+    free(dir->path);
+    free(dir);
+    pthread_mutex_lock(&walker->lock);
+    if (--walker->pending == 0) {
+      // Wakes idle workers so that they exit, and the consumer.
+      pthread_cond_broadcast(&walker->work_cond);
+      pthread_cond_broadcast(&walker->result_cond);
+    }
+    pthread_mutex_unlock(&walker->lock);
+  }
+  return NULL;
+}
+
+static void free_walker(Walker* walker) {
+  int i;
+  for (i = 0; i < walker->num_workers; i++) {
+    WalkDir* dir;
+    while ((dir = pop_dir(walker->deques + i, 0)) != NULL) {
+      free(dir->path);
+      free(dir);
+    }
+    pthread_mutex_destroy(&walker->deques[i].lock);
+  }
+  while (walker->results_head != NULL) {
+    WalkBatch* batch = walker->results_head;
+    walker->results_head = batch->next;
+    walker_free_batch(batch);
+  }
+  pthread_mutex_destroy(&walker->lock);
+  pthread_cond_destroy(&walker->work_cond);
+  pthread_cond_destroy(&walker->space_cond);
+  pthread_cond_destroy(&walker->result_cond);
+  free((char*) walker->options.name_pattern);
+  free(walker->error_path);
+  free(walker->workers);
+  free(walker->deques);
+  free(walker);
+}
+
+Walker* walker_start(hdfsFS fs, const char* path, WalkOptions* options) {
+  Walker* walker = calloc(1, sizeof(Walker));
+  if (walker == NULL) {
+    return NULL;
+  }
+  walker->fs = fs;
+  walker->options = *options;
+  walker->options.name_pattern = NULL;
+  walker->num_workers = options->num_threads;
+  walker->workers = calloc(walker->num_workers, sizeof(WalkWorker));
+  walker->deques = calloc(walker->num_workers, sizeof(WalkDeque));
+  char* root = strdup(path);
+  if (options->name_pattern != NULL) {
+    walker->options.name_pattern = strdup(options->name_pattern);
+  }
+  if (walker->workers == NULL || walker->deques == NULL || root == NULL ||
+      (options->name_pattern != NULL &&
+          walker->options.name_pattern == NULL)) {
+    free((char*) walker->options.name_pattern);
+    free(walker->workers);
+    free(walker->deques);
+    free(walker);
+    free(root);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&walker->lock, NULL);
+  pthread_cond_init(&walker->work_cond, NULL);
+  pthread_cond_init(&walker->space_cond, NULL);
+  pthread_cond_init(&walker->result_cond, NULL);
+  int i;
+  for (i = 0; i < walker->num_workers; i++) {
+    pthread_mutex_init(&walker->deques[i].lock, NULL);
+  }
+  push_dir(walker, 0, root, 1);
+  for (i = 0; i < walker->num_workers; i++) {
+    WalkWorker* worker = walker->workers + i;
+    worker->walker = walker;
+    worker->index = i;
+    int result = pthread_create(&worker->thread, NULL, run_walk_worker,
+        worker);
+    if (result != 0) {
+      // Stops the workers already started before giving up.
+      walker->num_workers = i;
+      pthread_mutex_lock(&walker->lock);
+      walker->stopping = 1;
+      pthread_cond_broadcast(&walker->work_cond);
+      pthread_mutex_unlock(&walker->lock);
+      int j;
+      for (j = 0; j < i; j++) {
+        pthread_join(walker->workers[j].thread, NULL);
+      }
+      // Keeps the deques of workers that never started so they are freed.
+      walker->num_workers = options->num_threads;
+      free_walker(walker);
+      errno = result;
+      return NULL;
+    }
+  }
+  return walker;
+}
+
+void walker_stop(Walker* walker) {
+  pthread_mutex_lock(&walker->lock);
+  walker->stopping = 1;
+  pthread_cond_broadcast(&walker->work_cond);
+  pthread_cond_broadcast(&walker->space_cond);
+  pthread_mutex_unlock(&walker->lock);
+  int i;
+  for (i = 0; i < walker->num_workers; i++) {
+    pthread_join(walker->workers[i].thread, NULL);
+  }
+  free_walker(walker);
+}
+
+int walker_next(Walker* walker, WalkBatch** batch, volatile int* interrupted,
+    int* error) {
+  int result;
+  pthread_mutex_lock(&walker->lock);
+  while (walker->results_head == NULL && walker->pending > 0 &&
+      !walker->stopping && !*interrupted) {
+    pthread_cond_wait(&walker->result_cond, &walker->lock);
+  }
+  if (walker->results_head != NULL) {
+    // Hands out what was listed before any failure first.
+    *batch = walker->results_head;
+    walker->results_head = (*batch)->next;
+    if (walker->results_head == NULL) {
+      walker->results_tail = NULL;
+    }
+    walker->num_results--;
+    pthread_cond_signal(&walker->space_cond);
+    result = 1;
+  } else if (walker->error != 0) {
+    *error = walker->error;
+    result = -1;
+  } else if (walker->pending == 0 || walker->stopping) {
+    result = 0;
+  } else {
+    result = -2;
+  }
+  pthread_mutex_unlock(&walker->lock);
+  return result;
+}
+
+const char* walker_error_path(Walker* walker) {
+  return walker->error_path;
+}
+
+void walker_free_batch(WalkBatch* batch) {
+  hdfsFreeFileInfo(batch->infos, batch->num_entries);
+  free(batch->matches);
+  free(batch);
+}
+
+void walker_wake(void* walker) {
+  Walker* self = (Walker*) walker;
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->result_cond);
+  pthread_mutex_unlock(&self->lock);
+}
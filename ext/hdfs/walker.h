@@ -0,0 +1,65 @@
+#ifndef HDFS_WALKER_H
+#define HDFS_WALKER_H
+
+#include "hdfs.h"
+
+
+/*
+ * A pool of threads which recursively lists the tree beneath a directory,
+ * each keeping a deque of directories still to list and stealing from the
+ * others once its own runs dry.  Entries matching the walk's predicates are
+ * handed back in batches through a bounded queue, so that a slow consumer
+ * holds back the walk rather than letting results pile up.
+ */
+typedef struct Walker Walker;
+
+/* Which entries a walk yields and how far it descends. */
+typedef struct WalkOptions {
+  int num_threads;
+  int max_depth;             /* levels of entries to yield, or 0 for all */
+  const char* name_pattern;  /* fnmatch pattern for base names, or NULL */
+  tObjectKind kind;          /* the only kind of entry to yield, or 0 */
+  tOffset min_size;          /* smallest size to yield, or -1 */
+  tOffset max_size;          /* largest size to yield, or -1 */
+  tTime newer_than;          /* yields only entries modified after, or -1 */
+  tTime older_than;          /* yields only entries modified before, or -1 */
+} WalkOptions;
+
+/* The matching entries of one listed directory. */
+typedef struct WalkBatch {
+  hdfsFileInfo* infos;
+  int num_entries;
+  char* matches;             /* non-zero for each entry that matched */
+  struct WalkBatch* next;
+} WalkBatch;
+
+/*
+ * Starts walking the tree beneath path.  Returns NULL and sets errno if the
+ * threads cannot be started.
+ */
+Walker* walker_start(hdfsFS fs, const char* path, WalkOptions* options);
+
+/*
+ * Stops the walk if it is still running, waits for its threads and frees
+ * the walker along with any batches not yet taken.
+ */
+void walker_stop(Walker* walker);
+
+/*
+ * Waits for the next batch of matching entries, which the caller must free
+ * with walker_free_batch.  Returns 1 and sets *batch, 0 once the walk has
+ * finished, -1 with *error set if listing a directory failed, or -2 if
+ * *interrupted was set first.
+ */
+int walker_next(Walker* walker, WalkBatch** batch, volatile int* interrupted,
+    int* error);
+
+/* Returns the path of the directory that failed to list, or NULL. */
+const char* walker_error_path(Walker* walker);
+
+void walker_free_batch(WalkBatch* batch);
+
+/* Wakes a caller waiting in walker_next so it rechecks interrupts. */
+void walker_wake(void* walker);
+
+#endif /* HDFS_WALKER_H */
@@ -1,44 +1,41 @@
 module HDFS
   class FileSystem
 
-    attr_reader :host, :local, :port, :user
+    attr_reader :conf, :host, :local, :port, :user
+
+    # Prepares the JVM environment before the first HDFS::FileSystem
+    # connects; see HDFS::JVM.
+    def self.new *args, &block
+      JVM.start
+      super
+    end # def self.new *args, &block
 
     # Recursively scans HDFS::FileInfo objects under the supplied path using
     # the supplied match proc to determine matching files.  If a match is
-    # found, calls the supplied block.
+    # found, calls the supplied block.  Directories are listed concurrently by
+    # #crawl, so matches arrive in no particular order.
     #
     # @param path [String] DFS path to search for files under
     # @param match_proc [Proc] determines if a HDFS::FileInfo object is a match
     # @param block [Block] called if an HDFS::FileInfo object matches
     def find path, match_proc, &block
-      dir_listing = ls path
-      dir_listing.each do |item|
+      crawl path do |item|
         if match_proc.call item
           block.call item
         end
-        if item.is_directory?
-          find item, match_proc, &block
-        end
       end
     end # def find path, match_proc, &block
 
     # Recursively scans HDFS::FileInfo objects under the supplied path using
     # the supplied match proc to determine matching files, returning a list of
-    # all matches.
+    # all matches in no particular order.
     #
     # @param path [String] DFS path to search for files under
     # @param match_proc [Proc] determines if a HDFS::FileInfo object is a match
     def find_all path, match_proc
-      dir_listing = ls path
-      dir_listing.map do |item|
-        found_items = []
-        if match_proc.call item
-          found_items << item
-        end
-        if item.is_directory?
-          found_items << find_all(item, match_proc)
-        end
-      end.flat_map
+      crawl(path).select do |item|
+        match_proc.call item
+      end
     end # def find_all path, match_proc
 
     # Reads the full contents of a DFS file, returning the contents as a
@@ -48,13 +45,12 @@ module HDFS
     # @param path [String]
     def read_all path
       file = open path, 'r'
-      size = stat(path).size
-      contents = ""
-      while file.tell < size
-        contents << file.read
+      begin
+        # Sizes the String once from the file's length and fills it natively.
+        file.read stat(path).size
+      ensure
+        file.close
       end
-      file.close
-      contents
     end # def read_all path
 
     def to_s
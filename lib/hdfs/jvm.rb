@@ -0,0 +1,107 @@
+module HDFS
+  # Prepares the environment of the JVM that libhdfs creates on the first
+  # connect.  Nothing happens until an HDFS::FileSystem is created, so that
+  # processes which never touch HDFS pay nothing for it; the CLASSPATH is read
+  # from a cache written by extconf.rb rather than found afresh on each load.
+  module JVM
+
+    MUTEX = Mutex.new
+
+    # Directories searched for Hadoop JARs when resolving the CLASSPATH.
+    def self.locations
+      prefix = ENV['HADOOP_PREFIX'] || '/opt/hadoop'
+      [
+        '/usr/lib/hadoop',
+        '/usr/lib/hadoop-hdfs',
+        '/usr/lib/hadoop-0.20',
+        "#{prefix}/share/hadoop-common",
+        "#{prefix}/share/hadoop-hdfs",
+      ] + ENV['HADOOP_DIRS'].to_s.split(':')
+    end # def self.locations
+
+    # The file in which the resolved CLASSPATH is cached, alongside the
+    # locations it was resolved from.  May be overridden by setting
+    # HDFS_CLASSPATH_CACHE.
+    def self.cache_path
+      ENV['HDFS_CLASSPATH_CACHE'] ||
+          ::File.join(::File.dirname(__FILE__), 'classpath.cache')
+    end # def self.cache_path
+
+    # Globs every JAR under the supplied locations, returning a CLASSPATH
+    # String.
+    #
+    # @param locations [Array] directories to search for JARs beneath
+    def self.resolve_classpath locations = self.locations
+      locations.map do |lib_dir|
+        Dir[::File.join(lib_dir, '**', '*.jar')]
+      end.flatten.uniq.join ':'
+    end # def self.resolve_classpath locations = self.locations
+
+    # Resolves the CLASSPATH and writes it to the cache, returning it.
+    def self.write_classpath_cache
+      classpath = resolve_classpath
+      ::File.write cache_path, [locations.join(':'), classpath].join("\n")
+      classpath
+    rescue SystemCallError
+      classpath
+    end # def self.write_classpath_cache
+
+    # Returns the CLASSPATH of Hadoop JARs: HDFS_CLASSPATH if it is set,
+    # otherwise the cached CLASSPATH if it was resolved from the same
+    # locations and every JAR in it still exists, as none does once Hadoop
+    # is upgraded in place, otherwise a newly resolved one, which is then
+    # cached.
+    def self.classpath
+      @classpath ||= ENV['HDFS_CLASSPATH'] || begin
+        cached_locations, cached = ::File.read(cache_path).split("\n", 2)
+        if cached_locations == locations.join(':') and cached and
+            cached.split(':').all? { |jar| ::File.exist? jar }
+          cached
+        else
+          write_classpath_cache
+        end
+      rescue SystemCallError
+        write_classpath_cache
+      end
+    end # def self.classpath
+
+    # Options passed to the JVM on creation, such as '-Xmx512m' or
+    # '-Xshare:auto'; defaults to the space-separated HDFS_JVM_OPTIONS.
+    def self.options
+      @options ||= ENV['HDFS_JVM_OPTIONS'].to_s.split
+    end # def self.options
+
+    # Sets the options passed to the JVM on creation.  Raises a RuntimeError
+    # once the JVM has been started.
+    #
+    # @param options [Array] Strings such as '-Xmx512m' or '-Xshare:auto'
+    def self.options= options
+      raise 'the JVM has already been started' if started?
+      @options = Array(options).map(&:to_s)
+    end # def self.options= options
+
+    # Returns true once the JVM environment has been prepared for the first
+    # connect, after which changing it has no effect.
+    def self.started?
+      @started == true
+    end # def self.started?
+
+    # Exports the CLASSPATH and JVM options for libhdfs to create the JVM
+    # with.  Called before each HDFS::FileSystem connects; only the first call
+    # has any effect.
+    def self.start
+      return if started?
+      MUTEX.synchronize do
+        return if started?
+        ENV['CLASSPATH'] = [ENV['CLASSPATH'], classpath].reject do |path|
+          path.nil? or path.empty?
+        end.join ':'
+        unless options.empty?
+          ENV['LIBHDFS_OPTS'] = [ENV['LIBHDFS_OPTS'], *options].compact.join ' '
+        end
+        @started = true
+      end
+    end # def self.start
+
+  end # module JVM
+end # module HDFS